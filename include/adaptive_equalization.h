@@ -0,0 +1,45 @@
+/**
+ * Declarations for contrast limited adaptive histogram equalization (CLAHE).
+ */
+
+#include <image_manipulation.h>
+
+#ifndef IPP_ADAPTIVE_EQUALIZATION_H
+#define IPP_ADAPTIVE_EQUALIZATION_H
+
+// equalize_histogram() maps the whole image through one table, which washes out images with both dark and bright
+// areas. Adaptive equalization gives every tile of the image its own table, built from the histogram of the tile
+// clipped at a limit so that flat areas do not get their noise amplified, and maps each pixel through the tables of
+// the four tiles around it, interpolated bilinearly by its distance to their centers so that no tile edges show.
+// As in equalize_histogram(), tables come from the luminance and are applied to every channel.
+
+/**
+ * Parameters of adaptive equalization.
+ */
+typedef struct clahe_options_struct {
+    int tile_width;             // in pixels; the tiles of the last column and row may be smaller
+    int tile_height;
+    double clip_limit;          // highest count of a tile histogram in multiples of its mean count (tile pixels / 256),
+                                // the excess being spread over all tones; 1 leaves the image as it is, 0 or less
+                                // disables clipping
+    int threads;                // maximum number of bands processed at once, 0 for default_thread_count()
+} clahe_options_t;
+
+/**
+ * Tiles of 128 by 128 pixels clipped at 3 times their mean count, over every processor.
+ */
+clahe_options_t default_clahe_options();
+
+/**
+ * Equalizes the histogram of every tile of an image in place, see above. Tile histograms and tables are built in
+ * parallel bands of tile rows, then the pixels are mapped in parallel bands of rows, in one pass over them.
+ * @param options parameters, NULL for default_clahe_options()
+ */
+void equalize_histogram_adaptive(image_t *image, const clahe_options_t *options);
+
+/**
+ * Clips a histogram at limit, spreading what was over it evenly over all of its tones.
+ */
+void clip_histogram(int *histogram, int limit);
+
+#endif //IPP_ADAPTIVE_EQUALIZATION_H
@@ -0,0 +1,85 @@
+/**
+ * Declarations for reusable JPEG codec contexts, for decoding and encoding many images in a row.
+ */
+
+#include <image_manipulation.h>
+
+#ifndef IPP_CODEC_CONTEXT_H
+#define IPP_CODEC_CONTEXT_H
+
+/**
+ * libjpeg objects, error managers and buffers that survive from one image to the next, so that batches of small
+ * images do not pay for creating and destroying them every time. That is about 5% of a decode or encode of a
+ * thumbnail of a few hundred pixels; from 0.1 MP on the codec itself dominates. A context stays usable after an error.
+ * A context must only be used by one thread at once.
+ */
+typedef struct codec_context_struct {
+    struct jpeg_decompress_struct decompress;
+    struct error_manager decompress_error;
+    struct jpeg_compress_struct compress;
+    struct error_manager compress_error;
+
+    unsigned char *encode_buffer;       // compressed output, reused (and grown) across encodes
+    unsigned long encode_capacity;
+} codec_context_t;
+
+/**
+ * Initializes a codec context in heap memory, with both libjpeg objects created.
+ * @return Pointer to initialized codec_context_t.
+ */
+codec_context_t *new_codec_context();
+
+/**
+ * Destroys the libjpeg objects and releases every buffer of a codec context.
+ */
+void free_codec_context(codec_context_t *context);
+
+/**
+ * Codec context of the calling thread, created on first use and released when the thread exits, or at exit() for
+ * the thread that calls it.
+ */
+codec_context_t *thread_codec_context();
+
+/**
+ * Decompresses a JPEG image held in memory into image, reusing its pixels when the geometry matches.
+ * @param context codec context to decompress with
+ * @param buffer the compressed JPEG data.
+ * @param size the number of bytes in buffer.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @param image destination (e.g. from new_image()); last_operation is set with the outcome.
+ */
+void codec_decompress_into(codec_context_t *context, const unsigned char *buffer, unsigned long size,
+                           const decode_options_t *options, image_t *image);
+
+/**
+ * Decompresses a JPEG image held in memory into a new image.
+ * @return Decompressed image (without filename), with last_operation set to the outcome.
+ */
+image_t *codec_decompress_buffer(codec_context_t *context, const unsigned char *buffer, unsigned long size,
+                                 const decode_options_t *options);
+
+/**
+ * Decompresses a memory-mapped JPEG file into a new image.
+ * @return Decompressed image, with last_operation set to the outcome.
+ */
+image_t *codec_decompress_file(codec_context_t *context, char *input_filename, const decode_options_t *options);
+
+/**
+ * Compresses an image into the context's encode buffer.
+ * @param context codec context to compress with
+ * @param image the image to compress; last_operation is set with the outcome.
+ * @param options encoder parameters, or NULL for the libjpeg defaults.
+ * @param buffer receives the compressed data, owned by the context and valid until its next compression.
+ * @return Number of bytes in buffer, 0 on failure.
+ */
+unsigned long codec_compress_buffer(codec_context_t *context, image_t *image, const encode_options_t *options,
+                                    const unsigned char **buffer);
+
+/**
+ * Compresses an image to a file.
+ * @param image the image to compress; last_operation is set with the outcome.
+ */
+void codec_compress_file(codec_context_t *context, image_t *image, char *output_filename,
+                         const encode_options_t *options);
+
+#endif //IPP_CODEC_CONTEXT_H
@@ -0,0 +1,70 @@
+/**
+ * Declarations for approximate luminance histograms read from the DC coefficients of JPEG images.
+ */
+
+#include <image_manipulation.h>
+#include <codec_context.h>
+
+#ifndef IPP_DC_HISTOGRAM_H
+#define IPP_DC_HISTOGRAM_H
+
+// The DC coefficient of an 8x8 block of a JPEG is eight times the mean of its samples (less 128), so the blocks alone
+// give the histogram of the image downsampled 8x in both directions by averaging. It is read with libjpeg scaling the
+// output by 1/8 to grayscale: its 1x1 inverse DCT looks at the DC coefficient only, leaving no IDCT, upsampling or
+// colour conversion, and ACs are decoded but not stored. Only the entropy decoding of a baseline JPEG remains, about a
+// third of a full decode for camera-sized images. Progressive JPEGs stop after the first scan holding the DC of luma,
+// usually a small part of the file. (jpeg_read_coefficients() would buffer every coefficient of every component for
+// the whole image, which costs as much as a full decode of the luma plane.) Each block counts for the pixels it
+// covers, so the counts add up to width * height as those of compute_histogram() do, and the two can be compared or
+// normalized in the same way.
+//
+// Error bound: the DC histogram moves each pixel to the value of its block, so the earth mover's distance
+// (histogram_distance()) between it and the exact histogram of the luma plane, as decoded with
+// luminance_decode_options(), is at most the mean distance between the pixels and the values of their blocks. That
+// value is the rounded mean of the block before the inverse DCT clamps samples to 0..255, and of the whole block,
+// including the samples past the right and bottom edges that the encoder filled by replicating the last ones. Where
+// neither happens it is within about 1 level of the mean of the decoded block, bounding the distance by the mean
+// absolute deviation of the pixels from the mean of their block plus 1 level. Progressive JPEGs whose first DC scan
+// leaves out low bits (libjpeg's default progression leaves out one) add up to that many bits times the DC
+// quantization step over 8, which is 1 level at quality 75. Clamped samples and padding can take the distance past
+// that bound, so it is a measured one rather than a guarantee: ipp_difftest checks it on images of at least a block
+// in each direction, baseline, progressive and 4:2:0, where it holds even on noise and on checkers of 0 and 255 that
+// clamp throughout. Images smaller than a block, mostly padding, exceed it by up to 40 levels. Against
+// compute_histogram() of an RGB decode, add the differences between the luma plane and the luminance of clipped RGB
+// described with luminance_decode_options(). On the sample images the distance is between 5 and 10 levels, and about
+// 1 level on a 12 MP image.
+
+/**
+ * Reads the DC histogram of a JPEG from cinfo, whose error manager and source must already be set up. The
+ * decompression object is left for the caller to abort or destroy.
+ * @param histogram receives the counts, HISTOGRAM_SIZE of them
+ */
+void read_dc_histogram(j_decompress_ptr cinfo, int *histogram);
+
+/**
+ * DC histogram of a JPEG held in memory, see above.
+ * @param context codec context to decompress with, reused for batches of images
+ * @param histogram receives the counts, HISTOGRAM_SIZE of them
+ * @return DECOMPRESSION_SUCCESS, or DECOMPRESSION_FAILURE if the data is not a JPEG libjpeg can turn into grayscale.
+ */
+enum result codec_dc_histogram(codec_context_t *context, const unsigned char *buffer, unsigned long size,
+                               int *histogram);
+
+/**
+ * DC histogram of a JPEG held in memory, with a decompression object of its own, see codec_dc_histogram().
+ */
+enum result jpeg_dc_histogram_buffer(const unsigned char *buffer, unsigned long size, int *histogram);
+
+/**
+ * DC histogram of a memory-mapped JPEG file.
+ * @return As codec_dc_histogram(), or FOPEN_FAILURE if the file can not be read.
+ */
+enum result jpeg_dc_histogram(char *input_filename, int *histogram);
+
+/**
+ * Earth mover's distance between two histograms, each normalized by its number of pixels: the mean number of levels
+ * pixels must move by to turn one into the other, 0 for identical distributions and at most 255.
+ */
+double histogram_distance(const int *a, const int *b);
+
+#endif //IPP_DC_HISTOGRAM_H
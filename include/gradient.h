@@ -0,0 +1,61 @@
+/**
+ * Declarations for the fused gradient (edge detection) operator.
+ */
+
+#include <image_manipulation.h>
+
+#ifndef IPP_GRADIENT_H
+#define IPP_GRADIENT_H
+
+// Most orientation bins compute_gradient() quantizes directions into
+#define MAX_ORIENTATION_BINS 64
+
+// Edges used to take a convolve() with sobel_hx_filter() and another with sobel_hy_filter() on two copies of the
+// image, each converting it to luminance and allocating its output, before combining the two. compute_gradient()
+// converts each row to luminance once and keeps the last three in a ring, from which one neighbourhood pass gives Gx
+// and Gy in 16 bit integers, then their magnitude and, if asked for, their orientation, all while the row is in cache.
+//
+// Unlike convolve(), which computes the convolution (left less right for sobel_hx_filter()) and leaves a border of
+// zeros, Gx is right less left and Gy below less above, and border pixels are computed as if the image went on with
+// copies of its edge pixels. The output has the size of the input. Orientations are binned without computing angles,
+// against bin boundaries with 14 bits of precision, so directions within 1/10000 of a radian of one may fall on either
+// side of it.
+
+enum gradient_operator {
+    GRADIENT_SOBEL,             // neighbours weighted 1, 2, 1: Gx and Gy up to 1020
+    GRADIENT_PREWITT            // neighbours weighted 1, 1, 1: Gx and Gy up to 765
+};
+
+enum gradient_norm {
+    GRADIENT_NORM_L1,           // |Gx| + |Gy|
+    GRADIENT_NORM_L2            // sqrt(Gx^2 + Gy^2), rounded
+};
+
+/**
+ * Parameters of compute_gradient().
+ */
+typedef struct gradient_options_struct {
+    enum gradient_operator gradient_operator;
+    enum gradient_norm norm;
+    int shift;                  // magnitudes are shifted right by shift bits before saturating at 255, from 0 to 15
+    int orientation_bins;       // bins half a turn of directions is split into, bin 0 centered on horizontal gradients
+                                // (vertical edges) and the next ones turning from right towards down; 4 gives the
+                                // 0, 45, 90 and 135 degree directions of non-maximum suppression
+    int threads;                // maximum number of bands processed at once, 0 for default_thread_count()
+} gradient_options_t;
+
+/**
+ * Sobel operator, L1 magnitude unshifted, 4 orientation bins, over every processor.
+ */
+gradient_options_t default_gradient_options();
+
+/**
+ * Replaces an image by the magnitude of the gradient of its luminance, one channel of the same size, see above.
+ * Rows are processed in parallel bands, with no other allocation than that of the output pixels.
+ * @param options parameters, NULL for default_gradient_options()
+ * @param orientation receives the orientation bin of every pixel, one channel of the same size, its pixels reused
+ * when they already have that size; NULL to skip orientation
+ */
+void compute_gradient(image_t *image, const gradient_options_t *options, image_t *orientation);
+
+#endif //IPP_GRADIENT_H
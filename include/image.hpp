@@ -0,0 +1,726 @@
+/**
+ * Header-only C++ interface to the image manipulation library: an owning Image and non-owning image views.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include <image_manipulation.h>
+#include <image_formats.h>
+#include <image_roi.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+}
+
+#ifndef IPP_IMAGE_HPP
+#define IPP_IMAGE_HPP
+
+namespace ipp {
+
+using Histogram = std::array<int, HISTOGRAM_SIZE>;
+
+class Image;
+
+void apply_lut(Image &image, const unsigned char *lut);
+
+void mirror_horizontally(Image &image);
+
+void mirror_vertically(Image &image);
+
+Image rotate_90_degrees_clock_wise(const Image &in);
+
+Image luminance(const Image &in);
+
+/**
+ * Rectangle of pixels owned by someone else, rows stride bytes apart. Copying a view never copies pixels.
+ * @tparam Pixel unsigned char for a writable view, const unsigned char for a read-only one
+ */
+template<typename Pixel>
+class BasicImageView {
+public:
+    BasicImageView() = default;
+
+    BasicImageView(Pixel *data, int width, int height, int channels, J_COLOR_SPACE colorspace, std::ptrdiff_t stride)
+            : data_(data), width_(width), height_(height), channels_(channels), colorspace_(colorspace),
+              stride_(stride) {}
+
+    BasicImageView(Pixel *data, int width, int height, int channels, J_COLOR_SPACE colorspace)
+            : BasicImageView(data, width, height, channels, colorspace, (std::ptrdiff_t) width * channels) {}
+
+    // a writable view is also a read-only one
+    template<typename Other, typename = typename std::enable_if<std::is_convertible<Other *, Pixel *>::value>::type>
+    BasicImageView(const BasicImageView<Other> &other)
+            : BasicImageView(other.data(), other.width(), other.height(), other.channels(), other.colorspace(),
+                             other.stride()) {}
+
+    Pixel *data() const { return data_; }
+
+    int width() const { return width_; }
+
+    int height() const { return height_; }
+
+    int channels() const { return channels_; }
+
+    J_COLOR_SPACE colorspace() const { return colorspace_; }
+
+    std::ptrdiff_t stride() const { return stride_; }
+
+    int row_bytes() const { return width_ * channels_; }
+
+    bool empty() const { return width_ <= 0 || height_ <= 0; }
+
+    Pixel *row(int y) const { return data_ + y * stride_; }
+
+    Pixel *pixel(int x, int y) const { return row(y) + x * channels_; }
+
+    /**
+     * View of a rectangle of this view, sharing its pixels.
+     * @throw std::out_of_range if the rectangle is not inside the view
+     */
+    BasicImageView sub(int x, int y, int width, int height) const {
+        if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > width_ || y + height > height_) {
+            throw std::out_of_range("sub-view outside of the view");
+        }
+        return BasicImageView(pixel(x, y), width, height, channels_, colorspace_, stride_);
+    }
+
+    BasicImageView sub(const region_t &region) const {
+        return sub(region.x, region.y, region.width, region.height);
+    }
+
+private:
+    Pixel *data_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+    J_COLOR_SPACE colorspace_ = JCS_UNKNOWN;
+    std::ptrdiff_t stride_ = 0;
+};
+
+using ImageView = BasicImageView<unsigned char>;
+using ConstImageView = BasicImageView<const unsigned char>;
+
+/**
+ * Image owning one contiguous pixel matrix, laid out as new_unsigned_char_matrix() does so that it can be lent to
+ * the C functions. Move-only: copies are made explicitly with clone().
+ * Like image_t, it keeps its histograms once histograms() or channel_histograms() computed them: the Image overloads
+ * of the point ops, mirroring, rotation and luminance() carry them along, while a writable view() drops them.
+ */
+class Image {
+public:
+    Image() = default;
+
+    /**
+     * Image of the given geometry with every component zero.
+     */
+    Image(int width, int height, int channels, J_COLOR_SPACE colorspace)
+            : pixels_(new_unsigned_char_matrix(height, width * channels)), width_(width), height_(height),
+              channels_(channels), colorspace_(colorspace) {
+        if (!pixels_ && height > 0) throw std::bad_alloc();
+        if (height > 0) std::memset(pixels_[0], 0, (size_t) height * width * channels);
+    }
+
+    /**
+     * Copy of the pixels of a C image, whatever the layout of its rows.
+     */
+    explicit Image(const image_t *image) : Image(image->width, image->height, image->channels, image->colorspace) {
+        for (int y = 0; y < height_; ++y) {
+            std::memcpy(pixels_[y], image->pixels[y], (size_t) width_ * channels_);
+        }
+    }
+
+    Image(Image &&other) noexcept { swap(other); }
+
+    Image &operator=(Image &&other) noexcept {
+        Image(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    Image(const Image &) = delete;
+
+    Image &operator=(const Image &) = delete;
+
+    ~Image() {
+        free_unsigned_char_matrix(pixels_);
+        ipp_free(histograms_);
+    }
+
+    /**
+     * Takes over a C image returned by the library, releasing the image_t itself. Its matrix is kept as is when its
+     * rows are still in order, and copied otherwise (after mirror_vertically() or for mapped images).
+     */
+    static Image adopt(image_t *image) {
+        Image adopted;
+        bool in_order = image->pixels && !image->mapping;
+        for (int y = 1; in_order && y < image->height; ++y) {
+            in_order = image->pixels[y] == image->pixels[0] + (size_t) y * image->width * image->channels;
+        }
+
+        if (in_order) {
+            adopted.pixels_ = image->pixels;
+            adopted.width_ = image->width;
+            adopted.height_ = image->height;
+            adopted.channels_ = image->channels;
+            adopted.colorspace_ = image->colorspace;
+            image->pixels = nullptr;
+        } else if (image->pixels) {
+            adopted = Image(image);
+        }
+        adopted.histograms_ = image->histograms;
+        image->histograms = nullptr;
+
+        free_image(image);
+        return adopted;
+    }
+
+    /**
+     * Reads an image with load_image().
+     * @throw std::runtime_error if the file could not be read
+     */
+    static Image load(const char *filename) {
+        image_t *image = load_image(const_cast<char *>(filename));
+        bool loaded = image->last_operation == DECOMPRESSION_SUCCESS || image->last_operation == READ_SUCCESS;
+        Image result = adopt(image);
+        if (!loaded) throw std::runtime_error(std::string("can't read ") + filename);
+        return result;
+    }
+
+    /**
+     * Writes the image with save_image().
+     * @return Whether the file was written.
+     */
+    bool save(const char *filename, const encode_options_t *options = nullptr) const {
+        image_t image = borrow();
+        return save_image(&image, const_cast<char *>(filename), options) != 0;
+    }
+
+    Image clone() const {
+        Image copy(width_, height_, channels_, colorspace_);
+        if (height_ > 0) std::memcpy(copy.pixels_[0], pixels_[0], (size_t) height_ * width_ * channels_);
+        copy.keep_histograms(*this);
+        return copy;
+    }
+
+    /**
+     * C image sharing these pixels, valid while this Image lives and is not reassigned. Only for functions that keep
+     * the pixel matrix, i.e. not the ones that change the size or colorspace of the image. It carries no histograms,
+     * so writes through it leave the cached ones stale: write through view() instead.
+     */
+    image_t borrow() const {
+        image_t image;
+        std::memset(&image, 0, sizeof(image_t));
+        image.width = width_;
+        image.height = height_;
+        image.channels = channels_;
+        image.colorspace = colorspace_;
+        image.pixels = pixels_;
+        return image;
+    }
+
+    /**
+     * Hands the pixels over to a new C image, leaving this Image empty.
+     * @return Image to be released with free_image().
+     */
+    image_t *release() {
+        image_t *image = new_image();
+        *image = borrow();
+        image->histograms = histograms_;
+        histograms_ = nullptr;
+        pixels_ = nullptr;
+        width_ = height_ = channels_ = 0;
+        return image;
+    }
+
+    /**
+     * Writable view of the pixels, which drops the cached histograms as they may be written through it.
+     */
+    ImageView view() {
+        if (histograms_) histograms_->channels_valid = histograms_->luminance_valid = FALSE;
+        return pixels();
+    }
+
+    ConstImageView view() const {
+        return ConstImageView(pixels_ ? pixels_[0] : nullptr, width_, height_, channels_, colorspace_);
+    }
+
+    operator ImageView() { return view(); }
+
+    operator ConstImageView() const { return view(); }
+
+    int width() const { return width_; }
+
+    int height() const { return height_; }
+
+    int channels() const { return channels_; }
+
+    J_COLOR_SPACE colorspace() const { return colorspace_; }
+
+    bool empty() const { return !pixels_ || width_ <= 0 || height_ <= 0; }
+
+    /**
+     * Histograms of each channel and of the luminance, see image_histograms().
+     * @throw std::bad_alloc if they could not be allocated
+     */
+    const image_histograms_t &histograms() const {
+        image_t image = borrow();
+        image.histograms = histograms_;
+        const image_histograms_t *computed = image_histograms(&image);
+        if (!computed) throw std::bad_alloc();
+        histograms_ = image.histograms;
+        return *computed;
+    }
+
+    /**
+     * Histograms with those of the channels current, see image_channel_histograms(); the luminance may be stale.
+     * @throw std::bad_alloc if they could not be allocated
+     */
+    const image_histograms_t &channel_histograms() const {
+        image_t image = borrow();
+        image.histograms = histograms_;
+        const image_histograms_t *computed = image_channel_histograms(&image);
+        if (!computed) throw std::bad_alloc();
+        histograms_ = image.histograms;
+        return *computed;
+    }
+
+    void swap(Image &other) noexcept {
+        std::swap(pixels_, other.pixels_);
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        std::swap(channels_, other.channels_);
+        std::swap(colorspace_, other.colorspace_);
+        std::swap(histograms_, other.histograms_);
+    }
+
+private:
+    friend void apply_lut(Image &image, const unsigned char *lut);
+    friend void mirror_horizontally(Image &image);
+    friend void mirror_vertically(Image &image);
+    friend Image rotate_90_degrees_clock_wise(const Image &in);
+    friend Image luminance(const Image &in);
+
+    // writable view for the operations that keep the cached histograms current
+    ImageView pixels() {
+        return ImageView(pixels_ ? pixels_[0] : nullptr, width_, height_, channels_, colorspace_);
+    }
+
+    // takes a copy of the cached histograms of an image with the same pixel values, if it has any; false if it has
+    // none or they could not be allocated
+    bool keep_histograms(const Image &other) {
+        if (!other.histograms_) return false;
+        if (!histograms_) histograms_ = static_cast<image_histograms_t *>(ipp_malloc(sizeof(image_histograms_t)));
+        if (!histograms_) return false;
+        *histograms_ = *other.histograms_;
+        return true;
+    }
+
+    unsigned char **pixels_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+    J_COLOR_SPACE colorspace_ = JCS_UNKNOWN;
+    mutable image_histograms_t *histograms_ = nullptr;     // NULL until histograms() is called
+};
+
+namespace detail {
+
+inline void expect_geometry(const ImageView &out, int width, int height, int channels) {
+    if (out.width() != width || out.height() != height || out.channels() != channels) {
+        throw std::invalid_argument("output view has the wrong geometry");
+    }
+}
+
+inline bool is_luminance(const ConstImageView &in) {
+    return in.colorspace() == JCS_GRAYSCALE || in.channels() == 1;
+}
+
+// region of interest handed to the C functions, which only write through it when the view is writable
+inline image_roi_t roi(const ConstImageView &view) {
+    return image_roi_t{const_cast<unsigned char *>(view.data()), view.width(), view.height(), view.channels(),
+                       view.colorspace(), view.stride()};
+}
+
+// trace span of an operation implemented here, ended with the pixel bytes of view even when it throws
+class Span {
+public:
+    Span(const char *name, const ConstImageView &view)
+            : span_(trace_begin("op", name)), bytes_((size_t) view.width() * view.height() * view.channels()) {}
+
+    Span(const Span &) = delete;
+
+    Span &operator=(const Span &) = delete;
+
+    ~Span() { trace_end(&span_, bytes_); }
+
+private:
+    trace_span_t span_;
+    size_t bytes_;
+};
+
+}
+
+// Operations in place, on the pixels of the view only (see image_roi.h)
+
+/**
+ * Replaces every pixel component value by lut[value], see apply_lut().
+ */
+inline void apply_lut(ImageView image, const unsigned char *lut) {
+    image_roi_t roi = detail::roi(image);
+    roi_apply_lut(&roi, lut);
+}
+
+inline void add_bias(ImageView image, double bias) {
+    image_roi_t roi = detail::roi(image);
+    roi_add_bias(&roi, bias);
+}
+
+inline void multiply_gain(ImageView image, double gain) {
+    image_roi_t roi = detail::roi(image);
+    roi_multiply_gain(&roi, gain);
+}
+
+inline void negative(ImageView image) {
+    image_roi_t roi = detail::roi(image);
+    roi_negative(&roi);
+}
+
+inline void quantize(ImageView image, int n_tones) {
+    image_roi_t roi = detail::roi(image);
+    roi_quantize(&roi, n_tones);
+}
+
+inline void mirror_horizontally(ImageView image) {
+    image_roi_t roi = detail::roi(image);
+    roi_mirror_horizontally(&roi);
+}
+
+/**
+ * Swaps the contents of the rows, unlike mirror_vertically() which swaps row pointers.
+ */
+inline void mirror_vertically(ImageView image) {
+    image_roi_t roi = detail::roi(image);
+    roi_mirror_vertically(&roi);
+}
+
+/**
+ * Convolves the luminance of the view in place, leaving its border untouched, see roi_convolve().
+ */
+inline void convolve_in_place(ImageView image, float **filter, bool clamp) {
+    image_roi_t roi = detail::roi(image);
+    roi_convolve(&roi, filter, clamp ? TRUE : FALSE);
+}
+
+// Histograms
+
+/**
+ * Histogram of the luminance, as compute_histogram().
+ */
+inline Histogram histogram(ConstImageView image) {
+    Histogram counts;
+    image_roi_t roi = detail::roi(image);
+    roi_compute_histogram(&roi, counts.data());
+    return counts;
+}
+
+/**
+ * Cumulative histogram of the luminance normalized to [0,255], as compute_norm_cum_histogram().
+ */
+inline Histogram cumulative_histogram(ConstImageView image) {
+    Histogram cumulative;
+    image_roi_t roi = detail::roi(image);
+    roi_compute_norm_cum_histogram(&roi, cumulative.data());
+    return cumulative;
+}
+
+/**
+ * Maps every component through the cumulative histogram of the luminance, as equalize_histogram().
+ */
+inline void equalize_histogram(ImageView image) {
+    image_roi_t roi = detail::roi(image);
+    roi_equalize_histogram(&roi);
+}
+
+/**
+ * 256x256 plot of a histogram, see histogram_plot().
+ */
+inline Image histogram_plot(const Histogram &counts) {
+    return Image::adopt(::histogram_plot(const_cast<int *>(counts.data())));
+}
+
+// Operations writing into a caller-provided output of the geometry given by the *_size() helpers or the
+// allocating overloads; outputs must not overlap inputs. They throw std::invalid_argument for a wrong geometry.
+
+/**
+ * Copy of in with the channel count of out: 1 for luminance, 3 for RGB or 4 for RGBA, see convert_pixels().
+ */
+inline void convert(ConstImageView in, ImageView out) {
+    detail::expect_geometry(out, in.width(), in.height(), out.channels());
+    detail::Span span("convert", in);
+    for (int y = 0; y < in.height(); ++y) {
+        convert_pixels(in.row(y), in.channels(), out.row(y), out.channels(), in.width());
+    }
+}
+
+inline Image convert(ConstImageView in, int channels) {
+    Image out(in.width(), in.height(), channels,
+              channels == 1 ? JCS_GRAYSCALE : channels == 4 ? JCS_EXT_RGBA : JCS_RGB);
+    convert(in, out);
+    return out;
+}
+
+/**
+ * Luminance of in, as rgb_to_luminance(), into a single channel out of the same size.
+ */
+inline void luminance(ConstImageView in, ImageView out) {
+    detail::expect_geometry(out, in.width(), in.height(), 1);
+    convert(in, out);
+}
+
+inline Image luminance(ConstImageView in) {
+    return convert(in, 1);
+}
+
+/**
+ * RGB copy of in, as luminance_to_rgb(), into a three channel out of the same size.
+ */
+inline void luminance_to_rgb(ConstImageView in, ImageView out) {
+    detail::expect_geometry(out, in.width(), in.height(), 3);
+    convert(in, out);
+}
+
+inline Image luminance_to_rgb(ConstImageView in) {
+    Image out(in.width(), in.height(), 3, JCS_RGB);
+    luminance_to_rgb(in, out);
+    return out;
+}
+
+/**
+ * in rotated by 90 degrees clock-wise, as rotate_90_degrees_clock_wise(), into an out of transposed size.
+ */
+inline void rotate_90_degrees_clock_wise(ConstImageView in, ImageView out) {
+    detail::expect_geometry(out, in.height(), in.width(), in.channels());
+    image_roi_t source = detail::roi(in), destination = detail::roi(out);
+    roi_rotate_90_degrees_clock_wise(&source, &destination);
+}
+
+inline Image rotate_90_degrees_clock_wise(ConstImageView in) {
+    Image out(in.height(), in.width(), in.channels(), in.colorspace());
+    rotate_90_degrees_clock_wise(in, out);
+    return out;
+}
+
+/**
+ * Size of the zoom_out() of a width by height image.
+ */
+inline std::pair<int, int> zoom_out_size(int width, int height, int sx, int sy) {
+    return {(int) std::ceil((double) width / sx), (int) std::ceil((double) height / sy)};
+}
+
+/**
+ * Means of sx by sy windows of in, as zoom_out(), into an out of zoom_out_size().
+ */
+inline void zoom_out(ConstImageView in, int sx, int sy, ImageView out) {
+    std::pair<int, int> size = zoom_out_size(in.width(), in.height(), sx, sy);
+    detail::expect_geometry(out, size.first, size.second, in.channels());
+    image_roi_t source = detail::roi(in), destination = detail::roi(out);
+    roi_zoom_out(&source, &destination, sx, sy);
+}
+
+inline Image zoom_out(ConstImageView in, int sx, int sy) {
+    std::pair<int, int> size = zoom_out_size(in.width(), in.height(), sx, sy);
+    Image out(size.first, size.second, in.channels(), in.colorspace());
+    zoom_out(in, sx, sy, out);
+    return out;
+}
+
+/**
+ * in zoomed in 2x2 with linear interpolation, as zoom_in(), into an out of 2 * width - 1 by 2 * height - 1.
+ */
+inline void zoom_in(ConstImageView in, ImageView out) {
+    detail::expect_geometry(out, 2 * in.width() - 1, 2 * in.height() - 1, in.channels());
+    image_roi_t source = detail::roi(in), destination = detail::roi(out);
+    roi_zoom_in(&source, &destination);
+}
+
+inline Image zoom_in(ConstImageView in) {
+    Image out(2 * in.width() - 1, 2 * in.height() - 1, in.channels(), in.colorspace());
+    zoom_in(in, out);
+    return out;
+}
+
+/**
+ * Luminance of in convolved with a FILTER_SIZE by FILTER_SIZE filter, as convolve(), into a single channel out
+ * FILTER_SIZE / 2 pixels narrower and shorter.
+ */
+inline void convolve(ConstImageView in, float **filter, bool clamp, ImageView out) {
+    const int half = FILTER_SIZE / 2;
+    int new_width = in.width() - half;
+    int new_height = in.height() - half;
+    detail::expect_geometry(out, new_width, new_height, 1);
+    detail::Span span("convolve", in);
+
+    // the filter works on the luminance, computed once if the input is in colour
+    Image converted;
+    ConstImageView source = in;
+    if (!detail::is_luminance(in)) {
+        converted = luminance(in);
+        source = converted;
+    }
+
+    // filter rotated by 180 degrees
+    float rot_filter[FILTER_SIZE][FILTER_SIZE];
+    for (int i = 0; i < FILTER_SIZE; ++i) {
+        for (int j = 0; j < FILTER_SIZE; ++j) rot_filter[i][j] = filter[FILTER_SIZE - i - 1][FILTER_SIZE - j - 1];
+    }
+
+    for (int y = 0; y < new_height; ++y) {
+        unsigned char *target = out.row(y);
+        std::memset(target, 0, new_width);
+        if (y < half || y >= new_height - half) continue;
+
+        const unsigned char *rows[FILTER_SIZE];
+        for (int i = 0; i < FILTER_SIZE; ++i) rows[i] = source.row(y - half + i);
+        convolve_row(rows, target, half, new_width - half, &rot_filter[0][0], clamp);
+    }
+}
+
+inline Image convolve(ConstImageView in, float **filter, bool clamp) {
+    Image out(in.width() - FILTER_SIZE / 2, in.height() - FILTER_SIZE / 2, 1, JCS_GRAYSCALE);
+    convolve(in, filter, clamp, out);
+    return out;
+}
+
+/**
+ * Luminance of source with its histogram matched to the one of target, as match_histogram(), into a single channel
+ * out of the size of source. Neither input is modified.
+ */
+inline void match_histogram(ConstImageView source, ConstImageView target, ImageView out) {
+    detail::Span span("match_histogram", source);
+    Histogram source_cumulative = cumulative_histogram(source);
+    Histogram target_cumulative = cumulative_histogram(target);
+
+    int *matching = compute_histogram_matching(source_cumulative.data(), target_cumulative.data());
+    unsigned char lut[256];
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) lut[tone] = (unsigned char) matching[tone];
+    free_histogram(matching);
+
+    luminance(source, out);
+    apply_lut(out, lut);
+}
+
+inline Image match_histogram(ConstImageView source, ConstImageView target) {
+    Image out(source.width(), source.height(), 1, JCS_GRAYSCALE);
+    match_histogram(source, target, out);
+    return out;
+}
+
+// Operations on a whole Image that keep its cached histograms current (see Image::histograms()), so that showing
+// them after each edit costs O(256) instead of a pass over the pixels
+
+inline void apply_lut(Image &image, const unsigned char *lut) {
+    apply_lut(image.pixels(), lut);
+    if (image.histograms_) map_histograms(image.histograms_, image.channels_, lut);
+}
+
+inline void add_bias(Image &image, double bias) {
+    unsigned char lut[256];
+    bias_lut(bias, lut);
+    apply_lut(image, lut);
+}
+
+inline void multiply_gain(Image &image, double gain) {
+    unsigned char lut[256];
+    gain_lut(gain, lut);
+    apply_lut(image, lut);
+}
+
+inline void negative(Image &image) {
+    unsigned char lut[256];
+    negative_lut(lut);
+    apply_lut(image, lut);
+}
+
+inline void quantize(Image &image, int n_tones) {
+    unsigned char lut[256];
+    quantize_lut(n_tones, lut);
+    apply_lut(image, lut);
+}
+
+inline void mirror_horizontally(Image &image) {
+    mirror_horizontally(image.pixels());
+}
+
+inline void mirror_vertically(Image &image) {
+    mirror_vertically(image.pixels());
+}
+
+inline Histogram histogram(const Image &image) {
+    Histogram counts;
+    const image_histograms_t &histograms = image.histograms();
+    std::copy(histograms.luminance, histograms.luminance + HISTOGRAM_SIZE, counts.begin());
+    return counts;
+}
+
+inline Histogram cumulative_histogram(const Image &image) {
+    Histogram counts = histogram(image), cumulative;
+    norm_cum_histogram(counts.data(), cumulative.data());
+    return cumulative;
+}
+
+/**
+ * Plot of the histograms of the channels of a colour image (up to three), see channel_histogram_plot(). Point ops keep
+ * them exact, so that unlike the luminance of a colour image they are never counted again after an edit.
+ * @param cumulative plots the normalized cumulative histograms instead
+ * @throw std::bad_alloc if the histograms could not be allocated
+ */
+inline Image channel_histogram_plot(const Image &image, bool cumulative = false) {
+    const image_histograms_t &histograms = image.channel_histograms();
+    if (!histograms.channels_valid) return histogram_plot(cumulative ? cumulative_histogram(image) : histogram(image));
+
+    int counts[MAX_CHANNELS][HISTOGRAM_SIZE];
+    int channels = std::min(image.channels(), MAX_CHANNELS);
+    for (int c = 0; c < channels; ++c) {
+        if (cumulative) norm_cum_histogram(histograms.channel[c], counts[c]);
+        else std::copy(histograms.channel[c], histograms.channel[c] + HISTOGRAM_SIZE, counts[c]);
+    }
+    return Image::adopt(::channel_histogram_plot(counts, channels));
+}
+
+inline void equalize_histogram(Image &image) {
+    detail::Span span("equalize_histogram", image);
+    Histogram cumulative = cumulative_histogram(image);
+    unsigned char lut[256];
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) lut[i] = (unsigned char) cumulative[i];
+    apply_lut(image, lut);
+}
+
+inline Image rotate_90_degrees_clock_wise(const Image &in) {
+    Image out = rotate_90_degrees_clock_wise(ConstImageView(in));
+    out.keep_histograms(in);
+    return out;
+}
+
+/**
+ * Luminance of in, whose histogram becomes the one of the only channel of the result.
+ */
+inline Image luminance(const Image &in) {
+    Image out = luminance(ConstImageView(in));
+    if (in.histograms_ && in.histograms_->luminance_valid && out.keep_histograms(in)) {
+        std::copy(in.histograms_->luminance, in.histograms_->luminance + HISTOGRAM_SIZE, out.histograms_->channel[0]);
+        out.histograms_->channels_valid = TRUE;
+    }
+    return out;
+}
+
+}
+
+#endif //IPP_IMAGE_HPP
@@ -0,0 +1,98 @@
+/**
+ * Declarations for the content-addressed cache of decoded images.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <image_manipulation.h>
+
+#ifndef IPP_IMAGE_CACHE_H
+#define IPP_IMAGE_CACHE_H
+
+#define IMAGE_CACHE_BUCKETS 1024
+
+typedef struct image_cache_stats_struct {
+    unsigned long hits;         // served from memory
+    unsigned long spill_hits;   // served by mapping a spilled raw file
+    unsigned long misses;       // decoded
+    unsigned long collisions;   // keys found cached for other content, decoded as misses
+    unsigned long evictions;    // dropped from memory to stay within budget
+    unsigned long spills;       // evictions written to the spill directory
+    size_t resident_bytes;
+    size_t byte_budget;
+} image_cache_stats_t;
+
+typedef struct image_cache_entry_struct {
+    uint64_t key;                                   // content hash mixed with the decode options
+    uint64_t content_size;                          // bytes of the compressed content
+    uint64_t content_digest;                        // second hash of the content, independent of the key
+    image_t *image;
+    size_t bytes;
+    struct image_cache_entry_struct *bucket_next;
+    struct image_cache_entry_struct *lru_prev;      // towards most recently used
+    struct image_cache_entry_struct *lru_next;      // towards least recently used
+} image_cache_entry_t;
+
+/**
+ * Decoded images keyed by the hash of the compressed bytes and the decode options, so the same content opened
+ * under any name is decoded once. Entries, and the headers of spilled files, also keep the size of the content and
+ * a second hash of it, which must both match for a hit: contents whose keys collide are decoded rather than served
+ * each other's pixels, unless their sizes and digests collide too. Resident images are evicted least recently used
+ * first to stay within a byte budget, and optionally spilled to raw files that are mapped back instead of decoded
+ * again. Thread safe.
+ */
+typedef struct image_cache_struct {
+    image_cache_entry_t *buckets[IMAGE_CACHE_BUCKETS];
+    image_cache_entry_t *most_recent;
+    image_cache_entry_t *least_recent;
+    char *spill_directory;
+    image_cache_stats_t stats;
+    pthread_mutex_t lock;
+} image_cache_t;
+
+/**
+ * Initializes an empty image cache in heap memory.
+ * @param byte_budget maximum bytes of pixels kept in memory
+ * @param spill_directory existing directory where evicted images are written as raw files, NULL to just drop them
+ * @return Pointer to initialized image_cache_t.
+ */
+image_cache_t *new_image_cache(size_t byte_budget, const char *spill_directory);
+
+/**
+ * Releases every cached image and the cache itself. Spilled files are kept.
+ */
+void free_image_cache(image_cache_t *cache);
+
+/**
+ * 64-bit hash of a byte buffer, used as cache key.
+ */
+uint64_t content_hash(const unsigned char *buffer, size_t size);
+
+/**
+ * Second 64-bit hash of a byte buffer, independent of content_hash(), which cache hits are verified with.
+ */
+uint64_t content_digest(const unsigned char *buffer, size_t size);
+
+/**
+ * Decompresses a JPEG file through the cache. Misses are decoded with the codec context of the calling thread.
+ * @param cache the cache to look up and fill
+ * @param input_filename the name of the input file, mapped and hashed on every call
+ * @param options decoder parameters, or NULL for the libjpeg defaults; part of the key
+ * @return Copy of the decoded image owned by the caller, with last_operation set to the outcome.
+ */
+image_t *image_cache_decompress(image_cache_t *cache, char *input_filename, const decode_options_t *options);
+
+/**
+ * Decompresses a JPEG image held in memory through the cache, see image_cache_decompress().
+ * @return Copy of the decoded image (without filename) owned by the caller.
+ */
+image_t *image_cache_decompress_buffer(image_cache_t *cache, const unsigned char *buffer, unsigned long size,
+                                       const decode_options_t *options);
+
+/**
+ * Snapshot of the cache counters.
+ */
+image_cache_stats_t image_cache_stats(image_cache_t *cache);
+
+#endif //IPP_IMAGE_CACHE_H
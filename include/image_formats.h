@@ -0,0 +1,87 @@
+/**
+ * Declarations for uncompressed image formats: the raw memory-mappable container and binary PPM/PGM.
+ */
+
+#include <stdint.h>
+#include <image_manipulation.h>
+
+#ifndef IPP_IMAGE_FORMATS_H
+#define IPP_IMAGE_FORMATS_H
+
+#define RAW_MAGIC "IPPRAW01"
+#define RAW_BYTE_ORDER 0x01020304
+#define RAW_HEADER_SIZE 64
+
+/**
+ * Header of a raw image file. Pixel rows follow at data_offset, each row starting stride bytes after the previous
+ * one; both are multiples of MATRIX_ALIGNMENT so that mapped rows are as aligned as allocated ones.
+ */
+typedef struct raw_header_struct {
+    char magic[8];              // RAW_MAGIC
+    uint32_t byte_order;        // RAW_BYTE_ORDER as written by the producing machine
+    uint32_t header_size;       // RAW_HEADER_SIZE
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t colorspace;        // J_COLOR_SPACE
+    uint64_t stride;            // bytes from one row to the next, at least width * channels
+    uint64_t data_offset;       // bytes from the start of the file to the first row
+    uint64_t source_size;       // bytes of the file the image was decoded from, 0 if unknown
+    uint64_t source_digest;     // hash of that file identifying it, 0 if unknown
+} raw_header_t;
+
+/**
+ * Writes an image to a raw file that raw_load() can map back without parsing or copying.
+ * @param image the image to write; last_operation is set to WRITE_SUCCESS or WRITE_FAILURE/FOPEN_FAILURE.
+ * @param output_filename the name of the output file.
+ */
+void raw_save(image_t *image, char *output_filename);
+
+/**
+ * Writes an image to a raw file recording the file it was decoded from, see raw_save().
+ * @param source_size size of the source file, stored in the header
+ * @param source_digest hash of the source file, stored in the header
+ */
+void raw_save_with_source(image_t *image, char *output_filename, uint64_t source_size, uint64_t source_digest);
+
+/**
+ * Maps a raw file into an image whose rows point straight into the mapping. The mapping is private, so changing
+ * the pixels never changes the file; free_pixels() unmaps it. Empty images (width or height 0) are rejected.
+ * @param input_filename the name of the input file.
+ * @return Mapped image, with last_operation set to READ_SUCCESS, or READ_FAILURE/FOPEN_FAILURE and no pixels.
+ */
+image_t *raw_load(char *input_filename);
+
+/**
+ * Writes an image as binary PGM (grayscale) or PPM (RGB).
+ * @param image the image to write; last_operation is set to WRITE_SUCCESS or WRITE_FAILURE/FOPEN_FAILURE.
+ * @param output_filename the name of the output file.
+ */
+void pnm_save(image_t *image, char *output_filename);
+
+/**
+ * Reads a binary PGM (P5) or PPM (P6) file with a maximum value of 255.
+ * @param input_filename the name of the input file.
+ * @return Read image, with last_operation set to READ_SUCCESS, or READ_FAILURE/FOPEN_FAILURE and no pixels.
+ */
+image_t *pnm_load(char *input_filename);
+
+/**
+ * Whether a filename has a JPEG extension (.jpg or .jpeg, in any case).
+ */
+int is_jpeg_filename(const char *filename);
+
+/**
+ * Reads an image in the format given by the file extension: .jpg/.jpeg, .ppm/.pgm/.pnm, or raw otherwise.
+ * @return Read image, last_operation tells the outcome (DECOMPRESSION_SUCCESS or READ_SUCCESS when successful).
+ */
+image_t *load_image(char *input_filename);
+
+/**
+ * Writes an image in the format given by the file extension: .jpg/.jpeg, .ppm/.pgm/.pnm, or raw otherwise.
+ * @param options encoder parameters for JPEG files, or NULL for the libjpeg defaults.
+ * @return Non-zero if the image was written.
+ */
+int save_image(image_t *image, char *output_filename, const encode_options_t *options);
+
+#endif //IPP_IMAGE_FORMATS_H
@@ -7,19 +7,26 @@
 #include <stdio.h>
 #include <jpeglib.h>
 #include <setjmp.h>
+#include <memory_accounting.h>
 
 #ifndef FPI_ASSIGNMENT_1_IMAGE_MANIPULATION_H
 #define FPI_ASSIGNMENT_1_IMAGE_MANIPULATION_H
 
 #define HISTOGRAM_SIZE 256
+#define MAX_CHANNELS 4
 #define FILTER_SIZE 3
+#define MATRIX_ALIGNMENT 64
 
 enum result {
     COMPRESSION_SUCCESS,
     COMPRESSION_FAILURE,
     DECOMPRESSION_SUCCESS,
     DECOMPRESSION_FAILURE,
-    FOPEN_FAILURE
+    FOPEN_FAILURE,
+    READ_SUCCESS,
+    READ_FAILURE,
+    WRITE_SUCCESS,
+    WRITE_FAILURE
 };
 
 struct error_manager {
@@ -29,30 +36,136 @@ struct error_manager {
 };
 typedef struct error_manager *error_manager_ptr;
 
+/**
+ * Destination manager writing to a malloc() block it grows with realloc() as libjpeg fills it, see
+ * jpeg_growing_dest(). Unlike jpeg_mem_dest(), the current block is always known, so an error during compression can
+ * free it.
+ */
+struct growing_destination_manager {
+    struct jpeg_destination_mgr pub;
+    unsigned char *buffer;      // current block, to be released with free()
+    unsigned long capacity;     // size of buffer
+};
+
+/**
+ * Histograms of the pixels of an image, kept with it once computed, see image_histograms().
+ */
+typedef struct image_histograms_struct {
+    boolean channels_valid;     // channel[c] counts component c of every pixel
+    boolean luminance_valid;    // luminance counts the luminance of every pixel, as compute_histogram() does
+    int channel[MAX_CHANNELS][HISTOGRAM_SIZE];
+    int luminance[HISTOGRAM_SIZE];
+} image_histograms_t;
+
 typedef struct image_struct {
     char *filename;
     int height;
     int width;
     J_COLOR_SPACE colorspace;
     int channels;
-    unsigned char **pixels;
+    unsigned char **pixels;     // row pointers, into one block allocated with them or into mapping
     enum result last_operation;
+    void *mapping;              // file mapping that backs the rows, if any, released by free_pixels()
+    size_t mapping_size;
+    image_histograms_t *histograms;     // cached histograms of the pixels, NULL until image_histograms() is called
 } image_t;
 
+/**
+ * What histogram equalization and matching map, see equalize_histogram_with_mode().
+ */
+enum histogram_mode {
+    HISTOGRAM_MODE_LUMINANCE,   // every component through one table of the luminance, which shifts colours
+    HISTOGRAM_MODE_CHANNELS,    // each channel through a table of its own histogram
+    HISTOGRAM_MODE_LUMA         // the Y of YCbCr through a table of the luminance, keeping Cb and Cr
+};
+
+/**
+ * Normalized cumulative histograms of a target image, kept to match any number of images to it.
+ */
+typedef struct histogram_reference_struct {
+    int channels;
+    int hist_cum_luminance[HISTOGRAM_SIZE];
+    int hist_cum_channels[MAX_CHANNELS][HISTOGRAM_SIZE];
+} histogram_reference_t;
+
+/**
+ * Named sets of encoder parameters, trading encode time against output size and fidelity.
+ */
+enum encode_preset {
+    ENCODE_PRESET_DEFAULT,
+    ENCODE_PRESET_FAST,
+    ENCODE_PRESET_BALANCED,
+    ENCODE_PRESET_SMALL,
+    ENCODE_PRESET_PROGRESSIVE,
+    ENCODE_PRESET_QUALITY,
+    ENCODE_PRESET_COUNT
+};
+
+/**
+ * Parameters that control JPEG compression speed and output size.
+ */
+typedef struct encode_options_struct {
+    int quality;                // 1 (smallest) to 100 (best), scaled into the quantization tables
+    J_DCT_METHOD dct_method;    // JDCT_ISLOW, JDCT_IFAST or JDCT_FLOAT
+    boolean optimize_coding;    // compute optimal Huffman tables (extra pass, smaller output)
+    boolean progressive;        // emit a progressive scan script instead of a single baseline scan
+    int h_sampling;             // horizontal luma sampling factor (chroma is always 1): 1 = 4:4:4, 2 = 4:2:x
+    int v_sampling;             // vertical luma sampling factor: 1 = 4:4:4/4:2:2, 2 = 4:2:0
+    int restart_in_rows;        // MCU rows per restart interval, 0 disables restart markers
+} encode_options_t;
+
+/**
+ * Axis aligned rectangle of pixels, with (x, y) its top-left corner.
+ */
+typedef struct region_struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} region_t;
+
+/**
+ * Parameters that trade JPEG decompression accuracy for speed.
+ */
+typedef struct decode_options_struct {
+    boolean grayscale;          // output only the luma plane (JCS_GRAYSCALE), skipping chroma upsampling and conversion
+    J_DCT_METHOD dct_method;    // JDCT_ISLOW, JDCT_IFAST or JDCT_FLOAT
+    boolean fancy_upsampling;   // smooth chroma upsampling instead of pixel replication
+    boolean block_smoothing;    // smooth blocky output of early progressive scans
+} decode_options_t;
+
 /**
  * Initializes an image_t in heap memory.
- * @return Pointer to initialized image_t.
+ * @return Pointer to initialized image_t, released with free_image().
  */
 image_t *new_image();
 
+/**
+ * Releases an image, its pixels, its filename and its cached histograms, doing nothing for NULL.
+ */
+void free_image(image_t *image);
+
+/**
+ * Allocates a rows by cols matrix in a single block: the row pointers followed by the rows, contiguous and starting
+ * at a MATRIX_ALIGNMENT boundary. The block may be one a previous matrix was released with, see scratch.h.
+ */
 unsigned char **new_unsigned_char_matrix(int rows, int cols);
 
+/**
+ * Releases a matrix of new_unsigned_char_matrix(), keeping its block for a later one of about the same size.
+ */
+void free_unsigned_char_matrix(unsigned char **matrix);
+
+int min_int(int a, int b);
+
 /**
  * Initializes a histogram (256-elements int vector) in heap memory.
- * @return Pointer to initialized histogram_t.
+ * @return Pointer to initialized histogram_t, released with free_histogram(), or NULL if it could not be allocated.
  */
 int *new_histogram();
 
+void free_histogram(int *histogram);
+
 image_t *copy_image(image_t *original);
 
 /**
@@ -65,6 +178,67 @@ image_t *copy_image(image_t *original);
  */
 void jpeg_compress(image_t *image, char *output_filename);
 
+/**
+ * Compresses an image to a file using JPEG algorithm with the given encoder parameters.
+ * @param image the image to compress; last_operation is set with the outcome.
+ * @param output_filename the name of the output file.
+ * @param options encoder parameters, or NULL for the libjpeg defaults.
+ */
+void jpeg_compress_with_options(image_t *image, char *output_filename, const encode_options_t *options);
+
+/**
+ * Compresses an image to a newly allocated memory buffer using JPEG algorithm.
+ * @param image the image to compress; last_operation is set with the outcome.
+ * @param options encoder parameters, or NULL for the libjpeg defaults.
+ * @param buffer receives the compressed data, to be released with free(); NULL on failure.
+ * @return Number of bytes in buffer, 0 on failure.
+ */
+unsigned long jpeg_compress_buffer(image_t *image, const encode_options_t *options, unsigned char **buffer);
+
+/**
+ * Makes cinfo compress into buffer, doubling it with realloc() whenever it is full.
+ * @param destination receives the block in use and its capacity, which outlive the compression
+ * @param buffer malloc() block to start from
+ * @param capacity size of buffer, at least 1
+ */
+void jpeg_growing_dest(j_compress_ptr cinfo, struct growing_destination_manager *destination, unsigned char *buffer,
+                       unsigned long capacity);
+
+/**
+ * Compresses an image into a caller-provided buffer, which is never reallocated.
+ * @param image the image to compress; last_operation is COMPRESSION_FAILURE if the buffer is too small.
+ * @param options encoder parameters, or NULL for the libjpeg defaults.
+ * @param buffer destination of the compressed data.
+ * @param capacity number of bytes available in buffer; jpeg_compress_bound() is always enough.
+ * @return Number of bytes written, 0 on failure.
+ */
+unsigned long jpeg_compress_into(image_t *image, const encode_options_t *options, unsigned char *buffer,
+                                 unsigned long capacity);
+
+/**
+ * Upper bound of the compressed size of an image, to size buffers for jpeg_compress_into().
+ * @param image the image to be compressed.
+ * @param options encoder parameters that will be used, or NULL for the libjpeg defaults.
+ * @return Number of bytes that any encode of the image with these options fits in.
+ */
+unsigned long jpeg_compress_bound(image_t *image, const encode_options_t *options);
+
+/**
+ * Encoder parameters matching what jpeg_set_defaults() produces (quality 75, ISLOW, 4:2:0).
+ */
+encode_options_t default_encode_options();
+
+/**
+ * Encoder parameters of a named preset.
+ * @param preset one of the encode_preset values, except ENCODE_PRESET_COUNT.
+ */
+encode_options_t encode_preset_options(enum encode_preset preset);
+
+/**
+ * Human readable name of a preset, e.g. "fast".
+ */
+const char *encode_preset_name(enum encode_preset preset);
+
 /**
  * Decompresses a JPEG image into an image buffer using JPEG algorithm.
  * @param pixels_array_ptr pointer to 2D buffer with R,G,B,R,G,B ... info.
@@ -73,12 +247,102 @@ void jpeg_compress(image_t *image, char *output_filename);
  */
 image_t *jpeg_decompress(char *input_filename);
 
+/**
+ * Decompresses a JPEG image with the given decoder parameters.
+ * @param input_filename the name of the input file.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @return Decompressed image, with last_operation set to the outcome.
+ */
+image_t *jpeg_decompress_with_options(char *input_filename, const decode_options_t *options);
+
+/**
+ * Decompresses a JPEG image held in memory, without touching the filesystem.
+ * @param buffer the compressed JPEG data.
+ * @param size the number of bytes in buffer.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @return Decompressed image (without filename), with last_operation set to the outcome.
+ */
+image_t *jpeg_decompress_buffer(const unsigned char *buffer, unsigned long size, const decode_options_t *options);
+
+/**
+ * Decompresses only a rectangle of a JPEG image, with the pixels it has in a decode of the whole image. With
+ * libjpeg-turbo, rows above the rectangle are skipped and only the iMCU columns that cover it, and one more on each
+ * side, are decoded; rows below it are never read.
+ * @param input_filename the name of the input file.
+ * @param region rectangle to decompress, clipped to the image bounds; NULL for the whole image.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @return Image of the region only, with last_operation set to the outcome.
+ */
+image_t *jpeg_decompress_region(char *input_filename, const region_t *region, const decode_options_t *options);
+
+/**
+ * Decompresses only a rectangle of a JPEG image held in memory, see jpeg_decompress_region().
+ */
+image_t *jpeg_decompress_buffer_region(const unsigned char *buffer, unsigned long size, const region_t *region,
+                                       const decode_options_t *options);
+
+/**
+ * Decompresses a JPEG file by memory-mapping it, avoiding the copy through stdio buffers.
+ * @param input_filename the name of the input file.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @return Decompressed image, with last_operation set to the outcome.
+ */
+image_t *jpeg_decompress_mapped(char *input_filename, const decode_options_t *options);
+
+/**
+ * Decoder parameters matching the libjpeg defaults: full color, ISLOW IDCT, fancy upsampling and block smoothing.
+ */
+decode_options_t default_decode_options();
+
+/**
+ * Fastest decoder parameters for images that are only used through their luminance (rgb_to_luminance, histograms,
+ * convolution, histogram matching): grayscale output, IFAST IDCT, no fancy upsampling, no block smoothing.
+ * The luma plane is taken straight from the JPEG instead of being recomputed from clipped RGB. Compared with
+ * jpeg_decompress() followed by rgb_to_luminance(), the mean absolute difference stays below 1.5 levels (about 0.5
+ * of it from the IFAST IDCT); isolated saturated pixels, whose RGB values were clipped, can differ by up to 25 levels.
+ */
+decode_options_t luminance_decode_options();
+
 /**
  * Replaces the standard error_exit method:
  * @param cinfo Contains information of a compression or a decompression
  */
 void my_error_exit(j_common_ptr cinfo);
 
+/**
+ * Sets compression parameters of cinfo from options, after jpeg_set_defaults() was called.
+ * @param cinfo compression object with image size and colorspace already set
+ * @param options encoder parameters, NULL keeps the libjpeg defaults
+ */
+void apply_encode_options(j_compress_ptr cinfo, const encode_options_t *options);
+
+/**
+ * Sets decompression parameters of cinfo from options, after jpeg_read_header() was called.
+ * @param cinfo decompression object with the header already read
+ * @param options decoder parameters, NULL keeps the libjpeg defaults
+ */
+void apply_decode_options(j_decompress_ptr cinfo, const decode_options_t *options);
+
+/**
+ * Compresses image through cinfo, whose error manager and destination must already be set up.
+ * The compression object is left ready to compress another image.
+ * @param cinfo created compression object
+ * @param image the image to compress
+ * @param options encoder parameters, NULL keeps the libjpeg defaults
+ */
+void write_jpeg(j_compress_ptr cinfo, image_t *image, const encode_options_t *options);
+
+/**
+ * Decompresses from cinfo into image, whose error manager and source must already be set up.
+ * If image already holds pixels of the decoded geometry they are overwritten in place, otherwise they are replaced.
+ * The decompression object must be finished or aborted before it reads another image.
+ * @param cinfo created decompression object
+ * @param image receives size, colorspace and pixels of the decompressed image
+ * @param options decoder parameters, NULL keeps the libjpeg defaults
+ * @param region rectangle to decompress, NULL for the whole image
+ */
+void read_jpeg(j_decompress_ptr cinfo, image_t *image, const decode_options_t *options, const region_t *region);
+
 /**
  * Converts 2D pixel array to 1D JSAMPLE array (R,G,B,R,G,B ...).
  * @param pixel_array The 2D pixel array to convert.
@@ -99,12 +363,32 @@ JSAMPLE *pixel_array_to_jsample_array(image_t *image);
  */
 unsigned char *pixel_array_to_unsigned_char_array(image_t *image);
 
+/**
+ * Writes the pixels of an image to a buffer of contiguous rows of another channel count, e.g. a display buffer.
+ * @param buffer width * height * channels bytes
+ * @param channels 1 for luminance, 3 for RGB or 4 for RGBA with opaque alpha, see convert_pixels()
+ */
+void image_to_buffer(image_t *image, unsigned char *buffer, int channels);
+
 void mirror_horizontally(image_t* image);
 
 void mirror_vertically(image_t *image);
 
+/**
+ * Releases the pixels of an image (and the file mapping behind them, if any), leaving pixels NULL. Cached histograms
+ * are kept for the op that fills in new pixels to update or invalidate.
+ */
 void free_pixels(image_t *image);
 
+/**
+ * Size of the pixels of an image, in bytes, as reported by its trace spans.
+ */
+size_t image_bytes(const image_t *image);
+
+/**
+ * Copies an image into RGB for display.
+ * @return New image, even if the original already is RGB, released with free_image().
+ */
 image_t *get_displayable(image_t *image);
 
 void rgb_to_luminance(image_t *image);
@@ -113,40 +397,167 @@ void luminance_to_rgb(image_t *image);
 
 void quantize(image_t *image, int n_tones);
 
+/**
+ * Fills lut with the 256 levels quantize() maps each component value to
+ */
+void quantize_lut(int n_tones, unsigned char *lut);
+
+/**
+ * Histogram of the luminance of an image, taken from its cached histograms when they are current.
+ * @return New histogram, released with free_histogram().
+ */
 int *compute_histogram(image_t *image);
 
 int *compute_norm_cum_histogram(image_t *image);
 
+/**
+ * Fills hist_cum with the cumulative histogram of hist normalized to [0,255], as compute_norm_cum_histogram() does;
+ * all zeros if hist counts no pixels
+ */
+void norm_cum_histogram(const int *hist, int *hist_cum);
+
+/**
+ * Histograms of each channel and of the luminance of an image, counted in one pass the first time and kept with the
+ * image. Point ops (apply_lut() and the ops built on it, equalize_histogram() and match_histogram()) update them in
+ * O(256), mirroring, rotation and conversion between RGB and luminance keep them, and the other ops that change
+ * pixels (zooming, convolution, decoding into the image, taking an image_roi()) drop them, so that they are counted
+ * again on next use. Code that writes the pixels itself calls invalidate_histograms().
+ * Channel histograms are only kept for up to MAX_CHANNELS channels.
+ * @return The histograms, NULL if they could not be allocated.
+ */
+const image_histograms_t *image_histograms(image_t *image);
+
+/**
+ * Histograms of an image as image_histograms() keeps them, counting only those of the channels when they are not
+ * current. These stay exact through point ops on images of any channel count, unlike the luminance of colour images,
+ * which may be left stale (see luminance_valid).
+ * @return The histograms, NULL if they could not be allocated; channels_valid is FALSE for more than MAX_CHANNELS
+ * channels.
+ */
+const image_histograms_t *image_channel_histograms(image_t *image);
+
+/**
+ * Marks the cached histograms of an image as stale, after its pixels were written other than by the library ops.
+ */
+void invalidate_histograms(image_t *image);
+
+/**
+ * Updates histograms for pixels whose components were all replaced by lut[value].
+ * @param channels channel count of the pixels; the luminance histogram of more than one channel is marked stale, as
+ * it can not be derived from the old one
+ */
+void map_histograms(image_histograms_t *histograms, int channels, const unsigned char *lut);
+
 /**
  * Build and returns 256x256 image representing the histogram
  */
 image_t *histogram_plot(int *histogram);
 
+/**
+ * Builds a 256x256 RGB image plotting the histograms of up to three channels on one scale, the bars of the first,
+ * second and third channel in red, green and blue, darkening where they overlap, so that the channels of a gray
+ * image plot as histogram_plot() does
+ */
+image_t *channel_histogram_plot(int histograms[][HISTOGRAM_SIZE], int channels);
+
 /**
  * Brightness adjustment by adding bias term to each pixel component
  */
 void add_bias(image_t *image, double bias);
 
+/**
+ * Fills lut with the saturated value + bias of each of the 256 component values
+ */
+void bias_lut(double bias, unsigned char *lut);
+
 /**
  * Contrast adjustment by multiplying gain term to each pixel component
  */
 void multiply_gain(image_t *image, double bias);
 
+/**
+ * Fills lut with the saturated value * gain of each of the 256 component values
+ */
+void gain_lut(double gain, unsigned char *lut);
+
 /**
  * Takes the negative of the image by making every pixel component value' = 255 - value
  */
 void negative(image_t *image);
 
+/**
+ * Fills lut with 255 - value for each of the 256 component values
+ */
+void negative_lut(unsigned char *lut);
+
+/**
+ * Point operation replacing every pixel component value by lut[value]
+ * @param lut 256 entries, e.g. from bias_lut(), gain_lut(), negative_lut() or quantize_lut()
+ */
+void apply_lut(image_t *image, const unsigned char *lut);
+
+/**
+ * Point operation replacing component c of every pixel by luts[c * 256 + value]
+ * @param luts 256 entries per channel of the image
+ */
+void apply_channel_luts(image_t *image, const unsigned char *luts);
+
+/**
+ * Maps the Y of YCbCr of every pixel through lut keeping its Cb and Cr, see map_luma()
+ */
+void apply_luma_lut(image_t *image, const unsigned char *lut);
+
 /**
  * Attempts to produce optimal contrast by equalizing the histogram of the image
  */
 void equalize_histogram(image_t *image);
 
 /**
- * Make source's histogram match target's
+ * Equalizes the histogram of the image in one of the histogram modes; HISTOGRAM_MODE_LUMINANCE is
+ * equalize_histogram(), the other two keep the hues of colour images
+ */
+void equalize_histogram_with_mode(image_t *image, enum histogram_mode mode);
+
+/**
+ * Make source's histogram match target's, converting both to luminance
  */
 void match_histogram(image_t *source, image_t *target);
 
+/**
+ * Makes source's histogram match target's in one of the histogram modes, keeping the channels of source and leaving
+ * target as it is (but for its cached histograms, see image_histograms())
+ */
+void match_histogram_with_mode(image_t *source, image_t *target, enum histogram_mode mode);
+
+/**
+ * Computes the normalized cumulative histograms of a target once, for match_histogram_to_reference()
+ * @return Reference released with free_histogram_reference()
+ */
+histogram_reference_t *new_histogram_reference(image_t *target);
+
+void free_histogram_reference(histogram_reference_t *reference);
+
+/**
+ * Makes source's histogram match the one of a reference, as match_histogram_with_mode() does with its image: one
+ * pass to count source and one to map it. In HISTOGRAM_MODE_CHANNELS, channels beyond those of the reference match
+ * its last one.
+ */
+void match_histogram_to_reference(image_t *source, const histogram_reference_t *reference,
+                                  enum histogram_mode mode);
+
+/**
+ * Tone mapping that makes a histogram match another one, as match_histogram() applies it: each source tone goes to
+ * the first target tone whose cumulative count is closest to its own
+ * @param hist_cum_source, hist_cum_target normalized cumulative histograms, see compute_norm_cum_histogram()
+ * @return HISTOGRAM_SIZE target tones, one per source tone
+ */
+int *compute_histogram_matching(const int *hist_cum_source, const int *hist_cum_target);
+
+/**
+ * Fills lut with the tone mapping of compute_histogram_matching(), in a single walk over both histograms
+ */
+void histogram_matching_lut(const int *hist_cum_source, const int *hist_cum_target, unsigned char *lut);
+
 /**
  * Zoom out of image using a sliding window of size sx by sy, taking the mean of the channels as it slides
  * @param image the image to zoom out
@@ -176,7 +587,11 @@ void rotate_90_degrees_clock_wise(image_t *image);
 void convolve(image_t *image, float **filter, boolean clamp);
 
 
+/**
+ * Allocates a size by size filter, released with free_filter(), as are the filters below.
+ */
 float **new_filter(int size);
+void free_filter(float **filter);
 float **gaussian_filter();
 float **laplacian_filter();
 float **high_pass_filter();
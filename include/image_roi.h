@@ -0,0 +1,124 @@
+/**
+ * Declarations for region of interest operations.
+ */
+
+#include <stddef.h>
+#include <image_manipulation.h>
+
+#ifndef IPP_IMAGE_ROI_H
+#define IPP_IMAGE_ROI_H
+
+/**
+ * Rectangle of pixels inside a buffer owned by someone else, usually an image_t. Operations on a region of interest
+ * work in place on that buffer and only touch the pixels of the rectangle, so their cost is proportional to its area.
+ */
+typedef struct image_roi_struct {
+    unsigned char *origin;      // first component of the top-left pixel
+    int width;
+    int height;
+    int channels;
+    J_COLOR_SPACE colorspace;
+    ptrdiff_t stride;           // bytes from the start of a row to the start of the next, negative for bottom-up rows
+} image_roi_t;
+
+/**
+ * Region of interest of an image, whose rows must be evenly spaced as they are in every image built by this library
+ * (mirror_vertically() makes the spacing negative). The cached histograms of the image are invalidated, as its pixels
+ * may be written through the region.
+ * @param region rectangle of the image, clipped to its bounds; NULL for the whole image
+ * @return The region of interest, empty (width and height 0) if the rectangle misses the image or the rows are not
+ * evenly spaced.
+ */
+image_roi_t image_roi(image_t *image, const region_t *region);
+
+/**
+ * Region of interest of a buffer of contiguous rows, such as the pixels of a GUI image.
+ */
+image_roi_t buffer_roi(unsigned char *pixels, int width, int height, int channels, J_COLOR_SPACE colorspace);
+
+/**
+ * Rectangle of a region of interest, clipped to its bounds, sharing its pixels.
+ */
+image_roi_t sub_roi(const image_roi_t *roi, const region_t *region);
+
+/**
+ * Pointer to the first component of row y of a region of interest.
+ */
+unsigned char *roi_row(const image_roi_t *roi, int y);
+
+/**
+ * Point operation replacing every pixel component value by lut[value], see apply_lut().
+ */
+void roi_apply_lut(const image_roi_t *roi, const unsigned char *lut);
+
+void roi_add_bias(const image_roi_t *roi, double bias);
+
+void roi_multiply_gain(const image_roi_t *roi, double gain);
+
+void roi_negative(const image_roi_t *roi);
+
+void roi_quantize(const image_roi_t *roi, int n_tones);
+
+void roi_mirror_horizontally(const image_roi_t *roi);
+
+/**
+ * Swaps the contents of the rows of the region, since rows of its buffer cannot be swapped by pointer.
+ */
+void roi_mirror_vertically(const image_roi_t *roi);
+
+/**
+ * Replaces every channel of each pixel by its luminance, as rgb_to_luminance() computes it. The buffer keeps its
+ * channels, so this turns the region gray inside a color image.
+ */
+void roi_rgb_to_luminance(const image_roi_t *roi);
+
+/**
+ * Histogram of the luminance of the region, as compute_histogram().
+ * @param histogram receives HISTOGRAM_SIZE counts
+ */
+void roi_compute_histogram(const image_roi_t *roi, int *histogram);
+
+/**
+ * Cumulative histogram of the luminance of the region normalized to [0,255], as compute_norm_cum_histogram().
+ * @param hist_cum receives HISTOGRAM_SIZE entries
+ */
+void roi_compute_norm_cum_histogram(const image_roi_t *roi, int *hist_cum);
+
+/**
+ * Equalizes the region with its own cumulative histogram, see equalize_histogram().
+ */
+void roi_equalize_histogram(const image_roi_t *roi);
+
+/**
+ * Replaces every channel of each pixel of source by its luminance mapped so that the histogram of the region
+ * matches the one of target, see match_histogram().
+ */
+void roi_match_histogram(const image_roi_t *source, const image_roi_t *target);
+
+/**
+ * Convolves the luminance of the region with a FILTER_SIZE by FILTER_SIZE filter, as convolve() does, writing the
+ * result to every channel. Pixels whose neighbourhood leaves the region are left untouched, so only the region is
+ * read and written.
+ */
+void roi_convolve(const image_roi_t *roi, float **filter, boolean clamp);
+
+// The ops below change the size of the region, so they read one region and write another one of the same channels,
+// which must not overlap it but may lie in the same image. They return 0 and write nothing when the destination does
+// not have the size of the result.
+
+/**
+ * Zooms out of source into a destination of ceil(width / sx) by ceil(height / sy) pixels, see zoom_out().
+ */
+int roi_zoom_out(const image_roi_t *source, const image_roi_t *destination, int sx, int sy);
+
+/**
+ * Zooms in source into a destination of 2 * width - 1 by 2 * height - 1 pixels, see zoom_in().
+ */
+int roi_zoom_in(const image_roi_t *source, const image_roi_t *destination);
+
+/**
+ * Rotates source by 90 degrees clock-wise into a destination of height by width pixels.
+ */
+int roi_rotate_90_degrees_clock_wise(const image_roi_t *source, const image_roi_t *destination);
+
+#endif //IPP_IMAGE_ROI_H
@@ -0,0 +1,91 @@
+/**
+ * Declarations for accounting of library allocations.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifndef IPP_MEMORY_ACCOUNTING_H
+#define IPP_MEMORY_ACCOUNTING_H
+
+// Every block the library allocates, for itself or for the caller, comes from the functions below, which count live
+// and peak bytes for the whole process and allocations for each thread (trace spans report the latter per op).
+// Blocks handed to the caller are released with free_image(), free_histogram(), free_filter() or ipp_free(), never
+// with free(); the exception is the compressed data of jpeg_compress_buffer() and jpeg_compress_parallel_buffer(),
+// which comes from malloc() (jpeg_compress_buffer() grows it with realloc() while writing) and is released with
+// free(). Setting the IPP_LEAK_REPORT environment variable also keeps a list of the live blocks, with the function
+// that allocated each, which is printed to stderr at exit.
+
+#define ipp_malloc(size) accounted_malloc((size), __func__)
+#define ipp_calloc(count, size) accounted_calloc((count), (size), __func__)
+#define ipp_realloc(block, size) accounted_realloc((block), (size), __func__)
+#define ipp_aligned_alloc(alignment, size) accounted_aligned_alloc((alignment), (size), __func__)
+#define ipp_strdup(string) accounted_strdup((string), __func__)
+
+/**
+ * Allocation counters, see memory_stats() and thread_memory_stats().
+ */
+typedef struct memory_stats_struct {
+    size_t live_bytes;
+    size_t peak_bytes;                  // highest live_bytes since the start or reset_peak_bytes()
+    size_t live_blocks;
+    unsigned long long allocations;     // since the start, successful reallocations included
+    unsigned long long allocated_bytes;
+} memory_stats_t;
+
+/**
+ * Allocates a block as malloc() does.
+ * @param site name of the allocating function, as reported for blocks still live at exit; the ipp_* macros pass
+ * __func__
+ */
+void *accounted_malloc(size_t size, const char *site);
+
+void *accounted_calloc(size_t count, size_t size, const char *site);
+
+/**
+ * Resizes a block of accounted_malloc() or accounted_calloc() as realloc() does; NULL allocates a new one.
+ * Blocks of accounted_aligned_alloc() can not be resized.
+ */
+void *accounted_realloc(void *block, size_t size, const char *site);
+
+/**
+ * Allocates a block starting at a multiple of alignment, a power of two.
+ */
+void *accounted_aligned_alloc(size_t alignment, size_t size, const char *site);
+
+char *accounted_strdup(const char *string, const char *site);
+
+/**
+ * Releases a block of any of the functions above, doing nothing for NULL.
+ */
+void ipp_free(void *block);
+
+/**
+ * Size a block was allocated (or last resized) with.
+ */
+size_t ipp_block_size(const void *block);
+
+/**
+ * Counters of the whole process.
+ */
+memory_stats_t memory_stats();
+
+/**
+ * Counters of the blocks allocated by the calling thread: only allocations and allocated_bytes, as its blocks may be
+ * released by others.
+ */
+memory_stats_t thread_memory_stats();
+
+/**
+ * Starts measuring peak_bytes again from the current live_bytes.
+ */
+void reset_peak_bytes();
+
+/**
+ * Writes the blocks still live, grouped by the function that allocated them, largest first. Only available with
+ * IPP_LEAK_REPORT set, otherwise just the totals are written.
+ * @return Number of live blocks.
+ */
+size_t memory_report(FILE *file);
+
+#endif //IPP_MEMORY_ACCOUNTING_H
@@ -0,0 +1,72 @@
+/**
+ * Declarations for multi-threaded JPEG compression and decompression.
+ */
+
+#include <image_manipulation.h>
+
+#ifndef IPP_PARALLEL_JPEG_H
+#define IPP_PARALLEL_JPEG_H
+
+/**
+ * Number of threads used when 0 threads are requested: the number of online processors.
+ */
+int default_thread_count();
+
+/**
+ * Runs task on every item, using up to `threads` threads at a time (the calling thread included).
+ * @param task function called with a pointer to each item
+ * @param items array of n_items items of item_size bytes
+ */
+void run_in_waves(void *(*task)(void *), void *items, size_t item_size, int n_items, int threads);
+
+/**
+ * Compresses an image to a newly allocated memory buffer, encoding horizontal strips concurrently.
+ * Each strip spans whole MCU rows and becomes one restart interval, so the stitched output is a single
+ * standards-compliant baseline JPEG with restart markers between strips.
+ * Strips must share Huffman tables, so optimize_coding and progressive are ignored, as is restart_in_rows.
+ * Falls back to serial compression for images too small (or too wide) to split.
+ * @param image the image to compress; last_operation is set with the outcome.
+ * @param options encoder parameters, or NULL for the libjpeg defaults.
+ * @param threads maximum number of strips encoded at once, 0 for default_thread_count().
+ * @param buffer receives the compressed data, to be released with free(); NULL on failure.
+ * @return Number of bytes in buffer, 0 on failure.
+ */
+unsigned long jpeg_compress_parallel_buffer(image_t *image, const encode_options_t *options, int threads,
+                                            unsigned char **buffer);
+
+/**
+ * Compresses an image to a file, encoding horizontal strips concurrently, see jpeg_compress_parallel_buffer().
+ * @param image the image to compress; last_operation is set with the outcome.
+ * @param output_filename the name of the output file.
+ * @param options encoder parameters, or NULL for the libjpeg defaults.
+ * @param threads maximum number of strips encoded at once, 0 for default_thread_count().
+ */
+void jpeg_compress_parallel(image_t *image, char *output_filename, const encode_options_t *options, int threads);
+
+/**
+ * Decompresses a JPEG image held in memory, decoding runs of restart intervals concurrently.
+ * The entropy-coded data is scanned for RSTn markers; every thread gets a run of intervals that starts and ends on
+ * MCU row boundaries and decodes it straight into its own rows of the destination image. Runs also decode one
+ * neighbouring run above and below as context, so the output is identical to a serial decode.
+ * Falls back to serial decompression for images without restart markers, with intervals that never line up with
+ * MCU rows, with progressive or multi-scan data, or when only one thread is requested.
+ * @param buffer the compressed JPEG data.
+ * @param size the number of bytes in buffer.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @param threads maximum number of runs decoded at once, 0 for default_thread_count().
+ * @return Decompressed image (without filename), with last_operation set to the outcome.
+ */
+image_t *jpeg_decompress_parallel_buffer(const unsigned char *buffer, unsigned long size,
+                                         const decode_options_t *options, int threads);
+
+/**
+ * Decompresses a memory-mapped JPEG file, decoding runs of restart intervals concurrently,
+ * see jpeg_decompress_parallel_buffer().
+ * @param input_filename the name of the input file.
+ * @param options decoder parameters, or NULL for the libjpeg defaults.
+ * @param threads maximum number of runs decoded at once, 0 for default_thread_count().
+ * @return Decompressed image, with last_operation set to the outcome.
+ */
+image_t *jpeg_decompress_parallel(char *input_filename, const decode_options_t *options, int threads);
+
+#endif //IPP_PARALLEL_JPEG_H
@@ -0,0 +1,179 @@
+/**
+ * Declarations for operation-graph pipelines.
+ */
+
+#include <stddef.h>
+#include <image_manipulation.h>
+
+#ifndef IPP_PIPELINE_H
+#define IPP_PIPELINE_H
+
+#define PIPELINE_SOURCE 0
+#define PIPELINE_RING_ROWS 4
+#define PIPELINE_POOL_SIZE 8
+
+enum pipeline_op {
+    PIPELINE_OP_SOURCE,
+    PIPELINE_OP_LUT,                            // add_bias, multiply_gain, negative, quantize
+    PIPELINE_OP_LUMINANCE,
+    PIPELINE_OP_LUMINANCE_TO_RGB,
+    PIPELINE_OP_MIRROR_HORIZONTALLY,
+    PIPELINE_OP_MIRROR_VERTICALLY,
+    PIPELINE_OP_CONVOLVE,
+    PIPELINE_OP_HISTOGRAM,                      // of the luminance, as compute_histogram()
+    PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE,   // ops from here on need the whole input image
+    PIPELINE_OP_ZOOM_OUT,
+    PIPELINE_OP_ZOOM_IN,
+    PIPELINE_OP_EQUALIZE_HISTOGRAM
+};
+
+typedef struct pipeline_stats_struct {
+    int passes;             // images written in full: outputs, shared intermediates and inputs of whole-image ops
+    int streamed;           // ops computed a few rows at a time, without an image of their own
+    int fused;              // ops folded into a neighbour by the planner
+    int reused_buffers;     // pixel matrices taken from the pool instead of allocated
+} pipeline_stats_t;
+
+typedef struct pipeline_node_struct {
+    enum pipeline_op op;
+    int input;                                  // node the op reads, -1 for the source
+    unsigned char lut[256];
+    float rot_filter[FILTER_SIZE][FILTER_SIZE]; // filter rotated by 180 degrees
+    boolean clamp;
+    int sx;
+    int sy;
+
+    // planning
+    int consumers;                              // live nodes reading this one
+    int fused;                                  // folded into its consumer, not computed
+    int materialize;                            // output kept as a whole image rather than streamed
+
+    // execution
+    int width;
+    int height;
+    int channels;
+    J_COLOR_SPACE colorspace;
+    int pending;                                // consumers that did not finish reading the image yet
+    image_t *image;                             // whole output, if materialized
+    int *histogram;                             // output of PIPELINE_OP_HISTOGRAM
+    unsigned char *ring;                        // last PIPELINE_RING_ROWS output rows, if streamed
+    int ring_tags[PIPELINE_RING_ROWS];          // row held by each ring slot, -1 for none
+    unsigned char *scratch;                     // luminance rows of the input of a convolution or histogram
+    int scratch_tags[PIPELINE_RING_ROWS];
+} pipeline_node_t;
+
+typedef struct pipeline_buffer_struct {
+    unsigned char **pixels;
+    int height;
+    int row_bytes;
+} pipeline_buffer_t;
+
+/**
+ * Directed acyclic graph of image operations run as a whole. Before running, the planner folds chains of point
+ * operations into one lookup table and luminance into the histogram or convolution that reads it. Ops that only
+ * need a few neighbouring rows are then streamed through small ring buffers, which stay in cache, so only graph
+ * outputs, images read by several ops and inputs of whole-image ops (rotation, zoom, equalization) are written in
+ * full. Pixel matrices that are no longer needed are pooled for later passes of the same geometry.
+ */
+typedef struct pipeline_struct {
+    pipeline_node_t *nodes;                     // node 0 is the source, every node comes after its input
+    int node_count;
+    int node_capacity;
+    pipeline_buffer_t pool[PIPELINE_POOL_SIZE];
+    int pool_count;
+    pipeline_stats_t stats;
+    enum result last_operation;
+} pipeline_t;
+
+/**
+ * Initializes a pipeline holding only the PIPELINE_SOURCE node.
+ */
+pipeline_t *new_pipeline();
+
+/**
+ * Releases a pipeline and the outputs that were not taken from it.
+ */
+void free_pipeline(pipeline_t *pipeline);
+
+/**
+ * Adds an op to a pipeline. Every function takes the node whose output the op reads, which cannot be a histogram.
+ * Ops are added before the first run, which may fold some of them into others.
+ * @return Node of the op, to be passed to later additions or to pipeline_image() / pipeline_histogram().
+ */
+int pipeline_add_lut(pipeline_t *pipeline, int input, const unsigned char *lut);
+
+int pipeline_add_bias(pipeline_t *pipeline, int input, double bias);
+
+int pipeline_add_gain(pipeline_t *pipeline, int input, double gain);
+
+int pipeline_add_negative(pipeline_t *pipeline, int input);
+
+int pipeline_add_quantize(pipeline_t *pipeline, int input, int n_tones);
+
+int pipeline_add_luminance(pipeline_t *pipeline, int input);
+
+int pipeline_add_luminance_to_rgb(pipeline_t *pipeline, int input);
+
+int pipeline_add_mirror_horizontally(pipeline_t *pipeline, int input);
+
+int pipeline_add_mirror_vertically(pipeline_t *pipeline, int input);
+
+int pipeline_add_convolve(pipeline_t *pipeline, int input, float **filter, boolean clamp);
+
+int pipeline_add_histogram(pipeline_t *pipeline, int input);
+
+int pipeline_add_rotate_90_degrees_clock_wise(pipeline_t *pipeline, int input);
+
+int pipeline_add_zoom_out(pipeline_t *pipeline, int input, int sx, int sy);
+
+int pipeline_add_zoom_in(pipeline_t *pipeline, int input);
+
+int pipeline_add_equalize_histogram(pipeline_t *pipeline, int input);
+
+/**
+ * Builds a chain of ops from a comma separated list such as "bias:30,luminance,convolve:sobel-hx:clamp".
+ * Ops: bias:<v>, gain:<v>, negative, quantize:<tones>, luminance, rgb, mirror-h, mirror-v, rotate,
+ * zoom-out:<sx>x<sy>, zoom-in, equalize, convolve:<gaussian|laplacian|high-pass|prewitt-hx|prewitt-hy|sobel-hx|
+ * sobel-hy>[:clamp] and histogram.
+ * @return The pipeline, whose last node is the output, or NULL if the list could not be parsed.
+ */
+pipeline_t *parse_pipeline(const char *spec);
+
+/**
+ * Node added last, the output of a chain built by parse_pipeline().
+ */
+int pipeline_output(pipeline_t *pipeline);
+
+/**
+ * Whether every path from the source only ever uses its luminance, so a JPEG source can be decoded with
+ * luminance_decode_options().
+ */
+int pipeline_luminance_only(pipeline_t *pipeline);
+
+/**
+ * Runs every op of a pipeline on a source image, which is left untouched. Outputs of a previous run are released.
+ * Sets last_operation to WRITE_SUCCESS, or to WRITE_FAILURE when the source has no pixels or an op could not be
+ * computed (its pixels could not be allocated, or a whole-image op was given an empty image), in which case the run
+ * leaves no outputs.
+ */
+void pipeline_run(pipeline_t *pipeline, image_t *source);
+
+/**
+ * Loads a file with load_image() and runs the pipeline. JPEGs are decoded with the codec context of the calling
+ * thread, only their luminance when the pipeline allows it.
+ */
+void pipeline_run_file(pipeline_t *pipeline, char *input_filename);
+
+/**
+ * Takes an image computed by the last run from a node without consumers.
+ * @return The image, owned by the caller and released with free_image(), or NULL if the node has no image output.
+ */
+image_t *pipeline_image(pipeline_t *pipeline, int node);
+
+/**
+ * Takes a histogram computed by the last run from a PIPELINE_OP_HISTOGRAM node.
+ * @return HISTOGRAM_SIZE entries owned by the caller and released with free_histogram(), or NULL.
+ */
+int *pipeline_histogram(pipeline_t *pipeline, int node);
+
+#endif //IPP_PIPELINE_H
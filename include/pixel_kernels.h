@@ -0,0 +1,174 @@
+/**
+ * Declarations for the row kernels shared by the image operations.
+ */
+
+#include <stddef.h>
+
+#ifndef IPP_PIXEL_KERNELS_H
+#define IPP_PIXEL_KERNELS_H
+
+// Each kernel works on a run of count pixels of interleaved channels and dispatches on the channel count once per
+// call: 1 (grayscale), 3 (RGB) and 4 (RGBA) get loops compiled for that exact count, so their channel loops unroll
+// and the pixel loops vectorize, while any other count falls back to a generic loop.
+//
+// Every kernel is also compiled once per cpu_level, and calls go to the variants of the level selected on first
+// use: the best one the processor supports, unless the IPP_CPU_LEVEL environment variable names a lower one. All
+// levels produce the same output.
+
+/**
+ * Instruction sets the kernels are compiled for, in increasing order.
+ */
+enum cpu_level {
+    CPU_LEVEL_GENERIC,      // baseline of the target, SSE2 on x86-64
+    CPU_LEVEL_SSE4_2,
+    CPU_LEVEL_AVX2,
+    CPU_LEVEL_AVX512        // AVX-512 F, BW and VL
+};
+
+/**
+ * Best level the processor supports.
+ */
+enum cpu_level supported_cpu_level();
+
+/**
+ * Level the kernels run at, selected on the first call.
+ */
+enum cpu_level active_cpu_level();
+
+/**
+ * Switches every kernel to another level, e.g. to compare levels in a benchmark.
+ * @return Zero, leaving the level unchanged, if the processor does not support it.
+ */
+int set_cpu_level(enum cpu_level level);
+
+const char *cpu_level_name(enum cpu_level level);
+
+/**
+ * Reads a level name as cpu_level_name() writes it, ignoring case.
+ * @return Zero if the name is unknown.
+ */
+int parse_cpu_level(const char *name, enum cpu_level *level);
+
+/**
+ * Converts pixels between channel counts: to 1 channel by taking the luminance of the first three channels as
+ * rgb_to_luminance() computes it, from 1 channel by replicating it, and between 3 and 4 by adding an opaque alpha
+ * or dropping it. Same channel counts are copied.
+ */
+void convert_pixels(const unsigned char *in, int in_channels, unsigned char *out, int out_channels, int count);
+
+/**
+ * Reverses the order of the pixels of a row in place.
+ */
+void mirror_pixels(unsigned char *row, int count, int channels);
+
+/**
+ * Writes the pixels of in to out in reverse order.
+ */
+void reverse_pixels(const unsigned char *in, unsigned char *out, int count, int channels);
+
+/**
+ * Adds every component of a row to the sum of its channel in the window of sx pixels it falls in.
+ * @param sums ceil(count / sx) * channels sums
+ */
+void accumulate_windows(const unsigned char *row, int count, int channels, int sx, int *sums);
+
+/**
+ * Writes the mean of each window accumulated by accumulate_windows() over rows rows, as zoom_out() takes it.
+ */
+void average_windows(const int *sums, unsigned char *out, int count, int channels, int sx, int rows);
+
+/**
+ * Writes the 2 * count - 1 pixels of a zoomed in row: the pixels of in on even positions and the mean of their
+ * neighbours on odd ones.
+ */
+void zoom_in_pixels(const unsigned char *in, unsigned char *out, int count, int channels);
+
+/**
+ * Replaces each pixel on an odd position by the mean of its two neighbours.
+ */
+void interpolate_odd_pixels(unsigned char *row, int count, int channels);
+
+/**
+ * Mean of two rows of components.
+ */
+void average_rows(const unsigned char *a, const unsigned char *b, unsigned char *out, int components);
+
+/**
+ * Writes the pixels of a row down a column: pixel x goes to column + x * stride.
+ */
+void scatter_pixels(const unsigned char *row, int count, int channels, unsigned char *column, ptrdiff_t stride);
+
+/**
+ * Replaces each of components values by lut[value], see apply_lut(). in and out may be the same.
+ */
+void map_components(const unsigned char *in, unsigned char *out, int components, const unsigned char *lut);
+
+/**
+ * Replaces component c of every pixel by luts[c * 256 + value], each channel through its own table. in and out may
+ * be the same.
+ */
+void map_channels(const unsigned char *in, unsigned char *out, int count, int channels, const unsigned char *luts);
+
+/**
+ * Maps the Y of YCbCr of every pixel through lut keeping Cb and Cr, which adds lut[Y] - Y to each of the first three
+ * channels (saturated), Y being the luminance of convert_pixels(). Pixels of fewer than 3 channels map their first
+ * channel through lut. Any fourth channel is kept. in and out may be the same.
+ */
+void map_luma(const unsigned char *in, unsigned char *out, int count, int channels, const unsigned char *lut);
+
+/**
+ * Adds the values of components components to a histogram of HISTOGRAM_SIZE counts.
+ */
+void count_components(const unsigned char *in, int components, int *histogram);
+
+/**
+ * Blends two arrays of table entries, weighting the second by weight / 256: out[i] = a[i] * (256 - weight) +
+ * b[i] * weight, so entries keep 8 bits of fraction.
+ */
+void blend_tables(const unsigned char *a, const unsigned char *b, int weight, unsigned short *out, int count);
+
+/**
+ * Maps every component of each pixel through two tables of 256 blend_tables() entries, interpolated by the weight
+ * of the pixel, as adaptive equalization does: out = (left[value] * (256 - weight) + right[value] * weight) / 65536,
+ * rounded. in and out may be the same.
+ * @param left, right offsets in tables of the two tables of each pixel
+ * @param weights weight of the right table of each pixel, out of 256
+ */
+void map_blended(const unsigned char *in, unsigned char *out, int count, int channels, const unsigned short *tables,
+                 const int *left, const int *right, const unsigned short *weights);
+
+/**
+ * Convolves single channel rows with a FILTER_SIZE by FILTER_SIZE filter as convolve() does, writing out[x] for x
+ * from first to last - 1.
+ * @param rows FILTER_SIZE rows centered on the output row, readable from first - FILTER_SIZE / 2 to
+ * last - 1 + FILTER_SIZE / 2
+ * @param rot_filter the filter rotated by 180 degrees, row after row
+ * @param clamp non-zero to offset the result by 127 before saturating it
+ */
+void convolve_row(const unsigned char *const *rows, unsigned char *out, int first, int last, const float *rot_filter,
+                  int clamp);
+
+/**
+ * Gradient of a single channel row by the Sobel (center_weight 2) or Prewitt (center_weight 1) operator: gx[x] is
+ * the right neighbours of x less the left ones and gy[x] the ones below less the ones above, the middle neighbour of
+ * each side weighted by center_weight.
+ * @param rows the rows above, at and below the one of the gradient, readable from -1 to count
+ */
+void gradient_row(const unsigned char *const *rows, int count, int center_weight, short *gx, short *gy);
+
+/**
+ * Magnitude of gradients, |gx| + |gy| (l2 zero) or the rounded square root of gx^2 + gy^2, shifted right by shift and
+ * saturated at 255.
+ */
+void gradient_magnitude(const short *gx, const short *gy, int count, int l2, int shift, unsigned char *out);
+
+/**
+ * Direction of gradients turned into half a turn, quantized into bins: the number of boundaries it lies past, bins
+ * meaning 0 again. Zero gradients are in bin 0.
+ * @param boundaries bins pairs of the cosine and sine of each boundary angle, from 0 to half a turn, scaled so that
+ * their products with gradient components fit in an int
+ */
+void gradient_orientation(const short *gx, const short *gy, int count, int bins, const int *boundaries,
+                          unsigned char *out);
+
+#endif //IPP_PIXEL_KERNELS_H
@@ -0,0 +1,77 @@
+/**
+ * Declarations for the reference implementations of the image operations.
+ */
+
+#include <image_manipulation.h>
+#include <adaptive_equalization.h>
+#include <gradient.h>
+
+#ifndef IPP_REFERENCE_OPS_H
+#define IPP_REFERENCE_OPS_H
+
+// The scalar implementations the library started from, one component at a time, kept as the ground truth that the
+// optimized paths (row kernels at every CPU level, regions of interest, tiled images and pipelines) are checked
+// against by the differential harness. They must keep producing the same output and are not to be optimized; fixes
+// are limited to releasing the temporaries they used to leak, to reading pixels of any channel count, to dropping
+// the cached histograms (see image_histograms()) of the images they write and to rounding normalized cumulative
+// histograms up in integers, as floating point took some of them to 256.
+// Ops the library gained later have references written the same way, straight from their definition.
+
+void reference_mirror_horizontally(image_t *image);
+
+void reference_mirror_vertically(image_t *image);
+
+void reference_rgb_to_luminance(image_t *image);
+
+void reference_luminance_to_rgb(image_t *image);
+
+void reference_quantize(image_t *image, int n_tones);
+
+void reference_add_bias(image_t *image, double bias);
+
+void reference_multiply_gain(image_t *image, double gain);
+
+void reference_negative(image_t *image);
+
+int *reference_compute_histogram(image_t *image);
+
+int *reference_compute_norm_cum_histogram(image_t *image);
+
+int *reference_compute_histogram_matching(const int *hist_cum_source, const int *hist_cum_target);
+
+void reference_equalize_histogram(image_t *image);
+
+void reference_match_histogram(image_t *source, image_t *target);
+
+void reference_equalize_histogram_with_mode(image_t *image, enum histogram_mode mode);
+
+void reference_match_histogram_with_mode(image_t *source, image_t *target, enum histogram_mode mode);
+
+/**
+ * Adaptive equalization with its tables interpolated in double precision, which equalize_histogram_adaptive()
+ * does with weights in 1/256 steps, so the two may differ by one level.
+ */
+void reference_equalize_histogram_adaptive(image_t *image, const clahe_options_t *options);
+
+// Radians from a boundary of orientation bins within which compute_gradient() may put a direction on either side,
+// its boundaries having 14 bits of precision (see gradient.h)
+#define REFERENCE_ORIENTATION_TOLERANCE 1e-4
+
+/**
+ * Gradient of the luminance computed pixel by pixel, with the orientation of each from atan2().
+ * @param orientation receives the orientation bins, NULL to skip them
+ * @param alternative receives, for directions within REFERENCE_ORIENTATION_TOLERANCE of a bin boundary, the bin on
+ * the other side of it, and the bin of orientation elsewhere; NULL to skip it
+ */
+void reference_compute_gradient(image_t *image, const gradient_options_t *options, image_t *orientation,
+                                image_t *alternative);
+
+void reference_zoom_out(image_t *image, int sx, int sy);
+
+void reference_zoom_in(image_t *image);
+
+void reference_rotate_90_degrees_clock_wise(image_t *image);
+
+void reference_convolve(image_t *image, float **filter, boolean clamp);
+
+#endif //IPP_REFERENCE_OPS_H
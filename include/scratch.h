@@ -0,0 +1,85 @@
+/**
+ * Declarations for per-thread scratch memory and reuse of pixel buffers.
+ */
+
+#include <stddef.h>
+
+#ifndef IPP_SCRATCH_H
+#define IPP_SCRATCH_H
+
+#define SCRATCH_ALIGNMENT 64
+#define SCRATCH_MIN_CHUNK (64 * 1024)
+#define PIXEL_POOL_BUFFERS 4
+#define PIXEL_POOL_MAX_BYTES ((size_t) 256 << 20)
+#define HEADER_POOL_BLOCKS 16
+
+// Temporaries that only live during an op (row buffers, sums, bookkeeping arrays) come from a bump arena of the
+// calling thread: an op takes a mark, allocates, and releases back to its mark before returning, so that nested ops
+// stack their temporaries. Chunks the arena outgrows are kept for the next op, so once every op has run the arena
+// stops allocating. Pixel buffers released by free_pixels() are likewise kept, a few per thread, and handed out again
+// for a matrix of about the same size, which is what batches of same-sized images ask for, and so are the small
+// headers (image_t) that come and go with them. All of it is released when its thread exits, at exit for the main
+// thread, or with scratch_trim().
+//
+// Once these are warm, image ops allocate nothing. libjpeg does not take part: it allocates its pools with malloc()
+// for every image, 7 calls per decode and 8 per encode through a codec context (codec_context.h), against 10 and 11
+// when jpeg_decompress_buffer() and jpeg_compress_buffer() create their own objects. ipp_bench counts them as mallocs.
+
+/**
+ * Position of the calling thread's arena, to release the scratch allocated after it.
+ */
+typedef struct scratch_mark_struct {
+    void *chunk;
+    size_t used;
+} scratch_mark_t;
+
+scratch_mark_t scratch_mark();
+
+/**
+ * Allocates scratch from the calling thread's arena, starting at a SCRATCH_ALIGNMENT boundary. Valid until the
+ * thread releases a mark taken before it.
+ * @return The scratch, NULL if it could not be allocated.
+ */
+void *scratch_alloc(size_t size);
+
+/**
+ * Releases all scratch of the calling thread allocated after a mark (marks are released in reverse order).
+ */
+void scratch_release(scratch_mark_t mark);
+
+/**
+ * Block for a pixel matrix: a pooled one of at least size bytes (and not much more), or a new one.
+ * @return Block starting at a SCRATCH_ALIGNMENT boundary, released with release_pooled_pixels().
+ */
+void *pooled_pixels(size_t size);
+
+/**
+ * Keeps a block of pooled_pixels() in the calling thread's pool, releasing the least recently pooled ones beyond
+ * PIXEL_POOL_BUFFERS or PIXEL_POOL_MAX_BYTES. Does nothing for NULL.
+ */
+void release_pooled_pixels(void *block);
+
+/**
+ * Zeroed block for a header of size bytes, e.g. an image_t: a pooled one of that exact size, or a new one.
+ * @return The block, NULL if it could not be allocated; released with release_pooled_header().
+ */
+void *pooled_header(size_t size);
+
+/**
+ * Keeps a block of pooled_header() in the calling thread's pool, or releases it when the pool already holds
+ * HEADER_POOL_BLOCKS of them. Does nothing for NULL.
+ */
+void release_pooled_header(void *header);
+
+/**
+ * Releases the arena and pooled buffers of the calling thread, e.g. after a batch. Must not be called while an op
+ * of the thread holds scratch.
+ */
+void scratch_trim();
+
+/**
+ * Bytes held by the arenas and pools of every thread, which stay allocated between ops on purpose.
+ */
+size_t scratch_retained_bytes();
+
+#endif //IPP_SCRATCH_H
@@ -0,0 +1,215 @@
+/**
+ * Declarations for the out-of-core tiled image store.
+ */
+
+#include <stddef.h>
+#include <image_manipulation.h>
+
+#ifndef IPP_TILED_IMAGE_H
+#define IPP_TILED_IMAGE_H
+
+#define DEFAULT_TILE_SIZE 256
+#define MIN_RESIDENT_TILES 4
+
+typedef struct tiled_image_stats_struct {
+    unsigned long hits;         // tile already resident
+    unsigned long loads;        // tile read back from the backing file
+    unsigned long writebacks;   // dirty tile written to the backing file
+    unsigned long evictions;    // resident tile dropped to make room for another
+    unsigned long prefetches;   // read-ahead requests for tiles not resident
+} tiled_image_stats_t;
+
+/**
+ * Resident copy of one tile. Rows are tile_size pixels long even for tiles on the right and bottom edges.
+ */
+typedef struct tile_struct {
+    int tile_x;                         // column of the tile, -1 for an empty slot
+    int tile_y;                         // row of the tile
+    unsigned char *pixels;              // tile_size rows of tile_size * channels components
+    int dirty;                          // differs from the backing file
+    int pins;                           // acquisitions not released yet, a pinned tile is never evicted
+    struct tile_struct *lru_prev;       // towards most recently used
+    struct tile_struct *lru_next;       // towards least recently used
+} tile_t;
+
+// Tiled images are not a backing of image_t. Ops on an image_t index image->pixels[y] anywhere in the image and keep
+// those rows for as long as they run, while a tiled image only holds cache_bytes of tiles at once and moves any of
+// them out of memory when another is acquired: no row pointer stays valid past the next acquisition. An image_t whose
+// rows were paged in behind its back would have to pin every tile an op might touch, the whole image for most of
+// them, which is what the tiled store exists to avoid. Ops on tiled images are therefore written over tiles, in the
+// tiled_ family below, sharing their kernels (pixel_kernels.h) and lookup tables with the in-memory ops so that both
+// give the same pixels.
+//
+// A tile that can not be made resident (every slot pinned, or the backing file failing to read or write) makes
+// acquire_tile() return NULL. Ops then stop and report it through last_operation: READ_FAILURE on the image they
+// return, or on the image itself for the point operations, which leave it partly modified.
+
+/**
+ * Image whose pixels live in fixed-size square tiles of an unlinked temporary file, of which only a bounded number
+ * is resident at a time, evicted least recently used first. Lets point operations, convolution and rotation run
+ * on images bigger than memory. Not thread safe.
+ */
+typedef struct tiled_image_struct {
+    int width;
+    int height;
+    int channels;
+    J_COLOR_SPACE colorspace;
+    int tile_size;
+    int tiles_x;
+    int tiles_y;
+    size_t tile_bytes;
+    size_t cache_bytes;
+    char *directory;                    // of the backing file, NULL for the default one
+    int fd;                             // backing file, unlinked
+    char *stored;                       // whether each tile was ever written to the backing file
+    tile_t *slots;
+    int slot_count;
+    unsigned char *slot_pixels;         // slot_count * tile_bytes
+    int *resident;                      // slot of each tile, -1 when not resident
+    tile_t *most_recent;
+    tile_t *least_recent;
+    tiled_image_stats_t stats;
+    enum result last_operation;
+} tiled_image_t;
+
+/**
+ * Walks the tiles of an image in row-major order, keeping the current one acquired and prefetching the next.
+ */
+typedef struct tile_iterator_struct {
+    tiled_image_t *image;
+    tile_t *tile;           // current tile, NULL before the first and after the last
+    int index;              // row-major index of the current tile
+    int writable;           // tiles are released dirty
+    int x;                  // image coordinates of the first pixel of the current tile
+    int y;
+    int width;              // pixels of the current tile inside the image
+    int height;
+} tile_iterator_t;
+
+/**
+ * Initializes a tiled image whose pixels are all zero.
+ * @param tile_size side of the square tiles in pixels, 0 for DEFAULT_TILE_SIZE
+ * @param cache_bytes bytes of resident tiles, never less than MIN_RESIDENT_TILES tiles
+ * @param directory where the backing file is created, NULL for $TMPDIR or /tmp
+ * @return Pointer to the tiled image, with last_operation set to WRITE_SUCCESS, to FOPEN_FAILURE if no backing file
+ * could be created or to WRITE_FAILURE if its resident tiles could not be allocated.
+ */
+tiled_image_t *new_tiled_image(int width, int height, int channels, J_COLOR_SPACE colorspace, int tile_size,
+                               size_t cache_bytes, const char *directory);
+
+/**
+ * Releases the resident tiles and the backing file.
+ */
+void free_tiled_image(tiled_image_t *image);
+
+/**
+ * Makes a tile resident and pins it until released, possibly evicting the least recently used unpinned tile.
+ * @return The tile, or NULL with last_operation set to READ_FAILURE if every slot is pinned, the tile could not be
+ * read back or the tile it replaces could not be written back.
+ */
+tile_t *acquire_tile(tiled_image_t *image, int tile_x, int tile_y);
+
+/**
+ * Unpins a tile returned by acquire_tile().
+ * @param dirty non-zero if the tile pixels were modified
+ */
+void release_tile(tile_t *tile, int dirty);
+
+/**
+ * Asks the system to start reading the tiles overlapping a rectangle, unless they are already resident.
+ */
+void prefetch_region(tiled_image_t *image, int x, int y, int width, int height);
+
+/**
+ * Writes every dirty resident tile to the backing file.
+ */
+void flush_tiles(tiled_image_t *image);
+
+/**
+ * Pointer to the first component of row y (in tile coordinates) of a tile.
+ */
+unsigned char *tile_row(tiled_image_t *image, tile_t *tile, int y);
+
+/**
+ * Positions an iterator before the first tile; tile_iterator_next() acquires it.
+ * @param writable non-zero if the tiles will be modified
+ */
+tile_iterator_t tile_iterator_begin(tiled_image_t *image, int writable);
+
+/**
+ * Releases the current tile and acquires the next one in row-major order, prefetching the one after.
+ * @return Non-zero while there is a current tile, zero after the last one or if the next could not be acquired.
+ */
+int tile_iterator_next(tile_iterator_t *iterator);
+
+/**
+ * Whether an iterator went past the last tile, rather than stopping at one it could not acquire.
+ */
+int tile_iterator_complete(const tile_iterator_t *iterator);
+
+/**
+ * Copies an in-memory image into a new tiled image.
+ * @param tile_size, cache_bytes, directory see new_tiled_image()
+ */
+tiled_image_t *tiled_from_image(image_t *image, int tile_size, size_t cache_bytes, const char *directory);
+
+/**
+ * Copies a tiled image into memory, which must be able to hold it.
+ * @return The image, without pixels and with last_operation set to READ_FAILURE if a tile could not be read.
+ */
+image_t *tiled_to_image(tiled_image_t *tiled);
+
+/**
+ * Decompresses a JPEG file into a tiled image, holding at most one band of tile_size scanlines in memory.
+ * @param options decoder parameters, NULL keeps the libjpeg defaults
+ * @param tile_size, cache_bytes, directory see new_tiled_image()
+ * @return Pointer to the tiled image, with last_operation set to the outcome.
+ */
+tiled_image_t *tiled_jpeg_decompress(char *input_filename, const decode_options_t *options, int tile_size,
+                                     size_t cache_bytes, const char *directory);
+
+/**
+ * Compresses a tiled image into a JPEG file, holding at most one band of tile_size scanlines in memory.
+ * Sets last_operation to the outcome.
+ * @param options encoder parameters, NULL keeps the libjpeg defaults
+ */
+void tiled_jpeg_compress(tiled_image_t *image, char *output_filename, const encode_options_t *options);
+
+/**
+ * Point operation replacing every pixel component value by lut[value], see apply_lut().
+ */
+void tiled_apply_lut(tiled_image_t *image, const unsigned char *lut);
+
+void tiled_add_bias(tiled_image_t *image, double bias);
+
+void tiled_multiply_gain(tiled_image_t *image, double gain);
+
+void tiled_negative(tiled_image_t *image);
+
+void tiled_quantize(tiled_image_t *image, int n_tones);
+
+/**
+ * Luminance of a tiled image, as rgb_to_luminance() computes it.
+ * @return New tiled image with the tile size, cache budget and backing directory of image.
+ */
+tiled_image_t *tiled_rgb_to_luminance(tiled_image_t *image);
+
+/**
+ * Rotates every pixel by 90 degrees clock-wise, as rotate_90_degrees_clock_wise() does.
+ * @return New tiled image with the tile size, cache budget and backing directory of image.
+ */
+tiled_image_t *tiled_rotate_90_degrees_clock_wise(tiled_image_t *image);
+
+/**
+ * Mirrors every row, as mirror_horizontally() does in place.
+ * @return New tiled image with the tile size, cache budget and backing directory of image.
+ */
+tiled_image_t *tiled_mirror_horizontally(tiled_image_t *image);
+
+/**
+ * Convolves the luminance of an image with a FILTER_SIZE by FILTER_SIZE filter, as convolve() does.
+ * @return New single channel tiled image with the tile size, cache budget and backing directory of image.
+ */
+tiled_image_t *tiled_convolve(tiled_image_t *image, float **filter, boolean clamp);
+
+#endif //IPP_TILED_IMAGE_H
@@ -0,0 +1,76 @@
+/**
+ * Declarations for tracing of library operations.
+ */
+
+#include <stddef.h>
+
+#ifndef IPP_TRACE_H
+#define IPP_TRACE_H
+
+#define TRACE_MAX_EVENTS_PER_THREAD (1 << 20)
+
+// Library functions and I/O phases are wrapped in spans, recorded per thread into buffers that are only locked when
+// a thread starts tracing, so that concurrent threads (e.g. parallel decoding) do not contend. While tracing is off,
+// which is the default, a span costs one check of a flag. Setting the IPP_TRACE environment variable to a file name
+// turns tracing on from the start and writes the trace to that file when the process exits.
+
+/**
+ * Span being timed, returned by trace_begin() and closed by trace_end().
+ */
+typedef struct trace_span_struct {
+    const char *category;
+    const char *name;
+    unsigned long long start;   // nanoseconds, 0 if tracing was off when the span began
+    int depth;                  // spans of the same thread open around this one
+    unsigned long long allocations;         // of the thread when the span began, see thread_memory_stats()
+    unsigned long long allocated_bytes;
+} trace_span_t;
+
+/**
+ * Turns tracing on or off. Spans already begun are still recorded when they end.
+ */
+void trace_enable(int enabled);
+
+int trace_enabled();
+
+/**
+ * Begins a span.
+ * @param category kind of work, such as "op", "io" or "copy"; must outlive the trace, as a string literal does
+ * @param name usually the library function; must outlive the trace too
+ */
+trace_span_t trace_begin(const char *category, const char *name);
+
+/**
+ * Ends a span and records it, with the number of bytes of pixels or data it processed (0 if not meaningful) and the
+ * library allocations its thread made meanwhile. Spans
+ * begun inside it and never ended, such as those left by a libjpeg error jumping out, are discarded.
+ */
+void trace_end(trace_span_t *span, size_t bytes);
+
+/**
+ * Monotonic clock of the spans, in nanoseconds, to mark where an action starts for trace_summary().
+ */
+unsigned long long trace_now();
+
+/**
+ * Writes a one line summary of the spans that began at or after since: the total time of the outermost spans of
+ * the calling thread and the functions that took the longest over every thread, e.g.
+ * "12.40 ms: equalize_histogram 12.40 ms, compute_histogram 3.10 ms".
+ * Should be called while no traced work runs.
+ * @return Number of spans summarized, 0 (and an empty summary) if there are none.
+ */
+int trace_summary(unsigned long long since, char *summary, size_t size);
+
+/**
+ * Writes every recorded span as Chrome trace event JSON, as read by chrome://tracing and Perfetto. Should be called
+ * while no traced work runs.
+ * @return Zero if the file could not be written.
+ */
+int trace_write_chrome(const char *filename);
+
+/**
+ * Discards every recorded span. Should be called while no traced work runs.
+ */
+void trace_clear();
+
+#endif //IPP_TRACE_H
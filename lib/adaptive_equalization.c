@@ -0,0 +1,235 @@
+/**
+ * Definitions for contrast limited adaptive histogram equalization (CLAHE).
+ */
+
+#include <adaptive_equalization.h>
+#include <parallel_jpeg.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+#include <scratch.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Tiles of an image and their tables, shared by every band.
+ */
+struct clahe_grid {
+    image_t *image;
+    const clahe_options_t *options;
+    int tiles_x;
+    int tiles_y;
+    unsigned char *tables;      // HISTOGRAM_SIZE tones per tile, tile rows one after the other
+    const int *left;            // offset in a row of tables of the left and right tables of each column
+    const int *right;
+    const unsigned short *weights;  // of the right table of each column, out of 256
+};
+
+struct clahe_band {
+    struct clahe_grid *grid;
+    int first;                  // tile rows when building tables, pixel rows when mapping
+    int last;
+    unsigned char *luminance;   // one row, for images in colour
+    int *histograms;            // one per tile of a tile row
+    unsigned short *blended;    // tables of the two tile rows around a pixel row, blended for it
+};
+
+/**
+ * Counts the histograms of a band of tile rows, clips them and turns them into tables.
+ * @param arg pointer to struct clahe_band
+ */
+void *build_tile_tables(void *arg);
+
+/**
+ * Maps a band of pixel rows through the tables of the tiles around each pixel.
+ * @param arg pointer to struct clahe_band
+ */
+void *map_band(void *arg);
+
+/**
+ * Finds the two tiles whose centers surround a position along one axis.
+ * @param size pixels along the axis, tile_size per tile but the last one
+ * @param tile receives the tile before the position, or the only one at the borders
+ * @param weight receives the weight of the tile after it, out of 256, 0 at the borders
+ */
+void surrounding_tiles(int position, int size, int tile_size, int tiles, int *tile, int *weight);
+
+clahe_options_t default_clahe_options() {
+    clahe_options_t options;
+    options.tile_width = 128;
+    options.tile_height = 128;
+    options.clip_limit = 3;
+    options.threads = 0;
+    return options;
+}
+
+void clip_histogram(int *histogram, int limit) {
+    int excess = 0;
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+        if (histogram[tone] > limit) {
+            excess += histogram[tone] - limit;
+            histogram[tone] = limit;
+        }
+    }
+
+    // every tone gets an even share, and what does not divide evenly goes to tones spread over the range
+    int share = excess / HISTOGRAM_SIZE, remainder = excess % HISTOGRAM_SIZE;
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+        histogram[tone] += share;
+    }
+    if (remainder > 0) {
+        int step = HISTOGRAM_SIZE / remainder;
+        for (int tone = 0; remainder > 0; tone += step, --remainder) {
+            ++histogram[tone];
+        }
+    }
+}
+
+void surrounding_tiles(int position, int size, int tile_size, int tiles, int *tile, int *weight) {
+    // tile t covers [t * tile_size, min((t + 1) * tile_size, size)), centered halfway
+    int t = position / tile_size;
+    double center = (t * tile_size + min_int((t + 1) * tile_size, size) - 1) / 2.0;
+    if (position < center) --t;
+
+    if (t < 0 || t >= tiles - 1) {
+        *tile = t < 0 ? 0 : tiles - 1;
+        *weight = 0;
+        return;
+    }
+
+    double before = (t * tile_size + (t + 1) * tile_size - 1) / 2.0;
+    double after = ((t + 1) * tile_size + min_int((t + 2) * tile_size, size) - 1) / 2.0;
+    *tile = t;
+    *weight = (int) ((position - before) / (after - before) * 256 + 0.5);
+}
+
+void *build_tile_tables(void *arg) {
+    struct clahe_band *band = arg;
+    struct clahe_grid *grid = band->grid;
+    image_t *image = grid->image;
+    int tile_width = grid->options->tile_width, tile_height = grid->options->tile_height;
+    trace_span_t span = trace_begin("op", "build_tile_tables");
+
+    for (int tile_y = band->first; tile_y < band->last; ++tile_y) {
+        int first_row = tile_y * tile_height, last_row = min_int(first_row + tile_height, image->height);
+        memset(band->histograms, 0, (size_t) grid->tiles_x * HISTOGRAM_SIZE * sizeof(int));
+
+        // each row is converted once and split between the tiles it crosses
+        for (int row = first_row; row < last_row; ++row) {
+            const unsigned char *luminance = image->pixels[row];
+            if (image->channels != 1) {
+                convert_pixels(image->pixels[row], image->channels, band->luminance, 1, image->width);
+                luminance = band->luminance;
+            }
+            for (int tile_x = 0; tile_x < grid->tiles_x; ++tile_x) {
+                int first_col = tile_x * tile_width;
+                count_components(luminance + first_col, min_int(tile_width, image->width - first_col),
+                                 band->histograms + tile_x * HISTOGRAM_SIZE);
+            }
+        }
+
+        for (int tile_x = 0; tile_x < grid->tiles_x; ++tile_x) {
+            int *histogram = band->histograms + tile_x * HISTOGRAM_SIZE;
+            int pixels = (last_row - first_row) * min_int(tile_width, image->width - tile_x * tile_width);
+            if (grid->options->clip_limit > 0) {
+                int limit = (int) (grid->options->clip_limit * pixels / HISTOGRAM_SIZE);
+                clip_histogram(histogram, limit > 0 ? limit : 1);
+            }
+
+            int hist_cum[HISTOGRAM_SIZE];
+            norm_cum_histogram(histogram, hist_cum);
+            unsigned char *table = grid->tables + ((size_t) tile_y * grid->tiles_x + tile_x) * HISTOGRAM_SIZE;
+            for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+                table[tone] = (unsigned char) hist_cum[tone];
+            }
+        }
+    }
+
+    int rows = min_int(band->last * tile_height, image->height) - band->first * tile_height;
+    trace_end(&span, (size_t) rows * image->width * image->channels);
+    return NULL;
+}
+
+void *map_band(void *arg) {
+    struct clahe_band *band = arg;
+    struct clahe_grid *grid = band->grid;
+    image_t *image = grid->image;
+    size_t tile_row_size = (size_t) grid->tiles_x * HISTOGRAM_SIZE;
+    trace_span_t span = trace_begin("op", "map_band");
+
+    for (int row = band->first; row < band->last; ++row) {
+        int tile_y, weight;
+        surrounding_tiles(row, image->height, grid->options->tile_height, grid->tiles_y, &tile_y, &weight);
+        const unsigned char *above = grid->tables + tile_y * tile_row_size;
+        blend_tables(above, weight ? above + tile_row_size : above, weight, band->blended, (int) tile_row_size);
+        map_blended(image->pixels[row], image->pixels[row], image->width, image->channels, band->blended,
+                    grid->left, grid->right, grid->weights);
+    }
+
+    trace_end(&span, (size_t) (band->last - band->first) * image->width * image->channels);
+    return NULL;
+}
+
+void equalize_histogram_adaptive(image_t *image, const clahe_options_t *options) {
+    clahe_options_t defaults = default_clahe_options();
+    if (!options) options = &defaults;
+    if (options->tile_width <= 0 || options->tile_height <= 0) {
+        fprintf(stderr, "Adaptive equalization needs tiles of at least 1x1 pixels\n");
+        return;
+    }
+    if (!image->pixels || image->width <= 0 || image->height <= 0) return;
+
+    trace_span_t span = trace_begin("op", "equalize_histogram_adaptive");
+    invalidate_histograms(image);
+    int threads = options->threads > 0 ? options->threads : default_thread_count();
+
+    struct clahe_grid grid;
+    grid.image = image;
+    grid.options = options;
+    grid.tiles_x = (image->width + options->tile_width - 1) / options->tile_width;
+    grid.tiles_y = (image->height + options->tile_height - 1) / options->tile_height;
+
+    scratch_mark_t mark = scratch_mark();
+    size_t tile_row_size = (size_t) grid.tiles_x * HISTOGRAM_SIZE;
+    grid.tables = scratch_alloc(grid.tiles_y * tile_row_size);
+
+    // the tiles around each column are the same on every row
+    int *left = scratch_alloc(image->width * sizeof(int));
+    int *right = scratch_alloc(image->width * sizeof(int));
+    unsigned short *weights = scratch_alloc(image->width * sizeof(unsigned short));
+    for (int col = 0; col < image->width; ++col) {
+        int tile_x, weight;
+        surrounding_tiles(col, image->width, options->tile_width, grid.tiles_x, &tile_x, &weight);
+        left[col] = tile_x * HISTOGRAM_SIZE;
+        right[col] = (weight ? tile_x + 1 : tile_x) * HISTOGRAM_SIZE;
+        weights[col] = (unsigned short) weight;
+    }
+    grid.left = left;
+    grid.right = right;
+    grid.weights = weights;
+
+    // bands get their buffers from this thread, so that workers allocate nothing
+    int n_bands = min_int(threads, image->height);
+    struct clahe_band *bands = scratch_alloc(n_bands * sizeof(struct clahe_band));
+    for (int i = 0; i < n_bands; ++i) {
+        bands[i].grid = &grid;
+        bands[i].luminance = scratch_alloc(image->width);
+        bands[i].histograms = scratch_alloc(tile_row_size * sizeof(int));
+        bands[i].blended = scratch_alloc(tile_row_size * sizeof(unsigned short));
+    }
+
+    int n_table_bands = min_int(n_bands, grid.tiles_y);
+    for (int i = 0; i < n_table_bands; ++i) {
+        bands[i].first = grid.tiles_y * i / n_table_bands;
+        bands[i].last = grid.tiles_y * (i + 1) / n_table_bands;
+    }
+    run_in_waves(build_tile_tables, bands, sizeof(struct clahe_band), n_table_bands, threads);
+
+    for (int i = 0; i < n_bands; ++i) {
+        bands[i].first = image->height * i / n_bands;
+        bands[i].last = image->height * (i + 1) / n_bands;
+    }
+    run_in_waves(map_band, bands, sizeof(struct clahe_band), n_bands, threads);
+
+    scratch_release(mark);
+    trace_end(&span, image_bytes(image));
+}
@@ -0,0 +1,190 @@
+/**
+ * Definitions for reusable JPEG codec contexts.
+ */
+
+#include <codec_context.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INITIAL_ENCODE_CAPACITY 65536
+
+pthread_key_t thread_context_key;
+pthread_once_t thread_context_once = PTHREAD_ONCE_INIT;
+pthread_once_t exit_release_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Creates the thread-specific key whose destructor releases each thread's context.
+ */
+void create_thread_context_key();
+
+/**
+ * Registers release_exiting_thread_context() to run at exit.
+ */
+void register_exit_release();
+
+/**
+ * Releases the context of the thread calling exit(), for which thread-specific destructors do not run.
+ */
+void release_exiting_thread_context();
+
+codec_context_t *new_codec_context() {
+    codec_context_t *context = ipp_calloc(1, sizeof(codec_context_t));
+
+    context->decompress.err = jpeg_std_error(&context->decompress_error.pub);
+    context->decompress_error.pub.error_exit = my_error_exit;
+    jpeg_create_decompress(&context->decompress);
+
+    context->compress.err = jpeg_std_error(&context->compress_error.pub);
+    context->compress_error.pub.error_exit = my_error_exit;
+    jpeg_create_compress(&context->compress);
+
+    // the encode buffer is grown with realloc(), so it comes from malloc() rather than ipp_malloc()
+    context->encode_capacity = INITIAL_ENCODE_CAPACITY;
+    context->encode_buffer = malloc(context->encode_capacity);
+
+    return context;
+}
+
+void free_codec_context(codec_context_t *context) {
+    jpeg_destroy_decompress(&context->decompress);
+    jpeg_destroy_compress(&context->compress);
+    free(context->encode_buffer);
+    ipp_free(context);
+}
+
+void create_thread_context_key() {
+    pthread_key_create(&thread_context_key, (void (*)(void *)) free_codec_context);
+}
+
+void register_exit_release() {
+    atexit(release_exiting_thread_context);
+}
+
+void release_exiting_thread_context() {
+    codec_context_t *context = pthread_getspecific(thread_context_key);
+    if (!context) return;
+    pthread_setspecific(thread_context_key, NULL);
+    free_codec_context(context);
+}
+
+codec_context_t *thread_codec_context() {
+    pthread_once(&thread_context_once, create_thread_context_key);
+
+    codec_context_t *context = pthread_getspecific(thread_context_key);
+    if (!context) {
+        context = new_codec_context();
+        pthread_setspecific(thread_context_key, context);
+
+        // registered once a context is allocated, so that it runs before IPP_LEAK_REPORT lists what is left
+        pthread_once(&exit_release_once, register_exit_release);
+    }
+    return context;
+}
+
+void codec_decompress_into(codec_context_t *context, const unsigned char *buffer, unsigned long size,
+                           const decode_options_t *options, image_t *image) {
+    j_decompress_ptr cinfo = &context->decompress;
+
+    if (setjmp(context->decompress_error.setjmp_buffer)) {
+        // Aborting keeps the object (and its permanent memory pool) usable for the next image
+        jpeg_abort_decompress(cinfo);
+        free_pixels(image);
+        image->last_operation = DECOMPRESSION_FAILURE;
+        return;
+    }
+
+    // libjpeg-turbo keeps the memory source manager allocated, this only re-points it
+    jpeg_mem_src(cinfo, buffer, size);
+    read_jpeg(cinfo, image, options, NULL);
+
+    // Release per-image memory but keep the object ready for the next jpeg_read_header()
+    jpeg_abort_decompress(cinfo);
+
+    image->last_operation = DECOMPRESSION_SUCCESS;
+}
+
+image_t *codec_decompress_buffer(codec_context_t *context, const unsigned char *buffer, unsigned long size,
+                                 const decode_options_t *options) {
+    image_t *image = new_image();
+    codec_decompress_into(context, buffer, size, options, image);
+    return image;
+}
+
+image_t *codec_decompress_file(codec_context_t *context, char *input_filename, const decode_options_t *options) {
+    image_t *image = new_image();
+    int input_fd;
+    struct stat input_stat;
+
+    if ((input_fd = open(input_filename, O_RDONLY)) < 0 || fstat(input_fd, &input_stat) < 0 || input_stat.st_size == 0) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        if (input_fd >= 0) close(input_fd);
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    size_t size = (size_t) input_stat.st_size;
+    unsigned char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close(input_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", input_filename);
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    codec_decompress_into(context, mapping, size, options, image);
+    munmap(mapping, size);
+
+    if (image->last_operation == DECOMPRESSION_SUCCESS) image->filename = ipp_strdup(input_filename);
+    return image;
+}
+
+unsigned long codec_compress_buffer(codec_context_t *context, image_t *image, const encode_options_t *options,
+                                    const unsigned char **buffer) {
+    j_compress_ptr cinfo = &context->compress;
+
+    // Start from the pooled buffer, which grows in place when the image does not fit
+    struct growing_destination_manager destination;
+    jpeg_growing_dest(cinfo, &destination, context->encode_buffer, context->encode_capacity);
+
+    if (setjmp(context->compress_error.setjmp_buffer)) {
+        // Keep the buffer, grown or not, for the next images
+        jpeg_abort_compress(cinfo);
+        context->encode_buffer = destination.buffer;
+        context->encode_capacity = destination.capacity;
+        *buffer = NULL;
+        image->last_operation = COMPRESSION_FAILURE;
+        return 0;
+    }
+
+    write_jpeg(cinfo, image, options);
+    unsigned long output_size = destination.capacity - destination.pub.free_in_buffer;
+    context->encode_buffer = destination.buffer;
+    context->encode_capacity = destination.capacity;
+
+    *buffer = context->encode_buffer;
+    image->last_operation = COMPRESSION_SUCCESS;
+    return output_size;
+}
+
+void codec_compress_file(codec_context_t *context, image_t *image, char *output_filename,
+                         const encode_options_t *options) {
+    const unsigned char *buffer;
+    unsigned long size = codec_compress_buffer(context, image, options, &buffer);
+    if (image->last_operation != COMPRESSION_SUCCESS) return;
+
+    FILE *output_file;
+    if ((output_file = fopen(output_filename, "wb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", output_filename);
+        image->last_operation = FOPEN_FAILURE;
+        return;
+    }
+
+    if (fwrite(buffer, 1, size, output_file) != size) image->last_operation = COMPRESSION_FAILURE;
+    fclose(output_file);
+}
@@ -0,0 +1,137 @@
+/**
+ * Definitions for approximate luminance histograms read from the DC coefficients of JPEG images.
+ */
+
+#include <dc_histogram.h>
+#include <trace.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Sum of the counts of a histogram.
+ */
+double histogram_pixels(const int *histogram);
+
+void read_dc_histogram(j_decompress_ptr cinfo, int *histogram) {
+    jpeg_read_header(cinfo, TRUE);
+    cinfo->out_color_space = JCS_GRAYSCALE;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = DCTSIZE;
+    cinfo->do_block_smoothing = FALSE;
+    cinfo->buffered_image = cinfo->progressive_mode;
+    jpeg_start_decompress(cinfo);
+
+    if (cinfo->buffered_image) {
+        // the output of a scan only waits for the input of that scan, so nothing past it is decoded
+        while (cinfo->coef_bits[0][0] < 0 && !jpeg_input_complete(cinfo)) {
+            jpeg_consume_input(cinfo);
+        }
+        jpeg_start_output(cinfo, cinfo->input_scan_number);
+    }
+
+    // each output sample is the mean of a block, and the blocks of the last column and row may stick out of the
+    // image, counting only for the pixels inside it
+    int width = (int) cinfo->image_width, height = (int) cinfo->image_height;
+    JSAMPARRAY means = (*cinfo->mem->alloc_sarray)((j_common_ptr) cinfo, JPOOL_IMAGE, cinfo->output_width, 1);
+    memset(histogram, 0, HISTOGRAM_SIZE * sizeof(int));
+    while (cinfo->output_scanline < cinfo->output_height) {
+        int rows = min_int(DCTSIZE, height - (int) cinfo->output_scanline * DCTSIZE);
+        jpeg_read_scanlines(cinfo, means, 1);
+        for (int block = 0; block < (int) cinfo->output_width; ++block) {
+            histogram[means[0][block]] += rows * min_int(DCTSIZE, width - block * DCTSIZE);
+        }
+    }
+}
+
+enum result codec_dc_histogram(codec_context_t *context, const unsigned char *buffer, unsigned long size,
+                               int *histogram) {
+    j_decompress_ptr cinfo = &context->decompress;
+    trace_span_t span = trace_begin("io", "dc_histogram");
+
+    if (setjmp(context->decompress_error.setjmp_buffer)) {
+        jpeg_abort_decompress(cinfo);
+        trace_end(&span, 0);
+        return DECOMPRESSION_FAILURE;
+    }
+
+    jpeg_mem_src(cinfo, buffer, size);
+    read_dc_histogram(cinfo, histogram);
+    jpeg_abort_decompress(cinfo);
+
+    trace_end(&span, size);
+    return DECOMPRESSION_SUCCESS;
+}
+
+enum result jpeg_dc_histogram_buffer(const unsigned char *buffer, unsigned long size, int *histogram) {
+    struct jpeg_decompress_struct cinfo;
+    struct error_manager jerr;
+    trace_span_t span = trace_begin("io", "dc_histogram");
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        trace_end(&span, 0);
+        return DECOMPRESSION_FAILURE;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, buffer, size);
+    read_dc_histogram(&cinfo, histogram);
+    jpeg_destroy_decompress(&cinfo);
+
+    trace_end(&span, size);
+    return DECOMPRESSION_SUCCESS;
+}
+
+enum result jpeg_dc_histogram(char *input_filename, int *histogram) {
+    int input_fd;
+    struct stat input_stat;
+
+    if ((input_fd = open(input_filename, O_RDONLY)) < 0 || fstat(input_fd, &input_stat) < 0 || input_stat.st_size == 0) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        if (input_fd >= 0) close(input_fd);
+        return FOPEN_FAILURE;
+    }
+
+    size_t size = (size_t) input_stat.st_size;
+    unsigned char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close(input_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", input_filename);
+        return FOPEN_FAILURE;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    enum result outcome = jpeg_dc_histogram_buffer(mapping, size, histogram);
+    munmap(mapping, size);
+    return outcome;
+}
+
+double histogram_distance(const int *a, const int *b) {
+    double pixels_a = histogram_pixels(a), pixels_b = histogram_pixels(b);
+    if (pixels_a == 0 || pixels_b == 0) return 0;
+
+    // in one dimension, the distance is the area between the two cumulative distributions
+    double cum_a = 0, cum_b = 0, distance = 0;
+    for (int tone = 0; tone < HISTOGRAM_SIZE - 1; ++tone) {
+        cum_a += a[tone] / pixels_a;
+        cum_b += b[tone] / pixels_b;
+        distance += fabs(cum_a - cum_b);
+    }
+    return distance;
+}
+
+double histogram_pixels(const int *histogram) {
+    double pixels = 0;
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+        pixels += histogram[tone];
+    }
+    return pixels;
+}
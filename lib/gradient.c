@@ -0,0 +1,161 @@
+/**
+ * Definitions for the fused gradient (edge detection) operator.
+ */
+
+#include <gradient.h>
+#include <parallel_jpeg.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+#include <scratch.h>
+#include <stdio.h>
+#include <math.h>
+
+// Fraction bits of the boundaries of orientation bins, small enough for their products with gradients to fit an int
+#define BOUNDARY_BITS 14
+
+/**
+ * Rows of an image a thread computes the gradient of, with buffers of its own.
+ */
+struct gradient_band {
+    image_t *image;
+    const gradient_options_t *options;
+    int first;
+    int last;
+    unsigned char **magnitude;          // rows of the output
+    unsigned char **orientation;        // NULL without orientation
+    const int *boundaries;
+    unsigned char *ring[3];             // luminance of the rows above, at and below the current one, with one copy of
+                                        // the edge pixel on each side
+    short *gx;
+    short *gy;
+};
+
+/**
+ * Computes the gradient of a band of rows.
+ * @param arg pointer to struct gradient_band
+ */
+void *gradient_band_task(void *arg);
+
+/**
+ * Converts a row of an image to luminance, with a copy of its edge pixels on each side.
+ * @param padded receives width + 2 values
+ */
+void load_padded_luminance(const image_t *image, int row, unsigned char *padded);
+
+gradient_options_t default_gradient_options() {
+    gradient_options_t options;
+    options.gradient_operator = GRADIENT_SOBEL;
+    options.norm = GRADIENT_NORM_L1;
+    options.shift = 0;
+    options.orientation_bins = 4;
+    options.threads = 0;
+    return options;
+}
+
+void load_padded_luminance(const image_t *image, int row, unsigned char *padded) {
+    row = row < 0 ? 0 : row >= image->height ? image->height - 1 : row;
+    convert_pixels(image->pixels[row], image->channels, padded + 1, 1, image->width);
+    padded[0] = padded[1];
+    padded[image->width + 1] = padded[image->width];
+}
+
+void *gradient_band_task(void *arg) {
+    struct gradient_band *band = arg;
+    image_t *image = band->image;
+    const gradient_options_t *options = band->options;
+    int center_weight = options->gradient_operator == GRADIENT_SOBEL ? 2 : 1;
+    trace_span_t span = trace_begin("op", "gradient_band");
+
+    unsigned char *above = band->ring[0], *row = band->ring[1], *below = band->ring[2];
+    load_padded_luminance(image, band->first - 1, above);
+    load_padded_luminance(image, band->first, row);
+    for (int y = band->first; y < band->last; ++y) {
+        load_padded_luminance(image, y + 1, below);
+
+        const unsigned char *rows[3] = {above + 1, row + 1, below + 1};
+        gradient_row(rows, image->width, center_weight, band->gx, band->gy);
+        gradient_magnitude(band->gx, band->gy, image->width, options->norm == GRADIENT_NORM_L2, options->shift,
+                           band->magnitude[y]);
+        if (band->orientation) {
+            gradient_orientation(band->gx, band->gy, image->width, options->orientation_bins, band->boundaries,
+                                 band->orientation[y]);
+        }
+
+        // the row buffers move up, the one above being loaded next
+        unsigned char *free_row = above;
+        above = row;
+        row = below;
+        below = free_row;
+    }
+
+    trace_end(&span, (size_t) (band->last - band->first) * image->width * image->channels);
+    return NULL;
+}
+
+void compute_gradient(image_t *image, const gradient_options_t *options, image_t *orientation) {
+    gradient_options_t defaults = default_gradient_options();
+    if (!options) options = &defaults;
+    if (options->shift < 0 || options->shift > 15) {
+        fprintf(stderr, "Gradient magnitudes can only be shifted by 0 to 15 bits\n");
+        return;
+    }
+    if (orientation && (options->orientation_bins < 1 || options->orientation_bins > MAX_ORIENTATION_BINS)) {
+        fprintf(stderr, "Gradient orientations need 1 to %d bins\n", MAX_ORIENTATION_BINS);
+        return;
+    }
+    if (!image->pixels || image->width <= 0 || image->height <= 0) return;
+
+    trace_span_t span = trace_begin("op", "compute_gradient");
+    int threads = options->threads > 0 ? options->threads : default_thread_count();
+    unsigned char **magnitude = new_unsigned_char_matrix(image->height, image->width);
+
+    if (orientation) {
+        if (!orientation->pixels || orientation->height != image->height || orientation->width != image->width ||
+            orientation->channels != 1) {
+            free_pixels(orientation);
+            orientation->pixels = new_unsigned_char_matrix(image->height, image->width);
+            orientation->height = image->height;
+            orientation->width = image->width;
+            orientation->channels = 1;
+        }
+        orientation->colorspace = JCS_GRAYSCALE;
+        invalidate_histograms(orientation);
+    }
+
+    scratch_mark_t mark = scratch_mark();
+
+    // boundary b of the bins is at (b + 1/2) bins of half a turn
+    int *boundaries = scratch_alloc(2 * MAX_ORIENTATION_BINS * sizeof(int));
+    for (int b = 0; orientation && b < options->orientation_bins; ++b) {
+        double angle = M_PI * (b + 0.5) / options->orientation_bins;
+        boundaries[2 * b] = (int) lround(cos(angle) * (1 << BOUNDARY_BITS));
+        boundaries[2 * b + 1] = (int) lround(sin(angle) * (1 << BOUNDARY_BITS));
+    }
+
+    // bands get their buffers from this thread, so that workers allocate nothing
+    int n_bands = min_int(threads, image->height);
+    struct gradient_band *bands = scratch_alloc(n_bands * sizeof(struct gradient_band));
+    for (int i = 0; i < n_bands; ++i) {
+        bands[i].image = image;
+        bands[i].options = options;
+        bands[i].first = image->height * i / n_bands;
+        bands[i].last = image->height * (i + 1) / n_bands;
+        bands[i].magnitude = magnitude;
+        bands[i].orientation = orientation ? orientation->pixels : NULL;
+        bands[i].boundaries = boundaries;
+        for (int r = 0; r < 3; ++r) {
+            bands[i].ring[r] = scratch_alloc(image->width + 2);
+        }
+        bands[i].gx = scratch_alloc(image->width * sizeof(short));
+        bands[i].gy = scratch_alloc(image->width * sizeof(short));
+    }
+    run_in_waves(gradient_band_task, bands, sizeof(struct gradient_band), n_bands, threads);
+    scratch_release(mark);
+
+    invalidate_histograms(image);
+    free_pixels(image);
+    image->pixels = magnitude;
+    image->channels = 1;
+    image->colorspace = JCS_GRAYSCALE;
+    trace_end(&span, image_bytes(image));
+}
@@ -0,0 +1,309 @@
+/**
+ * Definitions for the content-addressed cache of decoded images.
+ */
+
+#include <image_cache.h>
+#include <image_formats.h>
+#include <codec_context.h>
+#include <trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+
+uint64_t rotate_left(uint64_t value, int bits);
+
+/**
+ * 64-bit hash of a byte buffer starting from a seed, different seeds giving unrelated hashes.
+ */
+uint64_t seeded_hash(const unsigned char *buffer, size_t size, uint64_t seed);
+
+/**
+ * Mixes the decode options into a content hash, NULL options are the libjpeg defaults.
+ */
+uint64_t cache_key(uint64_t hash, const decode_options_t *options);
+
+/**
+ * Path of the spill file of a key, to be released with ipp_free().
+ */
+char *spill_path(image_cache_t *cache, uint64_t key);
+
+/**
+ * Finds the entry of a key and marks it most recently used. Cache lock must be held.
+ * @return The entry, which may hold other content with the same key, NULL if there is none.
+ */
+image_cache_entry_t *cache_lookup(image_cache_t *cache, uint64_t key);
+
+/**
+ * Adds a decoded image to the cache, evicting least recently used entries to respect the budget.
+ * Cache lock must be held.
+ * @param content_size size of the compressed content the image was decoded from
+ * @param content_digest content_digest() of that content
+ * @return the image now owned by the cache, or NULL if it was not kept (too big, or key already present)
+ */
+image_t *cache_insert(image_cache_t *cache, uint64_t key, uint64_t content_size, uint64_t content_digest,
+                      image_t *image);
+
+/**
+ * Drops the least recently used entry, spilling it first when a spill directory is set. Cache lock must be held.
+ */
+void cache_evict(image_cache_t *cache);
+
+/**
+ * Looks a key up in memory and then in the spill directory, or decodes the buffer on a miss. Images found under the
+ * key only count as hits if the size and digest of their content match those of the buffer.
+ * @return Copy of the decoded image owned by the caller.
+ */
+image_t *cache_decompress(image_cache_t *cache, uint64_t key, uint64_t digest, const unsigned char *buffer,
+                          unsigned long size, const decode_options_t *options);
+
+uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t content_hash(const unsigned char *buffer, size_t size) {
+    return seeded_hash(buffer, size, HASH_PRIME_3);
+}
+
+uint64_t content_digest(const unsigned char *buffer, size_t size) {
+    return seeded_hash(buffer, size, HASH_PRIME_2);
+}
+
+uint64_t seeded_hash(const unsigned char *buffer, size_t size, uint64_t seed) {
+    uint64_t hash = seed ^ (size * HASH_PRIME_1);
+
+    // 8 bytes at a time, then the tail byte by byte
+    size_t words = size / sizeof(uint64_t);
+    for (size_t i = 0; i < words; ++i) {
+        uint64_t word;
+        memcpy(&word, buffer + i * sizeof(uint64_t), sizeof(uint64_t));
+        hash ^= rotate_left(word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+        hash = rotate_left(hash, 27) * HASH_PRIME_1 + HASH_PRIME_3;
+    }
+    for (size_t i = words * sizeof(uint64_t); i < size; ++i) {
+        hash ^= buffer[i] * HASH_PRIME_3;
+        hash = rotate_left(hash, 11) * HASH_PRIME_1;
+    }
+
+    // final avalanche so that every input bit affects every output bit
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t cache_key(uint64_t hash, const decode_options_t *options) {
+    decode_options_t used = options ? *options : default_decode_options();
+    uint64_t bits = (uint64_t) (used.grayscale != 0) | ((uint64_t) used.dct_method << 1) |
+                    ((uint64_t) (used.fancy_upsampling != 0) << 3) | ((uint64_t) (used.block_smoothing != 0) << 4);
+    return hash ^ (rotate_left((bits + 1) * HASH_PRIME_1, 17));
+}
+
+image_cache_t *new_image_cache(size_t byte_budget, const char *spill_directory) {
+    image_cache_t *cache = ipp_calloc(1, sizeof(image_cache_t));
+    cache->stats.byte_budget = byte_budget;
+    if (spill_directory) cache->spill_directory = ipp_strdup(spill_directory);
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void free_image_cache(image_cache_t *cache) {
+    image_cache_entry_t *entry = cache->most_recent;
+    while (entry) {
+        image_cache_entry_t *next = entry->lru_next;
+        free_image(entry->image);
+        ipp_free(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    ipp_free(cache->spill_directory);
+    ipp_free(cache);
+}
+
+char *spill_path(image_cache_t *cache, uint64_t key) {
+    size_t length = strlen(cache->spill_directory) + 32;
+    char *path = ipp_malloc(length);
+    snprintf(path, length, "%s/%016llx.ippraw", cache->spill_directory, (unsigned long long) key);
+    return path;
+}
+
+image_cache_entry_t *cache_lookup(image_cache_t *cache, uint64_t key) {
+    image_cache_entry_t *entry = cache->buckets[key % IMAGE_CACHE_BUCKETS];
+    while (entry && entry->key != key) entry = entry->bucket_next;
+    if (!entry || entry == cache->most_recent) return entry;
+
+    // unlink from its LRU position and move to the front
+    entry->lru_prev->lru_next = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->least_recent = entry->lru_prev;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->most_recent;
+    cache->most_recent->lru_prev = entry;
+    cache->most_recent = entry;
+    return entry;
+}
+
+void cache_evict(image_cache_t *cache) {
+    image_cache_entry_t *victim = cache->least_recent;
+
+    if (cache->spill_directory) {
+        char *path = spill_path(cache, victim->key);
+        if (access(path, F_OK) != 0) {
+            // the header records which content the pixels belong to, as a spill file of another could have its name
+            raw_save_with_source(victim->image, path, victim->content_size, victim->content_digest);
+            if (victim->image->last_operation == WRITE_SUCCESS) ++cache->stats.spills;
+        }
+        ipp_free(path);
+    }
+
+    // unlink from the bucket chain and the LRU tail
+    image_cache_entry_t **link = &cache->buckets[victim->key % IMAGE_CACHE_BUCKETS];
+    while (*link != victim) link = &(*link)->bucket_next;
+    *link = victim->bucket_next;
+
+    cache->least_recent = victim->lru_prev;
+    if (cache->least_recent) cache->least_recent->lru_next = NULL;
+    else cache->most_recent = NULL;
+
+    cache->stats.resident_bytes -= victim->bytes;
+    ++cache->stats.evictions;
+    free_image(victim->image);
+    ipp_free(victim);
+}
+
+image_t *cache_insert(image_cache_t *cache, uint64_t key, uint64_t content_size, uint64_t content_digest,
+                      image_t *image) {
+    size_t bytes = (size_t) image->height * (image->width * image->channels + sizeof(unsigned char *));
+    if (bytes > cache->stats.byte_budget || cache_lookup(cache, key)) return NULL;
+
+    while (cache->stats.resident_bytes + bytes > cache->stats.byte_budget) cache_evict(cache);
+
+    image_cache_entry_t *entry = ipp_calloc(1, sizeof(image_cache_entry_t));
+    entry->key = key;
+    entry->content_size = content_size;
+    entry->content_digest = content_digest;
+    entry->image = image;
+    entry->bytes = bytes;
+
+    entry->bucket_next = cache->buckets[key % IMAGE_CACHE_BUCKETS];
+    cache->buckets[key % IMAGE_CACHE_BUCKETS] = entry;
+
+    entry->lru_next = cache->most_recent;
+    if (cache->most_recent) cache->most_recent->lru_prev = entry;
+    else cache->least_recent = entry;
+    cache->most_recent = entry;
+
+    cache->stats.resident_bytes += bytes;
+    return image;
+}
+
+image_t *cache_decompress(image_cache_t *cache, uint64_t key, uint64_t digest, const unsigned char *buffer,
+                          unsigned long size, const decode_options_t *options) {
+    pthread_mutex_lock(&cache->lock);
+    image_cache_entry_t *entry = cache_lookup(cache, key);
+    int collision = entry && (entry->content_size != size || entry->content_digest != digest);
+    if (entry && !collision) {
+        ++cache->stats.hits;
+        image_t *copy = copy_image(entry->image);
+        pthread_mutex_unlock(&cache->lock);
+        copy->last_operation = DECOMPRESSION_SUCCESS;
+        return copy;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    // Not resident: map the spilled raw file if there is one, decode otherwise (without holding the lock)
+    image_t *decoded = NULL;
+    int spill_hit = 0;
+    if (cache->spill_directory) {
+        char *path = spill_path(cache, key);
+        if (!collision && access(path, R_OK) == 0) {
+            decoded = raw_load(path);
+            spill_hit = decoded->last_operation == READ_SUCCESS;
+            if (spill_hit) {
+                // raw_load() keeps the header mapped in front of the rows
+                const raw_header_t *header = (const raw_header_t *) decoded->mapping;
+                collision = header->source_size != size || header->source_digest != digest;
+                spill_hit = !collision;
+            }
+            if (!spill_hit) {
+                free_image(decoded);
+                decoded = NULL;
+            }
+        }
+        ipp_free(path);
+    }
+    if (!decoded) {
+        decoded = codec_decompress_buffer(thread_codec_context(), buffer, size, options);
+        if (decoded->last_operation != DECOMPRESSION_SUCCESS) return decoded;
+    }
+    ipp_free(decoded->filename);
+    decoded->filename = NULL;
+    decoded->last_operation = DECOMPRESSION_SUCCESS;
+
+    pthread_mutex_lock(&cache->lock);
+    if (spill_hit) ++cache->stats.spill_hits;
+    else ++cache->stats.misses;
+    if (collision) ++cache->stats.collisions;
+    image_t *copy = copy_image(decoded);
+    if (!cache_insert(cache, key, size, digest, decoded)) free_image(decoded);
+    pthread_mutex_unlock(&cache->lock);
+
+    return copy;
+}
+
+image_t *image_cache_decompress_buffer(image_cache_t *cache, const unsigned char *buffer, unsigned long size,
+                                       const decode_options_t *options) {
+    // a miss shows up as a decode span inside this one
+    trace_span_t span = trace_begin("cache", "image_cache_decompress");
+    uint64_t key = cache_key(content_hash(buffer, size), options);
+    image_t *image = cache_decompress(cache, key, content_digest(buffer, size), buffer, size, options);
+    trace_end(&span, size);
+    return image;
+}
+
+image_t *image_cache_decompress(image_cache_t *cache, char *input_filename, const decode_options_t *options) {
+    int input_fd;
+    struct stat input_stat;
+
+    if ((input_fd = open(input_filename, O_RDONLY)) < 0 || fstat(input_fd, &input_stat) < 0 || input_stat.st_size == 0) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        if (input_fd >= 0) close(input_fd);
+        image_t *image = new_image();
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    // The mapping is hashed, and decoded from directly on a miss
+    size_t size = (size_t) input_stat.st_size;
+    unsigned char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close(input_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", input_filename);
+        image_t *image = new_image();
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    image_t *image = image_cache_decompress_buffer(cache, mapping, size, options);
+    munmap(mapping, size);
+
+    if (image->last_operation == DECOMPRESSION_SUCCESS) image->filename = ipp_strdup(input_filename);
+    return image;
+}
+
+image_cache_stats_t image_cache_stats(image_cache_t *cache) {
+    pthread_mutex_lock(&cache->lock);
+    image_cache_stats_t stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+    return stats;
+}
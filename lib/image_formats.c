@@ -0,0 +1,344 @@
+/**
+ * Definitions for uncompressed image formats.
+ */
+
+#include <image_formats.h>
+#include <trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <limits.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Case-insensitive check of a filename's extension.
+ * @param extension the extension, including the dot
+ */
+int has_extension(const char *filename, const char *extension);
+
+/**
+ * Reads the next number of a PNM header, skipping whitespace and comments.
+ * @return the number, -1 if the header ended prematurely or the number does not fit an int
+ */
+int read_pnm_number(FILE *file);
+
+/**
+ * Whether a raw header describes pixels this library can hold: 1 to MAX_CHANNELS channels in a colorspace with that
+ * many components (or an unknown one), and rows of at most INT_MAX bytes.
+ */
+int valid_raw_geometry(const raw_header_t *header);
+
+int valid_raw_geometry(const raw_header_t *header) {
+    if (header->channels < 1 || header->channels > MAX_CHANNELS || header->width > INT_MAX ||
+        header->height > INT_MAX || (uint64_t) header->width * header->channels > INT_MAX) {
+        return 0;
+    }
+
+    switch ((J_COLOR_SPACE) header->colorspace) {
+        case JCS_UNKNOWN:
+            return 1;
+        case JCS_GRAYSCALE:
+            return header->channels == 1;
+        case JCS_RGB:
+        case JCS_YCbCr:
+#ifdef JCS_EXTENSIONS
+        case JCS_EXT_RGB:
+        case JCS_EXT_BGR:
+#endif
+            return header->channels == 3;
+        case JCS_CMYK:
+        case JCS_YCCK:
+#ifdef JCS_EXTENSIONS
+        case JCS_EXT_RGBX:
+        case JCS_EXT_BGRX:
+        case JCS_EXT_XBGR:
+        case JCS_EXT_XRGB:
+#endif
+#ifdef JCS_ALPHA_EXTENSIONS
+        case JCS_EXT_RGBA:
+        case JCS_EXT_BGRA:
+        case JCS_EXT_ABGR:
+        case JCS_EXT_ARGB:
+#endif
+            return header->channels == 4;
+        default:
+            return 0;
+    }
+}
+
+int has_extension(const char *filename, const char *extension) {
+    size_t filename_length = strlen(filename), extension_length = strlen(extension);
+    return filename_length >= extension_length &&
+           strcasecmp(filename + filename_length - extension_length, extension) == 0;
+}
+
+int is_jpeg_filename(const char *filename) {
+    return has_extension(filename, ".jpg") || has_extension(filename, ".jpeg");
+}
+
+void raw_save(image_t *image, char *output_filename) {
+    raw_save_with_source(image, output_filename, 0, 0);
+}
+
+void raw_save_with_source(image_t *image, char *output_filename, uint64_t source_size, uint64_t source_digest) {
+    FILE *output_file;
+    if ((output_file = fopen(output_filename, "wb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", output_filename);
+        image->last_operation = FOPEN_FAILURE;
+        return;
+    }
+
+    raw_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+    header.byte_order = RAW_BYTE_ORDER;
+    header.header_size = RAW_HEADER_SIZE;
+    header.width = (uint32_t) image->width;
+    header.height = (uint32_t) image->height;
+    header.channels = (uint32_t) image->channels;
+    header.colorspace = (uint32_t) image->colorspace;
+    header.stride = ((uint64_t) image->width * image->channels + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT
+                    * MATRIX_ALIGNMENT;
+    header.data_offset = (RAW_HEADER_SIZE + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    header.source_size = source_size;
+    header.source_digest = source_digest;
+
+    int failed = fwrite(&header, sizeof(header), 1, output_file) != 1;
+    if (!failed && header.data_offset > sizeof(header)) {
+        failed = fseek(output_file, (long) header.data_offset, SEEK_SET) != 0;
+    }
+
+    // Rows are padded to the stride with zeros
+    size_t row_size = (size_t) image->width * image->channels;
+    unsigned char padding[MATRIX_ALIGNMENT];
+    memset(padding, 0, sizeof(padding));
+    for (int row = 0; row < image->height && !failed; ++row) {
+        failed = fwrite(image->pixels[row], 1, row_size, output_file) != row_size;
+        if (!failed && header.stride > row_size) {
+            failed = fwrite(padding, 1, header.stride - row_size, output_file) != header.stride - row_size;
+        }
+    }
+
+    if (fclose(output_file) != 0) failed = 1;
+    image->last_operation = failed ? WRITE_FAILURE : WRITE_SUCCESS;
+}
+
+image_t *raw_load(char *input_filename) {
+    image_t *image = new_image();
+    int input_fd;
+    struct stat input_stat;
+
+    if ((input_fd = open(input_filename, O_RDONLY)) < 0 || fstat(input_fd, &input_stat) < 0) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        if (input_fd >= 0) close(input_fd);
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    size_t size = (size_t) input_stat.st_size;
+    if (size < sizeof(raw_header_t)) {
+        fprintf(stderr, "%s is not a raw image\n", input_filename);
+        close(input_fd);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+
+    // Private writable mapping: pages are shared with the page cache until an operation writes to them
+    unsigned char *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, input_fd, 0);
+    close(input_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", input_filename);
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    // The rows must lie inside the file, with sizes computed without wrapping around
+    const raw_header_t *header = (const raw_header_t *) mapping;
+    uint64_t raster_size, data_end;
+    if (memcmp(header->magic, RAW_MAGIC, sizeof(header->magic)) != 0 || header->byte_order != RAW_BYTE_ORDER ||
+        header->header_size != RAW_HEADER_SIZE || !valid_raw_geometry(header) ||
+        header->stride < (uint64_t) header->width * header->channels || header->data_offset < RAW_HEADER_SIZE ||
+        __builtin_mul_overflow(header->stride, (uint64_t) header->height, &raster_size) ||
+        __builtin_add_overflow(header->data_offset, raster_size, &data_end) || data_end > size) {
+        fprintf(stderr, "%s is not a valid raw image\n", input_filename);
+        munmap(mapping, size);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+
+    // PNM files can not hold empty images either, and there would be no row pointers to allocate
+    if (header->width == 0 || header->height == 0) {
+        fprintf(stderr, "%s holds an empty %ux%u image\n", input_filename, header->width, header->height);
+        munmap(mapping, size);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+
+    image->filename = ipp_strdup(input_filename);
+    image->width = (int) header->width;
+    image->height = (int) header->height;
+    image->channels = (int) header->channels;
+    image->colorspace = (J_COLOR_SPACE) header->colorspace;
+    image->mapping = mapping;
+    image->mapping_size = size;
+
+    // Only the row pointers are allocated, rows are the mapped pages themselves
+    image->pixels = ipp_malloc(image->height * sizeof(unsigned char *));
+    if (!image->pixels) {
+        fprintf(stderr, "Not enough memory for the rows of %s\n", input_filename);
+        free_pixels(image);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+    for (int row = 0; row < image->height; ++row) {
+        image->pixels[row] = mapping + header->data_offset + row * header->stride;
+    }
+
+    image->last_operation = READ_SUCCESS;
+    return image;
+}
+
+void pnm_save(image_t *image, char *output_filename) {
+    if (image->channels != 1 && image->channels != 3) {
+        fprintf(stderr, "PNM needs 1 or 3 channels, not %d\n", image->channels);
+        image->last_operation = WRITE_FAILURE;
+        return;
+    }
+
+    FILE *output_file;
+    if ((output_file = fopen(output_filename, "wb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", output_filename);
+        image->last_operation = FOPEN_FAILURE;
+        return;
+    }
+
+    int failed = fprintf(output_file, "P%c\n%d %d\n255\n", image->channels == 1 ? '5' : '6',
+                         image->width, image->height) < 0;
+
+    size_t row_size = (size_t) image->width * image->channels;
+    for (int row = 0; row < image->height && !failed; ++row) {
+        failed = fwrite(image->pixels[row], 1, row_size, output_file) != row_size;
+    }
+
+    if (fclose(output_file) != 0) failed = 1;
+    image->last_operation = failed ? WRITE_FAILURE : WRITE_SUCCESS;
+}
+
+int read_pnm_number(FILE *file) {
+    int c;
+    // skip whitespace and '#' comments up to the end of their line
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(file)) != EOF && c != '\n');
+        } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            break;
+        }
+    }
+    if (c == EOF || c < '0' || c > '9') return -1;
+
+    int number = 0;
+    while (c >= '0' && c <= '9') {
+        if (number > (INT_MAX - (c - '0')) / 10) return -1;
+        number = number * 10 + (c - '0');
+        c = fgetc(file);
+    }
+    // c is the single whitespace that ends the number (and the header, after maxval)
+    return number;
+}
+
+image_t *pnm_load(char *input_filename) {
+    image_t *image = new_image();
+
+    FILE *input_file;
+    if ((input_file = fopen(input_filename, "rb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    char magic[2];
+    int channels = 0;
+    if (fread(magic, 1, 2, input_file) == 2 && magic[0] == 'P') {
+        if (magic[1] == '5') channels = 1;
+        if (magic[1] == '6') channels = 3;
+    }
+    int width = read_pnm_number(input_file);
+    int height = read_pnm_number(input_file);
+    int max_value = read_pnm_number(input_file);
+
+    if (!channels || width <= 0 || height <= 0 || max_value != 255) {
+        fprintf(stderr, "%s is not a binary 8-bit PGM/PPM\n", input_filename);
+        fclose(input_file);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+
+    // Rows of the matrix are indexed with ints, and the raster must be in the file before anything is allocated
+    size_t row_size = (size_t) width * channels;
+    struct stat input_stat;
+    long raster_start = ftell(input_file);
+    if (row_size > INT_MAX || fstat(fileno(input_file), &input_stat) < 0 || raster_start < 0 ||
+        row_size * height > (size_t) (input_stat.st_size - raster_start)) {
+        fprintf(stderr, "%s is truncated or too large\n", input_filename);
+        fclose(input_file);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+
+    image->filename = ipp_strdup(input_filename);
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    image->colorspace = (channels == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    image->pixels = new_unsigned_char_matrix(height, (int) row_size);
+
+    // Rows are contiguous in the matrix, so the whole raster is read at once
+    size_t raster_size = row_size * height;
+    int failed = !image->pixels || fread(image->pixels[0], 1, raster_size, input_file) != raster_size;
+    fclose(input_file);
+
+    // a partly read raster is dropped, as the pixels of failed decodes are
+    if (failed) {
+        fprintf(stderr, "Can't read the pixels of %s\n", input_filename);
+        free_pixels(image);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+    image->last_operation = READ_SUCCESS;
+    return image;
+}
+
+image_t *load_image(char *input_filename) {
+    trace_span_t span = trace_begin("io", "load_image");
+    image_t *image;
+    if (is_jpeg_filename(input_filename)) {
+        image = jpeg_decompress(input_filename);
+    } else if (has_extension(input_filename, ".ppm") || has_extension(input_filename, ".pgm") ||
+               has_extension(input_filename, ".pnm")) {
+        image = pnm_load(input_filename);
+    } else {
+        image = raw_load(input_filename);
+    }
+    trace_end(&span, image_bytes(image));
+    return image;
+}
+
+int save_image(image_t *image, char *output_filename, const encode_options_t *options) {
+    trace_span_t span = trace_begin("io", "save_image");
+    enum result success = WRITE_SUCCESS;
+    if (is_jpeg_filename(output_filename)) {
+        jpeg_compress_with_options(image, output_filename, options);
+        success = COMPRESSION_SUCCESS;
+    } else if (has_extension(output_filename, ".ppm") || has_extension(output_filename, ".pgm") ||
+               has_extension(output_filename, ".pnm")) {
+        pnm_save(image, output_filename);
+    } else {
+        raw_save(image, output_filename);
+    }
+    trace_end(&span, image_bytes(image));
+    return image->last_operation == success;
+}
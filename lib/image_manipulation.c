@@ -5,11 +5,22 @@
  */
 
 #include <image_manipulation.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+#include <scratch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <setjmp.h>
 #include <memory.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <jerror.h>
+
+// Size jpeg_compress_buffer() starts from, doubled as needed
+#define INITIAL_OUTPUT_CAPACITY 65536
 
 unsigned char closest_level(unsigned char value, int n_tones);
 
@@ -17,63 +28,221 @@ int pixels_in_histogram(const int *hist);
 
 int *compute_norm_cum_histogram(image_t *image);
 
-int *compute_histogram_matching(const int *hist_cum_source, const int *hist_cum_target);
-
 unsigned char *pixel(image_t *image, int x, int y);
 
+int min_int(int a, int b);
+
 /**
- * Returns vector of unsigned char of size image->channels of the average of a range of pixels of the image.
- * @param image the image from which the pixels are retrieved
- * @param first_y first pixel y coordinate
- * @param last_y last pixel y coordinate
- * @param first_x first pixel x coordinate
- * @param last_x  last pixel x coordinate
- * @return vector of unsigned char of size image->channels averaged channels of pixels in range
+ * Gives image a pixel matrix of the given geometry, keeping the current one if it already matches.
+ * @param image the image to reshape; its pixels are freed if they do not match
  */
-unsigned char *average_pixel(image_t *image, int first_y, int last_y, int first_x, int last_x);
+void reshape_pixels(image_t *image, int height, int width, int channels);
 
-int min_int(int a, int b);
+/**
+ * Decompresses only a rectangle of an image whose decompression was already started.
+ * @param cinfo started decompression object
+ * @param image receives size, colorspace and pixels of the region
+ * @param region rectangle to decompress, clipped to the image; an empty intersection is an error
+ */
+void read_jpeg_region(j_decompress_ptr cinfo, image_t *image, const region_t *region);
+
+/**
+ * Cached histograms of an image, allocated (and stale) if it had none.
+ * @return The histograms, NULL if they could not be allocated.
+ */
+image_histograms_t *histograms_of(image_t *image);
+
+/**
+ * Counts the luminance of every pixel of an image into histogram, which must start zeroed.
+ */
+void count_luminance(image_t *image, int *histogram);
+
+/**
+ * Counts each channel of every pixel of an image into its own histogram, which must start zeroed.
+ */
+void count_channels(image_t *image, int histograms[][HISTOGRAM_SIZE]);
+
+/**
+ * Fills histogram with the histogram of the luminance of an image, taken from its cached histograms when they are
+ * current and stored there otherwise.
+ */
+void luminance_histogram(image_t *image, int *histogram);
+
+/**
+ * Fills histograms with the histogram of each channel of an image (at most MAX_CHANNELS), taken from its cached
+ * histograms when they are current.
+ */
+void channel_histograms(image_t *image, int histograms[][HISTOGRAM_SIZE]);
+
+/**
+ * Moves the counts of a histogram to the tones lut maps them to.
+ */
+void map_histogram(int *histogram, const unsigned char *lut);
+
+/**
+ * Computes the normalized cumulative histograms of a target, those of its channels only if asked to.
+ */
+void fill_histogram_reference(image_t *target, histogram_reference_t *reference, boolean with_channels);
 
 image_t *new_image() {
-    return malloc(sizeof(image_t));
+    // batches make and release an image per input, so headers are pooled along with the pixels
+    return pooled_header(sizeof(image_t));
 }
 
 image_t *copy_image(image_t *original) {
+    trace_span_t span = trace_begin("copy", "copy_image");
     image_t *copy = new_image();
-    if (original->filename) copy->filename = strdup(original->filename);
+    if (original->filename) copy->filename = ipp_strdup(original->filename);
     copy->width = original->width;
     copy->height = original->height;
     copy->colorspace = original->colorspace;
     copy->channels = original->channels;
     copy->last_operation = original->last_operation;
+    if (original->histograms) {
+        copy->histograms = ipp_malloc(sizeof(image_histograms_t));
+        if (copy->histograms) memcpy(copy->histograms, original->histograms, sizeof(image_histograms_t));
+    }
 
     copy->pixels = new_unsigned_char_matrix(copy->height, copy->width * copy->channels);
     for (int row = 0; row < copy->height; ++row) {
         memcpy(copy->pixels[row], original->pixels[row], sizeof(unsigned char) * copy->width * copy->channels);
     }
 
+    trace_end(&span, image_bytes(copy));
     return copy;
 }
 
 int *new_histogram() {
-    int *histogram = malloc(HISTOGRAM_SIZE * sizeof(int));
-    memset(histogram, 0, HISTOGRAM_SIZE * sizeof(int));
+    int *histogram = ipp_malloc(HISTOGRAM_SIZE * sizeof(int));
+    if (histogram) memset(histogram, 0, HISTOGRAM_SIZE * sizeof(int));
     return histogram;
 }
 
+encode_options_t default_encode_options() {
+    encode_options_t options;
+    options.quality = 75;
+    options.dct_method = JDCT_ISLOW;
+    options.optimize_coding = FALSE;
+    options.progressive = FALSE;
+    options.h_sampling = 2;
+    options.v_sampling = 2;
+    options.restart_in_rows = 0;
+    return options;
+}
+
+encode_options_t encode_preset_options(enum encode_preset preset) {
+    encode_options_t options = default_encode_options();
+    switch (preset) {
+        case ENCODE_PRESET_FAST:
+            options.dct_method = JDCT_IFAST;
+            break;
+        case ENCODE_PRESET_BALANCED:
+            options.quality = 85;
+            options.optimize_coding = TRUE;
+            break;
+        case ENCODE_PRESET_SMALL:
+            options.quality = 60;
+            options.optimize_coding = TRUE;
+            break;
+        case ENCODE_PRESET_PROGRESSIVE:
+            options.quality = 85;
+            options.optimize_coding = TRUE;
+            options.progressive = TRUE;
+            break;
+        case ENCODE_PRESET_QUALITY:
+            options.quality = 95;
+            options.optimize_coding = TRUE;
+            options.h_sampling = 1;
+            options.v_sampling = 1;
+            break;
+        default:
+            break;
+    }
+    return options;
+}
+
+const char *encode_preset_name(enum encode_preset preset) {
+    switch (preset) {
+        case ENCODE_PRESET_DEFAULT:
+            return "default";
+        case ENCODE_PRESET_FAST:
+            return "fast";
+        case ENCODE_PRESET_BALANCED:
+            return "balanced";
+        case ENCODE_PRESET_SMALL:
+            return "small";
+        case ENCODE_PRESET_PROGRESSIVE:
+            return "progressive";
+        case ENCODE_PRESET_QUALITY:
+            return "quality";
+        default:
+            return "unknown";
+    }
+}
+
+void apply_encode_options(j_compress_ptr cinfo, const encode_options_t *options) {
+    if (!options) return;
+
+    jpeg_set_quality(cinfo, options->quality, TRUE /* limit to baseline-JPEG values */);
+    cinfo->dct_method = options->dct_method;
+    cinfo->optimize_coding = options->optimize_coding;
+    cinfo->restart_in_rows = options->restart_in_rows;
+
+    // Chroma subsampling only makes sense when libjpeg converts to YCbCr, luma is always the first component
+    if (cinfo->jpeg_color_space == JCS_YCbCr) {
+        cinfo->comp_info[0].h_samp_factor = options->h_sampling;
+        cinfo->comp_info[0].v_samp_factor = options->v_sampling;
+        for (int c = 1; c < cinfo->num_components; ++c) {
+            cinfo->comp_info[c].h_samp_factor = 1;
+            cinfo->comp_info[c].v_samp_factor = 1;
+        }
+    }
+
+    if (options->progressive) jpeg_simple_progression(cinfo);
+}
+
 void jpeg_compress(image_t *image, char *output_filename) {
+    jpeg_compress_with_options(image, output_filename, NULL);
+}
+
+void write_jpeg(j_compress_ptr cinfo, image_t *image, const encode_options_t *options) {
+    JSAMPROW row_pointer[1];
+
+    // Set parameters for compression, including image size & colorspace
+    cinfo->image_width = (JDIMENSION) image->width;
+    cinfo->image_height = (JDIMENSION) image->height;
+    cinfo->input_components = image->channels;
+    cinfo->in_color_space = image->colorspace;
+    jpeg_set_defaults(cinfo);
+    apply_encode_options(cinfo, options);
+
+    // Start compression
+    trace_span_t span = trace_begin("io", "jpeg_write_scanlines");
+    jpeg_start_compress(cinfo, TRUE);
+
+    // Compress each line straight from the pixel rows, which already are R,G,B,R,G,B ... JSAMPLEs
+    while (cinfo->next_scanline < cinfo->image_height) {
+        row_pointer[0] = (JSAMPROW) image->pixels[cinfo->next_scanline];
+        (void) jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+
+    // Finish compression
+    jpeg_finish_compress(cinfo);
+    trace_end(&span, image_bytes(image));
+}
+
+void jpeg_compress_with_options(image_t *image, char *output_filename, const encode_options_t *options) {
     struct jpeg_compress_struct cinfo;
     struct error_manager jerr;
 
     FILE *output_file;
-    JSAMPLE *jsample_array = pixel_array_to_jsample_array(image);
-    JSAMPROW row_pointer[1];
-    int row_stride;
+    trace_span_t span = trace_begin("io", "jpeg_compress");
 
     // Open the output file before doing anything else, so that the setjmp() error recovery below can assume the file is open.
     if ((output_file = fopen(output_filename, "wb")) == NULL) {
         fprintf(stderr, "Can't open %s\n", output_filename);
         image->last_operation = FOPEN_FAILURE;
+        trace_end(&span, 0);
         return;
     }
 
@@ -83,10 +252,11 @@ void jpeg_compress(image_t *image, char *output_filename) {
 
     // Establish the setjmp return context for my_error_exit to use.
     if (setjmp(jerr.setjmp_buffer)) {
-        // Here the JPEG code has signaled an error. Clean up the JPEG object, close the input file, and return.
-        jpeg_destroy_decompress((j_decompress_ptr) &cinfo);
+        // Here the JPEG code has signaled an error. Clean up the JPEG object, close the output file, and return.
+        jpeg_destroy_compress(&cinfo);
         fclose(output_file);
         image->last_operation = COMPRESSION_FAILURE;
+        trace_end(&span, 0);
         return;
     }
 
@@ -96,48 +266,288 @@ void jpeg_compress(image_t *image, char *output_filename) {
     // Specify the destination for the compressed data (eg, a file)
     jpeg_stdio_dest(&cinfo, output_file);
 
-    // Set parameters for compression, including image size & colorspace
-    cinfo.image_width = (JDIMENSION) image->width;
-    cinfo.image_height = (JDIMENSION) image->height;
-    cinfo.input_components = image->channels;
-    cinfo.in_color_space = image->colorspace;
-    jpeg_set_defaults(&cinfo);
-    // TODO account for quantization with jpeg_set_quality(&cinfo, quality, TRUE /* limit to baseline-JPEG values */);
+    write_jpeg(&cinfo, image, options);
+    fclose(output_file);
 
-    // Start compression
-    jpeg_start_compress(&cinfo, TRUE);
+    // Release the JPEG compression object
+    jpeg_destroy_compress(&cinfo);
 
-    // Compress each line to the output file
-    row_stride = cinfo.image_width * cinfo.input_components;
-    while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &jsample_array[cinfo.next_scanline * row_stride];
-        (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    image->last_operation = COMPRESSION_SUCCESS;
+    trace_end(&span, image_bytes(image));
+}
+
+unsigned long jpeg_compress_buffer(image_t *image, const encode_options_t *options, unsigned char **buffer) {
+    struct jpeg_compress_struct cinfo;
+    struct error_manager jerr;
+
+    trace_span_t span = trace_begin("io", "jpeg_compress_buffer");
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+
+    // the buffer is grown with realloc(), so the caller releases it with free()
+    struct growing_destination_manager destination;
+    destination.buffer = NULL;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        // the destination always holds the current buffer, however many times it grew
+        jpeg_destroy_compress(&cinfo);
+        free(destination.buffer);
+        *buffer = NULL;
+        image->last_operation = COMPRESSION_FAILURE;
+        trace_end(&span, 0);
+        return 0;
     }
 
-    // Finish compression
-    jpeg_finish_compress(&cinfo);
-    fclose(output_file);
+    jpeg_create_compress(&cinfo);
+    unsigned char *initial = malloc(INITIAL_OUTPUT_CAPACITY);
+    if (!initial) ERREXIT1(&cinfo, JERR_OUT_OF_MEMORY, 0);
+    jpeg_growing_dest(&cinfo, &destination, initial, INITIAL_OUTPUT_CAPACITY);
 
-    // Release the JPEG compression object
+    write_jpeg(&cinfo, image, options);
+    unsigned long output_size = destination.capacity - destination.pub.free_in_buffer;
+    jpeg_destroy_compress(&cinfo);
+
+    *buffer = destination.buffer;
+    image->last_operation = COMPRESSION_SUCCESS;
+    trace_end(&span, image_bytes(image));
+    return output_size;
+}
+
+void init_growing_destination(j_compress_ptr cinfo) {
+    // The first buffer was already handed to the destination manager
+}
+
+boolean empty_growing_destination(j_compress_ptr cinfo) {
+    // Called with the whole buffer full: double it, keeping what was written
+    struct growing_destination_manager *destination = (struct growing_destination_manager *) cinfo->dest;
+    unsigned long capacity = destination->capacity * 2;
+    unsigned char *grown = realloc(destination->buffer, capacity);
+    if (!grown) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 1);
+
+    destination->buffer = grown;
+    destination->pub.next_output_byte = grown + destination->capacity;
+    destination->pub.free_in_buffer = capacity - destination->capacity;
+    destination->capacity = capacity;
+    return TRUE;
+}
+
+void term_growing_destination(j_compress_ptr cinfo) {
+    // Nothing to flush, compressed data is written in place
+}
+
+void jpeg_growing_dest(j_compress_ptr cinfo, struct growing_destination_manager *destination, unsigned char *buffer,
+                       unsigned long capacity) {
+    destination->buffer = buffer;
+    destination->capacity = capacity;
+    destination->pub.next_output_byte = buffer;
+    destination->pub.free_in_buffer = capacity;
+    destination->pub.init_destination = init_growing_destination;
+    destination->pub.empty_output_buffer = empty_growing_destination;
+    destination->pub.term_destination = term_growing_destination;
+    cinfo->dest = &destination->pub;
+}
+
+unsigned long jpeg_compress_bound(image_t *image, const encode_options_t *options) {
+    int h_sampling = options ? options->h_sampling : 2;
+    int v_sampling = options ? options->v_sampling : 2;
+    if (image->channels == 1) h_sampling = v_sampling = 1;
+
+    // Worst case of a baseline encode: every 8x8 block of every component costs at most (2 + chroma blocks per
+    // luma block) bytes per pixel, padded to whole MCUs, plus room for headers and Huffman/quantization tables
+    unsigned long mcu_width = 8UL * h_sampling;
+    unsigned long mcu_height = 8UL * v_sampling;
+    unsigned long padded_width = (image->width + mcu_width - 1) / mcu_width * mcu_width;
+    unsigned long padded_height = (image->height + mcu_height - 1) / mcu_height * mcu_height;
+    unsigned long chroma_factor = (image->channels == 1) ? 0 : 4 * 64 / (mcu_width * mcu_height);
+
+    return padded_width * padded_height * (2 + chroma_factor) + 2048;
+}
+
+struct fixed_destination_manager {
+    struct jpeg_destination_mgr pub;
+    unsigned long capacity;
+};
+
+void init_fixed_destination(j_compress_ptr cinfo) {
+    // The caller's buffer was already handed to the destination manager
+}
+
+boolean empty_fixed_destination(j_compress_ptr cinfo) {
+    // The caller's buffer can not grow: give up with a "buffer too small" error
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+    return FALSE;
+}
+
+void term_fixed_destination(j_compress_ptr cinfo) {
+    // Nothing to flush, compressed data is written in place
+}
+
+unsigned long jpeg_compress_into(image_t *image, const encode_options_t *options, unsigned char *buffer,
+                                 unsigned long capacity) {
+    struct jpeg_compress_struct cinfo;
+    struct error_manager jerr;
+    struct fixed_destination_manager destination;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        image->last_operation = COMPRESSION_FAILURE;
+        return 0;
+    }
+
+    jpeg_create_compress(&cinfo);
+
+    destination.pub.next_output_byte = buffer;
+    destination.pub.free_in_buffer = capacity;
+    destination.pub.init_destination = init_fixed_destination;
+    destination.pub.empty_output_buffer = empty_fixed_destination;
+    destination.pub.term_destination = term_fixed_destination;
+    destination.capacity = capacity;
+    cinfo.dest = &destination.pub;
+
+    write_jpeg(&cinfo, image, options);
+    unsigned long written = destination.capacity - destination.pub.free_in_buffer;
     jpeg_destroy_compress(&cinfo);
 
     image->last_operation = COMPRESSION_SUCCESS;
+    return written;
+}
+
+decode_options_t default_decode_options() {
+    decode_options_t options;
+    options.grayscale = FALSE;
+    options.dct_method = JDCT_ISLOW;
+    options.fancy_upsampling = TRUE;
+    options.block_smoothing = TRUE;
+    return options;
+}
+
+decode_options_t luminance_decode_options() {
+    decode_options_t options;
+    options.grayscale = TRUE;
+    options.dct_method = JDCT_IFAST;
+    options.fancy_upsampling = FALSE;
+    options.block_smoothing = FALSE;
+    return options;
+}
+
+void apply_decode_options(j_decompress_ptr cinfo, const decode_options_t *options) {
+    if (!options) return;
+
+    // Only YCbCr and grayscale sources can skip straight to the luma plane
+    if (options->grayscale && (cinfo->jpeg_color_space == JCS_YCbCr || cinfo->jpeg_color_space == JCS_GRAYSCALE)) {
+        cinfo->out_color_space = JCS_GRAYSCALE;
+    }
+    cinfo->dct_method = options->dct_method;
+    cinfo->do_fancy_upsampling = options->fancy_upsampling;
+    cinfo->do_block_smoothing = options->block_smoothing;
 }
 
 image_t *jpeg_decompress(char *input_filename) {
+    return jpeg_decompress_with_options(input_filename, NULL);
+}
+
+void read_jpeg(j_decompress_ptr cinfo, image_t *image, const decode_options_t *options, const region_t *region) {
+    JSAMPROW row_pointer[1];
+
+    // Read file parameters and image info with jpeg_read_header()
+    trace_span_t span = trace_begin("io", "jpeg_read_header");
+    (void) jpeg_read_header(cinfo, TRUE);
+    trace_end(&span, 0);
+
+    // Set parameters for decompression, keeping the defaults from jpeg_read_header() when no options are given
+    apply_decode_options(cinfo, options);
+
+    // Start decompression
+    span = trace_begin("io", "jpeg_read_scanlines");
+    (void) jpeg_start_decompress(cinfo);
+
+    if (region) {
+        read_jpeg_region(cinfo, image, region);
+        trace_end(&span, image_bytes(image));
+        return;
+    }
+
+    // Set fields with image info and build (or reuse) 2D array to hold RGB (or luminance) values of all pixels
+    reshape_pixels(image, cinfo->output_height, cinfo->output_width, cinfo->output_components);
+    image->colorspace = cinfo->out_color_space;
+
+    // Decompress each line straight into its row of the 2D array
+    while (cinfo->output_scanline < cinfo->output_height) {
+        row_pointer[0] = (JSAMPROW) image->pixels[cinfo->output_scanline];
+        (void) jpeg_read_scanlines(cinfo, row_pointer, 1);
+    }
+    trace_end(&span, image_bytes(image));
+}
+
+void read_jpeg_region(j_decompress_ptr cinfo, image_t *image, const region_t *region) {
+    // Clip the requested rectangle to the image
+    int first_x = region->x < 0 ? 0 : region->x;
+    int first_y = region->y < 0 ? 0 : region->y;
+    int last_x = min_int(region->x + region->width, (int) cinfo->output_width);
+    int last_y = min_int(region->y + region->height, (int) cinfo->output_height);
+    if (first_x >= last_x || first_y >= last_y) ERREXIT(cinfo, JERR_EMPTY_IMAGE);
+
+    reshape_pixels(image, last_y - first_y, last_x - first_x, cinfo->output_components);
+    image->colorspace = cinfo->out_color_space;
+
+    JDIMENSION crop_x = (JDIMENSION) first_x;
+#ifdef LIBJPEG_TURBO_VERSION
+    // Only decode the iMCU columns covering the region (crop_x is moved left to an iMCU boundary and the
+    // output width grows to match), then skip whole iMCU rows above it without running the IDCT on them.
+    // Upsampling and block smoothing replicate the edges of what is decoded, so one more iMCU is decoded on
+    // each side and trimmed, giving the pixels the region has in a decode of the whole image.
+    int imcu_width = cinfo->max_h_samp_factor * (int) cinfo->min_DCT_scaled_size;
+    int imcu_height = cinfo->max_v_samp_factor * (int) cinfo->min_DCT_scaled_size;
+    int decoded_first_x = first_x > imcu_width ? first_x - imcu_width : 0;
+    int decoded_last_x = min_int(last_x + imcu_width, (int) cinfo->output_width);
+    int decoded_first_y = first_y > imcu_height ? first_y - imcu_height : 0;
+    crop_x = (JDIMENSION) decoded_first_x;
+    JDIMENSION crop_width = (JDIMENSION) (decoded_last_x - decoded_first_x);
+    jpeg_crop_scanline(cinfo, &crop_x, &crop_width);
+    if (decoded_first_y > 0) jpeg_skip_scanlines(cinfo, (JDIMENSION) decoded_first_y);
+#else
+    // Plain libjpeg can neither crop nor skip: decode and discard everything above the region
+    crop_x = 0;
+#endif
+
+    // Make a one-row-high sample array that will go away when done with image
+    JSAMPARRAY line_buffer = (*cinfo->mem->alloc_sarray)((j_common_ptr) cinfo, JPOOL_IMAGE,
+                                                         cinfo->output_width * cinfo->output_components, 1);
+    size_t region_offset = (size_t) (first_x - crop_x) * image->channels;
+    size_t region_stride = (size_t) image->width * image->channels;
+
+    while ((int) cinfo->output_scanline < last_y) {
+        (void) jpeg_read_scanlines(cinfo, line_buffer, 1);
+        int row = (int) cinfo->output_scanline - 1 - first_y;
+        if (row >= 0) memcpy(image->pixels[row], line_buffer[0] + region_offset, region_stride);
+    }
+
+    // Rows below the region are never decoded, so the object must be aborted rather than finished
+    jpeg_abort_decompress(cinfo);
+}
+
+image_t *jpeg_decompress_with_options(char *input_filename, const decode_options_t *options) {
+    return jpeg_decompress_region(input_filename, NULL, options);
+}
+
+image_t *jpeg_decompress_region(char *input_filename, const region_t *region, const decode_options_t *options) {
     image_t *image = new_image();
 
     struct jpeg_decompress_struct cinfo;
     struct error_manager jerr;
 
     FILE *input_file;
-    JSAMPARRAY line_buffer;
-    int row_stride;
+    trace_span_t span = trace_begin("io", "jpeg_decompress");
 
     // Open the input file before doing anything else, so that the setjmp() error recovery below can assume the file is open.
     if ((input_file = fopen(input_filename, "rb")) == NULL) {
         fprintf(stderr, "Can't open %s\n", input_filename);
         image->last_operation = FOPEN_FAILURE;
+        trace_end(&span, 0);
         return image;
     }
 
@@ -147,10 +557,13 @@ image_t *jpeg_decompress(char *input_filename) {
 
     // Establish the setjmp return context for my_error_exit to use.
     if (setjmp(jerr.setjmp_buffer)) {
-        // Here the JPEG code has signaled an error. Clean up the JPEG object, close the input file, and return.
+        // Here the JPEG code has signaled an error. Clean up the JPEG object, close the input file, drop the rows
+        // decoded so far, and return.
         jpeg_destroy_decompress(&cinfo);
         fclose(input_file);
+        free_pixels(image);
         image->last_operation = DECOMPRESSION_FAILURE;
+        trace_end(&span, 0);
         return image;
     }
 
@@ -160,53 +573,116 @@ image_t *jpeg_decompress(char *input_filename) {
     // Specify the source of the compressed data (eg, a file)
     jpeg_stdio_src(&cinfo, input_file);
 
-    // Read file parameters and image info with jpeg_read_header()
-    (void) jpeg_read_header(&cinfo, TRUE);
+    read_jpeg(&cinfo, image, options, region);
+    image->filename = ipp_strdup(input_filename);
 
-    // Set parameters for decompression: do nothing since we want the defaults from jpeg_read_header()
+    // Release JPEG decompression object
+    jpeg_destroy_decompress(&cinfo);
 
-    // Start decompression
-    (void) jpeg_start_decompress(&cinfo);
+    // Close input file
+    fclose(input_file);
 
-    // Set fields with image info
-    image->filename = strdup(input_filename);
-    image->height = cinfo.output_height;
-    image->width = cinfo.output_width;
-    image->channels = cinfo.output_components;
-    image->colorspace = cinfo.out_color_space;
+    image->last_operation = DECOMPRESSION_SUCCESS;
+    trace_end(&span, image_bytes(image));
+    return image;
+}
 
-    // Calculate physical/array size of a line
-    row_stride = cinfo.output_width * cinfo.output_components;
-    // Make a one-row-high sample array that will go away when done with image
-    line_buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, (JDIMENSION) row_stride, 1);
+image_t *jpeg_decompress_buffer(const unsigned char *buffer, unsigned long size, const decode_options_t *options) {
+    return jpeg_decompress_buffer_region(buffer, size, NULL, options);
+}
 
-    // Build 2D array to hold RGB (or luminance) values of all pixels
-    image->pixels = new_unsigned_char_matrix(cinfo.output_height, row_stride);
+image_t *jpeg_decompress_buffer_region(const unsigned char *buffer, unsigned long size, const region_t *region,
+                                       const decode_options_t *options) {
+    image_t *image = new_image();
+
+    struct jpeg_decompress_struct cinfo;
+    struct error_manager jerr;
+    trace_span_t span = trace_begin("io", "jpeg_decompress_buffer");
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
 
-    // Decompress each line from the input file to buffer and copy to 2D array
-    while (cinfo.output_scanline < cinfo.output_height) {
-        (void) jpeg_read_scanlines(&cinfo, line_buffer, 1);
-        memcpy(image->pixels[cinfo.output_scanline - 1], line_buffer[0], row_stride * sizeof(unsigned char));
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        free_pixels(image);
+        image->last_operation = DECOMPRESSION_FAILURE;
+        trace_end(&span, 0);
+        return image;
     }
 
-    // Release JPEG decompression object
-    jpeg_destroy_decompress(&cinfo);
+    jpeg_create_decompress(&cinfo);
 
-    // Close input file
-    fclose(input_file);
+    // Read the compressed data straight from memory, no stdio buffering involved
+    jpeg_mem_src(&cinfo, buffer, size);
+
+    read_jpeg(&cinfo, image, options, region);
+
+    jpeg_destroy_decompress(&cinfo);
 
     image->last_operation = DECOMPRESSION_SUCCESS;
+    trace_end(&span, image_bytes(image));
     return image;
 }
 
+image_t *jpeg_decompress_mapped(char *input_filename, const decode_options_t *options) {
+    int input_fd;
+    struct stat input_stat;
+
+    if ((input_fd = open(input_filename, O_RDONLY)) < 0 || fstat(input_fd, &input_stat) < 0 || input_stat.st_size == 0) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        if (input_fd >= 0) close(input_fd);
+        image_t *image = new_image();
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    // Map the file so libjpeg reads the page cache directly instead of copying through a stdio buffer
+    size_t size = (size_t) input_stat.st_size;
+    unsigned char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close(input_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", input_filename);
+        image_t *image = new_image();
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    image_t *image = jpeg_decompress_buffer(mapping, size, options);
+    munmap(mapping, size);
+
+    if (image->last_operation == DECOMPRESSION_SUCCESS) image->filename = ipp_strdup(input_filename);
+    return image;
+}
+
+void reshape_pixels(image_t *image, int height, int width, int channels) {
+    invalidate_histograms(image);
+    if (image->pixels && image->height == height && image->width == width && image->channels == channels) return;
+
+    if (image->pixels) free_pixels(image);
+    image->height = height;
+    image->width = width;
+    image->channels = channels;
+    image->pixels = new_unsigned_char_matrix(height, width * channels);
+}
+
 unsigned char **new_unsigned_char_matrix(int rows, int cols) {
-    unsigned char **pixel_array = (unsigned char **) malloc(rows * sizeof(unsigned char *));
+    // One block: the row pointers, then the rows back to back starting at an aligned address
+    size_t pointers_size = (rows * sizeof(unsigned char *) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    unsigned char **pixel_array = pooled_pixels(pointers_size + (size_t) rows * cols);
+    if (!pixel_array) return NULL;
+
+    unsigned char *data = (unsigned char *) pixel_array + pointers_size;
     for (int i = 0; i < rows; ++i) {
-        pixel_array[i] = (unsigned char *) malloc(cols * sizeof(unsigned char));
+        pixel_array[i] = data + (size_t) i * cols;
     }
     return pixel_array;
 }
 
+void free_unsigned_char_matrix(unsigned char **matrix) {
+    release_pooled_pixels(matrix);
+}
+
 void my_error_exit(j_common_ptr cinfo) {
     // cinfo->err really points to a error_manager struct, so coerce pointer
     error_manager_ptr manager_ptr = (error_manager_ptr) cinfo->err;
@@ -219,7 +695,7 @@ void my_error_exit(j_common_ptr cinfo) {
 }
 
 JSAMPLE *pixel_array_to_jsample_array(image_t *image) {
-    JSAMPLE *jsample_array = (JSAMPLE *) malloc((size_t) image->height * image->width * image->channels);
+    JSAMPLE *jsample_array = (JSAMPLE *) ipp_malloc((size_t) image->height * image->width * image->channels);
     int jsample_index = 0;
     for (int i = 0; i < image->height; ++i) {
         for (int j = 0; j < image->width * image->channels; ++j) {
@@ -230,7 +706,7 @@ JSAMPLE *pixel_array_to_jsample_array(image_t *image) {
 }
 
 unsigned char *pixel_array_to_unsigned_char_array(image_t *image) {
-    unsigned char *array = (unsigned char *) malloc((size_t) image->height * image->width * image->channels);
+    unsigned char *array = (unsigned char *) ipp_malloc((size_t) image->height * image->width * image->channels);
     int index = 0;
     for (int i = 0; i < image->height; ++i) {
         for (int j = 0; j < image->width * image->channels; ++j) {
@@ -240,42 +716,63 @@ unsigned char *pixel_array_to_unsigned_char_array(image_t *image) {
     return array;
 }
 
+void image_to_buffer(image_t *image, unsigned char *buffer, int channels) {
+    trace_span_t span = trace_begin("copy", "image_to_buffer");
+    for (int i = 0; i < image->height; ++i) {
+        convert_pixels(image->pixels[i], image->channels, buffer + (size_t) i * image->width * channels, channels,
+                       image->width);
+    }
+    trace_end(&span, (size_t) image->height * image->width * channels);
+}
+
 void mirror_vertically(image_t *image) {
+    trace_span_t span = trace_begin("op", "mirror_vertically");
     for (int top = 0, bot = image->height - 1; top < image->height / 2; ++top, --bot) {
         unsigned char *swap = image->pixels[top];
         image->pixels[top] = image->pixels[bot];
         image->pixels[bot] = swap;
     }
+    trace_end(&span, image_bytes(image));
 }
 
 void mirror_horizontally(image_t *image) {
-    // Iterate over lines
+    trace_span_t span = trace_begin("op", "mirror_horizontally");
     for (int i = 0; i < image->height; ++i) {
-        // Iterate over columns
-        for (int left = 0, right = image->channels * (image->width - 1);
-             left < (image->width * image->channels) / 2; left += image->channels, right -= image->channels) {
-
-            // Swap all channels
-            unsigned char *swap = malloc(sizeof(unsigned char) * image->channels);
-            for (int c = 0; c < image->channels; ++c) {
-                swap[c] = image->pixels[i][left + c];
-                image->pixels[i][left + c] = image->pixels[i][right + c];
-                image->pixels[i][right + c] = swap[c];
-            }
-        }
+        mirror_pixels(image->pixels[i], image->width, image->channels);
     }
+    trace_end(&span, image_bytes(image));
 }
 
 void free_pixels(image_t *image) {
-    for (int row = 0; row < image->height; ++row) {
-        free(image->pixels[row]);
+    // Rows either live in the same block as the row pointers, which is kept for the next matrix, or in a file mapping
+    if (image->mapping) ipp_free(image->pixels);
+    else free_unsigned_char_matrix(image->pixels);
+    image->pixels = NULL;
+
+    if (image->mapping) {
+        munmap(image->mapping, image->mapping_size);
+        image->mapping = NULL;
+        image->mapping_size = 0;
     }
-    free(image->pixels);
 }
 
-image_t *get_displayable(image_t *image) {
-    if (image->colorspace == JCS_RGB) return image;
+void free_image(image_t *image) {
+    if (!image) return;
+    free_pixels(image);
+    ipp_free(image->filename);
+    ipp_free(image->histograms);
+    release_pooled_header(image);
+}
+
+void free_histogram(int *histogram) {
+    ipp_free(histogram);
+}
+
+size_t image_bytes(const image_t *image) {
+    return (size_t) image->height * image->width * image->channels;
+}
 
+image_t *get_displayable(image_t *image) {
     image_t *displayable = copy_image(image);
     luminance_to_rgb(displayable);
 
@@ -283,39 +780,63 @@ image_t *get_displayable(image_t *image) {
 }
 
 void rgb_to_luminance(image_t *image) {
-    if (image->colorspace == JCS_GRAYSCALE) {
-        printf("Already grayscale!\n");
-        return;
-    }
+    // Images decoded with grayscale output are already in luminance
+    if (image->colorspace == JCS_GRAYSCALE) return;
 
+    trace_span_t span = trace_begin("op", "rgb_to_luminance");
     unsigned char **new_pixels = new_unsigned_char_matrix(image->height, image->width);
     for (int i = 0; i < image->height; ++i) {
-        for (int j = 0; j < image->width * image->channels; j += image->channels) {
-            int luminance = (int) (0.299 * (int) image->pixels[i][j] +
-                                   0.587 * (int) image->pixels[i][j + 1] +
-                                   0.114 * (int) image->pixels[i][j + 2]);
-
-            new_pixels[i][j / 3] = (unsigned char) luminance;
-        }
+        convert_pixels(image->pixels[i], image->channels, new_pixels[i], 1, image->width);
     }
 
     image->colorspace = JCS_GRAYSCALE;
     image->channels = 1;
 
+    // the luminance histogram is now the one of the only channel
+    image_histograms_t *histograms = image->histograms;
+    if (histograms) {
+        histograms->channels_valid = histograms->luminance_valid;
+        memcpy(histograms->channel[0], histograms->luminance, sizeof(histograms->luminance));
+    }
+
     free_pixels(image);
     image->pixels = new_pixels;
+    trace_end(&span, image_bytes(image));
 }
 
 void luminance_to_rgb(image_t *image) {
     if (image->colorspace == JCS_RGB) return;
 
+    trace_span_t span = trace_begin("op", "luminance_to_rgb");
     unsigned char **new_pixels = new_unsigned_char_matrix(image->height, image->width * 3);
     for (int i = 0; i < image->height; ++i) {
-        for (int j = 0; j < image->width; ++j) {
-            for (int c = 0; c < 3; ++c) {
-                new_pixels[i][j * 3 + c] = image->pixels[i][j];
+        convert_pixels(image->pixels[i], image->channels, new_pixels[i], 3, image->width);
+    }
+
+    // every channel copies the old one, whose values map to their luminance through a table
+    image_histograms_t *histograms = image->histograms;
+    if (histograms && image->channels == 1) {
+        if (!histograms->channels_valid && histograms->luminance_valid) {
+            memcpy(histograms->channel[0], histograms->luminance, sizeof(histograms->luminance));
+            histograms->channels_valid = TRUE;
+        }
+        if (histograms->channels_valid) {
+            unsigned char grays[3 * 256], luminance_lut[256];
+            for (int value = 0; value < 256; ++value) {
+                grays[3 * value] = grays[3 * value + 1] = grays[3 * value + 2] = (unsigned char) value;
             }
+            convert_pixels(grays, 3, luminance_lut, 1, 256);
+
+            memset(histograms->luminance, 0, sizeof(histograms->luminance));
+            for (int value = 0; value < HISTOGRAM_SIZE; ++value) {
+                histograms->luminance[luminance_lut[value]] += histograms->channel[0][value];
+            }
+            memcpy(histograms->channel[1], histograms->channel[0], sizeof(histograms->channel[0]));
+            memcpy(histograms->channel[2], histograms->channel[0], sizeof(histograms->channel[0]));
         }
+        histograms->luminance_valid = histograms->channels_valid;
+    } else {
+        invalidate_histograms(image);
     }
 
     image->colorspace = JCS_RGB;
@@ -323,15 +844,20 @@ void luminance_to_rgb(image_t *image) {
 
     free_pixels(image);
     image->pixels = new_pixels;
+    trace_end(&span, image_bytes(image));
 }
 
 void quantize(image_t *image, int n_tones) {
-    for (int i = 0; i < image->height; ++i) {
-        for (int j = 0; j < image->width * image->channels; j += image->channels) {
-            for (int c = 0; c < image->channels; ++c) {
-                image->pixels[i][j + c] = closest_level(image->pixels[i][j + c], n_tones);
-            }
-        }
+    trace_span_t span = trace_begin("op", "quantize");
+    unsigned char lut[256];
+    quantize_lut(n_tones, lut);
+    apply_lut(image, lut);
+    trace_end(&span, image_bytes(image));
+}
+
+void quantize_lut(int n_tones, unsigned char *lut) {
+    for (int value = 0; value < 256; ++value) {
+        lut[value] = closest_level((unsigned char) value, n_tones);
     }
 }
 
@@ -348,17 +874,140 @@ unsigned char closest_level(unsigned char value, int n_tones) {
 
 int *compute_histogram(image_t *image) {
     int *histogram = new_histogram();
+    luminance_histogram(image, histogram);
+    return histogram;
+}
 
-    image_t *gs_image = copy_image(image);
-    rgb_to_luminance(gs_image);
+void luminance_histogram(image_t *image, int *histogram) {
+    image_histograms_t *histograms = image->histograms;
+    if (histograms && histograms->luminance_valid) {
+        memcpy(histogram, histograms->luminance, HISTOGRAM_SIZE * sizeof(int));
+        return;
+    }
 
-    for (int row = 0; row < gs_image->height; ++row) {
-        for (int col = 0; col < gs_image->width; ++col) {
-            ++histogram[gs_image->pixels[row][col]];
+    trace_span_t span = trace_begin("op", "compute_histogram");
+    memset(histogram, 0, HISTOGRAM_SIZE * sizeof(int));
+    count_luminance(image, histogram);
+    if (histograms) {
+        memcpy(histograms->luminance, histogram, HISTOGRAM_SIZE * sizeof(int));
+        histograms->luminance_valid = TRUE;
+    }
+    trace_end(&span, image_bytes(image));
+}
+
+void channel_histograms(image_t *image, int histograms[][HISTOGRAM_SIZE]) {
+    int channels = min_int(image->channels, MAX_CHANNELS);
+    if (image->histograms && image->histograms->channels_valid) {
+        memcpy(histograms, image->histograms->channel, channels * sizeof(image->histograms->channel[0]));
+        return;
+    }
+
+    trace_span_t span = trace_begin("op", "channel_histograms");
+    memset(histograms, 0, channels * sizeof(histograms[0]));
+    count_channels(image, histograms);
+    trace_end(&span, image_bytes(image));
+}
+
+void count_luminance(image_t *image, int *histogram) {
+    // count the luminance row by row instead of converting a copy of the image
+    scratch_mark_t mark = scratch_mark();
+    unsigned char *luminance = image->colorspace == JCS_GRAYSCALE ? NULL : scratch_alloc(image->width);
+    for (int row = 0; row < image->height; ++row) {
+        if (luminance) convert_pixels(image->pixels[row], image->channels, luminance, 1, image->width);
+        count_components(luminance ? luminance : image->pixels[row], image->width, histogram);
+    }
+    scratch_release(mark);
+}
+
+void count_channels(image_t *image, int histograms[][HISTOGRAM_SIZE]) {
+    if (image->channels == 1) {
+        for (int row = 0; row < image->height; ++row) {
+            count_components(image->pixels[row], image->width, histograms[0]);
         }
+        return;
     }
 
-    return histogram;
+    // channels past MAX_CHANNELS are not counted
+    int channels = min_int(image->channels, MAX_CHANNELS);
+    for (int row = 0; row < image->height; ++row) {
+        const unsigned char *pixel = image->pixels[row];
+        for (int x = 0; x < image->width; ++x, pixel += image->channels) {
+            for (int c = 0; c < channels; ++c) {
+                ++histograms[c][pixel[c]];
+            }
+        }
+    }
+}
+
+image_histograms_t *histograms_of(image_t *image) {
+    if (!image->histograms) image->histograms = ipp_calloc(1, sizeof(image_histograms_t));
+    return image->histograms;
+}
+
+const image_histograms_t *image_histograms(image_t *image) {
+    image_histograms_t *histograms = histograms_of(image);
+    if (!histograms || (histograms->channels_valid && histograms->luminance_valid)) return histograms;
+
+    trace_span_t span = trace_begin("op", "image_histograms");
+    if (!histograms->channels_valid && image->channels <= MAX_CHANNELS) {
+        memset(histograms->channel, 0, sizeof(histograms->channel));
+        count_channels(image, histograms->channel);
+        histograms->channels_valid = TRUE;
+    }
+
+    // the luminance of a single channel is that channel
+    if (!histograms->luminance_valid) {
+        memset(histograms->luminance, 0, sizeof(histograms->luminance));
+        if (image->channels == 1 && histograms->channels_valid) {
+            memcpy(histograms->luminance, histograms->channel[0], sizeof(histograms->luminance));
+        } else {
+            count_luminance(image, histograms->luminance);
+        }
+        histograms->luminance_valid = TRUE;
+    }
+    trace_end(&span, image_bytes(image));
+    return histograms;
+}
+
+const image_histograms_t *image_channel_histograms(image_t *image) {
+    image_histograms_t *histograms = histograms_of(image);
+    if (!histograms || histograms->channels_valid || image->channels > MAX_CHANNELS) return histograms;
+
+    trace_span_t span = trace_begin("op", "image_channel_histograms");
+    memset(histograms->channel, 0, sizeof(histograms->channel));
+    count_channels(image, histograms->channel);
+    histograms->channels_valid = TRUE;
+    trace_end(&span, image_bytes(image));
+    return histograms;
+}
+
+void invalidate_histograms(image_t *image) {
+    if (!image->histograms) return;
+    image->histograms->channels_valid = FALSE;
+    image->histograms->luminance_valid = FALSE;
+}
+
+void map_histogram(int *histogram, const unsigned char *lut) {
+    int mapped[HISTOGRAM_SIZE] = {0};
+    for (int value = 0; value < HISTOGRAM_SIZE; ++value) {
+        mapped[lut[value]] += histogram[value];
+    }
+    memcpy(histogram, mapped, sizeof(mapped));
+}
+
+void map_histograms(image_histograms_t *histograms, int channels, const unsigned char *lut) {
+    if (histograms->channels_valid) {
+        for (int c = 0; c < channels && c < MAX_CHANNELS; ++c) {
+            map_histogram(histograms->channel[c], lut);
+        }
+    }
+
+    // the luminance of several channels mapped one by one is not a function of the old luminance
+    if (channels == 1 && histograms->luminance_valid) {
+        map_histogram(histograms->luminance, lut);
+    } else {
+        histograms->luminance_valid = FALSE;
+    }
 }
 
 image_t *histogram_plot(int *histogram) {
@@ -394,74 +1043,176 @@ image_t *histogram_plot(int *histogram) {
     return plot;
 }
 
-void add_bias(image_t *image, double bias) {
-    for (int h = 0; h < image->height; ++h) {
-        for (int w = 0; w < image->width * image->channels; w += image->channels) {
-            for (int c = 0; c < image->channels; ++c) {
-                double sum = image->pixels[h][w + c] + bias;
-
-                //verify saturation
-                if (sum > 255) {
-                    image->pixels[h][w + c] = 255;
-                } else if (sum < 0) {
-                    image->pixels[h][w + c] = 0;
-                } else {
-                    image->pixels[h][w + c] = (unsigned char) sum;
+image_t *channel_histogram_plot(int histograms[][HISTOGRAM_SIZE], int channels) {
+    channels = min_int(channels, 3);
+    image_t *plot = new_image();
+    plot->height = HISTOGRAM_SIZE;
+    plot->width = HISTOGRAM_SIZE;
+    plot->channels = 3;
+    plot->colorspace = JCS_RGB;
+    plot->pixels = new_unsigned_char_matrix(plot->height, plot->width * 3);
+
+    int histogram_max_value = 1;
+    for (int c = 0; c < channels; ++c) {
+        for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+            if (histograms[c][i] > histogram_max_value) {
+                histogram_max_value = histograms[c][i];
+            }
+        }
+    }
+
+    float scale_factor = (float) (HISTOGRAM_SIZE - 1) / histogram_max_value;
+    for (int col = 0; col < HISTOGRAM_SIZE; ++col) {
+        int bar_top[3];
+        for (int c = 0; c < channels; ++c) {
+            bar_top[c] = plot->height - 1 - (int) (scale_factor * histograms[c][col]);
+        }
+
+        // a component is cleared by the bars of the other channels, so that a bar alone shows its own colour
+        for (int row = 0; row < plot->height; ++row) {
+            for (int component = 0; component < 3; ++component) {
+                unsigned char value = 255;
+                for (int c = 0; c < channels; ++c) {
+                    if (c != component && row >= bar_top[c]) value = 0;
                 }
+                plot->pixels[row][col * 3 + component] = value;
             }
         }
     }
+
+    return plot;
 }
 
-void multiply_gain(image_t *image, double gain) {
+void apply_lut(image_t *image, const unsigned char *lut) {
+    trace_span_t span = trace_begin("op", "apply_lut");
     for (int h = 0; h < image->height; ++h) {
-        for (int w = 0; w < image->width * image->channels; w += image->channels) {
-            for (int c = 0; c < image->channels; ++c) {
-                double mult = image->pixels[h][w + c] * gain;
-
-                //verify saturation
-                if (mult > 255) {
-                    image->pixels[h][w + c] = 255;
-                } else {
-                    image->pixels[h][w + c] = (unsigned char) mult;
-                }
+        map_components(image->pixels[h], image->pixels[h], image->width * image->channels, lut);
+    }
+    if (image->histograms) map_histograms(image->histograms, image->channels, lut);
+    trace_end(&span, image_bytes(image));
+}
+
+void apply_channel_luts(image_t *image, const unsigned char *luts) {
+    trace_span_t span = trace_begin("op", "apply_channel_luts");
+    for (int h = 0; h < image->height; ++h) {
+        map_channels(image->pixels[h], image->pixels[h], image->width, image->channels, luts);
+    }
+
+    image_histograms_t *histograms = image->histograms;
+    if (histograms) {
+        if (histograms->channels_valid) {
+            for (int c = 0; c < image->channels && c < MAX_CHANNELS; ++c) {
+                map_histogram(histograms->channel[c], luts + c * 256);
             }
         }
+        if (image->channels == 1 && histograms->luminance_valid) map_histogram(histograms->luminance, luts);
+        else histograms->luminance_valid = FALSE;
     }
+    trace_end(&span, image_bytes(image));
 }
 
-void negative(image_t *image) {
+void apply_luma_lut(image_t *image, const unsigned char *lut) {
+    trace_span_t span = trace_begin("op", "apply_luma_lut");
     for (int h = 0; h < image->height; ++h) {
-        for (int w = 0; w < image->width * image->channels; w += image->channels) {
-            for (int c = 0; c < image->channels; ++c) {
-                image->pixels[h][w + c] = (unsigned char) 255 - image->pixels[h][w + c];
-            }
+        map_luma(image->pixels[h], image->pixels[h], image->width, image->channels, lut);
+    }
+
+    // shifting every channel by the change of the luminance, with saturation, is no function of the histograms
+    if (image->channels == 1 && image->histograms) map_histograms(image->histograms, 1, lut);
+    else invalidate_histograms(image);
+    trace_end(&span, image_bytes(image));
+}
+
+void add_bias(image_t *image, double bias) {
+    trace_span_t span = trace_begin("op", "add_bias");
+    unsigned char lut[256];
+    bias_lut(bias, lut);
+    apply_lut(image, lut);
+    trace_end(&span, image_bytes(image));
+}
+
+void bias_lut(double bias, unsigned char *lut) {
+    for (int value = 0; value < 256; ++value) {
+        double sum = value + bias;
+
+        //verify saturation
+        if (sum > 255) {
+            lut[value] = 255;
+        } else if (sum < 0) {
+            lut[value] = 0;
+        } else {
+            lut[value] = (unsigned char) sum;
         }
     }
 }
 
+void multiply_gain(image_t *image, double gain) {
+    trace_span_t span = trace_begin("op", "multiply_gain");
+    unsigned char lut[256];
+    gain_lut(gain, lut);
+    apply_lut(image, lut);
+    trace_end(&span, image_bytes(image));
+}
+
+void gain_lut(double gain, unsigned char *lut) {
+    for (int value = 0; value < 256; ++value) {
+        double mult = value * gain;
+
+        //verify saturation
+        if (mult > 255) {
+            lut[value] = 255;
+        } else {
+            lut[value] = (unsigned char) mult;
+        }
+    }
+}
+
+void negative(image_t *image) {
+    trace_span_t span = trace_begin("op", "negative");
+    unsigned char lut[256];
+    negative_lut(lut);
+    apply_lut(image, lut);
+    trace_end(&span, image_bytes(image));
+}
+
+void negative_lut(unsigned char *lut) {
+    for (int value = 0; value < 256; ++value) {
+        lut[value] = (unsigned char) (255 - value);
+    }
+}
+
 void equalize_histogram(image_t *image) {
-    image_t *copy = copy_image(image);
+    trace_span_t span = trace_begin("op", "equalize_histogram");
     int *hist_cum = compute_norm_cum_histogram(image);
 
-    for (int h = 0; h < image->height; ++h) {
-        for (int w = 0; w < image->width * image->channels; w += image->channels) {
-            for (int c = 0; c < image->channels; ++c) {
-                image->pixels[h][w + c] = (unsigned char) hist_cum[copy->pixels[h][w + c]];
-            }
-        }
+    // every component maps through the cumulative histogram independently, so no copy of the image is needed
+    unsigned char lut[256];
+    for (int i = 0; i < 256; ++i) {
+        lut[i] = (unsigned char) hist_cum[i];
     }
+    apply_lut(image, lut);
+    free_histogram(hist_cum);
+    trace_end(&span, image_bytes(image));
 }
 
 int *compute_norm_cum_histogram(image_t *image) {
-    image_t *gs_image = copy_image(image);
-    rgb_to_luminance(gs_image);
-
-    int *hist = compute_histogram(gs_image);
+    trace_span_t span = trace_begin("op", "compute_norm_cum_histogram");
+    // compute_histogram() already counts the luminance of RGB images, without a converted copy
+    int *hist = compute_histogram(image);
     int *hist_cum = new_histogram();
-    int pixels_in_hist = pixels_in_histogram(hist);
+    norm_cum_histogram(hist, hist_cum);
+    free_histogram(hist);
+    trace_end(&span, image_bytes(image));
+    return hist_cum;
+}
 
-    double scale_factor = (double) 255 / pixels_in_hist;
+void norm_cum_histogram(const int *hist, int *hist_cum) {
+    // the histogram of no pixels (an empty image or region) has nothing to scale, and stays 0 at every tone
+    int pixels = pixels_in_histogram(hist);
+    if (pixels == 0) {
+        memset(hist_cum, 0, HISTOGRAM_SIZE * sizeof(int));
+        return;
+    }
 
     // accumulate
     hist_cum[0] = hist[0];
@@ -469,12 +1220,11 @@ int *compute_norm_cum_histogram(image_t *image) {
         hist_cum[i] = (hist_cum[i - 1] + hist[i]);
     }
 
-    // normalize
+    // normalize, rounding up in integers: ceil(count * (255.0 / pixels)) gives 256 for all of 13 pixels, which
+    // tables of unsigned char turn into 0
     for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
-        hist_cum[i] = (int) ceil(hist_cum[i] * scale_factor);
+        hist_cum[i] = (int) (((long long) hist_cum[i] * 255 + pixels - 1) / pixels);
     }
-
-    return hist_cum;
 }
 
 int pixels_in_histogram(const int *hist) {
@@ -485,228 +1235,258 @@ int pixels_in_histogram(const int *hist) {
     return pixels_in_hist;
 }
 
-/**
- * For each tone, find the tone that has the closest number of corresponding pixels
- * @param tone the tone to have its pixel count mapped
- * @param hist_cum_source source cumulative histogram
- * @param hist_cum_target target cumulative histogram
- * @return the tone that has the closest pixel count in target histogram
- */
-int find_target_tone_closest_to(int tone, const int *hist_cum_source, const int *hist_cum_target) {
-    int ideal_pixel_count = hist_cum_source[tone];
-    int tone_for_closest_pixel_count = 0;
+void histogram_matching_lut(const int *hist_cum_source, const int *hist_cum_target, unsigned char *lut) {
+    // first tone holding each count of the target, as the earliest of equally close tones wins
+    int first_of_count[HISTOGRAM_SIZE];
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+        boolean repeated = tone > 0 && hist_cum_target[tone] == hist_cum_target[tone - 1];
+        first_of_count[tone] = repeated ? first_of_count[tone - 1] : tone;
+    }
 
-    for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
-        if (abs(ideal_pixel_count - hist_cum_target[i]) <
-            abs(ideal_pixel_count - hist_cum_target[tone_for_closest_pixel_count])) {
-            tone_for_closest_pixel_count = i;
+    // both histograms rise with the tone, so the first target count at or above the source count only moves forward,
+    // and the closest count is either that one or the one right before it
+    int above = 0;
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+        int count = hist_cum_source[tone];
+        while (above < HISTOGRAM_SIZE && hist_cum_target[above] < count) ++above;
+
+        int closest;
+        if (above == HISTOGRAM_SIZE) {
+            closest = first_of_count[HISTOGRAM_SIZE - 1];
+        } else if (above == 0) {
+            closest = 0;
+        } else if (count - hist_cum_target[above - 1] <= hist_cum_target[above] - count) {
+            closest = first_of_count[above - 1];
+        } else {
+            closest = above;
         }
+        lut[tone] = (unsigned char) closest;
     }
-
-    return tone_for_closest_pixel_count;
 }
 
-/**
- * Builds a histogram that makes that makes source match target
- * @param hist_cum_source source cumulative histogram
- * @param hist_cum_target target cumulative histogram
- * @return
- */
 int *compute_histogram_matching(const int *hist_cum_source, const int *hist_cum_target) {
+    unsigned char lut[HISTOGRAM_SIZE];
+    histogram_matching_lut(hist_cum_source, hist_cum_target, lut);
+
     int *histogram_matching = new_histogram();
     for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
-        histogram_matching[tone] = find_target_tone_closest_to(tone, hist_cum_source, hist_cum_target);
+        histogram_matching[tone] = lut[tone];
     }
     return histogram_matching;
 }
 
-void match_histogram(image_t *source, image_t *target) {
-    //assert images are in grayscale
-    rgb_to_luminance(source);
-    rgb_to_luminance(target);
+void equalize_histogram_with_mode(image_t *image, enum histogram_mode mode) {
+    if (mode == HISTOGRAM_MODE_LUMINANCE) {
+        equalize_histogram(image);
+        return;
+    }
+    if (mode == HISTOGRAM_MODE_CHANNELS && image->channels > MAX_CHANNELS) {
+        fprintf(stderr, "Per-channel equalization supports up to %d channels\n", MAX_CHANNELS);
+        return;
+    }
+
+    trace_span_t span = trace_begin("op", mode == HISTOGRAM_MODE_CHANNELS ? "equalize_histogram_channels"
+                                                                          : "equalize_histogram_luma");
+    int hist_cum[HISTOGRAM_SIZE];
+    if (mode == HISTOGRAM_MODE_CHANNELS) {
+        int histograms[MAX_CHANNELS][HISTOGRAM_SIZE];
+        channel_histograms(image, histograms);
+        unsigned char luts[MAX_CHANNELS * HISTOGRAM_SIZE];
+        for (int c = 0; c < image->channels; ++c) {
+            norm_cum_histogram(histograms[c], hist_cum);
+            for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+                luts[c * HISTOGRAM_SIZE + tone] = (unsigned char) hist_cum[tone];
+            }
+        }
+        apply_channel_luts(image, luts);
+    } else {
+        int histogram[HISTOGRAM_SIZE];
+        luminance_histogram(image, histogram);
+        norm_cum_histogram(histogram, hist_cum);
+        unsigned char lut[HISTOGRAM_SIZE];
+        for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+            lut[tone] = (unsigned char) hist_cum[tone];
+        }
+        apply_luma_lut(image, lut);
+    }
+    trace_end(&span, image_bytes(image));
+}
+
+void fill_histogram_reference(image_t *target, histogram_reference_t *reference, boolean with_channels) {
+    int histogram[HISTOGRAM_SIZE];
+    luminance_histogram(target, histogram);
+    norm_cum_histogram(histogram, reference->hist_cum_luminance);
+
+    reference->channels = 0;
+    if (!with_channels) return;
+    int histograms[MAX_CHANNELS][HISTOGRAM_SIZE];
+    channel_histograms(target, histograms);
+    reference->channels = min_int(target->channels, MAX_CHANNELS);
+    for (int c = 0; c < reference->channels; ++c) {
+        norm_cum_histogram(histograms[c], reference->hist_cum_channels[c]);
+    }
+}
 
-    int *hist_cum_source = compute_norm_cum_histogram(source);
-    int *hist_cum_target = compute_norm_cum_histogram(target);
+histogram_reference_t *new_histogram_reference(image_t *target) {
+    trace_span_t span = trace_begin("op", "new_histogram_reference");
+    histogram_reference_t *reference = ipp_malloc(sizeof(histogram_reference_t));
+    if (!reference) {
+        fprintf(stderr, "Could not allocate histogram reference\n");
+        trace_end(&span, 0);
+        return NULL;
+    }
+    fill_histogram_reference(target, reference, TRUE);
+    trace_end(&span, image_bytes(target));
+    return reference;
+}
 
-    int *histogram_matching = compute_histogram_matching(hist_cum_source, hist_cum_target);
+void free_histogram_reference(histogram_reference_t *reference) {
+    ipp_free(reference);
+}
 
-    for (int h = 0; h < source->height; ++h) {
-        for (int w = 0; w < source->width; ++w) {
-            source->pixels[h][w] = (unsigned char) histogram_matching[source->pixels[h][w]];
+void match_histogram_to_reference(image_t *source, const histogram_reference_t *reference, enum histogram_mode mode) {
+    if (mode == HISTOGRAM_MODE_CHANNELS && (source->channels > MAX_CHANNELS || reference->channels == 0)) {
+        fprintf(stderr, "Per-channel matching supports up to %d channels, against a reference with channels\n",
+                MAX_CHANNELS);
+        return;
+    }
+
+    trace_span_t span = trace_begin("op", "match_histogram_to_reference");
+    int hist_cum[HISTOGRAM_SIZE];
+    if (mode == HISTOGRAM_MODE_CHANNELS) {
+        int histograms[MAX_CHANNELS][HISTOGRAM_SIZE];
+        channel_histograms(source, histograms);
+        unsigned char luts[MAX_CHANNELS * HISTOGRAM_SIZE];
+        for (int c = 0; c < source->channels; ++c) {
+            // channels the reference lacks follow its last one, e.g. the alpha of an RGBA source against RGB
+            const int *hist_cum_target = reference->hist_cum_channels[min_int(c, reference->channels - 1)];
+            norm_cum_histogram(histograms[c], hist_cum);
+            histogram_matching_lut(hist_cum, hist_cum_target, luts + c * HISTOGRAM_SIZE);
         }
+        apply_channel_luts(source, luts);
+    } else {
+        int histogram[HISTOGRAM_SIZE];
+        luminance_histogram(source, histogram);
+        norm_cum_histogram(histogram, hist_cum);
+        unsigned char lut[HISTOGRAM_SIZE];
+        histogram_matching_lut(hist_cum, reference->hist_cum_luminance, lut);
+        if (mode == HISTOGRAM_MODE_LUMA) apply_luma_lut(source, lut);
+        else apply_lut(source, lut);
     }
+    trace_end(&span, image_bytes(source));
+}
+
+void match_histogram_with_mode(image_t *source, image_t *target, enum histogram_mode mode) {
+    trace_span_t span = trace_begin("op", "match_histogram_with_mode");
+    histogram_reference_t reference;
+    fill_histogram_reference(target, &reference, mode == HISTOGRAM_MODE_CHANNELS);
+    match_histogram_to_reference(source, &reference, mode);
+    trace_end(&span, image_bytes(source) + image_bytes(target));
+}
+
+void match_histogram(image_t *source, image_t *target) {
+    trace_span_t span = trace_begin("op", "match_histogram");
+    //assert images are in grayscale
+    rgb_to_luminance(source);
+    rgb_to_luminance(target);
+
+    // a point op, so that the cached histograms of source follow
+    match_histogram_with_mode(source, target, HISTOGRAM_MODE_LUMINANCE);
+    trace_end(&span, image_bytes(source) + image_bytes(target));
 }
 
 void zoom_out(image_t *image, int sx, int sy) {
+    trace_span_t span = trace_begin("op", "zoom_out");
     // matrix of zoomed out pixels
     int new_height = (int) ceil((double) image->height / sy);
     int new_width = (int) ceil((double) image->width / sx);
     unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width * image->channels);
+    scratch_mark_t mark = scratch_mark();
+    int *sums = scratch_alloc((size_t) new_width * image->channels * sizeof(int));
 
-    // slide window left to right and bottom to top
+    // slide a band of sy rows top to bottom, summing the channels of each window of the band
     for (int pos_y = 0; pos_y < image->height; pos_y += sy) {
-        for (int pos_x = 0; pos_x < image->width; pos_x += sx) {
-
-            // window averages pixels from (pos_x, pos_y) to (pos_x + step_x - 1, pos_y + step_y - 1)
-            int max_pixel_y = min_int(pos_y + sy - 1, image->height - 1);
-            int max_pixel_x = min_int(pos_x + sx - 1, image->width - 1);
-            unsigned char *averaged_channels = average_pixel(image, pos_y, max_pixel_y, pos_x, max_pixel_x);
-
-            // fill new pixel with obtained channels
-            int new_pixel_y = (pos_y / sy);
-            int new_pixel_x = (pos_x / sx);
-            for (int channel = 0; channel < image->channels; ++channel) {
-                new_pixels[new_pixel_y][new_pixel_x * image->channels + channel] = averaged_channels[channel];
-            }
-
-            free(averaged_channels);
+        int last_y = min_int(pos_y + sy, image->height);
+        memset(sums, 0, (size_t) new_width * image->channels * sizeof(int));
+        for (int y = pos_y; y < last_y; ++y) {
+            accumulate_windows(image->pixels[y], image->width, image->channels, sx, sums);
         }
+        average_windows(sums, new_pixels[pos_y / sy], image->width, image->channels, sx, last_y - pos_y);
     }
 
+    scratch_release(mark);
+    invalidate_histograms(image);
     free_pixels(image);
     image->pixels = new_pixels;
     image->height = new_height;
     image->width = new_width;
+    trace_end(&span, image_bytes(image));
 }
 
 int min_int(int a, int b) {
     return (a < b) ? a : b;
 }
 
-/**
- * Returns vector of unsigned char of size image->channels of the average of a range of pixels of the image.
- * @param image the image from which the pixels are retrieved
- * @param first_y first pixel y coordinate
- * @param last_y last pixel y coordinate
- * @param first_x first pixel x coordinate
- * @param last_x  last pixel x coordinate
- * @return vector of unsigned char of size image->channels averaged channels of pixels in range
- */
-unsigned char *average_pixel(image_t *image, int first_y, int last_y, int first_x, int last_x) {
-    int number_of_pixels = (last_y - first_y + 1) * (last_x - first_x + 1);
-
-    // iterate over pixels in window, accumulating a sum for each channel
-    int *channels_sums = malloc(image->channels * sizeof(int));
-    memset(channels_sums, 0, image->channels * sizeof(int));
-
-    for (int pixel_y = 0; first_y + pixel_y <= last_y; ++pixel_y) {
-        for (int pixel_x = 0; first_x + pixel_x <= last_x; ++pixel_x) {
-            for (int channel = 0; channel < image->channels; ++channel) {
-                channels_sums[channel] +=
-                        image->pixels[first_y + pixel_y][(first_x + pixel_x) * image->channels + channel];
-            }
-        }
-    }
-
-    // take the mean of each component, based on accumulated sum
-    unsigned char *channels_means = malloc(image->channels * sizeof(unsigned char));
-    for (int c = 0; c < image->channels; ++c) {
-        channels_means[c] = (unsigned char) (channels_sums[c] / number_of_pixels);
-    }
-
-    free(channels_sums);
-
-    return channels_means;
-}
-
-
 void zoom_in(image_t *image) {
+    trace_span_t span = trace_begin("op", "zoom_in");
     // matrix of zoomed in pixels
     int new_height = image->height * 2 - 1;
     int new_width = image->width * 2 - 1;
     unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width * image->channels);
 
-    for (int row = 0; row < image->height; ++row) {
-        memset(new_pixels[row], 0, new_width * image->channels * sizeof(unsigned char));
-    }
-
-    // copy old pixels with empty pixels in between
+    // old rows go to even rows, with interpolated pixels in between
     for (int row = 0; row < new_height; row += 2) {
-        for (int col = 0; col < new_width * image->channels; col += 2 * image->channels) {
-            for (int channel = 0; channel < image->channels; ++channel) {
-                new_pixels[row][col + channel] = image->pixels[row / 2][col / 2 + channel];
-            }
-        }
-    }
-
-    // fill half of each empty row R-1 with interpolation of row R-2 and R
-    for (int row = 2; row < new_height; row += 2) { // iterate rows skipping 1
-        for (int col = 0; col < new_width * image->channels; col += 2 * image->channels) { // iterate pixels skipping 1
-            for (int channel = 0; channel < image->channels; ++channel) { // iterates channels
-
-                int last = new_pixels[row - 2][col + channel];
-                int curr = new_pixels[row][col + channel];
-                new_pixels[row - 1][col + channel] = (unsigned char) ((last + curr) / 2);
-            }
-        }
+        zoom_in_pixels(image->pixels[row / 2], new_pixels[row], image->width, image->channels);
     }
 
-    // fill half of each empty column C-1 with interpolation of column C-2 and C
-    for (int row = 0; row < new_height; ++row) { // iterate rows
-        for (int col = 2 * image->channels;
-             col < new_width * image->channels; col += 2 * image->channels) { // iterate pixels skipping 1
-            for (int channel = 0; channel < image->channels; ++channel) { // iterates channels
-
-                int last = new_pixels[row][col - 2 * (image->channels) + channel];
-                int curr = new_pixels[row][col + channel];
-                new_pixels[row][col - image->channels + channel] = (unsigned char) ((last + curr) / 2);
-            }
-        }
+    // each odd row R-1 is the interpolation of rows R-2 and R, with its odd pixels interpolated along the row
+    for (int row = 2; row < new_height; row += 2) {
+        average_rows(new_pixels[row - 2], new_pixels[row], new_pixels[row - 1], new_width * image->channels);
+        interpolate_odd_pixels(new_pixels[row - 1], new_width, image->channels);
     }
 
+    invalidate_histograms(image);
     free_pixels(image);
     image->pixels = new_pixels;
     image->height = new_height;
     image->width = new_width;
+    trace_end(&span, image_bytes(image));
 }
 
 void rotate_90_degrees_clock_wise(image_t *image) {
+    trace_span_t span = trace_begin("op", "rotate_90_degrees_clock_wise");
     // matrix of rotated pixels
     int new_height = image->width;
     int new_width = image->height;
     unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width * image->channels);
 
-    for (int row = 0; row < new_height; ++row) {
-        memset(new_pixels[row], 0, new_width * image->channels * sizeof(unsigned char));
-    }
-
-    // iterate over old rows
+    // old rows become new columns from right to left, old columns become new rows
     for (int old_row = 0; old_row < image->height; ++old_row) {
-        // fix new column as the old row from upside down
         int new_col = (new_width - old_row - 1) * image->channels;
-
-        // old columns become new rows
-        for (int old_col = 0; old_col < image->width * image->channels; old_col += image->channels) {
-            int new_row = old_col / image->channels;
-
-            // use new and old indices to map the pixels
-            for (int channel = 0; channel < image->channels; ++channel) {
-                new_pixels[new_row][new_col + channel] = image->pixels[old_row][old_col + channel];
-            }
-        }
+        scatter_pixels(image->pixels[old_row], image->width, image->channels, new_pixels[0] + new_col,
+                       (ptrdiff_t) new_width * image->channels);
     }
 
     free_pixels(image);
     image->pixels = new_pixels;
     image->height = new_height;
     image->width = new_width;
+    trace_end(&span, image_bytes(image));
 }
 
 const unsigned char *get_pixel(image_t *image, int x, int y) {
-    unsigned char *pixel = malloc(image->channels * sizeof(unsigned char));
-    for (int channel = 0; channel < image->channels; ++channel) {
-        pixel[channel] = image->pixels[y][x * image->channels + channel];
-    }
-    return pixel;
+    return image->pixels[y] + x * image->channels;
 }
 
 void set_pixel(image_t *image, int x, int y, const unsigned char *pixel) {
+    invalidate_histograms(image);
     for (int channel = 0; channel < image->channels; ++channel) {
         image->pixels[y][x * image->channels + channel] = pixel[channel];
     }
 }
 
 void convolve(image_t *image, float **filter, boolean clamp) {
+    trace_span_t span = trace_begin("op", "convolve");
     rgb_to_luminance(image);
 
     // image of convolved pixels
@@ -718,7 +1498,7 @@ void convolve(image_t *image, float **filter, boolean clamp) {
     }
 
     // filter rotated by 180 degrees
-    float **rot_filter = new_filter(FILTER_SIZE);
+    float rot_filter[FILTER_SIZE][FILTER_SIZE];
     for (int i = 0; i < FILTER_SIZE; ++i) {
         for (int j = 0; j < FILTER_SIZE; ++j) {
             rot_filter[i][j] = filter[FILTER_SIZE - i - 1][FILTER_SIZE - j - 1];
@@ -727,48 +1507,32 @@ void convolve(image_t *image, float **filter, boolean clamp) {
 
     // slide filter through image
     for (int y = FILTER_SIZE / 2; y < new_height - FILTER_SIZE / 2; ++y) {
-        for (int x = FILTER_SIZE / 2; x < new_width - FILTER_SIZE / 2; ++x) {
-
-            // accumulate pixel by pixel multiplication around center of filter
-            float conv_point = 0;
-            for (int y_offset = -FILTER_SIZE / 2; y_offset <= FILTER_SIZE / 2; ++y_offset) {
-                for (int x_offset = -FILTER_SIZE / 2; x_offset <= FILTER_SIZE / 2; ++x_offset) {
-
-                    conv_point += rot_filter[FILTER_SIZE / 2 + y_offset][FILTER_SIZE / 2 + x_offset] *
-                                  (float) image->pixels[y + y_offset][x + x_offset];
-                }
-            }
-
-            // fix out of range values
-            if (clamp) conv_point += 127;
-            if (conv_point > 255) conv_point = 255;
-            if (conv_point < 0) conv_point = 0;
-
-            // save calculation as unsigned char
-            new_pixels[y][x] = (unsigned char) conv_point;
-        }
-    }
-
-    // free filter rotated by 180 degrees
-    for (int i = 0; i < FILTER_SIZE; ++i) {
-        free(rot_filter[i]);
+        convolve_row((const unsigned char *const *) image->pixels + y - FILTER_SIZE / 2, new_pixels[y],
+                     FILTER_SIZE / 2, new_width - FILTER_SIZE / 2, &rot_filter[0][0], clamp);
     }
-    free(rot_filter);
 
+    invalidate_histograms(image);
     free_pixels(image);
     image->pixels = new_pixels;
     image->height = new_height;
     image->width = new_width;
+    trace_end(&span, image_bytes(image));
 }
 
 float **new_filter(int size) {
-    float **filter = malloc(size * sizeof(float));
+    // One block: the row pointers, then the rows, so that free_filter() is a single release
+    float **filter = ipp_malloc(size * sizeof(float *) + (size_t) size * size * sizeof(float));
+    float *data = (float *) (filter + size);
     for (int i = 0; i < size; ++i) {
-        filter[i] = malloc(size * sizeof(float));
+        filter[i] = data + (size_t) i * size;
     }
     return filter;
 }
 
+void free_filter(float **filter) {
+    ipp_free(filter);
+}
+
 float **gaussian_filter() {
     float local_filter[FILTER_SIZE][FILTER_SIZE] =
             {{0.0625, 0.125, 0.0625},
@@ -0,0 +1,349 @@
+/**
+ * Definitions for region of interest operations.
+ */
+
+#include <image_roi.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+#include <scratch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <memory.h>
+
+/**
+ * Intersection of a rectangle with the one of the given size at the origin.
+ * @return Zero if they do not intersect.
+ */
+int clip_region(const region_t *region, int width, int height, region_t *clipped);
+
+/**
+ * Luminance of a pixel of a region, as rgb_to_luminance() computes it.
+ */
+unsigned char roi_luminance(const image_roi_t *roi, const unsigned char *pixel);
+
+/**
+ * Writes the luminance of row y of a region to a buffer of width components.
+ */
+void roi_luminance_row(const image_roi_t *roi, int y, unsigned char *luminance);
+
+/**
+ * Size of the pixels of a region, in bytes, as reported by its trace spans.
+ */
+size_t roi_bytes(const image_roi_t *roi);
+
+/**
+ * Whether destination has the given size and the channels of source; reports the mismatch otherwise.
+ */
+int check_destination(const image_roi_t *source, const image_roi_t *destination, int width, int height);
+
+int clip_region(const region_t *region, int width, int height, region_t *clipped) {
+    int first_x = region->x < 0 ? 0 : region->x;
+    int first_y = region->y < 0 ? 0 : region->y;
+    int last_x = min_int(region->x + region->width, width);
+    int last_y = min_int(region->y + region->height, height);
+    if (first_x >= last_x || first_y >= last_y) return 0;
+
+    clipped->x = first_x;
+    clipped->y = first_y;
+    clipped->width = last_x - first_x;
+    clipped->height = last_y - first_y;
+    return 1;
+}
+
+image_roi_t image_roi(image_t *image, const region_t *region) {
+    image_roi_t roi = {NULL, 0, 0, image->channels, image->colorspace, 0};
+    if (!image->pixels || image->height <= 0) return roi;
+    invalidate_histograms(image);
+
+    // Rows must be evenly spaced to be addressed by a stride
+    ptrdiff_t stride = image->height > 1 ? image->pixels[1] - image->pixels[0]
+                                         : (ptrdiff_t) image->width * image->channels;
+    for (int y = 2; y < image->height; ++y) {
+        if (image->pixels[y] - image->pixels[y - 1] != stride) return roi;
+    }
+
+    roi.origin = image->pixels[0];
+    roi.width = image->width;
+    roi.height = image->height;
+    roi.stride = stride;
+    return region ? sub_roi(&roi, region) : roi;
+}
+
+image_roi_t buffer_roi(unsigned char *pixels, int width, int height, int channels, J_COLOR_SPACE colorspace) {
+    image_roi_t roi = {pixels, width, height, channels, colorspace, (ptrdiff_t) width * channels};
+    return roi;
+}
+
+image_roi_t sub_roi(const image_roi_t *roi, const region_t *region) {
+    image_roi_t sub = *roi;
+    region_t clipped;
+    if (!clip_region(region, roi->width, roi->height, &clipped)) {
+        sub.origin = NULL;
+        sub.width = 0;
+        sub.height = 0;
+        return sub;
+    }
+
+    sub.origin = roi_row(roi, clipped.y) + (size_t) clipped.x * roi->channels;
+    sub.width = clipped.width;
+    sub.height = clipped.height;
+    return sub;
+}
+
+size_t roi_bytes(const image_roi_t *roi) {
+    return (size_t) roi->height * roi->width * roi->channels;
+}
+
+unsigned char *roi_row(const image_roi_t *roi, int y) {
+    return roi->origin + y * roi->stride;
+}
+
+void roi_apply_lut(const image_roi_t *roi, const unsigned char *lut) {
+    trace_span_t span = trace_begin("op", "roi_apply_lut");
+    for (int y = 0; y < roi->height; ++y) {
+        map_components(roi_row(roi, y), roi_row(roi, y), roi->width * roi->channels, lut);
+    }
+    trace_end(&span, roi_bytes(roi));
+}
+
+void roi_add_bias(const image_roi_t *roi, double bias) {
+    unsigned char lut[256];
+    bias_lut(bias, lut);
+    roi_apply_lut(roi, lut);
+}
+
+void roi_multiply_gain(const image_roi_t *roi, double gain) {
+    unsigned char lut[256];
+    gain_lut(gain, lut);
+    roi_apply_lut(roi, lut);
+}
+
+void roi_negative(const image_roi_t *roi) {
+    unsigned char lut[256];
+    negative_lut(lut);
+    roi_apply_lut(roi, lut);
+}
+
+void roi_quantize(const image_roi_t *roi, int n_tones) {
+    unsigned char lut[256];
+    quantize_lut(n_tones, lut);
+    roi_apply_lut(roi, lut);
+}
+
+void roi_mirror_horizontally(const image_roi_t *roi) {
+    trace_span_t span = trace_begin("op", "roi_mirror_horizontally");
+    for (int y = 0; y < roi->height; ++y) {
+        mirror_pixels(roi_row(roi, y), roi->width, roi->channels);
+    }
+    trace_end(&span, roi_bytes(roi));
+}
+
+void roi_mirror_vertically(const image_roi_t *roi) {
+    trace_span_t span = trace_begin("op", "roi_mirror_vertically");
+    int row_bytes = roi->width * roi->channels;
+    scratch_mark_t mark = scratch_mark();
+    unsigned char *swap = scratch_alloc(row_bytes);
+    for (int top = 0, bottom = roi->height - 1; top < bottom; ++top, --bottom) {
+        memcpy(swap, roi_row(roi, top), row_bytes);
+        memcpy(roi_row(roi, top), roi_row(roi, bottom), row_bytes);
+        memcpy(roi_row(roi, bottom), swap, row_bytes);
+    }
+    scratch_release(mark);
+    trace_end(&span, roi_bytes(roi));
+}
+
+unsigned char roi_luminance(const image_roi_t *roi, const unsigned char *pixel) {
+    if (roi->colorspace == JCS_GRAYSCALE || roi->channels < 3) return pixel[0];
+    return (unsigned char) (int) (0.299 * (int) pixel[0] + 0.587 * (int) pixel[1] + 0.114 * (int) pixel[2]);
+}
+
+void roi_luminance_row(const image_roi_t *roi, int y, unsigned char *luminance) {
+    const unsigned char *row = roi_row(roi, y);
+    if (roi->colorspace == JCS_GRAYSCALE || roi->channels < 3) {
+        for (int x = 0; x < roi->width; ++x) {
+            luminance[x] = row[x * roi->channels];
+        }
+        return;
+    }
+    convert_pixels(row, roi->channels, luminance, 1, roi->width);
+}
+
+void roi_rgb_to_luminance(const image_roi_t *roi) {
+    if (roi->colorspace == JCS_GRAYSCALE || roi->channels < 3) return;
+
+    trace_span_t span = trace_begin("op", "roi_rgb_to_luminance");
+    for (int y = 0; y < roi->height; ++y) {
+        unsigned char *row = roi_row(roi, y);
+        for (int x = 0; x < roi->width * roi->channels; x += roi->channels) {
+            unsigned char luminance = roi_luminance(roi, row + x);
+            memset(row + x, luminance, roi->channels);
+        }
+    }
+    trace_end(&span, roi_bytes(roi));
+}
+
+void roi_compute_histogram(const image_roi_t *roi, int *histogram) {
+    trace_span_t span = trace_begin("op", "roi_compute_histogram");
+    memset(histogram, 0, HISTOGRAM_SIZE * sizeof(int));
+    scratch_mark_t mark = scratch_mark();
+    unsigned char *luminance = scratch_alloc(roi->width);
+    for (int y = 0; y < roi->height; ++y) {
+        roi_luminance_row(roi, y, luminance);
+        count_components(luminance, roi->width, histogram);
+    }
+    scratch_release(mark);
+    trace_end(&span, roi_bytes(roi));
+}
+
+void roi_compute_norm_cum_histogram(const image_roi_t *roi, int *hist_cum) {
+    int hist[HISTOGRAM_SIZE];
+    roi_compute_histogram(roi, hist);
+    norm_cum_histogram(hist, hist_cum);
+}
+
+void roi_equalize_histogram(const image_roi_t *roi) {
+    trace_span_t span = trace_begin("op", "roi_equalize_histogram");
+    int hist_cum[HISTOGRAM_SIZE];
+    roi_compute_norm_cum_histogram(roi, hist_cum);
+
+    unsigned char lut[256];
+    for (int i = 0; i < 256; ++i) {
+        lut[i] = (unsigned char) hist_cum[i];
+    }
+    roi_apply_lut(roi, lut);
+    trace_end(&span, roi_bytes(roi));
+}
+
+void roi_match_histogram(const image_roi_t *source, const image_roi_t *target) {
+    trace_span_t span = trace_begin("op", "roi_match_histogram");
+    int hist_cum_source[HISTOGRAM_SIZE];
+    int hist_cum_target[HISTOGRAM_SIZE];
+    roi_compute_norm_cum_histogram(source, hist_cum_source);
+    roi_compute_norm_cum_histogram(target, hist_cum_target);
+
+    int *histogram_matching = compute_histogram_matching(hist_cum_source, hist_cum_target);
+
+    for (int y = 0; y < source->height; ++y) {
+        unsigned char *row = roi_row(source, y);
+        for (int x = 0; x < source->width * source->channels; x += source->channels) {
+            memset(row + x, histogram_matching[roi_luminance(source, row + x)], source->channels);
+        }
+    }
+
+    free_histogram(histogram_matching);
+    trace_end(&span, roi_bytes(source) + roi_bytes(target));
+}
+
+void roi_convolve(const image_roi_t *roi, float **filter, boolean clamp) {
+    int half = FILTER_SIZE / 2;
+    if (roi->width <= 2 * half || roi->height <= 2 * half) return;
+    trace_span_t span = trace_begin("op", "roi_convolve");
+
+    // filter rotated by 180 degrees
+    float rot_filter[FILTER_SIZE][FILTER_SIZE];
+    for (int i = 0; i < FILTER_SIZE; ++i) {
+        for (int j = 0; j < FILTER_SIZE; ++j) {
+            rot_filter[i][j] = filter[FILTER_SIZE - i - 1][FILTER_SIZE - j - 1];
+        }
+    }
+
+    // Luminance of the FILTER_SIZE input rows around the current one, kept aside since the rows above it are
+    // overwritten already; rows[i] holds row y - half + i
+    scratch_mark_t mark = scratch_mark();
+    unsigned char *luminance = scratch_alloc((size_t) FILTER_SIZE * roi->width);
+    unsigned char *rows[FILTER_SIZE];
+    for (int i = 0; i < FILTER_SIZE; ++i) {
+        rows[i] = luminance + (size_t) i * roi->width;
+        roi_luminance_row(roi, i, rows[i]);
+    }
+
+    unsigned char *convolved = scratch_alloc(roi->width);
+    for (int y = half; y < roi->height - half; ++y) {
+        unsigned char *row = roi_row(roi, y);
+        convolve_row((const unsigned char *const *) rows, convolved, half, roi->width - half, &rot_filter[0][0],
+                     clamp);
+        if (roi->channels == 1) {
+            memcpy(row + half, convolved + half, roi->width - 2 * half);
+        } else {
+            convert_pixels(convolved + half, 1, row + half * roi->channels, roi->channels, roi->width - 2 * half);
+        }
+
+        // slide the window one row down, reading the next input row before it is overwritten
+        if (y + half + 1 < roi->height) {
+            unsigned char *oldest = rows[0];
+            memmove(rows, rows + 1, (FILTER_SIZE - 1) * sizeof(unsigned char *));
+            rows[FILTER_SIZE - 1] = oldest;
+            roi_luminance_row(roi, y + half + 1, oldest);
+        }
+    }
+
+    scratch_release(mark);
+    trace_end(&span, roi_bytes(roi));
+}
+
+int check_destination(const image_roi_t *source, const image_roi_t *destination, int width, int height) {
+    if (destination->width == width && destination->height == height && destination->channels == source->channels) {
+        return 1;
+    }
+
+    fprintf(stderr, "Destination region is %dx%dx%d instead of %dx%dx%d\n", destination->width, destination->height,
+            destination->channels, width, height, source->channels);
+    return 0;
+}
+
+int roi_zoom_out(const image_roi_t *source, const image_roi_t *destination, int sx, int sy) {
+    int new_height = (int) ceil((double) source->height / sy);
+    int new_width = (int) ceil((double) source->width / sx);
+    if (!check_destination(source, destination, new_width, new_height)) return 0;
+    trace_span_t span = trace_begin("op", "roi_zoom_out");
+
+    // slide a band of sy rows top to bottom, summing the channels of each window of the band
+    scratch_mark_t mark = scratch_mark();
+    int *sums = scratch_alloc((size_t) new_width * source->channels * sizeof(int));
+    for (int pos_y = 0; pos_y < source->height; pos_y += sy) {
+        int last_y = min_int(pos_y + sy, source->height);
+        memset(sums, 0, (size_t) new_width * source->channels * sizeof(int));
+        for (int y = pos_y; y < last_y; ++y) {
+            accumulate_windows(roi_row(source, y), source->width, source->channels, sx, sums);
+        }
+        average_windows(sums, roi_row(destination, pos_y / sy), source->width, source->channels, sx, last_y - pos_y);
+    }
+    scratch_release(mark);
+    trace_end(&span, roi_bytes(source));
+    return 1;
+}
+
+int roi_zoom_in(const image_roi_t *source, const image_roi_t *destination) {
+    int new_height = source->height * 2 - 1;
+    int new_width = source->width * 2 - 1;
+    if (!check_destination(source, destination, new_width, new_height)) return 0;
+    trace_span_t span = trace_begin("op", "roi_zoom_in");
+
+    // old rows go to even rows, with interpolated pixels in between
+    for (int row = 0; row < new_height; row += 2) {
+        zoom_in_pixels(roi_row(source, row / 2), roi_row(destination, row), source->width, source->channels);
+    }
+
+    // each odd row R-1 is the interpolation of rows R-2 and R, with its odd pixels interpolated along the row
+    for (int row = 2; row < new_height; row += 2) {
+        average_rows(roi_row(destination, row - 2), roi_row(destination, row), roi_row(destination, row - 1),
+                     new_width * source->channels);
+        interpolate_odd_pixels(roi_row(destination, row - 1), new_width, source->channels);
+    }
+    trace_end(&span, roi_bytes(destination));
+    return 1;
+}
+
+int roi_rotate_90_degrees_clock_wise(const image_roi_t *source, const image_roi_t *destination) {
+    if (!check_destination(source, destination, source->height, source->width)) return 0;
+    trace_span_t span = trace_begin("op", "roi_rotate_90_degrees_clock_wise");
+
+    // old rows become new columns from right to left, old columns become new rows
+    for (int old_row = 0; old_row < source->height; ++old_row) {
+        scatter_pixels(roi_row(source, old_row), source->width, source->channels,
+                       destination->origin + (source->height - old_row - 1) * source->channels, destination->stride);
+    }
+    trace_end(&span, roi_bytes(source));
+    return 1;
+}
@@ -0,0 +1,276 @@
+/**
+ * Definitions for accounting of library allocations.
+ */
+
+#include <memory_accounting.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Room before every block of accounted_malloc(), keeping it aligned for any type as malloc() does
+#define HEADER_SIZE 64
+
+/**
+ * Bookkeeping stored right before every block.
+ */
+typedef struct block_header_struct {
+    size_t size;
+    size_t offset;                          // from the start of the underlying block to the one handed out
+    int aligned;                            // from accounted_aligned_alloc(), which can not be resized
+    const char *site;
+    struct block_header_struct *previous;   // list of live blocks, with IPP_LEAK_REPORT only
+    struct block_header_struct *next;
+} block_header_t;
+
+/**
+ * Live blocks of one allocating function, for memory_report().
+ */
+typedef struct site_total_struct {
+    const char *site;
+    size_t blocks;
+    size_t bytes;
+} site_total_t;
+
+atomic_size_t accounted_live_bytes = 0;
+atomic_size_t accounted_peak_bytes = 0;
+atomic_size_t accounted_live_blocks = 0;
+atomic_ullong accounted_allocations = 0;
+atomic_ullong accounted_allocated_bytes = 0;
+
+_Thread_local unsigned long long thread_allocations = 0;
+_Thread_local unsigned long long thread_allocated_bytes = 0;
+
+pthread_once_t accounting_once = PTHREAD_ONCE_INIT;
+int tracking_blocks = 0;
+pthread_mutex_t tracked_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+block_header_t *tracked_blocks = NULL;
+
+/**
+ * Reads IPP_LEAK_REPORT.
+ */
+void init_accounting();
+
+void report_at_exit();
+
+block_header_t *header_of(void *block);
+
+/**
+ * Counts a new block, or the new size of a resized one (whose old size was already uncounted), and links it into
+ * the list of live blocks when tracking.
+ * @param allocated whether the block was just allocated, counting towards the allocations and allocated bytes, or is
+ * only counted again as live, as a block whose resizing failed is
+ */
+void count_block(block_header_t *header, size_t size, const char *site, int allocated);
+
+/**
+ * Stops counting a block being released or resized.
+ */
+void uncount_block(block_header_t *header);
+
+int compare_site_totals(const void *a, const void *b);
+
+void init_accounting() {
+    const char *report = getenv("IPP_LEAK_REPORT");
+    if (report && *report && strcmp(report, "0") != 0) {
+        tracking_blocks = 1;
+        atexit(report_at_exit);
+    }
+}
+
+void report_at_exit() {
+    fprintf(stderr, "IPP_LEAK_REPORT: ");
+    memory_report(stderr);
+}
+
+block_header_t *header_of(void *block) {
+    return (block_header_t *) ((char *) block - sizeof(block_header_t));
+}
+
+void count_block(block_header_t *header, size_t size, const char *site, int allocated) {
+    header->size = size;
+    header->site = site;
+
+    size_t live = atomic_fetch_add(&accounted_live_bytes, size) + size;
+    size_t peak = atomic_load(&accounted_peak_bytes);
+    while (live > peak && !atomic_compare_exchange_weak(&accounted_peak_bytes, &peak, live));
+    atomic_fetch_add(&accounted_live_blocks, 1);
+    if (allocated) {
+        atomic_fetch_add(&accounted_allocations, 1);
+        atomic_fetch_add(&accounted_allocated_bytes, size);
+        ++thread_allocations;
+        thread_allocated_bytes += size;
+    }
+
+    if (!tracking_blocks) return;
+    pthread_mutex_lock(&tracked_blocks_lock);
+    header->previous = NULL;
+    header->next = tracked_blocks;
+    if (tracked_blocks) tracked_blocks->previous = header;
+    tracked_blocks = header;
+    pthread_mutex_unlock(&tracked_blocks_lock);
+}
+
+void uncount_block(block_header_t *header) {
+    atomic_fetch_sub(&accounted_live_bytes, header->size);
+    atomic_fetch_sub(&accounted_live_blocks, 1);
+
+    if (!tracking_blocks) return;
+    pthread_mutex_lock(&tracked_blocks_lock);
+    if (header->previous) header->previous->next = header->next;
+    else tracked_blocks = header->next;
+    if (header->next) header->next->previous = header->previous;
+    pthread_mutex_unlock(&tracked_blocks_lock);
+}
+
+void *accounted_malloc(size_t size, const char *site) {
+    pthread_once(&accounting_once, init_accounting);
+    if (size > SIZE_MAX - HEADER_SIZE) return NULL;
+
+    char *base = malloc(HEADER_SIZE + size);
+    if (!base) return NULL;
+
+    block_header_t *header = header_of(base + HEADER_SIZE);
+    header->offset = HEADER_SIZE;
+    header->aligned = 0;
+    count_block(header, size, site, 1);
+    return base + HEADER_SIZE;
+}
+
+void *accounted_calloc(size_t count, size_t size, const char *site) {
+    if (size && count > (SIZE_MAX - HEADER_SIZE) / size) return NULL;
+
+    void *block = accounted_malloc(count * size, site);
+    if (block) memset(block, 0, count * size);
+    return block;
+}
+
+void *accounted_realloc(void *block, size_t size, const char *site) {
+    if (!block) return accounted_malloc(size, site);
+    if (size > SIZE_MAX - HEADER_SIZE) return NULL;
+
+    block_header_t *header = header_of(block);
+    if (header->aligned) {
+        fprintf(stderr, "Aligned blocks can not be resized\n");
+        return NULL;
+    }
+
+    // uncounted while it may move, counted again at whichever address it ends up
+    size_t old_size = header->size;
+    uncount_block(header);
+    char *base = realloc((char *) block - HEADER_SIZE, HEADER_SIZE + size);
+    if (!base) {
+        // the block is where it was, and nothing was allocated
+        count_block(header, old_size, header->site, 0);
+        return NULL;
+    }
+
+    count_block(header_of(base + HEADER_SIZE), size, site, 1);
+    return base + HEADER_SIZE;
+}
+
+void *accounted_aligned_alloc(size_t alignment, size_t size, const char *site) {
+    pthread_once(&accounting_once, init_accounting);
+    if (alignment < sizeof(void *)) alignment = sizeof(void *);
+
+    // the header goes in the padding before the first aligned address past it
+    size_t offset = (sizeof(block_header_t) + alignment - 1) / alignment * alignment;
+    if (size > SIZE_MAX - offset) return NULL;
+
+    void *base;
+    if (posix_memalign(&base, alignment, offset + size) != 0) return NULL;
+
+    char *block = (char *) base + offset;
+    block_header_t *header = header_of(block);
+    header->offset = offset;
+    header->aligned = 1;
+    count_block(header, size, site, 1);
+    return block;
+}
+
+char *accounted_strdup(const char *string, const char *site) {
+    size_t length = strlen(string) + 1;
+    char *copy = accounted_malloc(length, site);
+    if (copy) memcpy(copy, string, length);
+    return copy;
+}
+
+void ipp_free(void *block) {
+    if (!block) return;
+
+    block_header_t *header = header_of(block);
+    uncount_block(header);
+    free((char *) block - header->offset);
+}
+
+size_t ipp_block_size(const void *block) {
+    return header_of((void *) block)->size;
+}
+
+memory_stats_t memory_stats() {
+    pthread_once(&accounting_once, init_accounting);
+    memory_stats_t stats;
+    stats.live_bytes = atomic_load(&accounted_live_bytes);
+    stats.peak_bytes = atomic_load(&accounted_peak_bytes);
+    stats.live_blocks = atomic_load(&accounted_live_blocks);
+    stats.allocations = atomic_load(&accounted_allocations);
+    stats.allocated_bytes = atomic_load(&accounted_allocated_bytes);
+    return stats;
+}
+
+memory_stats_t thread_memory_stats() {
+    memory_stats_t stats = {0};
+    stats.allocations = thread_allocations;
+    stats.allocated_bytes = thread_allocated_bytes;
+    return stats;
+}
+
+void reset_peak_bytes() {
+    atomic_store(&accounted_peak_bytes, atomic_load(&accounted_live_bytes));
+}
+
+int compare_site_totals(const void *a, const void *b) {
+    size_t x = ((const site_total_t *) a)->bytes, y = ((const site_total_t *) b)->bytes;
+    return (x < y) - (x > y);
+}
+
+size_t memory_report(FILE *file) {
+    pthread_once(&accounting_once, init_accounting);
+    memory_stats_t stats = memory_stats();
+    fprintf(file, "%zu live blocks, %zu bytes (peak %zu bytes, %llu allocations)\n", stats.live_blocks,
+            stats.live_bytes, stats.peak_bytes, stats.allocations);
+    if (!tracking_blocks) return stats.live_blocks;
+
+    // the totals are kept with malloc() so that the report does not count itself
+    site_total_t *totals = NULL;
+    size_t total_count = 0, total_capacity = 0;
+
+    pthread_mutex_lock(&tracked_blocks_lock);
+    for (block_header_t *header = tracked_blocks; header; header = header->next) {
+        size_t t;
+        for (t = 0; t < total_count && strcmp(totals[t].site, header->site) != 0; ++t);
+        if (t == total_count) {
+            if (total_count == total_capacity) {
+                total_capacity = total_capacity ? 2 * total_capacity : 16;
+                site_total_t *grown = realloc(totals, total_capacity * sizeof(site_total_t));
+                if (!grown) break;
+                totals = grown;
+            }
+            totals[total_count].site = header->site;
+            totals[total_count].blocks = 0;
+            totals[total_count].bytes = 0;
+            ++total_count;
+        }
+        ++totals[t].blocks;
+        totals[t].bytes += header->size;
+    }
+    pthread_mutex_unlock(&tracked_blocks_lock);
+
+    qsort(totals, total_count, sizeof(site_total_t), compare_site_totals);
+    for (size_t t = 0; t < total_count; ++t) {
+        fprintf(file, "  %s: %zu blocks, %zu bytes\n", totals[t].site, totals[t].blocks, totals[t].bytes);
+    }
+    free(totals);
+    return stats.live_blocks;
+}
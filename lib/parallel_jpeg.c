@@ -0,0 +1,529 @@
+/**
+ * Definitions for multi-threaded JPEG compression and decompression.
+ */
+
+#include <parallel_jpeg.h>
+#include <trace.h>
+#include <scratch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MARKER_SOF0 0xC0
+#define MARKER_SOF1 0xC1
+#define MARKER_SOS 0xDA
+#define MARKER_EOI 0xD9
+#define MARKER_DRI 0xDD
+#define MARKER_RST0 0xD0
+#define MAX_RESTART_INTERVAL 65535
+
+struct encode_strip {
+    image_t image;              // rows of the original image, not a copy
+    const encode_options_t *options;
+    unsigned char *buffer;
+    unsigned long size;
+};
+
+/**
+ * Compresses one strip into its own in-memory JPEG.
+ * @param arg pointer to struct encode_strip
+ */
+void *encode_strip(void *arg);
+
+/**
+ * Finds where the entropy-coded data of a sequential Huffman JPEG starts.
+ * @param jpeg compressed data
+ * @param size number of bytes of jpeg
+ * @param sof_offset receives the offset of the SOF0/SOF1 marker
+ * @param sos_offset receives the offset of the SOS marker
+ * @return offset of the first entropy-coded byte, 0 if the markers could not be found
+ */
+unsigned long find_entropy_data(const unsigned char *jpeg, unsigned long size, unsigned long *sof_offset,
+                                unsigned long *sos_offset);
+
+void run_in_waves(void *(*task)(void *), void *items, size_t item_size, int n_items, int threads) {
+    scratch_mark_t mark = scratch_mark();
+    pthread_t *workers = scratch_alloc(n_items * sizeof(pthread_t));
+    int *spawned = scratch_alloc(n_items * sizeof(int));
+    char *item = items;
+
+    // Run in waves of at most `threads` items, the current thread takes the last item of each wave
+    for (int first = 0; first < n_items; first += threads) {
+        int last = min_int(first + threads, n_items) - 1;
+        for (int i = first; i < last; ++i) {
+            spawned[i] = pthread_create(&workers[i], NULL, task, item + i * item_size) == 0;
+            if (!spawned[i]) task(item + i * item_size);
+        }
+        task(item + last * item_size);
+        for (int i = first; i < last; ++i) {
+            if (spawned[i]) pthread_join(workers[i], NULL);
+        }
+    }
+
+    scratch_release(mark);
+}
+
+int default_thread_count() {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (int) processors : 1;
+}
+
+void *encode_strip(void *arg) {
+    struct encode_strip *strip = arg;
+    trace_span_t span = trace_begin("io", "encode_strip");
+    strip->size = jpeg_compress_buffer(&strip->image, strip->options, &strip->buffer);
+    trace_end(&span, image_bytes(&strip->image));
+    return NULL;
+}
+
+unsigned long find_entropy_data(const unsigned char *jpeg, unsigned long size, unsigned long *sof_offset,
+                                unsigned long *sos_offset) {
+    // skip SOI, then hop from marker to marker using their length fields
+    unsigned long pos = 2;
+    *sof_offset = 0;
+    while (pos + 4 <= size && jpeg[pos] == 0xFF) {
+        int code = jpeg[pos + 1];
+        unsigned long length = ((unsigned long) jpeg[pos + 2] << 8) | jpeg[pos + 3];
+
+        if (code == MARKER_SOF0 || code == MARKER_SOF1) *sof_offset = pos;
+        if (code == MARKER_SOS) {
+            *sos_offset = pos;
+            return *sof_offset ? pos + 2 + length : 0;
+        }
+        pos += 2 + length;
+    }
+    return 0;
+}
+
+unsigned long jpeg_compress_parallel_buffer(image_t *image, const encode_options_t *options, int threads,
+                                            unsigned char **buffer) {
+    encode_options_t strip_options = options ? *options : default_encode_options();
+    strip_options.optimize_coding = FALSE;
+    strip_options.progressive = FALSE;
+    strip_options.restart_in_rows = 0;
+
+    if (threads <= 0) threads = default_thread_count();
+
+    // Strips must be whole MCU rows, and one strip is one restart interval (at most 65535 MCUs)
+    int color = image->channels == 3;
+    int mcu_width = 8 * (color ? strip_options.h_sampling : 1);
+    int mcu_height = 8 * (color ? strip_options.v_sampling : 1);
+    int mcus_per_row = (image->width + mcu_width - 1) / mcu_width;
+    int mcu_rows = (image->height + mcu_height - 1) / mcu_height;
+
+    int mcu_rows_per_strip = (mcu_rows + threads - 1) / threads;
+    if (mcus_per_row * mcu_rows_per_strip > MAX_RESTART_INTERVAL) {
+        mcu_rows_per_strip = MAX_RESTART_INTERVAL / mcus_per_row;
+    }
+    if (threads == 1 || mcu_rows < 2 || mcu_rows_per_strip < 1) {
+        return jpeg_compress_buffer(image, &strip_options, buffer);
+    }
+
+    int rows_per_strip = mcu_rows_per_strip * mcu_height;
+    int n_strips = (image->height + rows_per_strip - 1) / rows_per_strip;
+    scratch_mark_t mark = scratch_mark();
+    struct encode_strip *strips = scratch_alloc((size_t) n_strips * sizeof(struct encode_strip));
+    memset(strips, 0, (size_t) n_strips * sizeof(struct encode_strip));
+
+    for (int s = 0; s < n_strips; ++s) {
+        strips[s].image = *image;
+        strips[s].image.filename = NULL;
+        strips[s].image.pixels = image->pixels + s * rows_per_strip;
+        strips[s].image.height = min_int(rows_per_strip, image->height - s * rows_per_strip);
+        strips[s].options = &strip_options;
+    }
+
+    run_in_waves(encode_strip, strips, sizeof(struct encode_strip), n_strips, threads);
+
+    unsigned long total_size = 0;
+    unsigned long sof_offset = 0, sos_offset = 0, entropy_offset = 0;
+    int failed = 0;
+    for (int s = 0; s < n_strips; ++s) {
+        if (strips[s].image.last_operation != COMPRESSION_SUCCESS) failed = 1;
+        total_size += strips[s].size;
+    }
+    if (!failed) {
+        entropy_offset = find_entropy_data(strips[0].buffer, strips[0].size, &sof_offset, &sos_offset);
+        if (!entropy_offset) failed = 1;
+    }
+
+    unsigned char *output = NULL;
+    unsigned long output_size = 0;
+    if (!failed) {
+        // Headers of the first strip, with a DRI marker and the full image height, then every strip's
+        // entropy-coded data (which libjpeg already padded to a byte boundary) separated by RSTn markers
+        output = malloc(total_size + 6 + 2 * (size_t) n_strips);
+
+        memcpy(output, strips[0].buffer, sos_offset);
+        output[sof_offset + 5] = (unsigned char) (image->height >> 8);
+        output[sof_offset + 6] = (unsigned char) (image->height & 0xFF);
+        output_size = sos_offset;
+
+        unsigned int restart_interval = (unsigned int) (mcus_per_row * mcu_rows_per_strip);
+        unsigned char dri[6] = {0xFF, MARKER_DRI, 0x00, 0x04,
+                                (unsigned char) (restart_interval >> 8), (unsigned char) (restart_interval & 0xFF)};
+        memcpy(output + output_size, dri, sizeof(dri));
+        output_size += sizeof(dri);
+
+        memcpy(output + output_size, strips[0].buffer + sos_offset, entropy_offset - sos_offset);
+        output_size += entropy_offset - sos_offset;
+
+        for (int s = 0; s < n_strips; ++s) {
+            unsigned long strip_sof, strip_sos;
+            unsigned long strip_entropy = (s == 0) ? entropy_offset
+                                                   : find_entropy_data(strips[s].buffer, strips[s].size,
+                                                                       &strip_sof, &strip_sos);
+            // entropy-coded data runs until the trailing EOI marker
+            unsigned long strip_entropy_size = strips[s].size - 2 - strip_entropy;
+
+            if (s > 0) {
+                output[output_size++] = 0xFF;
+                output[output_size++] = (unsigned char) (MARKER_RST0 + (s - 1) % 8);
+            }
+            memcpy(output + output_size, strips[s].buffer + strip_entropy, strip_entropy_size);
+            output_size += strip_entropy_size;
+        }
+
+        output[output_size++] = 0xFF;
+        output[output_size++] = MARKER_EOI;
+    }
+
+    for (int s = 0; s < n_strips; ++s) {
+        free(strips[s].buffer);
+    }
+    scratch_release(mark);
+
+    *buffer = output;
+    image->last_operation = failed ? COMPRESSION_FAILURE : COMPRESSION_SUCCESS;
+    return output_size;
+}
+
+void jpeg_compress_parallel(image_t *image, char *output_filename, const encode_options_t *options, int threads) {
+    trace_span_t span = trace_begin("io", "jpeg_compress_parallel");
+    unsigned char *buffer;
+    unsigned long size = jpeg_compress_parallel_buffer(image, options, threads, &buffer);
+    if (image->last_operation != COMPRESSION_SUCCESS) {
+        trace_end(&span, 0);
+        return;
+    }
+
+    FILE *output_file;
+    if ((output_file = fopen(output_filename, "wb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", output_filename);
+        image->last_operation = FOPEN_FAILURE;
+        free(buffer);
+        trace_end(&span, 0);
+        return;
+    }
+
+    if (fwrite(buffer, 1, size, output_file) != size) image->last_operation = COMPRESSION_FAILURE;
+    fclose(output_file);
+    free(buffer);
+    trace_end(&span, image_bytes(image));
+}
+
+struct decode_chunk {
+    unsigned char *jpeg;        // standalone JPEG made of a run of restart intervals
+    unsigned long size;
+    const decode_options_t *options;
+    unsigned char **rows;       // destination rows, inside the pixels of the whole image
+    int skipped_rows;           // rows decoded only as upsampling context, discarded
+    int kept_rows;
+    int failed;
+};
+
+/**
+ * Decompresses one chunk straight into its rows of the destination image.
+ * @param arg pointer to struct decode_chunk
+ */
+void *decode_chunk(void *arg);
+
+/**
+ * Locates the restart intervals of the entropy-coded data of a single-scan JPEG.
+ * @param jpeg compressed data
+ * @param size number of bytes of jpeg
+ * @param entropy_offset offset of the first entropy-coded byte
+ * @param starts receives (allocated) the offset where each interval starts
+ * @param ends receives (allocated) the offset just past each interval's last byte
+ * @return number of intervals, 0 if the scan is not followed by EOI
+ */
+int find_restart_intervals(const unsigned char *jpeg, unsigned long size, unsigned long entropy_offset,
+                           unsigned long **starts, unsigned long **ends);
+
+/**
+ * Reads the header of a JPEG to learn the size, components and colorspace its decode with options has.
+ * @param image receives them
+ * @return Zero if libjpeg could not read the header.
+ */
+int read_output_format(const unsigned char *buffer, unsigned long size, const decode_options_t *options,
+                       image_t *image);
+
+void *decode_chunk(void *arg) {
+    struct decode_chunk *chunk = arg;
+    struct jpeg_decompress_struct cinfo;
+    struct error_manager jerr;
+    JSAMPROW row_pointer[1];
+    trace_span_t span = trace_begin("io", "decode_chunk");
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        chunk->failed = 1;
+        trace_end(&span, 0);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, chunk->jpeg, chunk->size);
+    (void) jpeg_read_header(&cinfo, TRUE);
+    apply_decode_options(&cinfo, chunk->options);
+    (void) jpeg_start_decompress(&cinfo);
+
+    JSAMPARRAY context_buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE,
+                                                           cinfo.output_width * cinfo.output_components, 1);
+    while ((int) cinfo.output_scanline < chunk->skipped_rows) {
+        (void) jpeg_read_scanlines(&cinfo, context_buffer, 1);
+    }
+    for (int row = 0; row < chunk->kept_rows; ++row) {
+        row_pointer[0] = (JSAMPROW) chunk->rows[row];
+        (void) jpeg_read_scanlines(&cinfo, row_pointer, 1);
+    }
+
+    trace_end(&span, (size_t) chunk->kept_rows * cinfo.output_width * cinfo.output_components);
+
+    // Trailing context rows are not needed
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return NULL;
+}
+
+int read_output_format(const unsigned char *buffer, unsigned long size, const decode_options_t *options,
+                       image_t *image) {
+    struct jpeg_decompress_struct cinfo;
+    struct error_manager jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return FALSE;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, buffer, size);
+    (void) jpeg_read_header(&cinfo, TRUE);
+    apply_decode_options(&cinfo, options);
+    jpeg_calc_output_dimensions(&cinfo);
+
+    image->width = (int) cinfo.output_width;
+    image->height = (int) cinfo.output_height;
+    image->channels = cinfo.output_components;
+    image->colorspace = cinfo.out_color_space;
+    jpeg_destroy_decompress(&cinfo);
+    return TRUE;
+}
+
+int find_restart_intervals(const unsigned char *jpeg, unsigned long size, unsigned long entropy_offset,
+                           unsigned long **starts, unsigned long **ends) {
+    int capacity = 64, n_intervals = 0;
+    *starts = ipp_malloc(capacity * sizeof(unsigned long));
+    *ends = ipp_malloc(capacity * sizeof(unsigned long));
+    (*starts)[0] = entropy_offset;
+
+    for (unsigned long pos = entropy_offset; pos + 1 < size; ++pos) {
+        if (jpeg[pos] != 0xFF) continue;
+
+        // skip fill bytes, then look at what the 0xFF introduces
+        unsigned long marker = pos + 1;
+        while (marker < size && jpeg[marker] == 0xFF) ++marker;
+        if (marker >= size) break;
+        int code = jpeg[marker];
+
+        if (code == 0x00) {
+            // stuffed zero: a literal 0xFF data byte
+            pos = marker;
+        } else if (code >= MARKER_RST0 && code <= MARKER_RST0 + 7) {
+            if (n_intervals + 1 == capacity) {
+                capacity *= 2;
+                *starts = ipp_realloc(*starts, capacity * sizeof(unsigned long));
+                *ends = ipp_realloc(*ends, capacity * sizeof(unsigned long));
+            }
+            (*ends)[n_intervals++] = pos;
+            (*starts)[n_intervals] = marker + 1;
+            pos = marker;
+        } else {
+            // any other marker ends the scan, only a lone scan followed by EOI is handled
+            (*ends)[n_intervals++] = pos;
+            return code == MARKER_EOI ? n_intervals : 0;
+        }
+    }
+    return 0;
+}
+
+image_t *jpeg_decompress_parallel_buffer(const unsigned char *buffer, unsigned long size,
+                                         const decode_options_t *options, int threads) {
+    if (threads <= 0) threads = default_thread_count();
+
+    unsigned long sof_offset = 0, sos_offset = 0;
+    unsigned long entropy_offset = find_entropy_data(buffer, size, &sof_offset, &sos_offset);
+
+    // Only interleaved sequential scans that carry every component can be cut at MCU rows
+    int n_components = entropy_offset ? buffer[sof_offset + 9] : 0;
+    if (!entropy_offset || threads == 1 || buffer[sos_offset + 4] != n_components) {
+        return jpeg_decompress_buffer(buffer, size, options);
+    }
+
+    int restart_interval = 0;
+    for (unsigned long pos = 2; pos < sos_offset; pos += 2 + ((buffer[pos + 2] << 8) | buffer[pos + 3])) {
+        if (buffer[pos + 1] == MARKER_DRI) restart_interval = (buffer[pos + 4] << 8) | buffer[pos + 5];
+    }
+    if (restart_interval == 0) return jpeg_decompress_buffer(buffer, size, options);
+
+    int image_height = (buffer[sof_offset + 5] << 8) | buffer[sof_offset + 6];
+    int image_width = (buffer[sof_offset + 7] << 8) | buffer[sof_offset + 8];
+    int max_h_sampling = 1, max_v_sampling = 1;
+    for (int c = 0; c < n_components && n_components > 1; ++c) {
+        int sampling = buffer[sof_offset + 10 + 3 * c + 1];
+        if ((sampling >> 4) > max_h_sampling) max_h_sampling = sampling >> 4;
+        if ((sampling & 0x0F) > max_v_sampling) max_v_sampling = sampling & 0x0F;
+    }
+    int mcu_width = 8 * max_h_sampling, mcu_height = 8 * max_v_sampling;
+    int mcus_per_row = (image_width + mcu_width - 1) / mcu_width;
+    int mcu_rows = (image_height + mcu_height - 1) / mcu_height;
+
+    unsigned long *starts, *ends;
+    int n_intervals = find_restart_intervals(buffer, size, entropy_offset, &starts, &ends);
+    long total_mcus = (long) mcus_per_row * mcu_rows;
+    if (n_intervals != (total_mcus + restart_interval - 1) / restart_interval) {
+        ipp_free(starts);
+        ipp_free(ends);
+        return jpeg_decompress_buffer(buffer, size, options);
+    }
+
+    // Chunks can only start at intervals that also start an MCU row
+    scratch_mark_t mark = scratch_mark();
+    int *boundaries = scratch_alloc((n_intervals + 1) * sizeof(int));
+    int n_boundaries = 0;
+    for (int i = 0; i < n_intervals; ++i) {
+        if ((long) i * restart_interval % mcus_per_row == 0) boundaries[n_boundaries++] = i;
+    }
+    boundaries[n_boundaries] = n_intervals;
+
+    // Pick, for each thread, the first boundary at or after its even share of MCU rows
+    int *chunk_starts = scratch_alloc((threads + 1) * sizeof(int));
+    int n_chunks = 0;
+    for (int t = 0, b = 0; t < threads; ++t) {
+        long target_mcu = (long) mcu_rows * t / threads * mcus_per_row;
+        while (b < n_boundaries && (long) boundaries[b] * restart_interval < target_mcu) ++b;
+        if (b < n_boundaries && (n_chunks == 0 || boundaries[b] > boundaries[chunk_starts[n_chunks - 1]])) {
+            chunk_starts[n_chunks++] = b;
+        }
+    }
+    chunk_starts[n_chunks] = n_boundaries;
+
+    // Read the header once to learn the output size and colorspace for these options
+    image_t *image = new_image();
+    if (n_chunks <= 1 || !read_output_format(buffer, size, options, image)) {
+        free_image(image);
+        ipp_free(starts);
+        ipp_free(ends);
+        scratch_release(mark);
+        return jpeg_decompress_buffer(buffer, size, options);
+    }
+    image->pixels = new_unsigned_char_matrix(image->height, image->width * image->channels);
+
+    struct decode_chunk *chunks = scratch_alloc((size_t) n_chunks * sizeof(struct decode_chunk));
+    memset(chunks, 0, (size_t) n_chunks * sizeof(struct decode_chunk));
+    for (int c = 0; c < n_chunks; ++c) {
+        // Each chunk also decodes the row-aligned run of intervals before and after it, so that fancy
+        // upsampling sees the same neighbouring chroma rows as a serial decode would
+        int first_boundary = chunk_starts[c] > 0 ? chunk_starts[c] - 1 : 0;
+        int last_boundary = chunk_starts[c + 1] < n_boundaries ? chunk_starts[c + 1] + 1 : n_boundaries;
+        int first_interval = boundaries[first_boundary];
+        int last_interval = boundaries[last_boundary];
+
+        int first_row = (int) ((long) boundaries[chunk_starts[c]] * restart_interval / mcus_per_row) * mcu_height;
+        int end_row = min_int((int) ((long) boundaries[chunk_starts[c + 1]] * restart_interval / mcus_per_row)
+                              * mcu_height, image_height);
+        int decoded_first_row = (int) ((long) first_interval * restart_interval / mcus_per_row) * mcu_height;
+        int decoded_end_row = min_int((int) ((long) last_interval * restart_interval / mcus_per_row) * mcu_height,
+                                      image_height);
+
+        // Standalone JPEG: original headers with the chunk's height, then its intervals renumbered from RST0
+        unsigned long data_size = ends[last_interval - 1] - starts[first_interval];
+        struct decode_chunk *chunk = &chunks[c];
+        chunk->jpeg = scratch_alloc(entropy_offset + data_size + 2 * (size_t) (last_interval - first_interval) + 2);
+        memcpy(chunk->jpeg, buffer, entropy_offset);
+        chunk->jpeg[sof_offset + 5] = (unsigned char) ((decoded_end_row - decoded_first_row) >> 8);
+        chunk->jpeg[sof_offset + 6] = (unsigned char) ((decoded_end_row - decoded_first_row) & 0xFF);
+        chunk->size = entropy_offset;
+        for (int i = first_interval; i < last_interval; ++i) {
+            if (i > first_interval) {
+                chunk->jpeg[chunk->size++] = 0xFF;
+                chunk->jpeg[chunk->size++] = (unsigned char) (MARKER_RST0 + (i - first_interval - 1) % 8);
+            }
+            memcpy(chunk->jpeg + chunk->size, buffer + starts[i], ends[i] - starts[i]);
+            chunk->size += ends[i] - starts[i];
+        }
+        chunk->jpeg[chunk->size++] = 0xFF;
+        chunk->jpeg[chunk->size++] = MARKER_EOI;
+
+        chunk->options = options;
+        chunk->rows = image->pixels + first_row;
+        chunk->skipped_rows = first_row - decoded_first_row;
+        chunk->kept_rows = end_row - first_row;
+    }
+
+    run_in_waves(decode_chunk, chunks, sizeof(struct decode_chunk), n_chunks, threads);
+
+    image->last_operation = DECOMPRESSION_SUCCESS;
+    for (int c = 0; c < n_chunks; ++c) {
+        if (chunks[c].failed) image->last_operation = DECOMPRESSION_FAILURE;
+    }
+    // as with a serial decode, a failed image has no pixels
+    if (image->last_operation == DECOMPRESSION_FAILURE) free_pixels(image);
+    scratch_release(mark);
+    ipp_free(starts);
+    ipp_free(ends);
+
+    return image;
+}
+
+image_t *jpeg_decompress_parallel(char *input_filename, const decode_options_t *options, int threads) {
+    int input_fd;
+    struct stat input_stat;
+    trace_span_t span = trace_begin("io", "jpeg_decompress_parallel");
+
+    if ((input_fd = open(input_filename, O_RDONLY)) < 0 || fstat(input_fd, &input_stat) < 0 || input_stat.st_size == 0) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        if (input_fd >= 0) close(input_fd);
+        image_t *image = new_image();
+        image->last_operation = FOPEN_FAILURE;
+        trace_end(&span, 0);
+        return image;
+    }
+
+    size_t size = (size_t) input_stat.st_size;
+    unsigned char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close(input_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", input_filename);
+        image_t *image = new_image();
+        image->last_operation = FOPEN_FAILURE;
+        trace_end(&span, 0);
+        return image;
+    }
+
+    image_t *image = jpeg_decompress_parallel_buffer(mapping, size, options, threads);
+    munmap(mapping, size);
+
+    if (image->last_operation == DECOMPRESSION_SUCCESS) image->filename = ipp_strdup(input_filename);
+    trace_end(&span, image_bytes(image));
+    return image;
+}
@@ -0,0 +1,697 @@
+/**
+ * Definitions for operation-graph pipelines.
+ */
+
+#include <pipeline.h>
+#include <image_formats.h>
+#include <codec_context.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+#include <scratch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+/**
+ * Appends a node reading input to a pipeline.
+ * @return Index of the node.
+ */
+int add_node(pipeline_t *pipeline, enum pipeline_op op, int input);
+
+/**
+ * Counts the consumers of every node, folds neighbours together and decides which outputs are whole images.
+ */
+void plan_pipeline(pipeline_t *pipeline);
+
+/**
+ * Whether an op reads its whole input before producing anything.
+ */
+int is_whole_image_op(enum pipeline_op op);
+
+/**
+ * Whether only the luminance of the output of a node is ever used downstream.
+ */
+int luminance_only_below(pipeline_t *pipeline, int node);
+
+/**
+ * Row y of the output of a node, computed if it is not materialized or in its ring buffer.
+ * The pointer stays valid while fewer than PIPELINE_RING_ROWS other rows of the node are requested.
+ */
+const unsigned char *node_row(pipeline_t *pipeline, int node, int y);
+
+/**
+ * Computes row y of the output of a streamed op.
+ * @param output where the row is written, unless the op can return a row of its input as is
+ * @return The row, either output or a row of the input.
+ */
+const unsigned char *compute_row(pipeline_t *pipeline, pipeline_node_t *node, int y, unsigned char *output);
+
+/**
+ * Row y of the luminance of the input of a convolution or histogram.
+ */
+const unsigned char *luminance_row(pipeline_t *pipeline, pipeline_node_t *node, int y);
+
+/**
+ * Sets the output geometry of a streamed op from its input.
+ */
+void stream_geometry(pipeline_t *pipeline, pipeline_node_t *node);
+
+/**
+ * Pixel matrix from the pool if one of the same geometry is there, a new one otherwise.
+ */
+unsigned char **take_buffer(pipeline_t *pipeline, int height, int row_bytes);
+
+/**
+ * Returns the pixels of an intermediate image to the pool, and releases the image.
+ */
+void release_buffer(pipeline_t *pipeline, image_t *image);
+
+/**
+ * Writes every row of the output of a node into a new image.
+ * @return The image, or NULL if its pixels could not be allocated.
+ */
+image_t *materialize_rows(pipeline_t *pipeline, int node);
+
+/**
+ * Tells the nearest materialized node above a finished node that one of its consumers is done with it, releasing
+ * its image when it was the last one.
+ */
+void finish_reading(pipeline_t *pipeline, int node);
+
+/**
+ * Releases what a previous run left in the nodes.
+ */
+void reset_outputs(pipeline_t *pipeline);
+
+/**
+ * Computes a node of a planned pipeline whose inputs were computed before it.
+ * @return Zero if the op could not be computed.
+ */
+int run_node(pipeline_t *pipeline, int index);
+
+pipeline_t *new_pipeline() {
+    pipeline_t *pipeline = ipp_calloc(1, sizeof(pipeline_t));
+    add_node(pipeline, PIPELINE_OP_SOURCE, -1);
+    return pipeline;
+}
+
+void reset_outputs(pipeline_t *pipeline) {
+    for (int i = 0; i < pipeline->node_count; ++i) {
+        pipeline_node_t *node = &pipeline->nodes[i];
+        if (node->image && i != PIPELINE_SOURCE) {
+            free_image(node->image);
+        }
+        node->image = NULL;
+        free_histogram(node->histogram);
+        node->histogram = NULL;
+        node->ring = NULL;
+        node->scratch = NULL;
+    }
+}
+
+void free_pipeline(pipeline_t *pipeline) {
+    reset_outputs(pipeline);
+    for (int i = 0; i < pipeline->pool_count; ++i) {
+        free_unsigned_char_matrix(pipeline->pool[i].pixels);
+    }
+    ipp_free(pipeline->nodes);
+    ipp_free(pipeline);
+}
+
+int add_node(pipeline_t *pipeline, enum pipeline_op op, int input) {
+    if (pipeline->node_count == pipeline->node_capacity) {
+        pipeline->node_capacity = pipeline->node_capacity ? 2 * pipeline->node_capacity : 8;
+        pipeline->nodes = ipp_realloc(pipeline->nodes, pipeline->node_capacity * sizeof(pipeline_node_t));
+    }
+
+    pipeline_node_t *node = &pipeline->nodes[pipeline->node_count];
+    memset(node, 0, sizeof(pipeline_node_t));
+    node->op = op;
+    node->input = input;
+    return pipeline->node_count++;
+}
+
+int pipeline_add_lut(pipeline_t *pipeline, int input, const unsigned char *lut) {
+    int node = add_node(pipeline, PIPELINE_OP_LUT, input);
+    memcpy(pipeline->nodes[node].lut, lut, sizeof(pipeline->nodes[node].lut));
+    return node;
+}
+
+int pipeline_add_bias(pipeline_t *pipeline, int input, double bias) {
+    unsigned char lut[256];
+    bias_lut(bias, lut);
+    return pipeline_add_lut(pipeline, input, lut);
+}
+
+int pipeline_add_gain(pipeline_t *pipeline, int input, double gain) {
+    unsigned char lut[256];
+    gain_lut(gain, lut);
+    return pipeline_add_lut(pipeline, input, lut);
+}
+
+int pipeline_add_negative(pipeline_t *pipeline, int input) {
+    unsigned char lut[256];
+    negative_lut(lut);
+    return pipeline_add_lut(pipeline, input, lut);
+}
+
+int pipeline_add_quantize(pipeline_t *pipeline, int input, int n_tones) {
+    unsigned char lut[256];
+    quantize_lut(n_tones, lut);
+    return pipeline_add_lut(pipeline, input, lut);
+}
+
+int pipeline_add_luminance(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_LUMINANCE, input);
+}
+
+int pipeline_add_luminance_to_rgb(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_LUMINANCE_TO_RGB, input);
+}
+
+int pipeline_add_mirror_horizontally(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_MIRROR_HORIZONTALLY, input);
+}
+
+int pipeline_add_mirror_vertically(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_MIRROR_VERTICALLY, input);
+}
+
+int pipeline_add_convolve(pipeline_t *pipeline, int input, float **filter, boolean clamp) {
+    int index = add_node(pipeline, PIPELINE_OP_CONVOLVE, input);
+    pipeline_node_t *node = &pipeline->nodes[index];
+    for (int i = 0; i < FILTER_SIZE; ++i) {
+        for (int j = 0; j < FILTER_SIZE; ++j) {
+            node->rot_filter[i][j] = filter[FILTER_SIZE - i - 1][FILTER_SIZE - j - 1];
+        }
+    }
+    node->clamp = clamp;
+    return index;
+}
+
+int pipeline_add_histogram(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_HISTOGRAM, input);
+}
+
+int pipeline_add_rotate_90_degrees_clock_wise(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE, input);
+}
+
+int pipeline_add_zoom_out(pipeline_t *pipeline, int input, int sx, int sy) {
+    int node = add_node(pipeline, PIPELINE_OP_ZOOM_OUT, input);
+    pipeline->nodes[node].sx = sx;
+    pipeline->nodes[node].sy = sy;
+    return node;
+}
+
+int pipeline_add_zoom_in(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_ZOOM_IN, input);
+}
+
+int pipeline_add_equalize_histogram(pipeline_t *pipeline, int input) {
+    return add_node(pipeline, PIPELINE_OP_EQUALIZE_HISTOGRAM, input);
+}
+
+int pipeline_output(pipeline_t *pipeline) {
+    return pipeline->node_count - 1;
+}
+
+pipeline_t *parse_pipeline(const char *spec) {
+    pipeline_t *pipeline = new_pipeline();
+    char *copy = ipp_strdup(spec);
+    int last = PIPELINE_SOURCE;
+    int failed = 0;
+
+    char *op_state;
+    for (char *op = strtok_r(copy, ",", &op_state); op && !failed; op = strtok_r(NULL, ",", &op_state)) {
+        char *argument_state;
+        char *name = strtok_r(op, ":", &argument_state);
+        char *argument = strtok_r(NULL, ":", &argument_state);
+        char *flag = strtok_r(NULL, ":", &argument_state);
+
+        if (!name || pipeline->nodes[last].op == PIPELINE_OP_HISTOGRAM) {
+            // a histogram has no image for later ops to read
+            failed = 1;
+        } else if (strcmp(name, "bias") == 0 && argument) {
+            last = pipeline_add_bias(pipeline, last, atof(argument));
+        } else if (strcmp(name, "gain") == 0 && argument) {
+            last = pipeline_add_gain(pipeline, last, atof(argument));
+        } else if (strcmp(name, "negative") == 0) {
+            last = pipeline_add_negative(pipeline, last);
+        } else if (strcmp(name, "quantize") == 0 && argument && atoi(argument) > 1) {
+            last = pipeline_add_quantize(pipeline, last, atoi(argument));
+        } else if (strcmp(name, "luminance") == 0) {
+            last = pipeline_add_luminance(pipeline, last);
+        } else if (strcmp(name, "rgb") == 0) {
+            last = pipeline_add_luminance_to_rgb(pipeline, last);
+        } else if (strcmp(name, "mirror-h") == 0) {
+            last = pipeline_add_mirror_horizontally(pipeline, last);
+        } else if (strcmp(name, "mirror-v") == 0) {
+            last = pipeline_add_mirror_vertically(pipeline, last);
+        } else if (strcmp(name, "rotate") == 0) {
+            last = pipeline_add_rotate_90_degrees_clock_wise(pipeline, last);
+        } else if (strcmp(name, "zoom-out") == 0 && argument) {
+            int sx, sy;
+            if (sscanf(argument, "%dx%d", &sx, &sy) != 2 || sx < 1 || sy < 1) failed = 1;
+            else last = pipeline_add_zoom_out(pipeline, last, sx, sy);
+        } else if (strcmp(name, "zoom-in") == 0) {
+            last = pipeline_add_zoom_in(pipeline, last);
+        } else if (strcmp(name, "equalize") == 0) {
+            last = pipeline_add_equalize_histogram(pipeline, last);
+        } else if (strcmp(name, "histogram") == 0) {
+            last = pipeline_add_histogram(pipeline, last);
+        } else if (strcmp(name, "convolve") == 0 && argument) {
+            float **filter;
+            if (strcmp(argument, "gaussian") == 0) filter = gaussian_filter();
+            else if (strcmp(argument, "laplacian") == 0) filter = laplacian_filter();
+            else if (strcmp(argument, "high-pass") == 0) filter = high_pass_filter();
+            else if (strcmp(argument, "prewitt-hx") == 0) filter = prewitt_hx_filter();
+            else if (strcmp(argument, "prewitt-hy") == 0) filter = prewitt_hy_filter();
+            else if (strcmp(argument, "sobel-hx") == 0) filter = sobel_hx_filter();
+            else if (strcmp(argument, "sobel-hy") == 0) filter = sobel_hy_filter();
+            else filter = NULL;
+
+            if (!filter || (flag && strcmp(flag, "clamp") != 0)) {
+                failed = 1;
+            } else {
+                last = pipeline_add_convolve(pipeline, last, filter, flag != NULL);
+            }
+
+            if (filter) {
+                free_filter(filter);
+            }
+        } else {
+            failed = 1;
+        }
+    }
+    ipp_free(copy);
+
+    if (failed || last == PIPELINE_SOURCE) {
+        free_pipeline(pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+int is_whole_image_op(enum pipeline_op op) {
+    return op >= PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE;
+}
+
+void plan_pipeline(pipeline_t *pipeline) {
+    pipeline_node_t *nodes = pipeline->nodes;
+    pipeline->stats.fused = 0;
+
+    for (int i = 0; i < pipeline->node_count; ++i) nodes[i].consumers = 0;
+    for (int i = 1; i < pipeline->node_count; ++i) {
+        if (!nodes[i].fused) ++nodes[nodes[i].input].consumers;
+    }
+
+    // Fold a node into its only consumer: lookup tables compose, and histograms and convolutions take the
+    // luminance of their input themselves. Inputs come first, so whole chains collapse into their last node.
+    for (int i = 1; i < pipeline->node_count; ++i) {
+        pipeline_node_t *node = &nodes[i];
+        if (node->fused) {
+            ++pipeline->stats.fused;
+            continue;
+        }
+
+        pipeline_node_t *input = &nodes[node->input];
+        if (input->consumers != 1 || node->input == PIPELINE_SOURCE) continue;
+
+        if (node->op == PIPELINE_OP_LUT && input->op == PIPELINE_OP_LUT) {
+            unsigned char lut[256];
+            for (int v = 0; v < 256; ++v) lut[v] = node->lut[input->lut[v]];
+            memcpy(node->lut, lut, sizeof(lut));
+        } else if ((node->op == PIPELINE_OP_HISTOGRAM || node->op == PIPELINE_OP_CONVOLVE) &&
+                   input->op == PIPELINE_OP_LUMINANCE) {
+            // nothing to combine, the consumer converts to luminance on its own
+        } else {
+            continue;
+        }
+
+        input->fused = 1;
+        input->consumers = 0;
+        node->input = input->input;
+        ++pipeline->stats.fused;
+    }
+
+    // Streamed outputs must be read by exactly one op, in row order; everything else is written in full
+    for (int i = 1; i < pipeline->node_count; ++i) {
+        pipeline_node_t *node = &nodes[i];
+        node->materialize = !node->fused && (node->consumers != 1 || is_whole_image_op(node->op) ||
+                                             node->op == PIPELINE_OP_HISTOGRAM);
+    }
+    nodes[PIPELINE_SOURCE].materialize = TRUE;
+}
+
+int luminance_only_below(pipeline_t *pipeline, int node) {
+    int readers = 0;
+    for (int i = node + 1; i < pipeline->node_count; ++i) {
+        pipeline_node_t *consumer = &pipeline->nodes[i];
+        if (consumer->fused || consumer->input != node) continue;
+        ++readers;
+
+        switch (consumer->op) {
+            case PIPELINE_OP_LUMINANCE:
+            case PIPELINE_OP_HISTOGRAM:
+            case PIPELINE_OP_CONVOLVE:
+                break;
+            case PIPELINE_OP_MIRROR_HORIZONTALLY:
+            case PIPELINE_OP_MIRROR_VERTICALLY:
+            case PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE:
+                // moving pixels around commutes with taking their luminance
+                if (!luminance_only_below(pipeline, i)) return FALSE;
+                break;
+            default:
+                return FALSE;
+        }
+    }
+    return readers > 0;
+}
+
+int pipeline_luminance_only(pipeline_t *pipeline) {
+    plan_pipeline(pipeline);
+    return luminance_only_below(pipeline, PIPELINE_SOURCE);
+}
+
+void stream_geometry(pipeline_t *pipeline, pipeline_node_t *node) {
+    pipeline_node_t *input = &pipeline->nodes[node->input];
+    node->width = input->width;
+    node->height = input->height;
+    node->channels = input->channels;
+    node->colorspace = input->colorspace;
+
+    switch (node->op) {
+        case PIPELINE_OP_LUMINANCE:
+            node->channels = 1;
+            node->colorspace = JCS_GRAYSCALE;
+            break;
+        case PIPELINE_OP_LUMINANCE_TO_RGB:
+            node->channels = 3;
+            node->colorspace = JCS_RGB;
+            break;
+        case PIPELINE_OP_CONVOLVE:
+            node->width = input->width - FILTER_SIZE / 2;
+            node->height = input->height - FILTER_SIZE / 2;
+            node->channels = 1;
+            node->colorspace = JCS_GRAYSCALE;
+            break;
+        default:
+            break;
+    }
+}
+
+unsigned char **take_buffer(pipeline_t *pipeline, int height, int row_bytes) {
+    for (int i = 0; i < pipeline->pool_count; ++i) {
+        if (pipeline->pool[i].height == height && pipeline->pool[i].row_bytes == row_bytes) {
+            unsigned char **pixels = pipeline->pool[i].pixels;
+            pipeline->pool[i] = pipeline->pool[--pipeline->pool_count];
+            ++pipeline->stats.reused_buffers;
+            return pixels;
+        }
+    }
+    return new_unsigned_char_matrix(height, row_bytes);
+}
+
+void release_buffer(pipeline_t *pipeline, image_t *image) {
+    if (pipeline->pool_count < PIPELINE_POOL_SIZE && !image->mapping) {
+        pipeline_buffer_t *buffer = &pipeline->pool[pipeline->pool_count++];
+        buffer->pixels = image->pixels;
+        buffer->height = image->height;
+        buffer->row_bytes = image->width * image->channels;
+        image->pixels = NULL;
+    }
+    free_image(image);
+}
+
+const unsigned char *luminance_row(pipeline_t *pipeline, pipeline_node_t *node, int y) {
+    pipeline_node_t *input = &pipeline->nodes[node->input];
+    const unsigned char *row = node_row(pipeline, node->input, y);
+    if (input->channels == 1) return row;
+
+    int slot = y % PIPELINE_RING_ROWS;
+    unsigned char *luminance = node->scratch + (size_t) slot * input->width;
+    if (node->scratch_tags[slot] != y) {
+        convert_pixels(row, input->channels, luminance, 1, input->width);
+        node->scratch_tags[slot] = y;
+    }
+    return luminance;
+}
+
+const unsigned char *compute_row(pipeline_t *pipeline, pipeline_node_t *node, int y, unsigned char *output) {
+    pipeline_node_t *input = &pipeline->nodes[node->input];
+    const unsigned char *row;
+    int half = FILTER_SIZE / 2;
+
+    switch (node->op) {
+        case PIPELINE_OP_LUT:
+            row = node_row(pipeline, node->input, y);
+            map_components(row, output, node->width * node->channels, node->lut);
+            return output;
+
+        case PIPELINE_OP_LUMINANCE:
+            row = node_row(pipeline, node->input, y);
+            if (input->colorspace == JCS_GRAYSCALE || input->channels == 1) return row;
+            convert_pixels(row, input->channels, output, 1, node->width);
+            return output;
+
+        case PIPELINE_OP_LUMINANCE_TO_RGB:
+            row = node_row(pipeline, node->input, y);
+            if (input->colorspace == JCS_RGB) return row;
+            convert_pixels(row, input->channels, output, 3, node->width);
+            return output;
+
+        case PIPELINE_OP_MIRROR_HORIZONTALLY:
+            row = node_row(pipeline, node->input, y);
+            reverse_pixels(row, output, node->width, node->channels);
+            return output;
+
+        case PIPELINE_OP_MIRROR_VERTICALLY:
+            return node_row(pipeline, node->input, node->height - 1 - y);
+
+        case PIPELINE_OP_CONVOLVE: {
+            memset(output, 0, node->width);
+            if (y < half || y >= node->height - half) return output;
+
+            const unsigned char *window[FILTER_SIZE];
+            for (int i = 0; i < FILTER_SIZE; ++i) window[i] = luminance_row(pipeline, node, y - half + i);
+
+            convolve_row(window, output, half, node->width - half, &node->rot_filter[0][0], node->clamp);
+            return output;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+const unsigned char *node_row(pipeline_t *pipeline, int index, int y) {
+    pipeline_node_t *node = &pipeline->nodes[index];
+    if (node->image) return node->image->pixels[y];
+
+    int slot = y % PIPELINE_RING_ROWS;
+    unsigned char *output = node->ring + (size_t) slot * node->width * node->channels;
+    if (node->ring_tags[slot] == y) return output;
+
+    const unsigned char *row = compute_row(pipeline, node, y, output);
+    if (row == output) node->ring_tags[slot] = y;
+    return row;
+}
+
+image_t *materialize_rows(pipeline_t *pipeline, int index) {
+    pipeline_node_t *node = &pipeline->nodes[index];
+    int row_bytes = node->width * node->channels;
+
+    // one span for the pass, whatever streamed ops it runs through
+    trace_span_t span = trace_begin("op", "materialize_rows");
+    image_t *image = new_image();
+    image->width = node->width;
+    image->height = node->height;
+    image->channels = node->channels;
+    image->colorspace = node->colorspace;
+    image->pixels = take_buffer(pipeline, node->height, row_bytes);
+    if (!image->pixels) {
+        free_image(image);
+        trace_end(&span, 0);
+        return NULL;
+    }
+
+    for (int y = 0; y < node->height; ++y) {
+        const unsigned char *row = node->image ? node->image->pixels[y] : compute_row(pipeline, node, y,
+                                                                                     image->pixels[y]);
+        if (row != image->pixels[y]) memcpy(image->pixels[y], row, row_bytes);
+    }
+    ++pipeline->stats.passes;
+    trace_end(&span, image_bytes(image));
+    return image;
+}
+
+void finish_reading(pipeline_t *pipeline, int index) {
+    // streamed nodes have a single consumer, so they are done as soon as it is
+    int above = pipeline->nodes[index].input;
+    while (above > PIPELINE_SOURCE && !pipeline->nodes[above].materialize) above = pipeline->nodes[above].input;
+    if (above <= PIPELINE_SOURCE) return;
+
+    pipeline_node_t *node = &pipeline->nodes[above];
+    if (--node->pending == 0 && node->image) {
+        release_buffer(pipeline, node->image);
+        node->image = NULL;
+    }
+}
+
+int run_node(pipeline_t *pipeline, int index) {
+    pipeline_node_t *nodes = pipeline->nodes;
+    pipeline_node_t *node = &nodes[index];
+    pipeline_node_t *input = &nodes[node->input];
+    node->pending = node->consumers;
+
+    if (!is_whole_image_op(node->op)) stream_geometry(pipeline, node);
+    if (node->width < 0 || node->height < 0) return FALSE;
+
+    if (!node->materialize) {
+        // streamed: rows are computed when the consumer asks for them
+        node->ring = scratch_alloc((size_t) PIPELINE_RING_ROWS * node->width * node->channels);
+        if (!node->ring) return FALSE;
+        for (int r = 0; r < PIPELINE_RING_ROWS; ++r) node->ring_tags[r] = -1;
+        ++pipeline->stats.streamed;
+    }
+    if ((node->op == PIPELINE_OP_CONVOLVE || node->op == PIPELINE_OP_HISTOGRAM) && input->channels != 1) {
+        node->scratch = scratch_alloc((size_t) PIPELINE_RING_ROWS * input->width);
+        if (!node->scratch) return FALSE;
+        for (int r = 0; r < PIPELINE_RING_ROWS; ++r) node->scratch_tags[r] = -1;
+    }
+    if (!node->materialize) return TRUE;
+
+    if (node->op == PIPELINE_OP_HISTOGRAM) {
+        trace_span_t pass = trace_begin("op", "compute_histogram");
+        node->histogram = new_histogram();
+        if (!node->histogram) {
+            trace_end(&pass, 0);
+            return FALSE;
+        }
+        for (int y = 0; y < input->height; ++y) {
+            const unsigned char *row = input->channels == 1 ? node_row(pipeline, node->input, y)
+                                                            : luminance_row(pipeline, node, y);
+            count_components(row, input->width, node->histogram);
+        }
+        trace_end(&pass, (size_t) input->height * input->width * input->channels);
+        ++pipeline->stats.passes;
+
+    } else if (is_whole_image_op(node->op)) {
+        // the ops below make no sense of an image without pixels (zoom_in() would give it a negative size)
+        if (input->width <= 0 || input->height <= 0) return FALSE;
+
+        // take over the input image when nothing else reads it, otherwise write the input rows in full
+        image_t *image;
+        if (node->input != PIPELINE_SOURCE && input->materialize && input->pending == 1 && input->image) {
+            image = input->image;
+            input->image = NULL;
+        } else {
+            node->width = input->width;
+            node->height = input->height;
+            node->channels = input->channels;
+            node->colorspace = input->colorspace;
+            image = materialize_rows(pipeline, node->input);
+            if (!image) return FALSE;
+        }
+
+        if (node->op == PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE) rotate_90_degrees_clock_wise(image);
+        else if (node->op == PIPELINE_OP_ZOOM_OUT) zoom_out(image, node->sx, node->sy);
+        else if (node->op == PIPELINE_OP_ZOOM_IN) zoom_in(image);
+        else equalize_histogram(image);
+        ++pipeline->stats.passes;
+
+        node->image = image;
+        node->width = image->width;
+        node->height = image->height;
+        node->channels = image->channels;
+        node->colorspace = image->colorspace;
+
+    } else {
+        node->image = materialize_rows(pipeline, index);
+        if (!node->image) return FALSE;
+    }
+
+    finish_reading(pipeline, index);
+    return TRUE;
+}
+
+void pipeline_run(pipeline_t *pipeline, image_t *source) {
+    trace_span_t span = trace_begin("op", "pipeline_run");
+    reset_outputs(pipeline);
+    memset(&pipeline->stats, 0, sizeof(pipeline_stats_t));
+    plan_pipeline(pipeline);
+    if (!source->pixels) {
+        fprintf(stderr, "Pipeline source has no pixels\n");
+        pipeline->last_operation = WRITE_FAILURE;
+        trace_end(&span, 0);
+        return;
+    }
+
+    // rings are scratch, only needed while their consumers run
+    scratch_mark_t mark = scratch_mark();
+    pipeline_node_t *nodes = pipeline->nodes;
+    nodes[PIPELINE_SOURCE].image = source;
+    nodes[PIPELINE_SOURCE].width = source->width;
+    nodes[PIPELINE_SOURCE].height = source->height;
+    nodes[PIPELINE_SOURCE].channels = source->channels;
+    nodes[PIPELINE_SOURCE].colorspace = source->colorspace;
+
+    int failed = 0;
+    for (int i = 1; i < pipeline->node_count && !failed; ++i) {
+        if (nodes[i].fused) continue;
+        if (!run_node(pipeline, i)) {
+            fprintf(stderr, "Pipeline node %d could not be computed\n", i);
+            failed = 1;
+        }
+    }
+
+    scratch_release(mark);
+    for (int i = 0; i < pipeline->node_count; ++i) {
+        nodes[i].ring = NULL;
+        nodes[i].scratch = NULL;
+    }
+    nodes[PIPELINE_SOURCE].image = NULL;
+    if (failed) {
+        // outputs computed before the failure are dropped along with the intermediates
+        reset_outputs(pipeline);
+    }
+    pipeline->last_operation = failed ? WRITE_FAILURE : WRITE_SUCCESS;
+    trace_end(&span, image_bytes(source));
+}
+
+void pipeline_run_file(pipeline_t *pipeline, char *input_filename) {
+    image_t *source;
+    if (is_jpeg_filename(input_filename)) {
+        // pipelines are run over many files in a row, so JPEGs are decoded with the codec context of the thread
+        decode_options_t options = luminance_decode_options();
+        source = codec_decompress_file(thread_codec_context(), input_filename,
+                                       pipeline_luminance_only(pipeline) ? &options : NULL);
+    } else {
+        source = load_image(input_filename);
+    }
+
+    if (source->last_operation == DECOMPRESSION_SUCCESS || source->last_operation == READ_SUCCESS) {
+        pipeline_run(pipeline, source);
+    } else {
+        pipeline->last_operation = READ_FAILURE;
+    }
+
+    free_image(source);
+}
+
+image_t *pipeline_image(pipeline_t *pipeline, int node) {
+    if (node <= PIPELINE_SOURCE || node >= pipeline->node_count || pipeline->nodes[node].consumers) return NULL;
+
+    image_t *image = pipeline->nodes[node].image;
+    pipeline->nodes[node].image = NULL;
+    return image;
+}
+
+int *pipeline_histogram(pipeline_t *pipeline, int node) {
+    if (node <= PIPELINE_SOURCE || node >= pipeline->node_count) return NULL;
+
+    int *histogram = pipeline->nodes[node].histogram;
+    pipeline->nodes[node].histogram = NULL;
+    return histogram;
+}
@@ -0,0 +1,585 @@
+/**
+ * Definitions for the row kernels shared by the image operations.
+ */
+
+#include <pixel_kernels.h>
+#include <image_manipulation.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Kernel bodies take the channel count as a parameter and are always inlined, so that calling one with a constant
+// count compiles a loop specialized for it
+#define PIXEL_KERNEL static inline __attribute__((always_inline))
+
+// Calls kernel(..., channels, ...) with channels a compile time constant for the counts worth specializing
+#define DISPATCH_CHANNELS(channels, call) \
+    switch (channels) {                   \
+        case 1: { enum { CHANNELS = 1 }; call; break; } \
+        case 3: { enum { CHANNELS = 3 }; call; break; } \
+        case 4: { enum { CHANNELS = 4 }; call; break; } \
+        default: { int CHANNELS = channels; call; break; } \
+    }
+
+// Levels other than CPU_LEVEL_GENERIC are only built where GCC can target them function by function
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MULTI_ISA 1
+#else
+#define MULTI_ISA 0
+#endif
+
+/**
+ * One compiled variant of every kernel. Multiplications and additions are never fused into FMA at any level so
+ * that all of them round, and so output, exactly as the generic one does.
+ */
+typedef struct pixel_kernels_struct {
+    void (*convert_pixels)(const unsigned char *, int, unsigned char *, int, int);
+    void (*mirror_pixels)(unsigned char *, int, int);
+    void (*reverse_pixels)(const unsigned char *, unsigned char *, int, int);
+    void (*accumulate_windows)(const unsigned char *, int, int, int, int *);
+    void (*zoom_in_pixels)(const unsigned char *, unsigned char *, int, int);
+    void (*interpolate_odd_pixels)(unsigned char *, int, int);
+    void (*average_rows)(const unsigned char *, const unsigned char *, unsigned char *, int);
+    void (*scatter_pixels)(const unsigned char *, int, int, unsigned char *, ptrdiff_t);
+    void (*map_components)(const unsigned char *, unsigned char *, int, const unsigned char *);
+    void (*map_channels)(const unsigned char *, unsigned char *, int, int, const unsigned char *);
+    void (*map_luma)(const unsigned char *, unsigned char *, int, int, const unsigned char *);
+    void (*count_components)(const unsigned char *, int, int *);
+    void (*blend_tables)(const unsigned char *, const unsigned char *, int, unsigned short *, int);
+    void (*map_blended)(const unsigned char *, unsigned char *, int, int, const unsigned short *, const int *,
+                        const int *, const unsigned short *);
+    void (*convolve_row)(const unsigned char *const *, unsigned char *, int, int, const float *, int);
+    void (*gradient_row)(const unsigned char *const *, int, int, short *, short *);
+    void (*gradient_magnitude)(const short *, const short *, int, int, int, unsigned char *);
+    void (*gradient_orientation)(const short *, const short *, int, int, const int *, unsigned char *);
+} pixel_kernels_t;
+
+// Level of the kernels, an enum cpu_level; set_cpu_level() may change it while other threads run kernels
+pthread_once_t cpu_level_once = PTHREAD_ONCE_INIT;
+atomic_int selected_cpu_level = CPU_LEVEL_GENERIC;
+
+/**
+ * Picks the level of the kernels: the best one the processor supports, or the one named by IPP_CPU_LEVEL.
+ */
+void select_cpu_level();
+
+/**
+ * Switches the kernels to a level, without first selecting the default one as set_cpu_level() does.
+ * @return Zero, leaving the level unchanged, if the processor does not support it.
+ */
+int store_cpu_level(enum cpu_level level);
+
+/**
+ * Kernels compiled for the selected level.
+ */
+const pixel_kernels_t *active_kernels();
+
+PIXEL_KERNEL unsigned char luminance_of(const unsigned char *pixel) {
+    return (unsigned char) (int) (0.299 * (int) pixel[0] + 0.587 * (int) pixel[1] + 0.114 * (int) pixel[2]);
+}
+
+PIXEL_KERNEL void convert_kernel(const unsigned char *restrict in, int in_channels, unsigned char *restrict out,
+                                 int out_channels, int count) {
+    for (int x = 0; x < count; ++x) {
+        const unsigned char *p = in + x * in_channels;
+        unsigned char *q = out + x * out_channels;
+        if (out_channels == 1) {
+            q[0] = in_channels >= 3 ? luminance_of(p) : p[0];
+            continue;
+        }
+        for (int c = 0; c < out_channels; ++c) {
+            if (c == 3) q[c] = in_channels == 4 ? p[3] : 255;
+            else q[c] = in_channels >= 3 ? p[c] : p[0];
+        }
+    }
+}
+
+PIXEL_KERNEL void convert_dispatch(const unsigned char *in, int in_channels, unsigned char *out, int out_channels,
+                                   int count) {
+    if (in_channels == out_channels) {
+        memcpy(out, in, (size_t) count * in_channels);
+        return;
+    }
+
+    switch (in_channels * 8 + out_channels) {
+        case 3 * 8 + 1: convert_kernel(in, 3, out, 1, count); break;
+        case 4 * 8 + 1: convert_kernel(in, 4, out, 1, count); break;
+        case 1 * 8 + 3: convert_kernel(in, 1, out, 3, count); break;
+        case 1 * 8 + 4: convert_kernel(in, 1, out, 4, count); break;
+        case 3 * 8 + 4: convert_kernel(in, 3, out, 4, count); break;
+        case 4 * 8 + 3: convert_kernel(in, 4, out, 3, count); break;
+        default: convert_kernel(in, in_channels, out, out_channels, count);
+    }
+}
+
+PIXEL_KERNEL void mirror_kernel(unsigned char *row, int count, int channels) {
+    for (int left = 0, right = count - 1; left < right; ++left, --right) {
+        for (int c = 0; c < channels; ++c) {
+            unsigned char swap = row[left * channels + c];
+            row[left * channels + c] = row[right * channels + c];
+            row[right * channels + c] = swap;
+        }
+    }
+}
+
+PIXEL_KERNEL void reverse_kernel(const unsigned char *restrict in, unsigned char *restrict out, int count,
+                                 int channels) {
+    for (int x = 0; x < count; ++x) {
+        for (int c = 0; c < channels; ++c) {
+            out[x * channels + c] = in[(count - 1 - x) * channels + c];
+        }
+    }
+}
+
+PIXEL_KERNEL void accumulate_kernel(const unsigned char *restrict row, int count, int channels, int sx,
+                                    int *restrict sums) {
+    for (int pos_x = 0; pos_x < count; pos_x += sx, sums += channels) {
+        int last_x = pos_x + sx < count ? pos_x + sx : count;
+        for (int x = pos_x; x < last_x; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                sums[c] += row[x * channels + c];
+            }
+        }
+    }
+}
+
+PIXEL_KERNEL void interpolate_odd_kernel(unsigned char *row, int count, int channels) {
+    for (int x = 1; x + 1 < count; x += 2) {
+        for (int c = 0; c < channels; ++c) {
+            row[x * channels + c] = (unsigned char) ((row[(x - 1) * channels + c] + row[(x + 1) * channels + c]) / 2);
+        }
+    }
+}
+
+PIXEL_KERNEL void zoom_in_kernel(const unsigned char *restrict in, unsigned char *restrict out, int count,
+                                 int channels) {
+    for (int x = 0; x < count; ++x) {
+        for (int c = 0; c < channels; ++c) {
+            out[2 * x * channels + c] = in[x * channels + c];
+        }
+    }
+    interpolate_odd_kernel(out, 2 * count - 1, channels);
+}
+
+PIXEL_KERNEL void average_rows_kernel(const unsigned char *restrict a, const unsigned char *restrict b,
+                                      unsigned char *restrict out, int components) {
+    for (int i = 0; i < components; ++i) {
+        out[i] = (unsigned char) ((a[i] + b[i]) / 2);
+    }
+}
+
+PIXEL_KERNEL void scatter_kernel(const unsigned char *restrict row, int count, int channels,
+                                 unsigned char *restrict column, ptrdiff_t stride) {
+    for (int x = 0; x < count; ++x) {
+        for (int c = 0; c < channels; ++c) {
+            column[x * stride + c] = row[x * channels + c];
+        }
+    }
+}
+
+PIXEL_KERNEL void map_kernel(const unsigned char *in, unsigned char *out, int components, const unsigned char *lut) {
+    for (int i = 0; i < components; ++i) {
+        out[i] = lut[in[i]];
+    }
+}
+
+PIXEL_KERNEL void map_channels_kernel(const unsigned char *in, unsigned char *out, int count, int channels,
+                                      const unsigned char *luts) {
+    for (int x = 0; x < count; ++x) {
+        for (int c = 0; c < channels; ++c) {
+            out[x * channels + c] = luts[c * 256 + in[x * channels + c]];
+        }
+    }
+}
+
+PIXEL_KERNEL void map_luma_kernel(const unsigned char *in, unsigned char *out, int count, int channels,
+                                  const unsigned char *lut) {
+    for (int x = 0; x < count; ++x) {
+        const unsigned char *p = in + x * channels;
+        unsigned char *q = out + x * channels;
+        if (channels < 3) {
+            q[0] = lut[p[0]];
+            for (int c = 1; c < channels; ++c) q[c] = p[c];
+            continue;
+        }
+
+        // with Cb and Cr fixed, a change of Y is the same change of R, G and B
+        int luminance = luminance_of(p);
+        int delta = lut[luminance] - luminance;
+        for (int c = 0; c < channels; ++c) {
+            int value = c < 3 ? p[c] + delta : p[c];
+            q[c] = (unsigned char) (value < 0 ? 0 : value > 255 ? 255 : value);
+        }
+    }
+}
+
+PIXEL_KERNEL void count_kernel(const unsigned char *in, int components, int *histogram) {
+    // Four partial histograms, so that runs of equal values do not wait on the same counter
+    int partial[4][HISTOGRAM_SIZE];
+    memset(partial, 0, sizeof(partial));
+
+    int i = 0;
+    for (; i + 4 <= components; i += 4) {
+        ++partial[0][in[i]];
+        ++partial[1][in[i + 1]];
+        ++partial[2][in[i + 2]];
+        ++partial[3][in[i + 3]];
+    }
+    for (; i < components; ++i) {
+        ++partial[0][in[i]];
+    }
+
+    for (int value = 0; value < HISTOGRAM_SIZE; ++value) {
+        histogram[value] += partial[0][value] + partial[1][value] + partial[2][value] + partial[3][value];
+    }
+}
+
+PIXEL_KERNEL void blend_kernel(const unsigned char *restrict a, const unsigned char *restrict b, int weight,
+                               unsigned short *restrict out, int count) {
+    for (int i = 0; i < count; ++i) {
+        out[i] = (unsigned short) (a[i] * (256 - weight) + b[i] * weight);
+    }
+}
+
+PIXEL_KERNEL void map_blended_kernel(const unsigned char *in, unsigned char *out, int count, int channels,
+                                     const unsigned short *restrict tables, const int *restrict left,
+                                     const int *restrict right, const unsigned short *restrict weights) {
+    for (int x = 0; x < count; ++x) {
+        const unsigned short *left_table = tables + left[x], *right_table = tables + right[x];
+        int weight = weights[x];
+        for (int c = 0; c < channels; ++c) {
+            int value = in[x * channels + c];
+            out[x * channels + c] = (unsigned char) ((left_table[value] * (256 - weight) +
+                                                      right_table[value] * weight + 32768) >> 16);
+        }
+    }
+}
+
+PIXEL_KERNEL void convolve_kernel(const unsigned char *const *rows, unsigned char *restrict out, int first, int last,
+                                  const float *rot_filter, int clamp) {
+    int half = FILTER_SIZE / 2;
+    float offset = clamp ? 127 : 0;
+
+    for (int x = first; x < last; ++x) {
+        // accumulate pixel by pixel multiplication around center of filter, in the order convolve() does
+        float conv_point = 0;
+        for (int y_offset = -half; y_offset <= half; ++y_offset) {
+            for (int x_offset = -half; x_offset <= half; ++x_offset) {
+                conv_point += rot_filter[(half + y_offset) * FILTER_SIZE + half + x_offset] *
+                              (float) rows[half + y_offset][x + x_offset];
+            }
+        }
+
+        // fix out of range values
+        conv_point += offset;
+        conv_point = conv_point > 255 ? 255 : conv_point;
+        conv_point = conv_point < 0 ? 0 : conv_point;
+
+        out[x] = (unsigned char) conv_point;
+    }
+}
+
+PIXEL_KERNEL void gradient_kernel(const unsigned char *const *rows, int count, int center_weight,
+                                   short *restrict gx, short *restrict gy) {
+    const unsigned char *above = rows[0], *row = rows[1], *below = rows[2];
+    for (int x = 0; x < count; ++x) {
+        int left = above[x - 1] + center_weight * row[x - 1] + below[x - 1];
+        int right = above[x + 1] + center_weight * row[x + 1] + below[x + 1];
+        int up = above[x - 1] + center_weight * above[x] + above[x + 1];
+        int down = below[x - 1] + center_weight * below[x] + below[x + 1];
+        gx[x] = (short) (right - left);
+        gy[x] = (short) (down - up);
+    }
+}
+
+PIXEL_KERNEL void magnitude_kernel(const short *restrict gx, const short *restrict gy, int count, int l2, int shift,
+                                   unsigned char *restrict out) {
+    if (l2) {
+        for (int x = 0; x < count; ++x) {
+            // exact in single precision, and square roots round the same at every level
+            float squared = (float) (gx[x] * gx[x] + gy[x] * gy[x]);
+            int magnitude = (int) (sqrtf(squared) + 0.5f) >> shift;
+            out[x] = (unsigned char) (magnitude > 255 ? 255 : magnitude);
+        }
+    } else {
+        for (int x = 0; x < count; ++x) {
+            int magnitude = (abs(gx[x]) + abs(gy[x])) >> shift;
+            out[x] = (unsigned char) (magnitude > 255 ? 255 : magnitude);
+        }
+    }
+}
+
+PIXEL_KERNEL void orientation_kernel(const short *restrict gx, const short *restrict gy, int count, int bins,
+                                     const int *boundaries, unsigned char *restrict out) {
+    memset(out, 0, count);
+
+    // gradients are turned into the upper half plane, then each boundary they lie past moves them one bin up: the
+    // sign of the cross product of the boundary direction and the gradient tells, with no angle computed
+    for (int b = 0; b < bins; ++b) {
+        int cos_b = boundaries[2 * b], sin_b = boundaries[2 * b + 1];
+        for (int x = 0; x < count; ++x) {
+            int flip = gy[x] < 0 || (gy[x] == 0 && gx[x] < 0);
+            int fx = flip ? -gx[x] : gx[x], fy = flip ? -gy[x] : gy[x];
+            out[x] += (unsigned char) (fy * cos_b - fx * sin_b > 0);
+        }
+    }
+
+    // past the last boundary is the first bin again, half a turn away
+    for (int x = 0; x < count; ++x) {
+        out[x] = (unsigned char) (out[x] == bins ? 0 : out[x]);
+    }
+}
+
+// Defines every kernel for one level, compiled with the given target attributes, and the table holding them
+#define DEFINE_PIXEL_KERNELS(level, attributes) \
+    attributes static void convert_pixels_##level(const unsigned char *in, int in_channels, unsigned char *out, \
+                                                  int out_channels, int count) { \
+        convert_dispatch(in, in_channels, out, out_channels, count); \
+    } \
+    attributes static void mirror_pixels_##level(unsigned char *row, int count, int channels) { \
+        DISPATCH_CHANNELS(channels, mirror_kernel(row, count, CHANNELS)) \
+    } \
+    attributes static void reverse_pixels_##level(const unsigned char *in, unsigned char *out, int count, \
+                                                  int channels) { \
+        DISPATCH_CHANNELS(channels, reverse_kernel(in, out, count, CHANNELS)) \
+    } \
+    attributes static void accumulate_windows_##level(const unsigned char *row, int count, int channels, int sx, \
+                                                      int *sums) { \
+        DISPATCH_CHANNELS(channels, accumulate_kernel(row, count, CHANNELS, sx, sums)) \
+    } \
+    attributes static void zoom_in_pixels_##level(const unsigned char *in, unsigned char *out, int count, \
+                                                  int channels) { \
+        DISPATCH_CHANNELS(channels, zoom_in_kernel(in, out, count, CHANNELS)) \
+    } \
+    attributes static void interpolate_odd_pixels_##level(unsigned char *row, int count, int channels) { \
+        DISPATCH_CHANNELS(channels, interpolate_odd_kernel(row, count, CHANNELS)) \
+    } \
+    attributes static void average_rows_##level(const unsigned char *a, const unsigned char *b, unsigned char *out, \
+                                                int components) { \
+        average_rows_kernel(a, b, out, components); \
+    } \
+    attributes static void scatter_pixels_##level(const unsigned char *row, int count, int channels, \
+                                                  unsigned char *column, ptrdiff_t stride) { \
+        DISPATCH_CHANNELS(channels, scatter_kernel(row, count, CHANNELS, column, stride)) \
+    } \
+    attributes static void map_components_##level(const unsigned char *in, unsigned char *out, int components, \
+                                                  const unsigned char *lut) { \
+        map_kernel(in, out, components, lut); \
+    } \
+    attributes static void map_channels_##level(const unsigned char *in, unsigned char *out, int count, \
+                                                int channels, const unsigned char *luts) { \
+        DISPATCH_CHANNELS(channels, map_channels_kernel(in, out, count, CHANNELS, luts)) \
+    } \
+    attributes static void map_luma_##level(const unsigned char *in, unsigned char *out, int count, int channels, \
+                                            const unsigned char *lut) { \
+        DISPATCH_CHANNELS(channels, map_luma_kernel(in, out, count, CHANNELS, lut)) \
+    } \
+    attributes static void count_components_##level(const unsigned char *in, int components, int *histogram) { \
+        count_kernel(in, components, histogram); \
+    } \
+    attributes static void blend_tables_##level(const unsigned char *a, const unsigned char *b, int weight, \
+                                                unsigned short *out, int count) { \
+        blend_kernel(a, b, weight, out, count); \
+    } \
+    attributes static void map_blended_##level(const unsigned char *in, unsigned char *out, int count, int channels, \
+                                               const unsigned short *tables, const int *left, const int *right, \
+                                               const unsigned short *weights) { \
+        DISPATCH_CHANNELS(channels, map_blended_kernel(in, out, count, CHANNELS, tables, left, right, weights)) \
+    } \
+    attributes static void convolve_row_##level(const unsigned char *const *rows, unsigned char *out, int first, \
+                                                int last, const float *rot_filter, int clamp) { \
+        convolve_kernel(rows, out, first, last, rot_filter, clamp); \
+    } \
+    attributes static void gradient_row_##level(const unsigned char *const *rows, int count, int center_weight, \
+                                                short *gx, short *gy) { \
+        if (center_weight == 2) gradient_kernel(rows, count, 2, gx, gy); \
+        else gradient_kernel(rows, count, 1, gx, gy); \
+    } \
+    attributes static void gradient_magnitude_##level(const short *gx, const short *gy, int count, int l2, \
+                                                      int shift, unsigned char *out) { \
+        magnitude_kernel(gx, gy, count, l2, shift, out); \
+    } \
+    attributes static void gradient_orientation_##level(const short *gx, const short *gy, int count, int bins, \
+                                                        const int *boundaries, unsigned char *out) { \
+        orientation_kernel(gx, gy, count, bins, boundaries, out); \
+    } \
+    static const pixel_kernels_t level##_kernels = { \
+        convert_pixels_##level, mirror_pixels_##level, reverse_pixels_##level, accumulate_windows_##level, \
+        zoom_in_pixels_##level, interpolate_odd_pixels_##level, average_rows_##level, scatter_pixels_##level, \
+        map_components_##level, map_channels_##level, map_luma_##level, count_components_##level, \
+        blend_tables_##level, map_blended_##level, convolve_row_##level, gradient_row_##level, \
+        gradient_magnitude_##level, gradient_orientation_##level \
+    };
+
+DEFINE_PIXEL_KERNELS(generic, )
+#if MULTI_ISA
+DEFINE_PIXEL_KERNELS(sse4_2, __attribute__((target("sse4.2,no-fma"))))
+DEFINE_PIXEL_KERNELS(avx2, __attribute__((target("avx2,no-fma"))))
+DEFINE_PIXEL_KERNELS(avx512, __attribute__((target("avx512f,avx512bw,avx512vl,no-fma,prefer-vector-width=512"))))
+#endif
+
+enum cpu_level supported_cpu_level() {
+#if MULTI_ISA
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl")) {
+        return CPU_LEVEL_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) return CPU_LEVEL_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return CPU_LEVEL_SSE4_2;
+#endif
+    return CPU_LEVEL_GENERIC;
+}
+
+const char *cpu_level_name(enum cpu_level level) {
+    switch (level) {
+        case CPU_LEVEL_SSE4_2: return "sse4.2";
+        case CPU_LEVEL_AVX2: return "avx2";
+        case CPU_LEVEL_AVX512: return "avx512";
+        default: return "generic";
+    }
+}
+
+int parse_cpu_level(const char *name, enum cpu_level *level) {
+    for (int candidate = CPU_LEVEL_GENERIC; candidate <= CPU_LEVEL_AVX512; ++candidate) {
+        if (strcasecmp(name, cpu_level_name((enum cpu_level) candidate)) == 0) {
+            *level = (enum cpu_level) candidate;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void select_cpu_level() {
+    atomic_store(&selected_cpu_level, supported_cpu_level());
+
+    const char *forced = getenv("IPP_CPU_LEVEL");
+    enum cpu_level level;
+    if (!forced || !*forced) return;
+    if (!parse_cpu_level(forced, &level)) {
+        fprintf(stderr, "Unknown IPP_CPU_LEVEL %s, expected generic, sse4.2, avx2 or avx512\n", forced);
+    } else if (!store_cpu_level(level)) {
+        fprintf(stderr, "IPP_CPU_LEVEL %s is not supported by this processor, using %s\n", forced,
+                cpu_level_name((enum cpu_level) atomic_load(&selected_cpu_level)));
+    }
+}
+
+enum cpu_level active_cpu_level() {
+    pthread_once(&cpu_level_once, select_cpu_level);
+    return (enum cpu_level) atomic_load(&selected_cpu_level);
+}
+
+int set_cpu_level(enum cpu_level level) {
+    // the default selection must happen first, or the first kernel call would make it and override this level
+    pthread_once(&cpu_level_once, select_cpu_level);
+    return store_cpu_level(level);
+}
+
+int store_cpu_level(enum cpu_level level) {
+    if (level < CPU_LEVEL_GENERIC || level > supported_cpu_level()) return 0;
+    atomic_store(&selected_cpu_level, level);
+    return 1;
+}
+
+const pixel_kernels_t *active_kernels() {
+    switch (active_cpu_level()) {
+#if MULTI_ISA
+        case CPU_LEVEL_AVX512: return &avx512_kernels;
+        case CPU_LEVEL_AVX2: return &avx2_kernels;
+        case CPU_LEVEL_SSE4_2: return &sse4_2_kernels;
+#endif
+        default: return &generic_kernels;
+    }
+}
+
+void convert_pixels(const unsigned char *in, int in_channels, unsigned char *out, int out_channels, int count) {
+    active_kernels()->convert_pixels(in, in_channels, out, out_channels, count);
+}
+
+void mirror_pixels(unsigned char *row, int count, int channels) {
+    active_kernels()->mirror_pixels(row, count, channels);
+}
+
+void reverse_pixels(const unsigned char *in, unsigned char *out, int count, int channels) {
+    active_kernels()->reverse_pixels(in, out, count, channels);
+}
+
+void accumulate_windows(const unsigned char *row, int count, int channels, int sx, int *sums) {
+    active_kernels()->accumulate_windows(row, count, channels, sx, sums);
+}
+
+void average_windows(const int *sums, unsigned char *out, int count, int channels, int sx, int rows) {
+    // every window is sx pixels wide but the last one
+    int windows = (count + sx - 1) / sx;
+    int full = (windows - 1) * channels;
+    for (int i = 0; i < full; ++i) {
+        out[i] = (unsigned char) (sums[i] / (rows * sx));
+    }
+    int last_pixels = rows * (count - (windows - 1) * sx);
+    for (int i = full; i < windows * channels; ++i) {
+        out[i] = (unsigned char) (sums[i] / last_pixels);
+    }
+}
+
+void zoom_in_pixels(const unsigned char *in, unsigned char *out, int count, int channels) {
+    active_kernels()->zoom_in_pixels(in, out, count, channels);
+}
+
+void interpolate_odd_pixels(unsigned char *row, int count, int channels) {
+    active_kernels()->interpolate_odd_pixels(row, count, channels);
+}
+
+void average_rows(const unsigned char *a, const unsigned char *b, unsigned char *out, int components) {
+    active_kernels()->average_rows(a, b, out, components);
+}
+
+void scatter_pixels(const unsigned char *row, int count, int channels, unsigned char *column, ptrdiff_t stride) {
+    active_kernels()->scatter_pixels(row, count, channels, column, stride);
+}
+
+void map_components(const unsigned char *in, unsigned char *out, int components, const unsigned char *lut) {
+    active_kernels()->map_components(in, out, components, lut);
+}
+
+void map_channels(const unsigned char *in, unsigned char *out, int count, int channels, const unsigned char *luts) {
+    active_kernels()->map_channels(in, out, count, channels, luts);
+}
+
+void map_luma(const unsigned char *in, unsigned char *out, int count, int channels, const unsigned char *lut) {
+    active_kernels()->map_luma(in, out, count, channels, lut);
+}
+
+void count_components(const unsigned char *in, int components, int *histogram) {
+    active_kernels()->count_components(in, components, histogram);
+}
+
+void blend_tables(const unsigned char *a, const unsigned char *b, int weight, unsigned short *out, int count) {
+    active_kernels()->blend_tables(a, b, weight, out, count);
+}
+
+void map_blended(const unsigned char *in, unsigned char *out, int count, int channels, const unsigned short *tables,
+                 const int *left, const int *right, const unsigned short *weights) {
+    active_kernels()->map_blended(in, out, count, channels, tables, left, right, weights);
+}
+
+void convolve_row(const unsigned char *const *rows, unsigned char *out, int first, int last, const float *rot_filter,
+                  int clamp) {
+    active_kernels()->convolve_row(rows, out, first, last, rot_filter, clamp);
+}
+
+void gradient_row(const unsigned char *const *rows, int count, int center_weight, short *gx, short *gy) {
+    active_kernels()->gradient_row(rows, count, center_weight, gx, gy);
+}
+
+void gradient_magnitude(const short *gx, const short *gy, int count, int l2, int shift, unsigned char *out) {
+    active_kernels()->gradient_magnitude(gx, gy, count, l2, shift, out);
+}
+
+void gradient_orientation(const short *gx, const short *gy, int count, int bins, const int *boundaries,
+                          unsigned char *out) {
+    active_kernels()->gradient_orientation(gx, gy, count, bins, boundaries, out);
+}
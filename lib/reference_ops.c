@@ -0,0 +1,779 @@
+/**
+ * Definitions for the reference implementations of the image operations.
+ */
+
+#include <reference_ops.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+
+unsigned char reference_closest_level(unsigned char value, int n_tones);
+
+int reference_pixels_in_histogram(const int *hist);
+
+/**
+ * For each tone, find the tone that has the closest number of corresponding pixels
+ * @param tone the tone to have its pixel count mapped
+ * @param hist_cum_source source cumulative histogram
+ * @param hist_cum_target target cumulative histogram
+ * @return the tone that has the closest pixel count in target histogram
+ */
+int reference_find_target_tone_closest_to(int tone, const int *hist_cum_source, const int *hist_cum_target);
+
+/**
+ * Returns vector of unsigned char of size image->channels of the average of a range of pixels of the image.
+ * @param image the image from which the pixels are retrieved
+ * @param first_y first pixel y coordinate
+ * @param last_y last pixel y coordinate
+ * @param first_x first pixel x coordinate
+ * @param last_x  last pixel x coordinate
+ * @return vector of unsigned char of size image->channels averaged channels of pixels in range
+ */
+unsigned char *reference_average_pixel(image_t *image, int first_y, int last_y, int first_x, int last_x);
+
+/**
+ * Normalized cumulative histogram of one channel of an image, or of its luminance if channel is negative.
+ */
+int *reference_channel_norm_cum_histogram(image_t *image, int channel);
+
+/**
+ * Maps the luminance of every pixel through a table keeping Cb and Cr: the first three channels of colour images
+ * move by the change of the luminance, saturated, the only channel of grayscale ones goes through the table.
+ */
+void reference_map_luma(image_t *image, const int *lut);
+
+/**
+ * Table of one tile of adaptive equalization: the clipped histogram of its luminance, accumulated and normalized.
+ */
+void reference_tile_table(image_t *luminance, int first_y, int last_y, int first_x, int last_x, double clip_limit,
+                          int *table);
+
+/**
+ * Position of a pixel between the centers of the tiles along one axis.
+ * @param tile receives the tile whose center is at or before the position, or the first one before any center
+ * @param weight receives the weight of the next tile, from 0 to 1, 0 past the last center
+ */
+void reference_tile_weight(int position, int size, int tile_size, int tiles, int *tile, double *weight);
+
+/**
+ * Luminance of a pixel of a one channel image, as if the image went on with copies of its edge pixels.
+ */
+int reference_clamped_pixel(image_t *luminance, int y, int x);
+
+/**
+ * Fills an image with one channel of the size of another, for the outputs of reference_compute_gradient().
+ */
+void reference_gradient_output(image_t *output, int width, int height);
+
+void reference_mirror_horizontally(image_t *image) {
+    invalidate_histograms(image);
+    // Iterate over lines
+    for (int i = 0; i < image->height; ++i) {
+        // Iterate over columns
+        for (int left = 0, right = image->channels * (image->width - 1);
+             left < (image->width * image->channels) / 2; left += image->channels, right -= image->channels) {
+
+            // Swap all channels
+            for (int c = 0; c < image->channels; ++c) {
+                unsigned char swap = image->pixels[i][left + c];
+                image->pixels[i][left + c] = image->pixels[i][right + c];
+                image->pixels[i][right + c] = swap;
+            }
+        }
+    }
+}
+
+void reference_mirror_vertically(image_t *image) {
+    invalidate_histograms(image);
+    for (int top = 0, bot = image->height - 1; top < image->height / 2; ++top, --bot) {
+        unsigned char *swap = image->pixels[top];
+        image->pixels[top] = image->pixels[bot];
+        image->pixels[bot] = swap;
+    }
+}
+
+void reference_rgb_to_luminance(image_t *image) {
+    invalidate_histograms(image);
+    if (image->colorspace == JCS_GRAYSCALE) return;
+
+    unsigned char **new_pixels = new_unsigned_char_matrix(image->height, image->width);
+    for (int i = 0; i < image->height; ++i) {
+        for (int j = 0; j < image->width * image->channels; j += image->channels) {
+            int luminance = (int) (0.299 * (int) image->pixels[i][j] +
+                                   0.587 * (int) image->pixels[i][j + 1] +
+                                   0.114 * (int) image->pixels[i][j + 2]);
+
+            new_pixels[i][j / image->channels] = (unsigned char) luminance;
+        }
+    }
+
+    image->colorspace = JCS_GRAYSCALE;
+    image->channels = 1;
+
+    free_pixels(image);
+    image->pixels = new_pixels;
+}
+
+void reference_luminance_to_rgb(image_t *image) {
+    invalidate_histograms(image);
+    if (image->colorspace == JCS_RGB) return;
+
+    unsigned char **new_pixels = new_unsigned_char_matrix(image->height, image->width * 3);
+    for (int i = 0; i < image->height; ++i) {
+        for (int j = 0; j < image->width; ++j) {
+            for (int c = 0; c < 3; ++c) {
+                new_pixels[i][j * 3 + c] = image->pixels[i][j];
+            }
+        }
+    }
+
+    image->colorspace = JCS_RGB;
+    image->channels = 3;
+
+    free_pixels(image);
+    image->pixels = new_pixels;
+}
+
+void reference_quantize(image_t *image, int n_tones) {
+    invalidate_histograms(image);
+    for (int i = 0; i < image->height; ++i) {
+        for (int j = 0; j < image->width * image->channels; j += image->channels) {
+            for (int c = 0; c < image->channels; ++c) {
+                image->pixels[i][j + c] = reference_closest_level(image->pixels[i][j + c], n_tones);
+            }
+        }
+    }
+}
+
+unsigned char reference_closest_level(unsigned char value, int n_tones) {
+    float step = (float) 255 / (n_tones - 1);
+    float min = 0;
+    while (!(value >= min && value <= min + step)) {
+        min += step;
+    }
+
+    float max = (min + step >= 255) ? 255 : min + step;
+    return (unsigned char) (abs((int) max - value) < abs((int) min - value) ? max : min);
+}
+
+void reference_add_bias(image_t *image, double bias) {
+    invalidate_histograms(image);
+    for (int h = 0; h < image->height; ++h) {
+        for (int w = 0; w < image->width * image->channels; w += image->channels) {
+            for (int c = 0; c < image->channels; ++c) {
+                double sum = image->pixels[h][w + c] + bias;
+
+                //verify saturation
+                if (sum > 255) {
+                    image->pixels[h][w + c] = 255;
+                } else if (sum < 0) {
+                    image->pixels[h][w + c] = 0;
+                } else {
+                    image->pixels[h][w + c] = (unsigned char) sum;
+                }
+            }
+        }
+    }
+}
+
+void reference_multiply_gain(image_t *image, double gain) {
+    invalidate_histograms(image);
+    for (int h = 0; h < image->height; ++h) {
+        for (int w = 0; w < image->width * image->channels; w += image->channels) {
+            for (int c = 0; c < image->channels; ++c) {
+                double mult = image->pixels[h][w + c] * gain;
+
+                //verify saturation
+                if (mult > 255) {
+                    image->pixels[h][w + c] = 255;
+                } else {
+                    image->pixels[h][w + c] = (unsigned char) mult;
+                }
+            }
+        }
+    }
+}
+
+void reference_negative(image_t *image) {
+    invalidate_histograms(image);
+    for (int h = 0; h < image->height; ++h) {
+        for (int w = 0; w < image->width * image->channels; w += image->channels) {
+            for (int c = 0; c < image->channels; ++c) {
+                image->pixels[h][w + c] = (unsigned char) 255 - image->pixels[h][w + c];
+            }
+        }
+    }
+}
+
+int *reference_compute_histogram(image_t *image) {
+    int *histogram = new_histogram();
+
+    image_t *gs_image = copy_image(image);
+    reference_rgb_to_luminance(gs_image);
+
+    for (int row = 0; row < gs_image->height; ++row) {
+        for (int col = 0; col < gs_image->width; ++col) {
+            ++histogram[gs_image->pixels[row][col]];
+        }
+    }
+
+    free_image(gs_image);
+
+    return histogram;
+}
+
+int *reference_compute_norm_cum_histogram(image_t *image) {
+    int *hist = reference_compute_histogram(image);
+    int *hist_cum = new_histogram();
+    int pixels_in_hist = reference_pixels_in_histogram(hist);
+
+
+    // accumulate
+    hist_cum[0] = hist[0];
+    for (int i = 1; i < HISTOGRAM_SIZE; ++i) {
+        hist_cum[i] = (hist_cum[i - 1] + hist[i]);
+    }
+
+    // normalize, rounding up
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+        hist_cum[i] = (int) (((long long) hist_cum[i] * 255 + pixels_in_hist - 1) / pixels_in_hist);
+    }
+
+    free_histogram(hist);
+    return hist_cum;
+}
+
+int reference_pixels_in_histogram(const int *hist) {
+    int pixels_in_hist = 0;
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+        pixels_in_hist += hist[i];
+    }
+    return pixels_in_hist;
+}
+
+int reference_find_target_tone_closest_to(int tone, const int *hist_cum_source, const int *hist_cum_target) {
+    int ideal_pixel_count = hist_cum_source[tone];
+    int tone_for_closest_pixel_count = 0;
+
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+        if (abs(ideal_pixel_count - hist_cum_target[i]) <
+            abs(ideal_pixel_count - hist_cum_target[tone_for_closest_pixel_count])) {
+            tone_for_closest_pixel_count = i;
+        }
+    }
+
+    return tone_for_closest_pixel_count;
+}
+
+int *reference_compute_histogram_matching(const int *hist_cum_source, const int *hist_cum_target) {
+    int *histogram_matching = new_histogram();
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) {
+        histogram_matching[tone] = reference_find_target_tone_closest_to(tone, hist_cum_source, hist_cum_target);
+    }
+    return histogram_matching;
+}
+
+void reference_equalize_histogram(image_t *image) {
+    invalidate_histograms(image);
+    int *hist_cum = reference_compute_norm_cum_histogram(image);
+
+    for (int h = 0; h < image->height; ++h) {
+        for (int w = 0; w < image->width * image->channels; w += image->channels) {
+            for (int c = 0; c < image->channels; ++c) {
+                image->pixels[h][w + c] = (unsigned char) hist_cum[image->pixels[h][w + c]];
+            }
+        }
+    }
+
+    free_histogram(hist_cum);
+}
+
+void reference_match_histogram(image_t *source, image_t *target) {
+    invalidate_histograms(source);
+    //assert images are in grayscale
+    reference_rgb_to_luminance(source);
+    reference_rgb_to_luminance(target);
+
+    int *hist_cum_source = reference_compute_norm_cum_histogram(source);
+    int *hist_cum_target = reference_compute_norm_cum_histogram(target);
+
+    int *histogram_matching = reference_compute_histogram_matching(hist_cum_source, hist_cum_target);
+
+    for (int h = 0; h < source->height; ++h) {
+        for (int w = 0; w < source->width; ++w) {
+            source->pixels[h][w] = (unsigned char) histogram_matching[source->pixels[h][w]];
+        }
+    }
+
+    free_histogram(hist_cum_source);
+    free_histogram(hist_cum_target);
+    free_histogram(histogram_matching);
+}
+
+int *reference_channel_norm_cum_histogram(image_t *image, int channel) {
+    if (channel < 0) return reference_compute_norm_cum_histogram(image);
+
+    int *hist = new_histogram();
+    for (int h = 0; h < image->height; ++h) {
+        for (int w = 0; w < image->width; ++w) {
+            ++hist[image->pixels[h][w * image->channels + channel]];
+        }
+    }
+
+    int *hist_cum = new_histogram();
+    int pixels_in_hist = reference_pixels_in_histogram(hist);
+    hist_cum[0] = hist[0];
+    for (int i = 1; i < HISTOGRAM_SIZE; ++i) {
+        hist_cum[i] = hist_cum[i - 1] + hist[i];
+    }
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+        hist_cum[i] = (int) (((long long) hist_cum[i] * 255 + pixels_in_hist - 1) / pixels_in_hist);
+    }
+
+    free_histogram(hist);
+    return hist_cum;
+}
+
+void reference_map_luma(image_t *image, const int *lut) {
+    for (int h = 0; h < image->height; ++h) {
+        for (int w = 0; w < image->width * image->channels; w += image->channels) {
+            unsigned char *pixel = &image->pixels[h][w];
+            if (image->channels < 3) {
+                pixel[0] = (unsigned char) lut[pixel[0]];
+                continue;
+            }
+
+            int luminance = (int) (0.299 * (int) pixel[0] + 0.587 * (int) pixel[1] + 0.114 * (int) pixel[2]);
+            int delta = lut[luminance] - luminance;
+            for (int c = 0; c < 3; ++c) {
+                int value = pixel[c] + delta;
+                pixel[c] = (unsigned char) (value > 255 ? 255 : value < 0 ? 0 : value);
+            }
+        }
+    }
+}
+
+void reference_equalize_histogram_with_mode(image_t *image, enum histogram_mode mode) {
+    invalidate_histograms(image);
+    if (mode == HISTOGRAM_MODE_LUMINANCE) {
+        reference_equalize_histogram(image);
+    } else if (mode == HISTOGRAM_MODE_LUMA) {
+        int *hist_cum = reference_compute_norm_cum_histogram(image);
+        reference_map_luma(image, hist_cum);
+        free_histogram(hist_cum);
+    } else {
+        for (int c = 0; c < image->channels; ++c) {
+            int *hist_cum = reference_channel_norm_cum_histogram(image, c);
+            for (int h = 0; h < image->height; ++h) {
+                for (int w = c; w < image->width * image->channels; w += image->channels) {
+                    image->pixels[h][w] = (unsigned char) hist_cum[image->pixels[h][w]];
+                }
+            }
+            free_histogram(hist_cum);
+        }
+    }
+}
+
+void reference_match_histogram_with_mode(image_t *source, image_t *target, enum histogram_mode mode) {
+    invalidate_histograms(source);
+    if (mode != HISTOGRAM_MODE_CHANNELS) {
+        int *hist_cum_source = reference_compute_norm_cum_histogram(source);
+        int *hist_cum_target = reference_compute_norm_cum_histogram(target);
+        int *histogram_matching = reference_compute_histogram_matching(hist_cum_source, hist_cum_target);
+
+        if (mode == HISTOGRAM_MODE_LUMA) {
+            reference_map_luma(source, histogram_matching);
+        } else {
+            for (int h = 0; h < source->height; ++h) {
+                for (int w = 0; w < source->width * source->channels; ++w) {
+                    source->pixels[h][w] = (unsigned char) histogram_matching[source->pixels[h][w]];
+                }
+            }
+        }
+
+        free_histogram(hist_cum_source);
+        free_histogram(hist_cum_target);
+        free_histogram(histogram_matching);
+        return;
+    }
+
+    // every channel of source is counted before any is mapped; channels target lacks follow its last one
+    int *hist_cum_sources[MAX_CHANNELS];
+    for (int c = 0; c < source->channels; ++c) {
+        hist_cum_sources[c] = reference_channel_norm_cum_histogram(source, c);
+    }
+    for (int c = 0; c < source->channels; ++c) {
+        int *hist_cum_target = reference_channel_norm_cum_histogram(target, min_int(c, target->channels - 1));
+        int *histogram_matching = reference_compute_histogram_matching(hist_cum_sources[c], hist_cum_target);
+        for (int h = 0; h < source->height; ++h) {
+            for (int w = c; w < source->width * source->channels; w += source->channels) {
+                source->pixels[h][w] = (unsigned char) histogram_matching[source->pixels[h][w]];
+            }
+        }
+        free_histogram(hist_cum_sources[c]);
+        free_histogram(hist_cum_target);
+        free_histogram(histogram_matching);
+    }
+}
+
+void reference_tile_table(image_t *luminance, int first_y, int last_y, int first_x, int last_x, double clip_limit,
+                          int *table) {
+    int *hist = new_histogram();
+    for (int h = first_y; h < last_y; ++h) {
+        for (int w = first_x; w < last_x; ++w) {
+            ++hist[luminance->pixels[h][w]];
+        }
+    }
+
+    // clip, spreading the excess evenly and its remainder over tones spread over the range
+    if (clip_limit > 0) {
+        int limit = (int) (clip_limit * (last_y - first_y) * (last_x - first_x) / HISTOGRAM_SIZE);
+        if (limit < 1) limit = 1;
+        int excess = 0;
+        for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+            if (hist[i] > limit) {
+                excess += hist[i] - limit;
+                hist[i] = limit;
+            }
+        }
+        for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+            hist[i] += excess / HISTOGRAM_SIZE;
+        }
+        int remainder = excess % HISTOGRAM_SIZE;
+        for (int i = 0; i < remainder; ++i) {
+            ++hist[i * (HISTOGRAM_SIZE / remainder)];
+        }
+    }
+
+    int pixels_in_hist = reference_pixels_in_histogram(hist);
+    int cumulative = 0;
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+        cumulative += hist[i];
+        table[i] = (int) (((long long) cumulative * 255 + pixels_in_hist - 1) / pixels_in_hist);
+    }
+
+    free_histogram(hist);
+}
+
+void reference_tile_weight(int position, int size, int tile_size, int tiles, int *tile, double *weight) {
+    *tile = 0;
+    *weight = 0;
+    for (int t = 0; t < tiles; ++t) {
+        double center = (t * tile_size + min_int((t + 1) * tile_size, size) - 1) / 2.0;
+        if (center > position) break;
+        *tile = t;
+        if (t + 1 < tiles) {
+            double next = ((t + 1) * tile_size + min_int((t + 2) * tile_size, size) - 1) / 2.0;
+            *weight = next > position ? (position - center) / (next - center) : 1;
+        } else {
+            *weight = 0;
+        }
+    }
+}
+
+void reference_equalize_histogram_adaptive(image_t *image, const clahe_options_t *options) {
+    invalidate_histograms(image);
+    image_t *luminance = copy_image(image);
+    reference_rgb_to_luminance(luminance);
+
+    int tiles_x = (image->width + options->tile_width - 1) / options->tile_width;
+    int tiles_y = (image->height + options->tile_height - 1) / options->tile_height;
+    int *tables = ipp_malloc((size_t) tiles_x * tiles_y * HISTOGRAM_SIZE * sizeof(int));
+    for (int tile_y = 0; tile_y < tiles_y; ++tile_y) {
+        for (int tile_x = 0; tile_x < tiles_x; ++tile_x) {
+            reference_tile_table(luminance, tile_y * options->tile_height,
+                                 min_int((tile_y + 1) * options->tile_height, image->height),
+                                 tile_x * options->tile_width, min_int((tile_x + 1) * options->tile_width, image->width),
+                                 options->clip_limit, tables + (tile_y * tiles_x + tile_x) * HISTOGRAM_SIZE);
+        }
+    }
+
+    // every component goes through the tables of the four tiles around its pixel, interpolated bilinearly
+    for (int h = 0; h < image->height; ++h) {
+        int tile_y;
+        double weight_y;
+        reference_tile_weight(h, image->height, options->tile_height, tiles_y, &tile_y, &weight_y);
+        int next_y = weight_y > 0 ? tile_y + 1 : tile_y;
+
+        for (int w = 0; w < image->width; ++w) {
+            int tile_x;
+            double weight_x;
+            reference_tile_weight(w, image->width, options->tile_width, tiles_x, &tile_x, &weight_x);
+            int next_x = weight_x > 0 ? tile_x + 1 : tile_x;
+
+            int *top_left = tables + (tile_y * tiles_x + tile_x) * HISTOGRAM_SIZE;
+            int *top_right = tables + (tile_y * tiles_x + next_x) * HISTOGRAM_SIZE;
+            int *bottom_left = tables + (next_y * tiles_x + tile_x) * HISTOGRAM_SIZE;
+            int *bottom_right = tables + (next_y * tiles_x + next_x) * HISTOGRAM_SIZE;
+            for (int c = 0; c < image->channels; ++c) {
+                int value = image->pixels[h][w * image->channels + c];
+                double top = top_left[value] * (1 - weight_x) + top_right[value] * weight_x;
+                double bottom = bottom_left[value] * (1 - weight_x) + bottom_right[value] * weight_x;
+                image->pixels[h][w * image->channels + c] = (unsigned char) lround(top * (1 - weight_y) +
+                                                                                   bottom * weight_y);
+            }
+        }
+    }
+
+    ipp_free(tables);
+    free_image(luminance);
+}
+
+int reference_clamped_pixel(image_t *luminance, int y, int x) {
+    y = y < 0 ? 0 : y >= luminance->height ? luminance->height - 1 : y;
+    x = x < 0 ? 0 : x >= luminance->width ? luminance->width - 1 : x;
+    return luminance->pixels[y][x];
+}
+
+void reference_gradient_output(image_t *output, int width, int height) {
+    invalidate_histograms(output);
+    free_pixels(output);
+    output->pixels = new_unsigned_char_matrix(height, width);
+    output->height = height;
+    output->width = width;
+    output->channels = 1;
+    output->colorspace = JCS_GRAYSCALE;
+}
+
+void reference_compute_gradient(image_t *image, const gradient_options_t *options, image_t *orientation,
+                                image_t *alternative) {
+    invalidate_histograms(image);
+    reference_rgb_to_luminance(image);
+    image_t *luminance = copy_image(image);
+    int center_weight = options->gradient_operator == GRADIENT_SOBEL ? 2 : 1;
+    if (orientation) reference_gradient_output(orientation, image->width, image->height);
+    if (alternative) reference_gradient_output(alternative, image->width, image->height);
+
+    for (int y = 0; y < image->height; ++y) {
+        for (int x = 0; x < image->width; ++x) {
+            int gx = reference_clamped_pixel(luminance, y - 1, x + 1) +
+                     center_weight * reference_clamped_pixel(luminance, y, x + 1) +
+                     reference_clamped_pixel(luminance, y + 1, x + 1) -
+                     reference_clamped_pixel(luminance, y - 1, x - 1) -
+                     center_weight * reference_clamped_pixel(luminance, y, x - 1) -
+                     reference_clamped_pixel(luminance, y + 1, x - 1);
+            int gy = reference_clamped_pixel(luminance, y + 1, x - 1) +
+                     center_weight * reference_clamped_pixel(luminance, y + 1, x) +
+                     reference_clamped_pixel(luminance, y + 1, x + 1) -
+                     reference_clamped_pixel(luminance, y - 1, x - 1) -
+                     center_weight * reference_clamped_pixel(luminance, y - 1, x) -
+                     reference_clamped_pixel(luminance, y - 1, x + 1);
+
+            int magnitude = options->norm == GRADIENT_NORM_L2 ? (int) lround(sqrt((double) gx * gx + gy * gy))
+                                                              : abs(gx) + abs(gy);
+            magnitude >>= options->shift;
+            image->pixels[y][x] = (unsigned char) (magnitude > 255 ? 255 : magnitude);
+            if (!orientation && !alternative) continue;
+
+            // the direction turned into half a turn, in bins, the first one centered on 0
+            int bins = options->orientation_bins;
+            double angle = atan2(gy, gx);
+            if (angle < 0) angle += M_PI;
+            double position = gx == 0 && gy == 0 ? 0 : angle * bins / M_PI;
+            int bin = (int) floor(position + 0.5) % bins;
+            if (orientation) orientation->pixels[y][x] = (unsigned char) bin;
+
+            // boundary j + 1/2 lies between bins j and j + 1
+            if (alternative) {
+                int boundary = (int) floor(position);
+                double distance = fabs(position - (boundary + 0.5)) * M_PI / bins;
+                boolean near = gx != 0 || gy != 0 ? distance < REFERENCE_ORIENTATION_TOLERANCE : FALSE;
+                int other = position < boundary + 0.5 ? (boundary + 1) % bins : boundary % bins;
+                alternative->pixels[y][x] = (unsigned char) (near ? other : bin);
+            }
+        }
+    }
+
+    free_image(luminance);
+}
+
+void reference_zoom_out(image_t *image, int sx, int sy) {
+    invalidate_histograms(image);
+    // matrix of zoomed out pixels
+    int new_height = (int) ceil((double) image->height / sy);
+    int new_width = (int) ceil((double) image->width / sx);
+    unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width * image->channels);
+
+    // slide window left to right and bottom to top
+    for (int pos_y = 0; pos_y < image->height; pos_y += sy) {
+        for (int pos_x = 0; pos_x < image->width; pos_x += sx) {
+
+            // window averages pixels from (pos_x, pos_y) to (pos_x + step_x - 1, pos_y + step_y - 1)
+            int max_pixel_y = min_int(pos_y + sy - 1, image->height - 1);
+            int max_pixel_x = min_int(pos_x + sx - 1, image->width - 1);
+            unsigned char *averaged_channels = reference_average_pixel(image, pos_y, max_pixel_y, pos_x, max_pixel_x);
+
+            // fill new pixel with obtained channels
+            int new_pixel_y = (pos_y / sy);
+            int new_pixel_x = (pos_x / sx);
+            for (int channel = 0; channel < image->channels; ++channel) {
+                new_pixels[new_pixel_y][new_pixel_x * image->channels + channel] = averaged_channels[channel];
+            }
+
+            ipp_free(averaged_channels);
+        }
+    }
+
+    free_pixels(image);
+    image->pixels = new_pixels;
+    image->height = new_height;
+    image->width = new_width;
+}
+
+unsigned char *reference_average_pixel(image_t *image, int first_y, int last_y, int first_x, int last_x) {
+    int number_of_pixels = (last_y - first_y + 1) * (last_x - first_x + 1);
+
+    // iterate over pixels in window, accumulating a sum for each channel
+    int *channels_sums = ipp_malloc(image->channels * sizeof(int));
+    memset(channels_sums, 0, image->channels * sizeof(int));
+
+    for (int pixel_y = 0; first_y + pixel_y <= last_y; ++pixel_y) {
+        for (int pixel_x = 0; first_x + pixel_x <= last_x; ++pixel_x) {
+            for (int channel = 0; channel < image->channels; ++channel) {
+                channels_sums[channel] +=
+                        image->pixels[first_y + pixel_y][(first_x + pixel_x) * image->channels + channel];
+            }
+        }
+    }
+
+    // take the mean of each component, based on accumulated sum
+    unsigned char *channels_means = ipp_malloc(image->channels * sizeof(unsigned char));
+    for (int c = 0; c < image->channels; ++c) {
+        channels_means[c] = (unsigned char) (channels_sums[c] / number_of_pixels);
+    }
+
+    ipp_free(channels_sums);
+
+    return channels_means;
+}
+
+void reference_zoom_in(image_t *image) {
+    invalidate_histograms(image);
+    // matrix of zoomed in pixels
+    int new_height = image->height * 2 - 1;
+    int new_width = image->width * 2 - 1;
+    unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width * image->channels);
+
+    for (int row = 0; row < new_height; ++row) {
+        memset(new_pixels[row], 0, new_width * image->channels * sizeof(unsigned char));
+    }
+
+    // copy old pixels with empty pixels in between
+    for (int row = 0; row < new_height; row += 2) {
+        for (int col = 0; col < new_width * image->channels; col += 2 * image->channels) {
+            for (int channel = 0; channel < image->channels; ++channel) {
+                new_pixels[row][col + channel] = image->pixels[row / 2][col / 2 + channel];
+            }
+        }
+    }
+
+    // fill half of each empty row R-1 with interpolation of row R-2 and R
+    for (int row = 2; row < new_height; row += 2) { // iterate rows skipping 1
+        for (int col = 0; col < new_width * image->channels; col += 2 * image->channels) { // iterate pixels skipping 1
+            for (int channel = 0; channel < image->channels; ++channel) { // iterates channels
+
+                int last = new_pixels[row - 2][col + channel];
+                int curr = new_pixels[row][col + channel];
+                new_pixels[row - 1][col + channel] = (unsigned char) ((last + curr) / 2);
+            }
+        }
+    }
+
+    // fill half of each empty column C-1 with interpolation of column C-2 and C
+    for (int row = 0; row < new_height; ++row) { // iterate rows
+        for (int col = 2 * image->channels;
+             col < new_width * image->channels; col += 2 * image->channels) { // iterate pixels skipping 1
+            for (int channel = 0; channel < image->channels; ++channel) { // iterates channels
+
+                int last = new_pixels[row][col - 2 * (image->channels) + channel];
+                int curr = new_pixels[row][col + channel];
+                new_pixels[row][col - image->channels + channel] = (unsigned char) ((last + curr) / 2);
+            }
+        }
+    }
+
+    free_pixels(image);
+    image->pixels = new_pixels;
+    image->height = new_height;
+    image->width = new_width;
+}
+
+void reference_rotate_90_degrees_clock_wise(image_t *image) {
+    invalidate_histograms(image);
+    // matrix of rotated pixels
+    int new_height = image->width;
+    int new_width = image->height;
+    unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width * image->channels);
+
+    // iterate over old rows
+    for (int old_row = 0; old_row < image->height; ++old_row) {
+        // fix new column as the old row from upside down
+        int new_col = (new_width - old_row - 1) * image->channels;
+
+        // old columns become new rows
+        for (int old_col = 0; old_col < image->width * image->channels; old_col += image->channels) {
+            int new_row = old_col / image->channels;
+
+            // use new and old indices to map the pixels
+            for (int channel = 0; channel < image->channels; ++channel) {
+                new_pixels[new_row][new_col + channel] = image->pixels[old_row][old_col + channel];
+            }
+        }
+    }
+
+    free_pixels(image);
+    image->pixels = new_pixels;
+    image->height = new_height;
+    image->width = new_width;
+}
+
+void reference_convolve(image_t *image, float **filter, boolean clamp) {
+    invalidate_histograms(image);
+    reference_rgb_to_luminance(image);
+
+    // image of convolved pixels
+    int new_height = image->height - FILTER_SIZE / 2;
+    int new_width = image->width - FILTER_SIZE / 2;
+    unsigned char **new_pixels = new_unsigned_char_matrix(new_height, new_width);
+    for (int row = 0; row < new_height; ++row) {
+        memset(new_pixels[row], 0, new_width * sizeof(unsigned char));
+    }
+
+    // filter rotated by 180 degrees
+    float rot_filter[FILTER_SIZE][FILTER_SIZE];
+    for (int i = 0; i < FILTER_SIZE; ++i) {
+        for (int j = 0; j < FILTER_SIZE; ++j) {
+            rot_filter[i][j] = filter[FILTER_SIZE - i - 1][FILTER_SIZE - j - 1];
+        }
+    }
+
+    // slide filter through image
+    for (int y = FILTER_SIZE / 2; y < new_height - FILTER_SIZE / 2; ++y) {
+        for (int x = FILTER_SIZE / 2; x < new_width - FILTER_SIZE / 2; ++x) {
+
+            // accumulate pixel by pixel multiplication around center of filter
+            float conv_point = 0;
+            for (int y_offset = -FILTER_SIZE / 2; y_offset <= FILTER_SIZE / 2; ++y_offset) {
+                for (int x_offset = -FILTER_SIZE / 2; x_offset <= FILTER_SIZE / 2; ++x_offset) {
+
+                    conv_point += rot_filter[FILTER_SIZE / 2 + y_offset][FILTER_SIZE / 2 + x_offset] *
+                                  (float) image->pixels[y + y_offset][x + x_offset];
+                }
+            }
+
+            // fix out of range values
+            if (clamp) conv_point += 127;
+            if (conv_point > 255) conv_point = 255;
+            if (conv_point < 0) conv_point = 0;
+
+            // save calculation as unsigned char
+            new_pixels[y][x] = (unsigned char) conv_point;
+        }
+    }
+
+    free_pixels(image);
+    image->pixels = new_pixels;
+    image->height = new_height;
+    image->width = new_width;
+}
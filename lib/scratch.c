@@ -0,0 +1,255 @@
+/**
+ * Definitions for per-thread scratch memory and reuse of pixel buffers.
+ */
+
+#include <scratch.h>
+#include <memory_accounting.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * Chunk of an arena, its scratch following the header.
+ */
+typedef struct scratch_chunk_struct {
+    struct scratch_chunk_struct *previous;  // chunk in use before this one, or the next spare chunk
+    size_t size;                            // bytes of scratch
+    size_t used;
+} scratch_chunk_t;
+
+#define CHUNK_HEADER_SIZE ((sizeof(scratch_chunk_t) + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT)
+
+/**
+ * Pixel buffer kept for reuse.
+ */
+typedef struct pooled_block_struct {
+    void *block;
+    size_t size;
+} pooled_block_t;
+
+/**
+ * Arena and pixel pool of one thread.
+ */
+typedef struct thread_scratch_struct {
+    scratch_chunk_t *current;
+    scratch_chunk_t *spare;                 // chunks outgrown and released, for the next op that grows as far
+    pooled_block_t pool[PIXEL_POOL_BUFFERS];
+    int pool_count;                         // least recently pooled first
+    size_t pool_bytes;
+    void *headers[HEADER_POOL_BLOCKS];      // blocks of pooled_header(), most recently pooled last
+    int header_count;
+    int registered;                         // with the key whose destructor releases all of it
+} thread_scratch_t;
+
+_Thread_local thread_scratch_t thread_scratch;
+atomic_size_t scratch_retained = 0;
+
+pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+pthread_key_t scratch_key;
+
+/**
+ * Creates the thread-specific key that releases the scratch of exiting threads.
+ */
+void init_scratch();
+
+/**
+ * Releases every chunk and pooled buffer of a thread.
+ */
+void release_thread_scratch(void *scratch);
+
+/**
+ * Scratch of the calling thread, registered for release on its first use.
+ */
+thread_scratch_t *this_thread_scratch();
+
+/**
+ * Chunk of at least size bytes of scratch: a spare one if one is large enough, a new one otherwise.
+ */
+scratch_chunk_t *new_chunk(thread_scratch_t *scratch, size_t size);
+
+void free_chunks(scratch_chunk_t *chunk);
+
+/**
+ * Releases the least recently pooled buffer.
+ */
+void evict_pooled(thread_scratch_t *scratch);
+
+void init_scratch() {
+    // accounting registers its leak report on first use, so doing so first makes the release at exit run before it
+    memory_stats();
+    pthread_key_create(&scratch_key, release_thread_scratch);
+    atexit(scratch_trim);
+}
+
+void release_thread_scratch(void *scratch) {
+    thread_scratch_t *thread = scratch;
+    free_chunks(thread->current);
+    free_chunks(thread->spare);
+    thread->current = thread->spare = NULL;
+    while (thread->pool_count > 0) evict_pooled(thread);
+    while (thread->header_count > 0) {
+        void *header = thread->headers[--thread->header_count];
+        atomic_fetch_sub(&scratch_retained, ipp_block_size(header));
+        ipp_free(header);
+    }
+}
+
+thread_scratch_t *this_thread_scratch() {
+    pthread_once(&scratch_once, init_scratch);
+    if (!thread_scratch.registered) {
+        pthread_setspecific(scratch_key, &thread_scratch);
+        thread_scratch.registered = 1;
+    }
+    return &thread_scratch;
+}
+
+scratch_chunk_t *new_chunk(thread_scratch_t *scratch, size_t size) {
+    for (scratch_chunk_t **link = &scratch->spare; *link; link = &(*link)->previous) {
+        if ((*link)->size >= size) {
+            scratch_chunk_t *chunk = *link;
+            *link = chunk->previous;
+            chunk->used = 0;
+            return chunk;
+        }
+    }
+
+    // none is large enough: the spares are smaller than what ops now need, so they are released
+    free_chunks(scratch->spare);
+    scratch->spare = NULL;
+
+    size_t chunk_size = SCRATCH_MIN_CHUNK;
+    if (scratch->current && 2 * scratch->current->size > chunk_size) chunk_size = 2 * scratch->current->size;
+    if (size > chunk_size) chunk_size = size;
+
+    scratch_chunk_t *chunk = ipp_aligned_alloc(SCRATCH_ALIGNMENT, CHUNK_HEADER_SIZE + chunk_size);
+    if (!chunk) return NULL;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    atomic_fetch_add(&scratch_retained, CHUNK_HEADER_SIZE + chunk_size);
+    return chunk;
+}
+
+void free_chunks(scratch_chunk_t *chunk) {
+    while (chunk) {
+        scratch_chunk_t *previous = chunk->previous;
+        atomic_fetch_sub(&scratch_retained, CHUNK_HEADER_SIZE + chunk->size);
+        ipp_free(chunk);
+        chunk = previous;
+    }
+}
+
+scratch_mark_t scratch_mark() {
+    thread_scratch_t *scratch = this_thread_scratch();
+    scratch_mark_t mark = {scratch->current, scratch->current ? scratch->current->used : 0};
+    return mark;
+}
+
+void *scratch_alloc(size_t size) {
+    thread_scratch_t *scratch = this_thread_scratch();
+    size = (size + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT;
+
+    scratch_chunk_t *chunk = scratch->current;
+    if (!chunk || chunk->size - chunk->used < size) {
+        chunk = new_chunk(scratch, size);
+        if (!chunk) return NULL;
+        chunk->previous = scratch->current;
+        scratch->current = chunk;
+    }
+
+    void *block = (char *) chunk + CHUNK_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+void scratch_release(scratch_mark_t mark) {
+    thread_scratch_t *scratch = this_thread_scratch();
+    while (scratch->current && scratch->current != mark.chunk) {
+        scratch_chunk_t *chunk = scratch->current;
+        scratch->current = chunk->previous;
+        chunk->previous = scratch->spare;
+        scratch->spare = chunk;
+    }
+    if (scratch->current) scratch->current->used = mark.used;
+}
+
+void *pooled_pixels(size_t size) {
+    thread_scratch_t *scratch = this_thread_scratch();
+
+    // the smallest pooled buffer that fits without wasting more than an eighth of it
+    int best = -1;
+    for (int i = 0; i < scratch->pool_count; ++i) {
+        size_t pooled = scratch->pool[i].size;
+        if (pooled >= size && pooled - size <= size / 8 && (best < 0 || pooled < scratch->pool[best].size)) best = i;
+    }
+    if (best < 0) return ipp_aligned_alloc(SCRATCH_ALIGNMENT, size);
+
+    pooled_block_t taken = scratch->pool[best];
+    memmove(&scratch->pool[best], &scratch->pool[best + 1],
+            (scratch->pool_count - best - 1) * sizeof(pooled_block_t));
+    --scratch->pool_count;
+    scratch->pool_bytes -= taken.size;
+    atomic_fetch_sub(&scratch_retained, taken.size);
+    return taken.block;
+}
+
+void evict_pooled(thread_scratch_t *scratch) {
+    pooled_block_t evicted = scratch->pool[0];
+    memmove(&scratch->pool[0], &scratch->pool[1], (scratch->pool_count - 1) * sizeof(pooled_block_t));
+    --scratch->pool_count;
+    scratch->pool_bytes -= evicted.size;
+    atomic_fetch_sub(&scratch_retained, evicted.size);
+    ipp_free(evicted.block);
+}
+
+void release_pooled_pixels(void *block) {
+    if (!block) return;
+    size_t size = ipp_block_size(block);
+    if (size > PIXEL_POOL_MAX_BYTES) {
+        ipp_free(block);
+        return;
+    }
+
+    thread_scratch_t *scratch = this_thread_scratch();
+    while (scratch->pool_count == PIXEL_POOL_BUFFERS || scratch->pool_bytes + size > PIXEL_POOL_MAX_BYTES) {
+        evict_pooled(scratch);
+    }
+    scratch->pool[scratch->pool_count].block = block;
+    scratch->pool[scratch->pool_count].size = size;
+    ++scratch->pool_count;
+    scratch->pool_bytes += size;
+    atomic_fetch_add(&scratch_retained, size);
+}
+
+void *pooled_header(size_t size) {
+    thread_scratch_t *scratch = this_thread_scratch();
+    for (int i = scratch->header_count - 1; i >= 0; --i) {
+        void *header = scratch->headers[i];
+        if (ipp_block_size(header) != size) continue;
+
+        scratch->headers[i] = scratch->headers[--scratch->header_count];
+        atomic_fetch_sub(&scratch_retained, size);
+        memset(header, 0, size);
+        return header;
+    }
+    return ipp_calloc(1, size);
+}
+
+void release_pooled_header(void *header) {
+    if (!header) return;
+    thread_scratch_t *scratch = this_thread_scratch();
+    if (scratch->header_count == HEADER_POOL_BLOCKS) {
+        ipp_free(header);
+        return;
+    }
+    scratch->headers[scratch->header_count++] = header;
+    atomic_fetch_add(&scratch_retained, ipp_block_size(header));
+}
+
+void scratch_trim() {
+    release_thread_scratch(this_thread_scratch());
+}
+
+size_t scratch_retained_bytes() {
+    return atomic_load(&scratch_retained);
+}
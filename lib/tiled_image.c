@@ -0,0 +1,794 @@
+/**
+ * Definitions for the out-of-core tiled image store.
+ */
+
+#include <tiled_image.h>
+#include <pixel_kernels.h>
+#include <trace.h>
+#include <scratch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Creates the unlinked backing file of a tiled image, sized for all of its tiles.
+ * @return File descriptor, negative on failure.
+ */
+int create_backing_file(const char *directory, off_t size);
+
+/**
+ * Offset of a tile in the backing file.
+ */
+off_t tile_offset(tiled_image_t *image, int index);
+
+/**
+ * Writes a resident tile to the backing file if it is dirty.
+ * @return Zero, with last_operation set to WRITE_FAILURE, if the tile could not be written.
+ */
+int write_back_tile(tiled_image_t *image, tile_t *tile);
+
+/**
+ * Moves a resident tile to the most recently used end of the LRU list.
+ */
+void touch_tile(tiled_image_t *image, tile_t *tile);
+
+/**
+ * Frees a slot for another tile: an empty one if there is any, otherwise the least recently used unpinned tile.
+ * @return The slot, unlinked from the LRU list, or NULL if every slot is pinned or the victim could not be written back.
+ */
+tile_t *take_slot(tiled_image_t *image);
+
+/**
+ * New tiled image of another geometry sharing the tile size, cache budget and backing directory of image.
+ */
+tiled_image_t *new_tiled_like(tiled_image_t *image, int width, int height, int channels, J_COLOR_SPACE colorspace);
+
+/**
+ * Size of the pixels of a tiled image, in bytes, as reported by its trace spans.
+ */
+size_t tiled_bytes(tiled_image_t *image);
+
+/**
+ * Luminance, as rgb_to_luminance() computes it, of the pixels of a rectangle of an image.
+ * Pixels of the rectangle outside the image are left untouched.
+ * @param window receives the rectangle row by row, window_stride bytes apart
+ * @return Zero if a tile of the rectangle could not be acquired.
+ */
+int gather_luminance(tiled_image_t *image, int x, int y, int width, int height, unsigned char *window,
+                     int window_stride);
+
+int create_backing_file(const char *directory, off_t size) {
+    if (!directory) directory = getenv("TMPDIR");
+    if (!directory || !*directory) directory = "/tmp";
+
+    size_t length = strlen(directory) + 32;
+    char *path = ipp_malloc(length);
+    snprintf(path, length, "%s/ipp-tiles-XXXXXX", directory);
+
+    // The file only lives as long as the descriptor, so nothing is left behind if the process dies
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+        if (ftruncate(fd, size) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) fprintf(stderr, "Can't create tile file in %s\n", directory);
+
+    ipp_free(path);
+    return fd;
+}
+
+tiled_image_t *new_tiled_image(int width, int height, int channels, J_COLOR_SPACE colorspace, int tile_size,
+                               size_t cache_bytes, const char *directory) {
+    tiled_image_t *image = ipp_calloc(1, sizeof(tiled_image_t));
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    image->colorspace = colorspace;
+    image->tile_size = tile_size > 0 ? tile_size : DEFAULT_TILE_SIZE;
+    image->tiles_x = (width + image->tile_size - 1) / image->tile_size;
+    image->tiles_y = (height + image->tile_size - 1) / image->tile_size;
+    image->tile_bytes = (size_t) image->tile_size * image->tile_size * channels;
+    image->cache_bytes = cache_bytes;
+    if (directory) image->directory = ipp_strdup(directory);
+
+    int tile_count = image->tiles_x * image->tiles_y;
+    image->fd = create_backing_file(directory, (off_t) tile_count * (off_t) image->tile_bytes);
+    if (image->fd < 0) {
+        image->last_operation = FOPEN_FAILURE;
+        return image;
+    }
+
+    image->slot_count = (int) (cache_bytes / image->tile_bytes);
+    if (image->slot_count < MIN_RESIDENT_TILES) image->slot_count = MIN_RESIDENT_TILES;
+    if (image->slot_count > tile_count) image->slot_count = tile_count;
+
+    image->stored = ipp_calloc(tile_count, sizeof(char));
+    image->resident = ipp_malloc(tile_count * sizeof(int));
+    image->slots = ipp_calloc(image->slot_count, sizeof(tile_t));
+    image->slot_pixels = ipp_aligned_alloc(MATRIX_ALIGNMENT, image->slot_count * image->tile_bytes);
+    if (tile_count > 0 && (!image->stored || !image->resident || !image->slots || !image->slot_pixels)) {
+        fprintf(stderr, "Can't allocate %d resident tiles\n", image->slot_count);
+        image->slot_count = 0;
+        image->last_operation = WRITE_FAILURE;
+        return image;
+    }
+
+    for (int i = 0; i < tile_count; ++i) image->resident[i] = -1;
+    for (int i = 0; i < image->slot_count; ++i) {
+        image->slots[i].tile_x = -1;
+        image->slots[i].pixels = image->slot_pixels + i * image->tile_bytes;
+    }
+
+    image->last_operation = WRITE_SUCCESS;
+    return image;
+}
+
+void free_tiled_image(tiled_image_t *image) {
+    if (image->fd >= 0) close(image->fd);
+    ipp_free(image->slot_pixels);
+    ipp_free(image->slots);
+    ipp_free(image->resident);
+    ipp_free(image->stored);
+    ipp_free(image->directory);
+    ipp_free(image);
+}
+
+size_t tiled_bytes(tiled_image_t *image) {
+    return (size_t) image->height * image->width * image->channels;
+}
+
+off_t tile_offset(tiled_image_t *image, int index) {
+    return (off_t) index * (off_t) image->tile_bytes;
+}
+
+unsigned char *tile_row(tiled_image_t *image, tile_t *tile, int y) {
+    return tile->pixels + (size_t) y * image->tile_size * image->channels;
+}
+
+int write_back_tile(tiled_image_t *image, tile_t *tile) {
+    if (!tile->dirty) return 1;
+
+    int index = tile->tile_y * image->tiles_x + tile->tile_x;
+    trace_span_t span = trace_begin("io", "write_back_tile");
+    ssize_t written = pwrite(image->fd, tile->pixels, image->tile_bytes, tile_offset(image, index));
+    trace_end(&span, image->tile_bytes);
+    if (written != (ssize_t) image->tile_bytes) {
+        fprintf(stderr, "Can't write tile %d,%d\n", tile->tile_x, tile->tile_y);
+        image->last_operation = WRITE_FAILURE;
+        return 0;
+    }
+    image->stored[index] = 1;
+    tile->dirty = 0;
+    ++image->stats.writebacks;
+    return 1;
+}
+
+void touch_tile(tiled_image_t *image, tile_t *tile) {
+    if (tile == image->most_recent) return;
+
+    // unlink, if linked at all
+    if (tile->lru_prev) tile->lru_prev->lru_next = tile->lru_next;
+    if (tile->lru_next) tile->lru_next->lru_prev = tile->lru_prev;
+    else if (image->least_recent == tile) image->least_recent = tile->lru_prev;
+
+    tile->lru_prev = NULL;
+    tile->lru_next = image->most_recent;
+    if (image->most_recent) image->most_recent->lru_prev = tile;
+    image->most_recent = tile;
+    if (!image->least_recent) image->least_recent = tile;
+}
+
+tile_t *take_slot(tiled_image_t *image) {
+    for (int i = 0; i < image->slot_count; ++i) {
+        if (image->slots[i].tile_x < 0) return &image->slots[i];
+    }
+
+    tile_t *victim = image->least_recent;
+    while (victim && victim->pins) victim = victim->lru_prev;
+    if (!victim) return NULL;
+
+    // a dirty tile that can not be written back stays resident rather than losing its pixels
+    if (!write_back_tile(image, victim)) return NULL;
+    image->resident[victim->tile_y * image->tiles_x + victim->tile_x] = -1;
+    ++image->stats.evictions;
+
+    if (victim->lru_prev) victim->lru_prev->lru_next = victim->lru_next;
+    else image->most_recent = victim->lru_next;
+    if (victim->lru_next) victim->lru_next->lru_prev = victim->lru_prev;
+    else image->least_recent = victim->lru_prev;
+    victim->lru_prev = NULL;
+    victim->lru_next = NULL;
+    victim->tile_x = -1;
+    return victim;
+}
+
+tile_t *acquire_tile(tiled_image_t *image, int tile_x, int tile_y) {
+    // no resident tiles at all if the image could not be created
+    if (image->slot_count == 0) return NULL;
+    int index = tile_y * image->tiles_x + tile_x;
+
+    if (image->resident[index] >= 0) {
+        tile_t *tile = &image->slots[image->resident[index]];
+        ++image->stats.hits;
+        ++tile->pins;
+        touch_tile(image, tile);
+        return tile;
+    }
+
+    tile_t *tile = take_slot(image);
+    if (!tile) {
+        if (image->last_operation != WRITE_FAILURE) fprintf(stderr, "Every resident tile is in use\n");
+        image->last_operation = READ_FAILURE;
+        return NULL;
+    }
+
+    // Tiles never written back are still zero, there is nothing to read
+    if (image->stored[index]) {
+        trace_span_t span = trace_begin("io", "load_tile");
+        ssize_t loaded = pread(image->fd, tile->pixels, image->tile_bytes, tile_offset(image, index));
+        trace_end(&span, image->tile_bytes);
+        if (loaded != (ssize_t) image->tile_bytes) {
+            // the slot taken stays empty
+            fprintf(stderr, "Can't read tile %d,%d\n", tile_x, tile_y);
+            image->last_operation = READ_FAILURE;
+            return NULL;
+        }
+        ++image->stats.loads;
+    } else {
+        memset(tile->pixels, 0, image->tile_bytes);
+    }
+
+    tile->tile_x = tile_x;
+    tile->tile_y = tile_y;
+    tile->dirty = 0;
+    tile->pins = 1;
+    image->resident[index] = (int) (tile - image->slots);
+    touch_tile(image, tile);
+    return tile;
+}
+
+void release_tile(tile_t *tile, int dirty) {
+    if (!tile) return;
+    if (dirty) tile->dirty = 1;
+    --tile->pins;
+}
+
+void prefetch_region(tiled_image_t *image, int x, int y, int width, int height) {
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    if (width <= 0 || height <= 0 || x >= image->width || y >= image->height) return;
+
+    int first_x = x / image->tile_size;
+    int last_x = min_int(x + width - 1, image->width - 1) / image->tile_size;
+    int first_y = y / image->tile_size;
+    int last_y = min_int(y + height - 1, image->height - 1) / image->tile_size;
+
+    for (int tile_y = first_y; tile_y <= last_y; ++tile_y) {
+        for (int tile_x = first_x; tile_x <= last_x; ++tile_x) {
+            int index = tile_y * image->tiles_x + tile_x;
+            if (image->resident[index] >= 0 || !image->stored[index]) continue;
+
+            // The read happens in the background, acquire_tile() then finds the data in the page cache
+            posix_fadvise(image->fd, tile_offset(image, index), (off_t) image->tile_bytes, POSIX_FADV_WILLNEED);
+            ++image->stats.prefetches;
+        }
+    }
+}
+
+void flush_tiles(tiled_image_t *image) {
+    for (int i = 0; i < image->slot_count; ++i) {
+        if (image->slots[i].tile_x >= 0) write_back_tile(image, &image->slots[i]);
+    }
+}
+
+tile_iterator_t tile_iterator_begin(tiled_image_t *image, int writable) {
+    tile_iterator_t iterator;
+    memset(&iterator, 0, sizeof(tile_iterator_t));
+    iterator.image = image;
+    iterator.index = -1;
+    iterator.writable = writable;
+    return iterator;
+}
+
+int tile_iterator_next(tile_iterator_t *iterator) {
+    tiled_image_t *image = iterator->image;
+    release_tile(iterator->tile, iterator->writable);
+    iterator->tile = NULL;
+
+    if (iterator->index >= image->tiles_x * image->tiles_y) return 0;
+    ++iterator->index;
+    if (iterator->index >= image->tiles_x * image->tiles_y) return 0;
+
+    int tile_x = iterator->index % image->tiles_x;
+    int tile_y = iterator->index / image->tiles_x;
+    iterator->x = tile_x * image->tile_size;
+    iterator->y = tile_y * image->tile_size;
+    iterator->width = min_int(image->tile_size, image->width - iterator->x);
+    iterator->height = min_int(image->tile_size, image->height - iterator->y);
+
+    // row-major walk: the next tile is to the right, or the first one of the next tile row
+    int next = iterator->index + 1;
+    if (next < image->tiles_x * image->tiles_y) {
+        prefetch_region(image, (next % image->tiles_x) * image->tile_size, (next / image->tiles_x) * image->tile_size,
+                        1, 1);
+    }
+
+    iterator->tile = acquire_tile(image, tile_x, tile_y);
+    return iterator->tile != NULL;
+}
+
+int tile_iterator_complete(const tile_iterator_t *iterator) {
+    return iterator->index >= iterator->image->tiles_x * iterator->image->tiles_y;
+}
+
+tiled_image_t *new_tiled_like(tiled_image_t *image, int width, int height, int channels, J_COLOR_SPACE colorspace) {
+    return new_tiled_image(width, height, channels, colorspace, image->tile_size, image->cache_bytes,
+                           image->directory);
+}
+
+tiled_image_t *tiled_from_image(image_t *image, int tile_size, size_t cache_bytes, const char *directory) {
+    tiled_image_t *tiled = new_tiled_image(image->width, image->height, image->channels, image->colorspace, tile_size,
+                                           cache_bytes, directory);
+    if (tiled->last_operation != WRITE_SUCCESS) return tiled;
+
+    tile_iterator_t iterator = tile_iterator_begin(tiled, TRUE);
+    while (tile_iterator_next(&iterator)) {
+        for (int row = 0; row < iterator.height; ++row) {
+            memcpy(tile_row(tiled, iterator.tile, row), image->pixels[iterator.y + row] + iterator.x * image->channels,
+                   (size_t) iterator.width * image->channels);
+        }
+    }
+    return tiled;
+}
+
+image_t *tiled_to_image(tiled_image_t *tiled) {
+    image_t *image = new_image();
+    image->width = tiled->width;
+    image->height = tiled->height;
+    image->channels = tiled->channels;
+    image->colorspace = tiled->colorspace;
+    image->pixels = new_unsigned_char_matrix(image->height, image->width * image->channels);
+    if (!image->pixels) {
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+
+    tile_iterator_t iterator = tile_iterator_begin(tiled, FALSE);
+    while (tile_iterator_next(&iterator)) {
+        for (int row = 0; row < iterator.height; ++row) {
+            memcpy(image->pixels[iterator.y + row] + iterator.x * image->channels, tile_row(tiled, iterator.tile, row),
+                   (size_t) iterator.width * image->channels);
+        }
+    }
+    if (!tile_iterator_complete(&iterator)) {
+        free_pixels(image);
+        image->last_operation = READ_FAILURE;
+        return image;
+    }
+    image->last_operation = READ_SUCCESS;
+    return image;
+}
+
+tiled_image_t *tiled_jpeg_decompress(char *input_filename, const decode_options_t *options, int tile_size,
+                                     size_t cache_bytes, const char *directory) {
+    struct jpeg_decompress_struct cinfo;
+    struct error_manager jerr;
+    tiled_image_t *volatile tiled = NULL;
+    scratch_mark_t mark = scratch_mark();
+    trace_span_t span = trace_begin("io", "tiled_jpeg_decompress");
+
+    FILE *input_file;
+    if ((input_file = fopen(input_filename, "rb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", input_filename);
+        tiled = new_tiled_image(0, 0, 1, JCS_GRAYSCALE, tile_size, 0, directory);
+        tiled->last_operation = FOPEN_FAILURE;
+        trace_end(&span, 0);
+        return tiled;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(input_file);
+        scratch_release(mark);
+        if (!tiled) tiled = new_tiled_image(0, 0, 1, JCS_GRAYSCALE, tile_size, 0, directory);
+        tiled->last_operation = DECOMPRESSION_FAILURE;
+        trace_end(&span, 0);
+        return tiled;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, input_file);
+    (void) jpeg_read_header(&cinfo, TRUE);
+    apply_decode_options(&cinfo, options);
+    (void) jpeg_start_decompress(&cinfo);
+
+    tiled = new_tiled_image((int) cinfo.output_width, (int) cinfo.output_height, cinfo.output_components,
+                            cinfo.out_color_space, tile_size, cache_bytes, directory);
+    if (tiled->last_operation != WRITE_SUCCESS) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(input_file);
+        trace_end(&span, 0);
+        return tiled;
+    }
+
+    // Decode one band of tile rows at a time and scatter it over the tiles of that band
+    size_t row_bytes = (size_t) tiled->width * tiled->channels;
+    unsigned char *band = scratch_alloc(row_bytes * tiled->tile_size);
+    for (int tile_y = 0; tile_y < tiled->tiles_y; ++tile_y) {
+        int band_height = min_int(tiled->tile_size, tiled->height - tile_y * tiled->tile_size);
+        for (int row = 0; row < band_height;) {
+            JSAMPROW row_pointer[1] = {band + row * row_bytes};
+            row += (int) jpeg_read_scanlines(&cinfo, row_pointer, 1);
+        }
+
+        for (int tile_x = 0; tile_x < tiled->tiles_x; ++tile_x) {
+            int x = tile_x * tiled->tile_size;
+            size_t bytes = (size_t) min_int(tiled->tile_size, tiled->width - x) * tiled->channels;
+            tile_t *tile = acquire_tile(tiled, tile_x, tile_y);
+            if (!tile) {
+                jpeg_destroy_decompress(&cinfo);
+                fclose(input_file);
+                scratch_release(mark);
+                tiled->last_operation = DECOMPRESSION_FAILURE;
+                trace_end(&span, 0);
+                return tiled;
+            }
+            for (int row = 0; row < band_height; ++row) {
+                memcpy(tile_row(tiled, tile, row), band + row * row_bytes + (size_t) x * tiled->channels, bytes);
+            }
+            release_tile(tile, TRUE);
+        }
+    }
+
+    (void) jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(input_file);
+    scratch_release(mark);
+
+    tiled->last_operation = DECOMPRESSION_SUCCESS;
+    trace_end(&span, tiled_bytes(tiled));
+    return tiled;
+}
+
+void tiled_jpeg_compress(tiled_image_t *image, char *output_filename, const encode_options_t *options) {
+    struct jpeg_compress_struct cinfo;
+    struct error_manager jerr;
+    scratch_mark_t mark = scratch_mark();
+    trace_span_t span = trace_begin("io", "tiled_jpeg_compress");
+
+    FILE *output_file;
+    if ((output_file = fopen(output_filename, "wb")) == NULL) {
+        fprintf(stderr, "Can't open %s\n", output_filename);
+        image->last_operation = FOPEN_FAILURE;
+        trace_end(&span, 0);
+        return;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        fclose(output_file);
+        scratch_release(mark);
+        image->last_operation = COMPRESSION_FAILURE;
+        trace_end(&span, 0);
+        return;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, output_file);
+
+    cinfo.image_width = (JDIMENSION) image->width;
+    cinfo.image_height = (JDIMENSION) image->height;
+    cinfo.input_components = image->channels;
+    cinfo.in_color_space = image->colorspace;
+    jpeg_set_defaults(&cinfo);
+    apply_encode_options(&cinfo, options);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // Gather one band of tile rows at a time and compress its scanlines
+    size_t row_bytes = (size_t) image->width * image->channels;
+    unsigned char *band = scratch_alloc(row_bytes * image->tile_size);
+    for (int tile_y = 0; tile_y < image->tiles_y; ++tile_y) {
+        int band_height = min_int(image->tile_size, image->height - tile_y * image->tile_size);
+
+        if (tile_y + 1 < image->tiles_y) prefetch_region(image, 0, (tile_y + 1) * image->tile_size, image->width, 1);
+        for (int tile_x = 0; tile_x < image->tiles_x; ++tile_x) {
+            int x = tile_x * image->tile_size;
+            size_t bytes = (size_t) min_int(image->tile_size, image->width - x) * image->channels;
+            tile_t *tile = acquire_tile(image, tile_x, tile_y);
+            if (!tile) {
+                // the file is left incomplete, as when libjpeg fails
+                jpeg_destroy_compress(&cinfo);
+                fclose(output_file);
+                scratch_release(mark);
+                image->last_operation = COMPRESSION_FAILURE;
+                trace_end(&span, 0);
+                return;
+            }
+            for (int row = 0; row < band_height; ++row) {
+                memcpy(band + row * row_bytes + (size_t) x * image->channels, tile_row(image, tile, row), bytes);
+            }
+            release_tile(tile, FALSE);
+        }
+
+        for (int row = 0; row < band_height; ++row) {
+            JSAMPROW row_pointer[1] = {band + row * row_bytes};
+            (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        }
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(output_file);
+    scratch_release(mark);
+
+    image->last_operation = COMPRESSION_SUCCESS;
+    trace_end(&span, tiled_bytes(image));
+}
+
+void tiled_apply_lut(tiled_image_t *image, const unsigned char *lut) {
+    trace_span_t span = trace_begin("op", "tiled_apply_lut");
+    tile_iterator_t iterator = tile_iterator_begin(image, TRUE);
+    while (tile_iterator_next(&iterator)) {
+        for (int row = 0; row < iterator.height; ++row) {
+            unsigned char *components = tile_row(image, iterator.tile, row);
+            map_components(components, components, iterator.width * image->channels, lut);
+        }
+    }
+    trace_end(&span, tiled_bytes(image));
+}
+
+void tiled_add_bias(tiled_image_t *image, double bias) {
+    unsigned char lut[256];
+    bias_lut(bias, lut);
+    tiled_apply_lut(image, lut);
+}
+
+void tiled_multiply_gain(tiled_image_t *image, double gain) {
+    unsigned char lut[256];
+    gain_lut(gain, lut);
+    tiled_apply_lut(image, lut);
+}
+
+void tiled_negative(tiled_image_t *image) {
+    unsigned char lut[256];
+    negative_lut(lut);
+    tiled_apply_lut(image, lut);
+}
+
+void tiled_quantize(tiled_image_t *image, int n_tones) {
+    unsigned char lut[256];
+    quantize_lut(n_tones, lut);
+    tiled_apply_lut(image, lut);
+}
+
+int gather_luminance(tiled_image_t *image, int x, int y, int width, int height, unsigned char *window,
+                     int window_stride) {
+    int first_x = x < 0 ? 0 : x;
+    int first_y = y < 0 ? 0 : y;
+    int last_x = min_int(x + width, image->width) - 1;
+    int last_y = min_int(y + height, image->height) - 1;
+    if (first_x > last_x || first_y > last_y) return 1;
+
+    for (int tile_y = first_y / image->tile_size; tile_y <= last_y / image->tile_size; ++tile_y) {
+        for (int tile_x = first_x / image->tile_size; tile_x <= last_x / image->tile_size; ++tile_x) {
+            tile_t *tile = acquire_tile(image, tile_x, tile_y);
+            if (!tile) return 0;
+            int tile_left = tile_x * image->tile_size;
+            int tile_top = tile_y * image->tile_size;
+            int from_x = first_x > tile_left ? first_x : tile_left;
+            int to_x = min_int(last_x, tile_left + image->tile_size - 1);
+            int from_y = first_y > tile_top ? first_y : tile_top;
+            int to_y = min_int(last_y, tile_top + image->tile_size - 1);
+
+            for (int row = from_y; row <= to_y; ++row) {
+                unsigned char *source = tile_row(image, tile, row - tile_top);
+                unsigned char *target = window + (size_t) (row - y) * window_stride;
+                convert_pixels(source + (from_x - tile_left) * image->channels, image->channels,
+                               target + from_x - x, 1, to_x - from_x + 1);
+            }
+            release_tile(tile, FALSE);
+        }
+    }
+    return 1;
+}
+
+tiled_image_t *tiled_rgb_to_luminance(tiled_image_t *image) {
+    tiled_image_t *luminance = new_tiled_like(image, image->width, image->height, 1, JCS_GRAYSCALE);
+    if (luminance->last_operation != WRITE_SUCCESS) return luminance;
+    trace_span_t span = trace_begin("op", "tiled_rgb_to_luminance");
+
+    tile_iterator_t iterator = tile_iterator_begin(luminance, TRUE);
+    while (tile_iterator_next(&iterator)) {
+        // same tile grid, so the source is a single tile
+        if (!gather_luminance(image, iterator.x, iterator.y, iterator.width, iterator.height,
+                              tile_row(luminance, iterator.tile, 0), luminance->tile_size)) {
+            release_tile(iterator.tile, FALSE);
+            luminance->last_operation = READ_FAILURE;
+            break;
+        }
+    }
+    trace_end(&span, tiled_bytes(image));
+    return luminance;
+}
+
+tiled_image_t *tiled_rotate_90_degrees_clock_wise(tiled_image_t *image) {
+    // new pixel (row, col) is old pixel (height - 1 - col, row)
+    tiled_image_t *rotated = new_tiled_like(image, image->height, image->width, image->channels, image->colorspace);
+    if (rotated->last_operation != WRITE_SUCCESS) return rotated;
+    trace_span_t span = trace_begin("op", "tiled_rotate_90_degrees_clock_wise");
+    int channels = image->channels;
+
+    int failed = 0;
+    tile_iterator_t iterator = tile_iterator_begin(rotated, TRUE);
+    while (!failed && tile_iterator_next(&iterator)) {
+        // old rectangle mapped onto this tile: a column of old tiles, walked upwards as new tiles go right
+        int old_x = iterator.y;
+        int old_y = image->height - iterator.x - iterator.width;
+
+        int next = iterator.index + 1;
+        if (next < rotated->tiles_x * rotated->tiles_y) {
+            int next_x = (next % rotated->tiles_x) * rotated->tile_size;
+            int next_y = (next / rotated->tiles_x) * rotated->tile_size;
+            prefetch_region(image, next_y, image->height - next_x - rotated->tile_size, rotated->tile_size,
+                            rotated->tile_size);
+        }
+
+        int last_old_x = old_x + iterator.height - 1;
+        int last_old_y = old_y + iterator.width - 1;
+        for (int tile_y = old_y / image->tile_size; !failed && tile_y <= last_old_y / image->tile_size; ++tile_y) {
+            for (int tile_x = old_x / image->tile_size; tile_x <= last_old_x / image->tile_size; ++tile_x) {
+                tile_t *tile = acquire_tile(image, tile_x, tile_y);
+                if (!tile) {
+                    failed = 1;
+                    break;
+                }
+                int tile_left = tile_x * image->tile_size;
+                int tile_top = tile_y * image->tile_size;
+                int from_x = old_x > tile_left ? old_x : tile_left;
+                int to_x = min_int(last_old_x, tile_left + image->tile_size - 1);
+                int from_y = old_y > tile_top ? old_y : tile_top;
+                int to_y = min_int(last_old_y, tile_top + image->tile_size - 1);
+
+                for (int old_row = from_y; old_row <= to_y; ++old_row) {
+                    unsigned char *source = tile_row(image, tile, old_row - tile_top);
+                    int new_col = image->height - 1 - old_row - iterator.x;
+
+                    // old columns become new rows
+                    for (int old_col = from_x; old_col <= to_x; ++old_col) {
+                        unsigned char *target = tile_row(rotated, iterator.tile, old_col - iterator.y);
+                        memcpy(target + new_col * channels, source + (old_col - tile_left) * channels, channels);
+                    }
+                }
+                release_tile(tile, FALSE);
+            }
+        }
+    }
+    if (failed) {
+        release_tile(iterator.tile, FALSE);
+        rotated->last_operation = READ_FAILURE;
+    }
+    trace_end(&span, tiled_bytes(image));
+    return rotated;
+}
+
+tiled_image_t *tiled_mirror_horizontally(tiled_image_t *image) {
+    // new pixel (row, col) is old pixel (row, width - 1 - col)
+    tiled_image_t *mirrored = new_tiled_like(image, image->width, image->height, image->channels, image->colorspace);
+    if (mirrored->last_operation != WRITE_SUCCESS) return mirrored;
+    trace_span_t span = trace_begin("op", "tiled_mirror_horizontally");
+    int channels = image->channels;
+
+    int failed = 0;
+    tile_iterator_t iterator = tile_iterator_begin(mirrored, TRUE);
+    while (!failed && tile_iterator_next(&iterator)) {
+        // old columns mapped onto this tile, in at most two old tiles of the same tile row
+        int old_x = image->width - iterator.x - iterator.width;
+        int last_old_x = old_x + iterator.width - 1;
+        int tile_y = iterator.y / image->tile_size;
+
+        int next = iterator.index + 1;
+        if (next < mirrored->tiles_x * mirrored->tiles_y) {
+            int next_x = (next % mirrored->tiles_x) * mirrored->tile_size;
+            int next_y = (next / mirrored->tiles_x) * mirrored->tile_size;
+            prefetch_region(image, image->width - next_x - mirrored->tile_size, next_y, mirrored->tile_size, 1);
+        }
+
+        for (int tile_x = old_x / image->tile_size; tile_x <= last_old_x / image->tile_size; ++tile_x) {
+            tile_t *tile = acquire_tile(image, tile_x, tile_y);
+            if (!tile) {
+                failed = 1;
+                break;
+            }
+            int tile_left = tile_x * image->tile_size;
+            int from_x = old_x > tile_left ? old_x : tile_left;
+            int to_x = min_int(last_old_x, tile_left + image->tile_size - 1);
+            int new_col = image->width - 1 - to_x - iterator.x;
+
+            for (int row = 0; row < iterator.height; ++row) {
+                reverse_pixels(tile_row(image, tile, row) + (from_x - tile_left) * channels,
+                               tile_row(mirrored, iterator.tile, row) + new_col * channels, to_x - from_x + 1,
+                               channels);
+            }
+            release_tile(tile, FALSE);
+        }
+    }
+    if (failed) {
+        release_tile(iterator.tile, FALSE);
+        mirrored->last_operation = READ_FAILURE;
+    }
+    trace_end(&span, tiled_bytes(image));
+    return mirrored;
+}
+
+tiled_image_t *tiled_convolve(tiled_image_t *image, float **filter, boolean clamp) {
+    int half = FILTER_SIZE / 2;
+    int new_height = image->height - half;
+    int new_width = image->width - half;
+    tiled_image_t *convolved = new_tiled_like(image, new_width, new_height, 1, JCS_GRAYSCALE);
+    if (convolved->last_operation != WRITE_SUCCESS) return convolved;
+    trace_span_t span = trace_begin("op", "tiled_convolve");
+
+    // filter rotated by 180 degrees
+    float rot_filter[FILTER_SIZE][FILTER_SIZE];
+    for (int i = 0; i < FILTER_SIZE; ++i) {
+        for (int j = 0; j < FILTER_SIZE; ++j) {
+            rot_filter[i][j] = filter[FILTER_SIZE - i - 1][FILTER_SIZE - j - 1];
+        }
+    }
+
+    // luminance of a tile and its border of half pixels on each side
+    int window_stride = convolved->tile_size + 2 * half;
+    scratch_mark_t mark = scratch_mark();
+    unsigned char *window = scratch_alloc((size_t) window_stride * window_stride);
+
+    tile_iterator_t iterator = tile_iterator_begin(convolved, TRUE);
+    while (tile_iterator_next(&iterator)) {
+        int next = iterator.index + 1;
+        if (next < convolved->tiles_x * convolved->tiles_y) {
+            prefetch_region(image, (next % convolved->tiles_x) * convolved->tile_size - half,
+                            (next / convolved->tiles_x) * convolved->tile_size - half, window_stride, window_stride);
+        }
+        if (!gather_luminance(image, iterator.x - half, iterator.y - half, iterator.width + 2 * half,
+                              iterator.height + 2 * half, window, window_stride)) {
+            release_tile(iterator.tile, FALSE);
+            convolved->last_operation = READ_FAILURE;
+            break;
+        }
+
+        // slide filter through the tile, pixels on the border of the image stay zero
+        for (int row = 0; row < iterator.height; ++row) {
+            int y = iterator.y + row;
+            if (y < half || y >= new_height - half) continue;
+            unsigned char *target = tile_row(convolved, iterator.tile, row);
+
+            // window rows around this one, shifted so that tile column col reads window column col + half
+            const unsigned char *rows[FILTER_SIZE];
+            for (int i = 0; i < FILTER_SIZE; ++i) {
+                rows[i] = window + (size_t) (row + i) * window_stride + half;
+            }
+            int first = iterator.x < half ? half - iterator.x : 0;
+            int last = min_int(iterator.width, new_width - half - iterator.x);
+            if (first < last) convolve_row(rows, target, first, last, &rot_filter[0][0], clamp);
+        }
+    }
+
+    scratch_release(mark);
+    trace_end(&span, tiled_bytes(image));
+    return convolved;
+}
@@ -0,0 +1,316 @@
+/**
+ * Definitions for tracing of library operations.
+ */
+
+#include <trace.h>
+#include <memory_accounting.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define INITIAL_EVENT_CAPACITY 1024
+#define SUMMARY_NAMES 4
+
+/**
+ * Span recorded when it ended.
+ */
+typedef struct trace_event_struct {
+    const char *category;
+    const char *name;
+    unsigned long long start;
+    unsigned long long duration;
+    size_t bytes;
+    int depth;                  // spans of the same thread open around this one
+    unsigned long long allocations;
+    unsigned long long allocated_bytes;
+} trace_event_t;
+
+/**
+ * Spans of one thread, written by that thread alone. Buffers outlive their threads, so that spans of short-lived
+ * workers end up in the trace. The buffer of an exited thread is taken over, spans included, by the next thread
+ * that begins a span, so that workers started for every operation do not add a buffer each; trace_clear()
+ * releases those that are left.
+ */
+typedef struct trace_buffer_struct {
+    int thread_id;              // small number in order of the first span of the first thread of the buffer
+    int depth;
+    int exited;
+    trace_event_t *events;
+    size_t count;
+    size_t capacity;
+    size_t dropped;             // spans not recorded because the buffer reached TRACE_MAX_EVENTS_PER_THREAD
+    struct trace_buffer_struct *next;
+} trace_buffer_t;
+
+/**
+ * Time spent in spans of one name, for trace_summary().
+ */
+typedef struct trace_total_struct {
+    const char *name;
+    unsigned long long duration;
+    int count;
+} trace_total_t;
+
+// Whether spans are recorded; trace_enable() may change it while other threads trace
+atomic_int tracing = 0;
+char *trace_exit_filename = NULL;
+
+pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+pthread_key_t trace_buffer_key;
+pthread_mutex_t trace_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+trace_buffer_t *trace_buffers = NULL;
+int trace_threads = 0;
+
+/**
+ * Creates the thread-specific key of the buffers and reads IPP_TRACE.
+ */
+void init_tracing();
+
+/**
+ * Marks the buffer of an exiting thread as releasable.
+ */
+void retire_trace_buffer(void *buffer);
+
+/**
+ * Buffer of the calling thread, registered on its first span.
+ * @return The buffer, NULL if it could not be allocated.
+ */
+trace_buffer_t *thread_trace_buffer();
+
+void write_trace_at_exit();
+
+int compare_totals(const void *a, const void *b);
+
+void init_tracing() {
+    pthread_key_create(&trace_buffer_key, retire_trace_buffer);
+
+    const char *filename = getenv("IPP_TRACE");
+    if (filename && *filename) {
+        trace_exit_filename = strdup(filename);
+        atexit(write_trace_at_exit);
+        atomic_store(&tracing, 1);
+    }
+}
+
+void retire_trace_buffer(void *buffer) {
+    pthread_mutex_lock(&trace_buffers_lock);
+    ((trace_buffer_t *) buffer)->exited = 1;
+    pthread_mutex_unlock(&trace_buffers_lock);
+}
+
+void write_trace_at_exit() {
+    if (!trace_write_chrome(trace_exit_filename)) {
+        fprintf(stderr, "Could not write trace to %s\n", trace_exit_filename);
+    }
+}
+
+trace_buffer_t *thread_trace_buffer() {
+    trace_buffer_t *buffer = pthread_getspecific(trace_buffer_key);
+    if (buffer) return buffer;
+
+    // the spans of an exited thread all ended before this one began any, so they share the buffer in order
+    pthread_mutex_lock(&trace_buffers_lock);
+    for (buffer = trace_buffers; buffer && !buffer->exited; buffer = buffer->next);
+    if (buffer) {
+        buffer->exited = 0;
+        buffer->depth = 0;
+    } else if ((buffer = calloc(1, sizeof(trace_buffer_t)))) {
+        buffer->thread_id = ++trace_threads;
+        buffer->next = trace_buffers;
+        trace_buffers = buffer;
+    }
+    pthread_mutex_unlock(&trace_buffers_lock);
+    if (!buffer) return NULL;
+
+    pthread_setspecific(trace_buffer_key, buffer);
+    return buffer;
+}
+
+void trace_enable(int enabled) {
+    pthread_once(&trace_once, init_tracing);
+    atomic_store(&tracing, enabled);
+}
+
+int trace_enabled() {
+    pthread_once(&trace_once, init_tracing);
+    return atomic_load(&tracing);
+}
+
+unsigned long long trace_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ull + (unsigned long long) now.tv_nsec;
+}
+
+trace_span_t trace_begin(const char *category, const char *name) {
+    trace_span_t span = {category, name, 0, 0, 0, 0};
+    pthread_once(&trace_once, init_tracing);
+    if (!atomic_load(&tracing)) return span;
+
+    trace_buffer_t *buffer = thread_trace_buffer();
+    if (!buffer) return span;
+    span.depth = buffer->depth++;
+    memory_stats_t memory = thread_memory_stats();
+    span.allocations = memory.allocations;
+    span.allocated_bytes = memory.allocated_bytes;
+    span.start = trace_now();
+    return span;
+}
+
+void trace_end(trace_span_t *span, size_t bytes) {
+    if (!span->start) return;
+    unsigned long long end = trace_now();
+    memory_stats_t memory = thread_memory_stats();
+
+    trace_buffer_t *buffer = thread_trace_buffer();
+    if (!buffer) return;
+    buffer->depth = span->depth;
+
+    if (buffer->count == buffer->capacity) {
+        size_t capacity = buffer->capacity ? 2 * buffer->capacity : INITIAL_EVENT_CAPACITY;
+        trace_event_t *events = capacity <= TRACE_MAX_EVENTS_PER_THREAD
+                                ? realloc(buffer->events, capacity * sizeof(trace_event_t)) : NULL;
+        if (!events) {
+            ++buffer->dropped;
+            return;
+        }
+        buffer->events = events;
+        buffer->capacity = capacity;
+    }
+
+    trace_event_t *event = &buffer->events[buffer->count++];
+    event->category = span->category;
+    event->name = span->name;
+    event->start = span->start;
+    event->duration = end - span->start;
+    event->bytes = bytes;
+    event->depth = span->depth;
+    event->allocations = memory.allocations - span->allocations;
+    event->allocated_bytes = memory.allocated_bytes - span->allocated_bytes;
+}
+
+int compare_totals(const void *a, const void *b) {
+    unsigned long long x = ((const trace_total_t *) a)->duration, y = ((const trace_total_t *) b)->duration;
+    return (x < y) - (x > y);
+}
+
+int trace_summary(unsigned long long since, char *summary, size_t size) {
+    if (size) summary[0] = '\0';
+    pthread_once(&trace_once, init_tracing);
+
+    // time of each name, and of the outermost spans, over every thread
+    trace_total_t *totals = NULL;
+    int total_count = 0, total_capacity = 0, spans = 0;
+    unsigned long long outermost = 0;
+    trace_buffer_t *caller = pthread_getspecific(trace_buffer_key);
+
+    pthread_mutex_lock(&trace_buffers_lock);
+    for (trace_buffer_t *buffer = trace_buffers; buffer; buffer = buffer->next) {
+        for (size_t i = 0; i < buffer->count; ++i) {
+            trace_event_t *event = &buffer->events[i];
+            if (event->start < since) continue;
+
+            ++spans;
+            if (event->depth == 0 && buffer == caller) outermost += event->duration;
+
+            int t;
+            for (t = 0; t < total_count && strcmp(totals[t].name, event->name) != 0; ++t);
+            if (t == total_count) {
+                if (total_count == total_capacity) {
+                    // without memory for another name, its spans are left out of the totals
+                    int capacity = total_capacity ? 2 * total_capacity : 16;
+                    trace_total_t *grown = realloc(totals, capacity * sizeof(trace_total_t));
+                    if (!grown) continue;
+                    totals = grown;
+                    total_capacity = capacity;
+                }
+                totals[total_count].name = event->name;
+                totals[total_count].duration = 0;
+                totals[total_count].count = 0;
+                ++total_count;
+            }
+            totals[t].duration += event->duration;
+            ++totals[t].count;
+        }
+    }
+    pthread_mutex_unlock(&trace_buffers_lock);
+
+    if (total_count > 0 && size) {
+        qsort(totals, total_count, sizeof(trace_total_t), compare_totals);
+
+        // the outermost spans of the calling thread make up the action, unless it only waited on other threads
+        if (outermost == 0) outermost = totals[0].duration;
+        size_t length = (size_t) snprintf(summary, size, "%.2f ms:", outermost / 1e6);
+        for (int t = 0; t < total_count && t < SUMMARY_NAMES && length < size; ++t) {
+            length += (size_t) snprintf(summary + length, size - length, "%s %s %.2f ms", t ? "," : "",
+                                        totals[t].name, totals[t].duration / 1e6);
+            if (totals[t].count > 1 && length < size) {
+                length += (size_t) snprintf(summary + length, size - length, " (x%d)", totals[t].count);
+            }
+        }
+    }
+
+    free(totals);
+    return spans;
+}
+
+int trace_write_chrome(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) return 0;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    int first = 1;
+    unsigned long long origin = 0;
+    size_t dropped = 0;
+
+    pthread_mutex_lock(&trace_buffers_lock);
+
+    // timestamps relative to the first span, in microseconds as the format expects
+    for (trace_buffer_t *buffer = trace_buffers; buffer; buffer = buffer->next) {
+        for (size_t i = 0; i < buffer->count; ++i) {
+            if (!origin || buffer->events[i].start < origin) origin = buffer->events[i].start;
+        }
+    }
+
+    for (trace_buffer_t *buffer = trace_buffers; buffer; buffer = buffer->next) {
+        fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                      "\"args\": {\"name\": \"thread %d\"}}", first ? "" : ",", buffer->thread_id,
+                buffer->thread_id);
+        first = 0;
+        dropped += buffer->dropped;
+
+        for (size_t i = 0; i < buffer->count; ++i) {
+            trace_event_t *event = &buffer->events[i];
+            fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                          "\"pid\": 1, \"tid\": %d, \"args\": {\"bytes\": %zu, \"allocations\": %llu, "
+                          "\"allocated_bytes\": %llu}}", event->name, event->category, (event->start - origin) / 1e3,
+                    event->duration / 1e3, buffer->thread_id, event->bytes, event->allocations,
+                    event->allocated_bytes);
+        }
+    }
+    pthread_mutex_unlock(&trace_buffers_lock);
+
+    fprintf(file, "\n], \"otherData\": {\"dropped_spans\": %zu}}\n", dropped);
+    return fclose(file) == 0;
+}
+
+void trace_clear() {
+    pthread_mutex_lock(&trace_buffers_lock);
+    trace_buffer_t **link = &trace_buffers;
+    while (*link) {
+        trace_buffer_t *buffer = *link;
+        if (buffer->exited) {
+            *link = buffer->next;
+            free(buffer->events);
+            free(buffer);
+        } else {
+            buffer->count = 0;
+            buffer->dropped = 0;
+            link = &buffer->next;
+        }
+    }
+    pthread_mutex_unlock(&trace_buffers_lock);
+}
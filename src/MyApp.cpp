@@ -9,15 +9,27 @@
 
 #define __GXX_ABI_VERSION 1002
 
-#define ASSERT_IMAGE_OPEN if (!image) {\
+#define IMAGE_FILES_WILDCARD "JPEG images (*.jpg, *.jpeg)|*.jpg;*.jpeg|" \
+                             "PPM/PGM images (*.ppm, *.pgm)|*.ppm;*.pgm|" \
+                             "Raw images (*.ippraw)|*.ippraw"
+
+#define DECODE_CACHE_BUDGET (256 * 1024 * 1024)
+
+#define ASSERT_IMAGE_OPEN if (image.empty()) {\
         wxLogMessage("You must open an image first!");\
         return;\
     }
 
 extern "C" {
 #include <image_manipulation.h>
+#include <image_formats.h>
+#include <image_cache.h>
+#include <pipeline.h>
+#include <trace.h>
 };
 
+#include <image.hpp>
+
 #endif
 
 class MyApp : public wxApp {
@@ -29,13 +41,27 @@ class MyFrame : public wxFrame {
 public:
     MyFrame();
 
+    ~MyFrame() override;
+
 private:
-    image_t *image;
+    ipp::Image image;
+
+    image_cache_t *decodeCache;
 
     int histogramFrames = 0;
 
+    // ops applied since the image was opened, as a parse_pipeline() list
+    wxString history;
+
+    bool historyReplayable = true;
+
+    // when the menu command being handled started, so its status bar summary only covers its own spans
+    unsigned long long actionStart = 0;
+
     wxStaticBitmap *staticBitmap;
 
+    bool TryBefore(wxEvent &event) override;
+
     void OnOpen(wxCommandEvent &event);
 
     void OnSave(wxCommandEvent &event);
@@ -76,9 +102,23 @@ private:
 
     void OnAbout(wxCommandEvent &event);
 
+    void OnReplayHistory(wxCommandEvent &event);
+
+    void OnToggleTracing(wxCommandEvent &event);
+
+    void OnSaveTrace(wxCommandEvent &event);
+
+    void ShowTraceSummary();
+
+    bool AskEncodeOptions(encode_options_t *options);
+
+    void RecordOp(const wxString &op);
+
     void ShowImage();
 
-    void ShowImageInNewFrame(image_t *image_to_show, const char *frame_title);
+    void ShowImageInNewFrame(ipp::ConstImageView image_to_show, const char *frame_title);
+
+    static wxImage ToWxImage(ipp::ConstImageView view);
 };
 
 enum {
@@ -99,7 +139,10 @@ enum {
     ID_ZOOM_IN = 15,
     ID_ROTATE_90_DEGREES_CLOCK_WISE = 16,
     ID_CONVOLVE = 17,
-    ID_GENERAL_CONVOLVE = 18
+    ID_GENERAL_CONVOLVE = 18,
+    ID_REPLAY_HISTORY = 19,
+    ID_TRACING = 20,
+    ID_SAVE_TRACE = 21
 };
 
 wxIMPLEMENT_APP(MyApp);
@@ -112,13 +155,22 @@ bool MyApp::OnInit() {
 
 MyFrame::MyFrame()
         : wxFrame(NULL, wxID_ANY, "IPP - [Image Processing Playground]", wxPoint(-1, -1), wxSize(600, 600)) {
-    image = nullptr;
+    decodeCache = new_image_cache(DECODE_CACHE_BUDGET, nullptr);
 
     auto *menuFile = new wxMenu;
     menuFile->Append(ID_OPEN, "&Open...\tCtrl-O",
                      "Open an image from internal storage");
     menuFile->Append(ID_SAVE, "&Save...\tCtrl-S",
                      "Save edited image to internal storage");
+    menuFile->Append(ID_REPLAY_HISTORY, "&Replay History On...\tCtrl-Shift-R",
+                     "Apply the edits made since opening the current image to another image");
+    menuFile->AppendSeparator();
+    menuFile->AppendCheckItem(ID_TRACING, "Enable &Tracing",
+                              "Time every library operation, summarizing the last one in the status bar; "
+                              "disabling discards the operations timed so far");
+    menuFile->Append(ID_SAVE_TRACE, "Save Tra&ce...",
+                     "Save the operations timed since the last save as a Chrome trace (chrome://tracing, Perfetto)");
+    menuFile->Check(ID_TRACING, trace_enabled() != 0);
     menuFile->AppendSeparator();
     menuFile->Append(wxID_EXIT);
 
@@ -168,7 +220,8 @@ MyFrame::MyFrame()
     menuBar->Append(menu2, "&Assignment 2");
     menuBar->Append(menuHelp, "&Help");
     SetMenuBar(menuBar);
-    CreateStatusBar();
+    // second field holds the timing summary of the last command while tracing
+    CreateStatusBar(2);
     SetStatusText("Welcome to Image Processing Playground!");
 
     wxPanel *panel = new wxPanel(this, -1);
@@ -183,6 +236,9 @@ MyFrame::MyFrame()
 
     Bind(wxEVT_MENU, &MyFrame::OnOpen, this, ID_OPEN);
     Bind(wxEVT_MENU, &MyFrame::OnSave, this, ID_SAVE);
+    Bind(wxEVT_MENU, &MyFrame::OnReplayHistory, this, ID_REPLAY_HISTORY);
+    Bind(wxEVT_MENU, &MyFrame::OnToggleTracing, this, ID_TRACING);
+    Bind(wxEVT_MENU, &MyFrame::OnSaveTrace, this, ID_SAVE_TRACE);
     Bind(wxEVT_MENU, &MyFrame::OnMirrorVertically, this, ID_MIRROR_VERTICALLY);
     Bind(wxEVT_MENU, &MyFrame::OnMirrorHorizontally, this, ID_MIRROR_HORIZONTALLY);
     Bind(wxEVT_MENU, &MyFrame::OnGrayScale, this, ID_GRAY_SCALE);
@@ -204,6 +260,11 @@ MyFrame::MyFrame()
     Bind(wxEVT_MENU, &MyFrame::OnExit, this, wxID_EXIT);
 }
 
+MyFrame::~MyFrame() {
+    // frames are destroyed however they are closed, from the Exit menu item or the window itself
+    free_image_cache(decodeCache);
+}
+
 void MyFrame::OnExit(wxCommandEvent &event) {
     Close(true);
 }
@@ -217,23 +278,32 @@ void MyFrame::OnAbout(wxCommandEvent &event) {
 void MyFrame::OnOpen(wxCommandEvent &event) {
     wxFileDialog *OpenDialog = new wxFileDialog(
             this, _("Choose a file to open"), wxEmptyString, wxEmptyString,
-            _("JPEG images (*.jpg, *.jpeg)|*.jpg;*.jpeg"),
+            _(IMAGE_FILES_WILDCARD),
             wxFD_OPEN, wxDefaultPosition);
 
-    // Creates a "open file" dialog with 2 file types
+    // Creates a "open file" dialog with 3 file types
     if (OpenDialog->ShowModal() == wxID_OK) // if the user click "Open" instead of "cancel"
     {
         wxString filename = OpenDialog->GetPath();
 
         // Sets our current document to the file the user selected
-        image = jpeg_decompress((char *) filename.mb_str().data());
+        // JPEGs go through the decode cache, so reopening a file (or a copy of it) is a lookup
+        wxCharBuffer path_buffer = filename.mb_str();
+        char *path = path_buffer.data();
+        image_t *opened_image = is_jpeg_filename(path) ? image_cache_decompress(decodeCache, path, nullptr)
+                                                       : load_image(path);
+        bool opened = opened_image->last_operation == DECOMPRESSION_SUCCESS ||
+                      opened_image->last_operation == READ_SUCCESS;
+        ipp::Image loaded = ipp::Image::adopt(opened_image);
+        if (opened) image = std::move(loaded);
         // Set the Title to reflect the  file open
         SetTitle(wxString("Edit - ") << OpenDialog->GetFilename());
         // Set the Status to reflect that file saved
-        SetStatusText((image->last_operation == DECOMPRESSION_SUCCESS) ? "File opened successfully!"
-                                                                       : "Failed to open file!");
+        SetStatusText(opened ? "File opened successfully!" : "Failed to open file!");
 
-        if (image->last_operation == DECOMPRESSION_SUCCESS) {
+        if (opened) {
+            history.Clear();
+            historyReplayable = true;
             ShowImage();
         }
     }
@@ -244,27 +314,103 @@ void MyFrame::OnSave(wxCommandEvent &event) {
 
     wxFileDialog *SaveDialog = new wxFileDialog(
             this, _("Choose where to save the file"), wxEmptyString, wxEmptyString,
-            _("JPEG images (*.jpg, *.jpeg)|*.jpg;*.jpeg"),
+            _(IMAGE_FILES_WILDCARD),
             wxFD_SAVE | wxFD_OVERWRITE_PROMPT, wxDefaultPosition);
 
-    // Creates a "open file" dialog with 4 file types
+    // Creates a "open file" dialog with 3 file types
     if (SaveDialog->ShowModal() == wxID_OK) // if the user click "Open" instead of "cancel"
     {
         wxString filename = SaveDialog->GetPath();
 
+        // Encoder options only matter for JPEG, the other formats are stored as is
+        encode_options_t options = default_encode_options();
+        if (is_jpeg_filename(filename.mb_str().data()) && !AskEncodeOptions(&options)) return;
+
         // Sets our current document to the file the user selected
-        jpeg_compress(image, (char *) filename.mb_str().data());
+        bool saved = image.save(filename.mb_str().data(), &options);
 
         // Set the Status to reflect that file saved
-        SetStatusText(
-                (image->last_operation == COMPRESSION_SUCCESS) ? "File saved successfully!" : "Failed to save file!");
+        SetStatusText(saved ? "File saved successfully!" : "Failed to save file!");
+        ShowTraceSummary();
+    }
+}
+
+bool MyFrame::AskEncodeOptions(encode_options_t *options) {
+    wxArrayString presets;
+    for (int preset = 0; preset < ENCODE_PRESET_COUNT; ++preset) {
+        encode_options_t preset_options = encode_preset_options(static_cast<encode_preset>(preset));
+        presets.Add(wxString::Format("%s (quality %d%s%s, %dx%d sampling)",
+                                     encode_preset_name(static_cast<encode_preset>(preset)),
+                                     preset_options.quality,
+                                     preset_options.dct_method == JDCT_IFAST ? ", fast DCT" : "",
+                                     preset_options.progressive ? ", progressive" : "",
+                                     preset_options.h_sampling, preset_options.v_sampling));
+    }
+
+    wxSingleChoiceDialog PresetDialog(this, _("Encoder preset"), _("JPEG options"), presets);
+    if (PresetDialog.ShowModal() != wxID_OK) return false;
+    *options = encode_preset_options(static_cast<encode_preset>(PresetDialog.GetSelection()));
+
+    wxTextEntryDialog QualityDialog(this, _("Quality (1-100)"), _("JPEG options"),
+                                    wxString::Format("%d", options->quality));
+    if (QualityDialog.ShowModal() != wxID_OK) return false;
+
+    long quality;
+    if (!QualityDialog.GetValue().ToLong(&quality) || quality < 1 || quality > 100) {
+        wxLogMessage("Enter a quality in the range [1,100]");
+        return false;
+    }
+    options->quality = static_cast<int>(quality);
+
+    return true;
+}
+
+void MyFrame::RecordOp(const wxString &op) {
+    if (!history.IsEmpty()) history << ",";
+    history << op;
+}
+
+void MyFrame::OnReplayHistory(wxCommandEvent &event) {
+    ASSERT_IMAGE_OPEN
+
+    if (history.IsEmpty() || !historyReplayable) {
+        wxLogMessage(history.IsEmpty() ? "No edits to replay yet."
+                                       : "Custom filters and histogram matching can't be replayed.");
+        return;
+    }
+
+    wxFileDialog *OpenDialog = new wxFileDialog(
+            this, _("Choose an image to apply the edits to"), wxEmptyString, wxEmptyString,
+            _(IMAGE_FILES_WILDCARD),
+            wxFD_OPEN, wxDefaultPosition);
+
+    if (OpenDialog->ShowModal() == wxID_OK) // if the user click "Open" instead of "cancel"
+    {
+        // The whole history runs as one pipeline, fused into as few passes over the image as possible
+        pipeline_t *pipeline = parse_pipeline(history.mb_str().data());
+        if (!pipeline) {
+            wxLogMessage("Can't replay " + history);
+            return;
+        }
+
+        wxCharBuffer path_buffer = OpenDialog->GetPath().mb_str();
+        pipeline_run_file(pipeline, path_buffer.data());
+        image_t *output = pipeline->last_operation == WRITE_SUCCESS ?
+                          pipeline_image(pipeline, pipeline_output(pipeline)) : nullptr;
+        SetStatusText(output ? wxString::Format("Replayed %d ops in %d passes", pipeline_output(pipeline),
+                                                pipeline->stats.passes)
+                             : wxString("Failed to open file!"));
+        free_pipeline(pipeline);
+
+        if (output) ShowImageInNewFrame(ipp::Image::adopt(output), "Replayed History");
     }
 }
 
 void MyFrame::OnMirrorVertically(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    mirror_vertically(image);
+    ipp::mirror_vertically(image);
+    RecordOp("mirror-v");
 
     ShowImage();
 }
@@ -272,7 +418,8 @@ void MyFrame::OnMirrorVertically(wxCommandEvent &event) {
 void MyFrame::OnMirrorHorizontally(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    mirror_horizontally(image);
+    ipp::mirror_horizontally(image);
+    RecordOp("mirror-h");
 
     ShowImage();
 }
@@ -280,7 +427,8 @@ void MyFrame::OnMirrorHorizontally(wxCommandEvent &event) {
 void MyFrame::OnGrayScale(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    rgb_to_luminance(image);
+    image = ipp::luminance(image);
+    RecordOp("luminance");
 
     ShowImage();
 }
@@ -295,27 +443,34 @@ void MyFrame::OnQuantize(wxCommandEvent &event) {
     {
         double tones;
         TextEntryDialog->GetValue().ToDouble(&tones);
-        quantize(image, (int) tones);
+        ipp::quantize(image, (int) tones);
+        RecordOp(wxString::Format("quantize:%d", (int) tones));
 
         ShowImage();
     }
 }
 
+wxImage MyFrame::ToWxImage(ipp::ConstImageView view) {
+    // wxImage owns its RGB buffer, which is filled straight from the pixels
+    wxImage wx_image(view.width(), view.height(), false);
+    ipp::luminance_to_rgb(view, ipp::ImageView(wx_image.GetData(), view.width(), view.height(), 3, JCS_RGB));
+    return wx_image;
+}
+
 void MyFrame::ShowImage() {
     ASSERT_IMAGE_OPEN
 
-    image_t *displayable = get_displayable(image);
-    wxImage wx_image(displayable->width, displayable->height, pixel_array_to_unsigned_char_array(displayable), true);
-    wxBitmap wx_bitmap(wx_image);
+    wxBitmap wx_bitmap(ToWxImage(image));
 
     // Update later with your bitmap
     staticBitmap->SetBitmap(wx_bitmap);
+    ShowTraceSummary();
 }
 
-void MyFrame::ShowImageInNewFrame(image_t *image_to_show, const char *frame_title) {
+void MyFrame::ShowImageInNewFrame(ipp::ConstImageView image_to_show, const char *frame_title) {
     wxFrame *frame = new wxFrame(nullptr, histogramFrames++, frame_title, wxPoint(50, 50),
-                                 wxSize(static_cast<int>(image_to_show->height * 1.2),
-                                        static_cast<int>(image_to_show->width * 1.2)));
+                                 wxSize(static_cast<int>(image_to_show.height() * 1.2),
+                                        static_cast<int>(image_to_show.width() * 1.2)));
     wxPanel *panel = new wxPanel(frame);
     auto *hbox = new wxBoxSizer(wxHORIZONTAL);
 
@@ -325,37 +480,64 @@ void MyFrame::ShowImageInNewFrame(image_t *image_to_show, const char *frame_titl
     hbox->Add(histogramBitmap, 1, wxEXPAND);
     frame->SetSizer(hbox);
 
-    image_t *displayable = get_displayable(image_to_show);
-    wxImage wx_image(displayable->width, displayable->height, pixel_array_to_unsigned_char_array(displayable), true);
-    wxBitmap wx_bitmap(wx_image);
+    wxBitmap wx_bitmap(ToWxImage(image_to_show));
 
     frame->Show(true);
     histogramBitmap->SetBitmap(wx_bitmap);
+    ShowTraceSummary();
+}
+
+bool MyFrame::TryBefore(wxEvent &event) {
+    if (event.GetEventType() == wxEVT_MENU) actionStart = trace_now();
+    return wxFrame::TryBefore(event);
+}
+
+void MyFrame::OnToggleTracing(wxCommandEvent &event) {
+    trace_enable(event.IsChecked());
+    // the spans would otherwise be kept, and grow, until the application exits
+    if (!event.IsChecked()) trace_clear();
+    SetStatusText(event.IsChecked() ? "Tracing enabled" : "Tracing disabled");
+    SetStatusText("", 1);
+}
+
+void MyFrame::OnSaveTrace(wxCommandEvent &event) {
+    wxFileDialog SaveDialog(this, _("Choose where to save the trace"), wxEmptyString, "trace.json",
+                            _("Chrome traces (*.json)|*.json"), wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (SaveDialog.ShowModal() != wxID_OK) return;
+
+    bool saved = trace_write_chrome(SaveDialog.GetPath().mb_str().data()) != 0;
+    if (saved) trace_clear();
+    SetStatusText(saved ? "Trace saved successfully!" : "Failed to save trace!");
+}
+
+void MyFrame::ShowTraceSummary() {
+    if (!trace_enabled()) return;
+
+    char summary[256];
+    trace_summary(actionStart, summary, sizeof(summary));
+    SetStatusText(summary, 1);
 }
 
 void MyFrame::OnShowHistogram(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    image_t *histogram = histogram_plot(compute_histogram(image));
-    if (!histogram) {
-        wxLogMessage("Error generating histogram");
-        return;
+    // colour images plot their channels, whose histograms point ops keep exact, where the luminance would be counted
+    // again after every edit
+    if (image.channels() == 1) {
+        ShowImageInNewFrame(ipp::histogram_plot(ipp::histogram(image)), "Histogram");
+    } else {
+        ShowImageInNewFrame(ipp::channel_histogram_plot(image), "Channel Histograms");
     }
-
-    ShowImageInNewFrame(histogram, "Histogram");
 }
 
 void MyFrame::OnShowCumulativeHistogram(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    image_t *cum_hist = histogram_plot(compute_norm_cum_histogram(image));
-    if (!cum_hist) {
-        wxLogMessage("Error generating histogram");
-        return;
+    if (image.channels() == 1) {
+        ShowImageInNewFrame(ipp::histogram_plot(ipp::cumulative_histogram(image)), "Cumulative Histogram");
+    } else {
+        ShowImageInNewFrame(ipp::channel_histogram_plot(image, true), "Cumulative Channel Histograms");
     }
-    const char *frame_title = "Cumulative Histogram";
-
-    ShowImageInNewFrame(cum_hist, frame_title);
 }
 
 void MyFrame::OnAdjustBrightness(wxCommandEvent &event) {
@@ -370,7 +552,8 @@ void MyFrame::OnAdjustBrightness(wxCommandEvent &event) {
         TextEntryDialog->GetValue().ToDouble(&bias);
 
         if (bias >= -255 && bias <= 255) {
-            add_bias(image, bias);
+            ipp::add_bias(image, bias);
+            RecordOp(wxString::Format("bias:%g", bias));
         } else {
             wxLogMessage("Enter a value in the range [0,255]");
             return;
@@ -392,7 +575,8 @@ void MyFrame::OnAdjustContrast(wxCommandEvent &event) {
         TextEntryDialog->GetValue().ToDouble(&gain);
 
         if (gain > 0 && gain <= 255) {
-            multiply_gain(image, gain);
+            ipp::multiply_gain(image, gain);
+            RecordOp(wxString::Format("gain:%g", gain));
         } else {
             wxLogMessage("Enter a value in the range (0,255]");
             return;
@@ -405,7 +589,8 @@ void MyFrame::OnAdjustContrast(wxCommandEvent &event) {
 void MyFrame::OnNegative(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    negative(image);
+    ipp::negative(image);
+    RecordOp("negative");
 
     ShowImage();
 }
@@ -413,7 +598,8 @@ void MyFrame::OnNegative(wxCommandEvent &event) {
 void MyFrame::OnEqualizeHistogram(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    equalize_histogram(image);
+    ipp::equalize_histogram(image);
+    RecordOp("equalize");
 
     ShowImage();
 }
@@ -431,22 +617,23 @@ void MyFrame::OnMatchHistogram(wxCommandEvent &event) {
     {
         wxString filename = OpenDialog->GetPath();
 
-        image_t *target = jpeg_decompress((char *) filename.mb_str().data());
+        // The target is only ever used through its luminance, so skip the chroma work when decoding it
+        decode_options_t target_options = luminance_decode_options();
+        image_t *decoded = image_cache_decompress(decodeCache, (char *) filename.mb_str().data(), &target_options);
+        bool decoded_ok = decoded->last_operation == DECOMPRESSION_SUCCESS;
+        ipp::Image target = ipp::Image::adopt(decoded);
         // Set the Status to reflect that file saved
-        SetStatusText((image->last_operation == DECOMPRESSION_SUCCESS) ? "File opened successfully!"
-                                                                       : "Failed to open file!");
+        SetStatusText(decoded_ok ? "File opened successfully!" : "Failed to open file!");
 
-        if (image->last_operation == DECOMPRESSION_SUCCESS) {
+        if (decoded_ok) {
 
-            image_t *histogram_source = histogram_plot(compute_histogram(image));
-            image_t *histogram_target = histogram_plot(compute_histogram(target));
-            ShowImageInNewFrame(histogram_source, "Source Histogram");
-            ShowImageInNewFrame(histogram_target, "Target Histogram");
+            ShowImageInNewFrame(ipp::histogram_plot(ipp::histogram(image)), "Source Histogram");
+            ShowImageInNewFrame(ipp::histogram_plot(ipp::histogram(target)), "Target Histogram");
 
-            match_histogram(image, target);
+            image = ipp::match_histogram(image, target);
+            historyReplayable = false;
 
-            image_t *histogram_matched = histogram_plot(compute_histogram(image));
-            ShowImageInNewFrame(histogram_matched, "Matched Histogram");
+            ShowImageInNewFrame(ipp::histogram_plot(ipp::histogram(image)), "Matched Histogram");
 
             ShowImage();
         }
@@ -476,7 +663,8 @@ void MyFrame::OnZoomOut(wxCommandEvent &event) {
             return;
         }
 
-        zoom_out(image, static_cast<int>(sx), static_cast<int>(sy));
+        image = ipp::zoom_out(image, static_cast<int>(sx), static_cast<int>(sy));
+        RecordOp(wxString::Format("zoom-out:%dx%d", static_cast<int>(sx), static_cast<int>(sy)));
 
         ShowImage();
     }
@@ -485,7 +673,8 @@ void MyFrame::OnZoomOut(wxCommandEvent &event) {
 void MyFrame::OnZoomIn(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    zoom_in(image);
+    image = ipp::zoom_in(image);
+    RecordOp("zoom-in");
 
     ShowImage();
 }
@@ -493,7 +682,8 @@ void MyFrame::OnZoomIn(wxCommandEvent &event) {
 void MyFrame::OnRotate90DegreesClockWise(wxCommandEvent &event) {
     ASSERT_IMAGE_OPEN
 
-    rotate_90_degrees_clock_wise(image);
+    image = ipp::rotate_90_degrees_clock_wise(image);
+    RecordOp("rotate");
 
     ShowImage();
 }
@@ -519,32 +709,37 @@ void MyFrame::OnConvolve(wxCommandEvent &event) {
 
         float **filter;
         if (wxStrcmp(input, _("GAUSSIAN")) == 0) {
-            convolve(image, filter = gaussian_filter(), false);
+            image = ipp::convolve(image, filter = gaussian_filter(), false);
 
         } else if (wxStrcmp(input, _("LAPLACIAN")) == 0) {
-            convolve(image, filter = laplacian_filter(), false);
+            image = ipp::convolve(image, filter = laplacian_filter(), false);
 
         } else if (wxStrcmp(input, _("HIGH-PASS")) == 0) {
-            convolve(image, filter = high_pass_filter(), false);
+            image = ipp::convolve(image, filter = high_pass_filter(), false);
 
         } else if (wxStrcmp(input, _("PREWITT HX")) == 0) {
-            convolve(image, filter = prewitt_hx_filter(), true);
+            image = ipp::convolve(image, filter = prewitt_hx_filter(), true);
 
         } else if (wxStrcmp(input, _("PREWITT HY")) == 0) {
-            convolve(image, filter = prewitt_hy_filter(), true);
+            image = ipp::convolve(image, filter = prewitt_hy_filter(), true);
 
         } else if (wxStrcmp(input, _("SOBEL HX")) == 0) {
-            convolve(image, filter = sobel_hx_filter(), true);
+            image = ipp::convolve(image, filter = sobel_hx_filter(), true);
 
         } else if (wxStrcmp(input, _("SOBEL HY")) == 0) {
-            convolve(image, filter = sobel_hy_filter(), true);
+            image = ipp::convolve(image, filter = sobel_hy_filter(), true);
 
         } else {
             wxLogMessage("Choose one of the filters of the list.");
             return;
         }
 
-        free(filter);
+        // "PREWITT HX" is recorded as convolve:prewitt-hx:clamp
+        wxString name = input.Lower();
+        name.Replace(" ", "-");
+        RecordOp("convolve:" + name + (input.Contains("PREWITT") || input.Contains("SOBEL") ? ":clamp" : ""));
+
+        free_filter(filter);
 
         ShowImage();
     }
@@ -580,12 +775,14 @@ void MyFrame::OnGeneralConvolve(wxCommandEvent &event) {
         if (components < FILTER_SIZE * FILTER_SIZE) {
             wxLogMessage("Please provide nine components, in the following order/format: \n"
                          "00 01 02 10 11 12 20 21 22 (where ij is F[i,j])");
+            free_filter(filter);
             return;
         }
 
-        convolve(image, filter, false);
+        image = ipp::convolve(image, filter, false);
+        historyReplayable = false;
 
-        free(filter);
+        free_filter(filter);
 
         ShowImage();
     }
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <image_manipulation.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define DEFAULT_REPETITIONS 5
+
+double elapsed_ms(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("%s <input file path> <scratch output file path> [repetitions]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int repetitions = (argc > 3) ? atoi(argv[3]) : DEFAULT_REPETITIONS;
+    if (repetitions < 1) repetitions = 1;
+
+    image_t *image = jpeg_decompress(argv[1]);
+    if (image->last_operation != DECOMPRESSION_SUCCESS) {
+        fprintf(stderr, "Decompression failed for file %s", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%s: %dx%d, %d channels, %d repetitions\n", argv[1], image->width, image->height, image->channels,
+           repetitions);
+    printf("%-12s %8s %6s %8s %12s %12s %10s\n", "preset", "quality", "dct", "sampling", "encode ms", "bytes",
+           "bits/px");
+
+    for (int preset = 0; preset < ENCODE_PRESET_COUNT; ++preset) {
+        encode_options_t options = encode_preset_options((enum encode_preset) preset);
+
+        // keep the best time, as it is the least disturbed by the rest of the system
+        double best_ms = -1;
+        for (int r = 0; r < repetitions; ++r) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            jpeg_compress_with_options(image, argv[2], &options);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            if (image->last_operation != COMPRESSION_SUCCESS) {
+                fprintf(stderr, "Compression failed for file %s", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+
+            double ms = elapsed_ms(start, end);
+            if (best_ms < 0 || ms < best_ms) best_ms = ms;
+        }
+
+        struct stat output_stat;
+        stat(argv[2], &output_stat);
+
+        const char *dct_names[] = {"islow", "ifast", "float"};
+        char sampling[8];
+        snprintf(sampling, sizeof(sampling), "%dx%d", options.h_sampling, options.v_sampling);
+        printf("%-12s %8d %6s %8s %12.2f %12ld %10.3f\n", encode_preset_name((enum encode_preset) preset),
+               options.quality, dct_names[options.dct_method], sampling, best_ms, (long) output_stat.st_size,
+               8.0 * output_stat.st_size / ((double) image->width * image->height));
+    }
+
+    remove(argv[2]);
+    free_image(image);
+    return 0;
+}
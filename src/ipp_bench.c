@@ -0,0 +1,708 @@
+#include <stdio.h>
+#include <image_manipulation.h>
+#include <adaptive_equalization.h>
+#include <codec_context.h>
+#include <dc_histogram.h>
+#include <gradient.h>
+#include <pixel_kernels.h>
+#include <scratch.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_REPETITIONS 7
+#define DEFAULT_BUDGET_SECONDS 3.0
+#define DEFAULT_SIZES "0.1,1,12,50,200"
+#define DEFAULT_SAMPLES "sample"
+#define DEFAULT_JSON "ipp_bench.json"
+#define MAX_SIZES 32
+#define FILTER_COUNT 7
+
+/**
+ * Image an op is timed on, with everything the ops need prepared from it ahead of time.
+ */
+typedef struct bench_input_struct {
+    char name[256];             // sample path, or size for synthetic images
+    image_t *color;
+    image_t *gray;              // luminance of color
+    unsigned char *jpeg;        // color encoded with the default options
+    unsigned long jpeg_size;
+    int *histogram;             // of gray
+    histogram_reference_t *reference;   // of color
+    float **filters[FILTER_COUNT];
+} bench_input_t;
+
+/**
+ * One timed library function. Ops run either on a fresh copy of their input, made outside the timing, or directly
+ * on the input when they do not modify it.
+ */
+typedef struct bench_op_struct {
+    const char *name;
+    int gray_input;             // runs on the luminance of the input rather than on its colours
+    int modifies;               // needs a copy of the input for every run
+    double memory_factor;       // peak memory the op allocates, in sizes of its input image
+    int parameter;              // zoom factor, filter index or histogram mode
+    void (*run)(const struct bench_op_struct *op, const bench_input_t *input, image_t *image);
+} bench_op_t;
+
+/**
+ * Statistics of the runs of one op on one input.
+ */
+typedef struct bench_result_struct {
+    int runs;
+    double median_ms;
+    double p99_ms;
+    double min_ms;
+    double mb_per_s;
+    double allocations;         // per run, through the library's accounting
+    double malloc_calls;        // per run, to the C allocator from anywhere, libjpeg included
+    double allocated_mb;        // per run
+    double peak_mb;             // most the op had allocated at once, over all runs
+    size_t leaked_bytes;        // still allocated after the outputs of the runs were released
+    const char *skipped;        // reason the op did not run, NULL if it did
+} bench_result_t;
+
+// Calls to the C allocator from anywhere in the process. The library's accounting (memory_stats()) only sees its own
+// ipp_malloc() and the like, while libjpeg allocates its pools and objects with malloc() directly, so with glibc this
+// program replaces the allocation entry points to count every call before passing it on.
+atomic_ullong malloc_calls = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *block, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&malloc_calls, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&malloc_calls, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *block, size_t size) {
+    atomic_fetch_add_explicit(&malloc_calls, 1, memory_order_relaxed);
+    return __libc_realloc(block, size);
+}
+
+int posix_memalign(void **block, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1))) return EINVAL;
+    atomic_fetch_add_explicit(&malloc_calls, 1, memory_order_relaxed);
+    void *aligned = __libc_memalign(alignment, size);
+    if (!aligned) return ENOMEM;
+    *block = aligned;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    atomic_fetch_add_explicit(&malloc_calls, 1, memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+#endif
+
+const char *filter_names[FILTER_COUNT] = {"gaussian", "laplacian", "high-pass", "prewitt-hx", "prewitt-hy",
+                                          "sobel-hx", "sobel-hy"};
+
+// derivative filters are offset to mid gray as the GUI does
+const boolean filter_clamps[FILTER_COUNT] = {FALSE, FALSE, FALSE, TRUE, TRUE, TRUE, TRUE};
+
+void run_decode(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_image(jpeg_decompress_buffer(input->jpeg, input->jpeg_size, NULL));
+}
+
+void run_decode_codec_context(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_image(codec_decompress_buffer(thread_codec_context(), input->jpeg, input->jpeg_size, NULL));
+}
+
+void run_dc_histogram(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    int histogram[HISTOGRAM_SIZE];
+    jpeg_dc_histogram_buffer(input->jpeg, input->jpeg_size, histogram);
+}
+
+void run_encode(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    unsigned char *buffer = NULL;
+    jpeg_compress_buffer(image, NULL, &buffer);
+    free(buffer);
+}
+
+void run_encode_codec_context(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    const unsigned char *buffer;
+    codec_compress_buffer(thread_codec_context(), image, NULL, &buffer);
+}
+
+void run_copy_image(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_image(copy_image(image));
+}
+
+void run_get_displayable(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_image(get_displayable(image));
+}
+
+void run_mirror_horizontally(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    mirror_horizontally(image);
+}
+
+void run_mirror_vertically(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    mirror_vertically(image);
+}
+
+void run_rgb_to_luminance(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    rgb_to_luminance(image);
+}
+
+void run_luminance_to_rgb(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    luminance_to_rgb(image);
+}
+
+void run_quantize(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    quantize(image, op->parameter);
+}
+
+void run_add_bias(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    add_bias(image, op->parameter);
+}
+
+void run_multiply_gain(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    multiply_gain(image, op->parameter / 10.0);
+}
+
+void run_negative(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    negative(image);
+}
+
+void run_compute_histogram(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_histogram(compute_histogram(image));
+}
+
+void run_compute_norm_cum_histogram(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_histogram(compute_norm_cum_histogram(image));
+}
+
+void run_histogram_plot(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    free_image(histogram_plot(input->histogram));
+}
+
+void run_equalize_histogram(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    equalize_histogram(image);
+}
+
+void run_equalize_histogram_adaptive(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    equalize_histogram_adaptive(image, NULL);
+}
+
+void run_equalize_histogram_with_mode(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    equalize_histogram_with_mode(image, op->parameter);
+}
+
+void run_match_histogram_to_reference(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    match_histogram_to_reference(image, input->reference, op->parameter);
+}
+
+void run_match_histogram(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    // the target is converted to luminance in place, which leaves the gray input as it is
+    match_histogram(image, input->gray);
+}
+
+void run_zoom_out(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    zoom_out(image, op->parameter, op->parameter);
+}
+
+void run_zoom_in(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    zoom_in(image);
+}
+
+void run_rotate(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    rotate_90_degrees_clock_wise(image);
+}
+
+void run_convolve(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    convolve(image, input->filters[op->parameter], filter_clamps[op->parameter]);
+}
+
+void run_compute_gradient(const bench_op_t *op, const bench_input_t *input, image_t *image) {
+    gradient_options_t options = default_gradient_options();
+    if (!op->parameter) {
+        compute_gradient(image, &options, NULL);
+        return;
+    }
+
+    // L2 magnitude and orientation, the most the operator computes
+    options.norm = GRADIENT_NORM_L2;
+    image_t *orientation = new_image();
+    compute_gradient(image, &options, orientation);
+    free_image(orientation);
+}
+
+const bench_op_t bench_ops[] = {
+        {"decode",                      0, 0, 1.1,  0, run_decode},
+        {"decode codec_context",        0, 0, 1.1,  0, run_decode_codec_context},
+        {"dc_histogram",                0, 0, 0,    0, run_dc_histogram},
+        {"encode",                      0, 0, 1.1,  0, run_encode},
+        {"encode codec_context",        0, 0, 1.1,  0, run_encode_codec_context},
+        {"copy_image",                  0, 0, 1,    0, run_copy_image},
+        {"get_displayable",             1, 0, 3,    0, run_get_displayable},
+        {"mirror_horizontally",         0, 1, 1,    0, run_mirror_horizontally},
+        {"mirror_vertically",           0, 1, 1,    0, run_mirror_vertically},
+        {"rgb_to_luminance",            0, 1, 1.4,  0, run_rgb_to_luminance},
+        {"luminance_to_rgb",            1, 1, 4,    0, run_luminance_to_rgb},
+        {"quantize",                    1, 1, 1,    8, run_quantize},
+        {"add_bias",                    0, 1, 1,    30, run_add_bias},
+        {"multiply_gain",               0, 1, 1,    15, run_multiply_gain},
+        {"negative",                    0, 1, 1,    0, run_negative},
+        {"compute_histogram",           0, 0, 0.4,  0, run_compute_histogram},
+        {"compute_norm_cum_histogram",  0, 0, 1.4,  0, run_compute_norm_cum_histogram},
+        {"histogram_plot",              1, 0, 0,    0, run_histogram_plot},
+        {"equalize_histogram",          0, 1, 2,    0, run_equalize_histogram},
+        {"equalize_histogram_adaptive", 0, 1, 1,    0, run_equalize_histogram_adaptive},
+        {"equalize_histogram channels", 0, 1, 0,    HISTOGRAM_MODE_CHANNELS, run_equalize_histogram_with_mode},
+        {"equalize_histogram luma",     0, 1, 0,    HISTOGRAM_MODE_LUMA, run_equalize_histogram_with_mode},
+        {"match_histogram",             0, 1, 2,    0, run_match_histogram},
+        {"match_reference channels",    0, 1, 0,    HISTOGRAM_MODE_CHANNELS, run_match_histogram_to_reference},
+        {"match_reference luma",        0, 1, 0,    HISTOGRAM_MODE_LUMA, run_match_histogram_to_reference},
+        {"zoom_out 2x2",                0, 1, 1.3,  2, run_zoom_out},
+        {"zoom_out 4x4",                0, 1, 1.1,  4, run_zoom_out},
+        {"zoom_in",                     0, 1, 5,    0, run_zoom_in},
+        {"rotate_90_degrees_clock_wise", 0, 1, 2,   0, run_rotate},
+        {"convolve gaussian",           0, 1, 1.7,  0, run_convolve},
+        {"convolve laplacian",          0, 1, 1.7,  1, run_convolve},
+        {"convolve high-pass",          0, 1, 1.7,  2, run_convolve},
+        {"convolve prewitt-hx",         0, 1, 1.7,  3, run_convolve},
+        {"convolve prewitt-hy",         0, 1, 1.7,  4, run_convolve},
+        {"convolve sobel-hx",           0, 1, 1.7,  5, run_convolve},
+        {"convolve sobel-hy",           0, 1, 1.7,  6, run_convolve},
+        {"compute_gradient",            0, 1, 0.4,  0, run_compute_gradient},
+        {"compute_gradient l2+orient",  0, 1, 0.7,  1, run_compute_gradient},
+};
+
+#define BENCH_OP_COUNT ((int) (sizeof(bench_ops) / sizeof(bench_ops[0])))
+
+void print_usage(char *program) {
+    printf("%s [--samples <dir>] [--sizes <megapixels,...>] [--repetitions <N>] [--budget <seconds>]\n"
+           "    [--ops <name,...>] [--cpu-level <level>] [--json <output path>]\n", program);
+    printf("times every op on the JPEGs of --samples (default %s) and on synthetic RGB images of --sizes megapixels\n"
+           "(default %s); each op runs up to --repetitions times (default %d) or until it has taken --budget\n"
+           "seconds (default %.0f), at least once. Ops that would not fit in the available memory are skipped.\n",
+           DEFAULT_SAMPLES, DEFAULT_SIZES, DEFAULT_REPETITIONS, DEFAULT_BUDGET_SECONDS);
+    printf("--ops picks ops by name; --cpu-level is generic, sse4.2, avx2 or avx512; results are also written as JSON\n"
+           "to --json (default %s). Exits with failure if an op leaves library memory allocated after its outputs are\n"
+           "released. allocs counts the library's own allocations per run, mallocs every call to the C allocator\n"
+           "(with glibc), libjpeg's included.\n", DEFAULT_JSON);
+}
+
+double elapsed_ms(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * Bytes of memory that can still be allocated without swapping, or 0 if unknown.
+ */
+size_t available_memory() {
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) return 0;
+    return (size_t) pages * page_size;
+}
+
+/**
+ * Deterministic image of the given size: gradients in each channel with some noise, so that the histograms are
+ * spread out and the JPEG encoder has detail to work on.
+ */
+image_t *synthetic_image(int width, int height) {
+    image_t *image = new_image();
+    image->width = width;
+    image->height = height;
+    image->channels = 3;
+    image->colorspace = JCS_RGB;
+    image->pixels = new_unsigned_char_matrix(height, width * 3);
+    if (!image->pixels) {
+        free_image(image);
+        return NULL;
+    }
+
+    unsigned int state = 2463534242u;
+    for (int y = 0; y < height; ++y) {
+        unsigned char *row = image->pixels[y];
+        int vertical = (int) ((long) y * 255 / height);
+        for (int x = 0; x < width; ++x) {
+            // xorshift noise
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int horizontal = (int) ((long) x * 255 / width);
+            int noise = (int) (state & 31) - 16;
+            row[3 * x] = (unsigned char) (horizontal * 7 / 8 + 16 + noise);
+            row[3 * x + 1] = (unsigned char) (vertical * 7 / 8 + 16 + noise);
+            row[3 * x + 2] = (unsigned char) ((horizontal + vertical) * 7 / 16 + 16 - noise);
+        }
+    }
+    return image;
+}
+
+/**
+ * Reads a whole file into a newly allocated buffer.
+ * @return The buffer, NULL if the file cannot be read.
+ */
+unsigned char *read_file(const char *path, unsigned long *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *buffer = length > 0 ? malloc(length) : NULL;
+    if (buffer && fread(buffer, 1, length, file) != (size_t) length) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+
+    *size = (unsigned long) length;
+    return buffer;
+}
+
+/**
+ * Prepares an input from its colour image, which it takes ownership of. jpeg may be given when the image was
+ * decoded from it, and is encoded otherwise.
+ * @return Zero if the input could not be prepared.
+ */
+int prepare_input(bench_input_t *input, image_t *color, unsigned char *jpeg, unsigned long jpeg_size) {
+    input->color = color;
+    input->gray = copy_image(color);
+    rgb_to_luminance(input->gray);
+    input->histogram = compute_histogram(input->gray);
+    input->reference = new_histogram_reference(color);
+
+    input->jpeg = jpeg;
+    input->jpeg_size = jpeg_size;
+    if (!input->jpeg) input->jpeg_size = jpeg_compress_buffer(color, NULL, &input->jpeg);
+
+    float **(*filter_constructors[FILTER_COUNT])() = {gaussian_filter, laplacian_filter, high_pass_filter,
+                                                     prewitt_hx_filter, prewitt_hy_filter, sobel_hx_filter,
+                                                     sobel_hy_filter};
+    for (int i = 0; i < FILTER_COUNT; ++i) input->filters[i] = filter_constructors[i]();
+
+    return input->jpeg_size > 0;
+}
+
+void release_input(bench_input_t *input) {
+    free_image(input->color);
+    free_image(input->gray);
+    free(input->jpeg);
+    free_histogram(input->histogram);
+    free_histogram_reference(input->reference);
+    for (int i = 0; i < FILTER_COUNT; ++i) free_filter(input->filters[i]);
+    memset(input, 0, sizeof(bench_input_t));
+
+    // the pooled buffers are of this input's size
+    scratch_trim();
+}
+
+/**
+ * Times an op on an input.
+ * @param memory_limit bytes the op may allocate, 0 for no limit
+ */
+bench_result_t time_op(const bench_op_t *op, const bench_input_t *input, int repetitions, double budget_seconds,
+                       size_t memory_limit) {
+    bench_result_t result = {0};
+    image_t *source = op->gray_input ? input->gray : input->color;
+
+    double needed = op->memory_factor * image_bytes(source) + (op->modifies ? image_bytes(source) : 0);
+    if (memory_limit && needed > (double) memory_limit) {
+        result.skipped = "memory";
+        return result;
+    }
+
+    double *times = malloc(repetitions * sizeof(double));
+    unsigned long long total_allocations = 0;
+    unsigned long long total_malloc_calls = 0;
+    unsigned long long total_allocated = 0;
+    size_t peak_bytes = 0;
+    double total_ms = 0;
+
+    while (result.runs < repetitions && (result.runs == 0 || total_ms < budget_seconds * 1e3)) {
+        // whatever a run leaves allocated once its copy and outputs are released is a leak, except for the scratch
+        // and pixel buffers kept for the next run
+        size_t live_before = memory_stats().live_bytes - scratch_retained_bytes();
+        image_t *image = op->modifies ? copy_image(source) : source;
+        if (!image->pixels) {
+            result.skipped = "memory";
+            if (op->modifies) free_image(image);
+            break;
+        }
+
+        reset_peak_bytes();
+        memory_stats_t before = memory_stats();
+        unsigned long long malloc_calls_before = atomic_load(&malloc_calls);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        op->run(op, input, image);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total_malloc_calls += atomic_load(&malloc_calls) - malloc_calls_before;
+        memory_stats_t after = memory_stats();
+        total_allocations += after.allocations - before.allocations;
+        total_allocated += after.allocated_bytes - before.allocated_bytes;
+        if (after.peak_bytes - before.live_bytes > peak_bytes) peak_bytes = after.peak_bytes - before.live_bytes;
+
+        times[result.runs] = elapsed_ms(start, end);
+        total_ms += times[result.runs];
+        ++result.runs;
+
+        if (op->modifies) free_image(image);
+        size_t live_after = memory_stats().live_bytes - scratch_retained_bytes();
+        if (live_after > live_before) result.leaked_bytes += live_after - live_before;
+    }
+
+    if (result.runs > 0) {
+        qsort(times, result.runs, sizeof(double), compare_doubles);
+        result.min_ms = times[0];
+        result.median_ms = result.runs % 2 ? times[result.runs / 2]
+                                           : (times[result.runs / 2 - 1] + times[result.runs / 2]) / 2;
+        // nearest rank, which is the slowest run until there are 100 of them
+        result.p99_ms = times[(int) ceil(0.99 * result.runs) - 1];
+        result.mb_per_s = result.median_ms > 0 ? image_bytes(source) / 1e6 / (result.median_ms / 1e3) : 0;
+        result.allocations = (double) total_allocations / result.runs;
+        result.malloc_calls = (double) total_malloc_calls / result.runs;
+        result.allocated_mb = total_allocated / 1e6 / result.runs;
+        result.peak_mb = peak_bytes / 1e6;
+    }
+
+    free(times);
+    return result;
+}
+
+void write_json_string(FILE *json, const char *string) {
+    fputc('"', json);
+    for (const char *c = string; *c; ++c) {
+        if (*c == '"' || *c == '\\') fputc('\\', json);
+        if ((unsigned char) *c >= 0x20) fputc(*c, json);
+    }
+    fputc('"', json);
+}
+
+void write_json_result(FILE *json, int *first, const bench_input_t *input, const bench_op_t *op,
+                       const bench_result_t *result) {
+    image_t *source = op->gray_input ? input->gray : input->color;
+
+    fprintf(json, "%s\n    {\"input\": ", *first ? "" : ",");
+    write_json_string(json, input->name);
+    fprintf(json, ", \"width\": %d, \"height\": %d, \"channels\": %d, \"megapixels\": %.3f, \"op\": ",
+            source->width, source->height, source->channels, (double) source->width * source->height / 1e6);
+    write_json_string(json, op->name);
+    if (result->skipped) {
+        fprintf(json, ", \"skipped\": \"%s\"}", result->skipped);
+    } else {
+        fprintf(json, ", \"runs\": %d, \"median_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, \"mb_per_s\": %.2f",
+                result->runs, result->median_ms, result->p99_ms, result->min_ms, result->mb_per_s);
+        fprintf(json, ", \"allocations\": %.2f, \"malloc_calls\": %.2f, \"allocated_mb\": %.3f, \"peak_mb\": %.3f",
+                result->allocations, result->malloc_calls, result->allocated_mb, result->peak_mb);
+        fprintf(json, ", \"leaked_bytes\": %zu}", result->leaked_bytes);
+    }
+    *first = 0;
+}
+
+/**
+ * Times the selected ops on an input, printing and writing their results.
+ * @return Number of ops that leaked.
+ */
+int bench_input(const bench_input_t *input, const int *selected, int repetitions, double budget_seconds,
+                FILE *json, int *first) {
+    printf("\n%s: %dx%d, %d channels, %.2f MP\n", input->name, input->color->width, input->color->height,
+           input->color->channels, (double) input->color->width * input->color->height / 1e6);
+    printf("%-30s %6s %12s %12s %10s %10s %10s %12s %10s %10s\n", "op", "runs", "median ms", "p99 ms", "MB/s",
+           "allocs", "mallocs", "alloc MB", "peak MB", "leaked");
+
+    int leaks = 0;
+    for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+        if (!selected[i]) continue;
+
+        // what the inputs take is already allocated, so the op may use what is left
+        size_t memory = available_memory();
+        bench_result_t result = time_op(&bench_ops[i], input, repetitions, budget_seconds, memory * 3 / 4);
+
+        if (result.skipped) {
+            printf("%-30s skipped (%s)\n", bench_ops[i].name, result.skipped);
+        } else {
+            printf("%-30s %6d %12.3f %12.3f %10.1f %10.1f %10.1f %12.2f %10.2f %10zu\n", bench_ops[i].name,
+                   result.runs, result.median_ms, result.p99_ms, result.mb_per_s, result.allocations,
+                   result.malloc_calls, result.allocated_mb, result.peak_mb, result.leaked_bytes);
+        }
+        if (result.leaked_bytes) ++leaks;
+        write_json_result(json, first, input, &bench_ops[i], &result);
+        fflush(stdout);
+    }
+    return leaks;
+}
+
+/**
+ * Reads a comma separated list of op names into a selection flag per op.
+ * @return Zero if a name is unknown.
+ */
+int parse_ops(char *list, int *selected) {
+    memset(selected, 0, BENCH_OP_COUNT * sizeof(int));
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        int found = 0;
+        for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+            // ops with a parameter are also selected by their function name alone
+            size_t length = strlen(name);
+            if (strcmp(bench_ops[i].name, name) == 0 ||
+                (strncmp(bench_ops[i].name, name, length) == 0 && bench_ops[i].name[length] == ' ')) {
+                selected[i] = found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown op %s\n", name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *samples = DEFAULT_SAMPLES;
+    const char *json_path = DEFAULT_JSON;
+    char sizes_list[256] = DEFAULT_SIZES;
+    int repetitions = DEFAULT_REPETITIONS;
+    double budget_seconds = DEFAULT_BUDGET_SECONDS;
+    int selected[BENCH_OP_COUNT];
+    for (int i = 0; i < BENCH_OP_COUNT; ++i) selected[i] = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--samples") == 0 && has_value) {
+            samples = argv[++i];
+        } else if (strcmp(argv[i], "--sizes") == 0 && has_value) {
+            snprintf(sizes_list, sizeof(sizes_list), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--repetitions") == 0 && has_value) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--budget") == 0 && has_value) {
+            budget_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ops") == 0 && has_value) {
+            if (!parse_ops(argv[++i], selected)) exit(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "--cpu-level") == 0 && has_value) {
+            enum cpu_level level;
+            if (!parse_cpu_level(argv[++i], &level) || !set_cpu_level(level)) {
+                fprintf(stderr, "CPU level %s is unknown or not supported\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (repetitions < 1) repetitions = 1;
+
+    double sizes[MAX_SIZES];
+    int size_count = 0;
+    for (char *size = strtok(sizes_list, ","); size && size_count < MAX_SIZES; size = strtok(NULL, ",")) {
+        sizes[size_count] = atof(size);
+        if (sizes[size_count] > 0) ++size_count;
+    }
+
+    FILE *json = fopen(json_path, "w");
+    if (!json) {
+        fprintf(stderr, "Cannot write %s\n", json_path);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *level = cpu_level_name(active_cpu_level());
+    printf("cpu level %s, up to %d repetitions or %.1f s per op\n", level, repetitions, budget_seconds);
+    fprintf(json, "{\n  \"benchmark\": \"ipp_bench\",\n  \"cpu_level\": \"%s\",\n  \"max_repetitions\": %d,\n"
+                  "  \"budget_seconds\": %.2f,\n  \"results\": [", level, repetitions, budget_seconds);
+    int first = 1, leaks = 0;
+
+    // the codec context of this thread lives as long as it, so it is created before anything is timed
+    thread_codec_context();
+
+    // sample JPEGs, in name order so that runs are comparable
+    DIR *directory = opendir(samples);
+    if (directory) {
+        char *names[256];
+        int name_count = 0;
+        struct dirent *entry;
+        while ((entry = readdir(directory)) && name_count < 256) {
+            const char *extension = strrchr(entry->d_name, '.');
+            if (extension && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0)) {
+                names[name_count++] = strdup(entry->d_name);
+            }
+        }
+        closedir(directory);
+        qsort(names, name_count, sizeof(char *), compare_strings);
+
+        for (int i = 0; i < name_count; ++i) {
+            bench_input_t input = {0};
+            snprintf(input.name, sizeof(input.name), "%s/%s", samples, names[i]);
+            free(names[i]);
+
+            unsigned long size;
+            unsigned char *jpeg = read_file(input.name, &size);
+            image_t *color = jpeg ? jpeg_decompress_buffer(jpeg, size, NULL) : NULL;
+            if (!color || color->last_operation != DECOMPRESSION_SUCCESS) {
+                fprintf(stderr, "Decompression failed for file %s\n", input.name);
+                free(jpeg);
+                free_image(color);
+                continue;
+            }
+
+            if (prepare_input(&input, color, jpeg, size)) {
+                leaks += bench_input(&input, selected, repetitions, budget_seconds, json, &first);
+            }
+            release_input(&input);
+        }
+    } else {
+        fprintf(stderr, "No samples directory %s, timing synthetic images only\n", samples);
+    }
+
+    // synthetic images of 4:3 aspect ratio
+    for (int i = 0; i < size_count; ++i) {
+        int width = (int) lround(sqrt(sizes[i] * 1e6 * 4 / 3));
+        int height = (int) lround(sizes[i] * 1e6 / width);
+        if (width < 1) width = 1;
+        if (height < 1) height = 1;
+
+        image_t *color = synthetic_image(width, height);
+        if (!color) {
+            fprintf(stderr, "Not enough memory for a synthetic image of %g MP\n", sizes[i]);
+            continue;
+        }
+
+        bench_input_t input = {0};
+        snprintf(input.name, sizeof(input.name), "synthetic %gMP", sizes[i]);
+        if (prepare_input(&input, color, NULL, 0)) {
+            leaks += bench_input(&input, selected, repetitions, budget_seconds, json, &first);
+        } else {
+            fprintf(stderr, "Compression failed for synthetic image of %g MP\n", sizes[i]);
+        }
+        release_input(&input);
+    }
+
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+    printf("\nresults written to %s\n", json_path);
+
+    if (leaks) {
+        fprintf(stderr, "%d ops leaked memory, see the leaked column\n", leaks);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <image.hpp>
+
+#define DEFAULT_SEED 1
+#define RANDOM_IMAGES 3
+#define FILTER_COUNT 7
+#define FRAME_BORDER 3
+#define FRAME_VALUE 0xa5
+
+typedef float **(*filter_constructor_t)();
+
+const filter_constructor_t filter_constructors[FILTER_COUNT] = {gaussian_filter, laplacian_filter, high_pass_filter,
+                                                                 prewitt_hx_filter, prewitt_hy_filter, sobel_hx_filter,
+                                                                 sobel_hy_filter};
+
+float **filters[FILTER_COUNT];
+
+// Shapes of the test images, single pixels and images smaller than the filters included
+const int shapes[][2] = {{1, 1}, {2, 3}, {3, 3}, {5, 4}, {17, 9}, {1, 33}, {33, 31}, {64, 48}};
+
+const int zooms[][2] = {{1, 1}, {2, 2}, {3, 2}, {7, 5}};
+
+unsigned int random_state;
+
+unsigned char next_random() {
+    random_state = random_state * 1103515245u + 12345u;
+    return (unsigned char) (random_state >> 16);
+}
+
+void print_usage(char *program) {
+    printf("%s [--seed <N>]\n", program);
+    printf("runs the operations of the C++ interface (image.hpp) on Images and on views with a stride wider than their\n"
+           "rows, on random images of several shapes in 1 and 3 channels, and compares them with the C functions\n"
+           "they stand for, which they must match exactly. Views must leave the pixels around them untouched and\n"
+           "Images must keep their cached histograms those of their pixels. Exits with a failure if any case differs.\n");
+}
+
+image_t *random_image(int width, int height, int channels) {
+    image_t *image = new_image();
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    image->colorspace = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    image->pixels = new_unsigned_char_matrix(height, width * channels);
+    for (int y = 0; y < height; ++y) {
+        for (int i = 0; i < width * channels; ++i) image->pixels[y][i] = next_random();
+    }
+    return image;
+}
+
+/**
+ * Image inside a frame of FRAME_VALUE pixels, so that a view of it has rows further apart than their length.
+ */
+struct Framed {
+    ipp::Image frame;
+    ipp::ImageView inside;
+
+    Framed(int width, int height, int channels, J_COLOR_SPACE colorspace)
+            : frame(width + 2 * FRAME_BORDER, height + 2 * FRAME_BORDER, channels, colorspace) {
+        ipp::ImageView all = frame.view();
+        for (int y = 0; y < all.height(); ++y) std::memset(all.row(y), FRAME_VALUE, all.row_bytes());
+        inside = all.sub(FRAME_BORDER, FRAME_BORDER, width, height);
+    }
+
+    explicit Framed(const image_t *image) : Framed(image->width, image->height, image->channels, image->colorspace) {
+        for (int y = 0; y < image->height; ++y) std::memcpy(inside.row(y), image->pixels[y], inside.row_bytes());
+    }
+
+    // whether the pixels around the view still have FRAME_VALUE
+    bool untouched() const {
+        ipp::ConstImageView all = frame.view();
+        for (int y = 0; y < all.height(); ++y) {
+            for (int x = 0; x < all.width(); ++x) {
+                bool in_view = x >= FRAME_BORDER && x < FRAME_BORDER + inside.width() && y >= FRAME_BORDER &&
+                               y < FRAME_BORDER + inside.height();
+                for (int c = 0; !in_view && c < all.channels(); ++c) {
+                    if (all.pixel(x, y)[c] != FRAME_VALUE) return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+bool same(ipp::ConstImageView view, const image_t *image) {
+    if (view.width() != image->width || view.height() != image->height || view.channels() != image->channels) {
+        return false;
+    }
+    for (int y = 0; y < view.height(); ++y) {
+        if (std::memcmp(view.row(y), image->pixels[y], view.row_bytes()) != 0) return false;
+    }
+    return true;
+}
+
+bool same_histogram(const ipp::Histogram &counts, int *expected) {
+    bool equal = std::equal(counts.begin(), counts.end(), expected);
+    free_histogram(expected);
+    return equal;
+}
+
+/**
+ * An in-place op run by the C function on an image_t, and by the C++ one on an Image (whose histograms, computed
+ * beforehand, must follow its pixels) and on a framed view.
+ */
+bool check_in_place(const image_t *image, const std::function<void(image_t *)> &c_op,
+                    const std::function<void(ipp::Image &)> &image_op,
+                    const std::function<void(ipp::ImageView)> &view_op) {
+    image_t *expected = copy_image(const_cast<image_t *>(image));
+    c_op(expected);
+
+    ipp::Image whole(image);
+    whole.histograms();
+    image_op(whole);
+    bool passed = same(whole, expected) && same_histogram(ipp::histogram(whole), compute_histogram(expected));
+
+    Framed framed(image);
+    view_op(framed.inside);
+    passed = passed && same(framed.inside, expected) && framed.untouched();
+
+    free_image(expected);
+    return passed;
+}
+
+/**
+ * An op whose result is a new image: the C function on an image_t, the allocating C++ overload on an Image and the
+ * one writing into a caller's view on framed input and output views, whose input must be left as it was.
+ */
+bool check_output(const image_t *image, const std::function<void(image_t *)> &c_op,
+                  const std::function<ipp::Image(ipp::ConstImageView)> &allocating_op,
+                  const std::function<void(ipp::ConstImageView, ipp::ImageView)> &view_op) {
+    image_t *expected = copy_image(const_cast<image_t *>(image));
+    c_op(expected);
+
+    ipp::Image whole(image);
+    bool passed = same(allocating_op(whole), expected);
+
+    Framed input(image);
+    Framed output(expected->width, expected->height, expected->channels, expected->colorspace);
+    view_op(input.inside, output.inside);
+    passed = passed && same(output.inside, expected) && output.untouched() && same(input.inside, image) &&
+             input.untouched();
+
+    free_image(expected);
+    return passed;
+}
+
+bool check_point_ops(const image_t *image) {
+    const double biases[] = {-300, -30.5, 0, 99.9};
+    const double gains[] = {0, 0.5, 1.7, 1000};
+    const int tones[] = {2, 7, 256};
+    bool passed = true;
+    for (double bias : biases) {
+        passed = passed && check_in_place(image, [=](image_t *c) { add_bias(c, bias); },
+                                          [=](ipp::Image &cpp) { ipp::add_bias(cpp, bias); },
+                                          [=](ipp::ImageView view) { ipp::add_bias(view, bias); });
+    }
+    for (double gain : gains) {
+        passed = passed && check_in_place(image, [=](image_t *c) { multiply_gain(c, gain); },
+                                          [=](ipp::Image &cpp) { ipp::multiply_gain(cpp, gain); },
+                                          [=](ipp::ImageView view) { ipp::multiply_gain(view, gain); });
+    }
+    for (int n_tones : tones) {
+        passed = passed && check_in_place(image, [=](image_t *c) { quantize(c, n_tones); },
+                                          [=](ipp::Image &cpp) { ipp::quantize(cpp, n_tones); },
+                                          [=](ipp::ImageView view) { ipp::quantize(view, n_tones); });
+    }
+    return passed && check_in_place(image, [](image_t *c) { negative(c); },
+                                    [](ipp::Image &cpp) { ipp::negative(cpp); },
+                                    [](ipp::ImageView view) { ipp::negative(view); });
+}
+
+bool check_mirrors(const image_t *image) {
+    return check_in_place(image, [](image_t *c) { mirror_horizontally(c); },
+                          [](ipp::Image &cpp) { ipp::mirror_horizontally(cpp); },
+                          [](ipp::ImageView view) { ipp::mirror_horizontally(view); }) &&
+           check_in_place(image, [](image_t *c) { mirror_vertically(c); },
+                          [](ipp::Image &cpp) { ipp::mirror_vertically(cpp); },
+                          [](ipp::ImageView view) { ipp::mirror_vertically(view); });
+}
+
+bool check_equalize(const image_t *image) {
+    return check_in_place(image, [](image_t *c) { equalize_histogram(c); },
+                          [](ipp::Image &cpp) { ipp::equalize_histogram(cpp); },
+                          [](ipp::ImageView view) { ipp::equalize_histogram(view); });
+}
+
+bool check_histograms(const image_t *image) {
+    image_t *c = const_cast<image_t *>(image);
+    ipp::Image whole(image);
+    Framed framed(image);
+    return same_histogram(ipp::histogram(whole), compute_histogram(c)) &&
+           same_histogram(ipp::histogram(framed.inside), compute_histogram(c)) &&
+           same_histogram(ipp::cumulative_histogram(whole), compute_norm_cum_histogram(c)) &&
+           same_histogram(ipp::cumulative_histogram(framed.inside), compute_norm_cum_histogram(c));
+}
+
+bool check_luminance(const image_t *image) {
+    // the Image overload of luminance() hands the luminance histogram over to the result
+    ipp::Image cached(image);
+    cached.histograms();
+    ipp::Image converted = ipp::luminance(cached);
+    image_t *expected = copy_image(const_cast<image_t *>(image));
+    rgb_to_luminance(expected);
+    bool passed = same(converted, expected) && same_histogram(ipp::histogram(converted), compute_histogram(expected));
+    free_image(expected);
+
+    return passed &&
+           check_output(image, [](image_t *c) { rgb_to_luminance(c); },
+                        [](ipp::ConstImageView in) { return ipp::luminance(in); },
+                        [](ipp::ConstImageView in, ipp::ImageView out) { ipp::luminance(in, out); }) &&
+           (image->channels != 1 ||
+            check_output(image, [](image_t *c) { luminance_to_rgb(c); },
+                         [](ipp::ConstImageView in) { return ipp::luminance_to_rgb(in); },
+                         [](ipp::ConstImageView in, ipp::ImageView out) { ipp::luminance_to_rgb(in, out); }));
+}
+
+bool check_rotate(const image_t *image) {
+    // the Image overload keeps the histograms, which rotation does not change
+    ipp::Image cached(image);
+    cached.histograms();
+    ipp::Image rotated = ipp::rotate_90_degrees_clock_wise(cached);
+    image_t *expected = copy_image(const_cast<image_t *>(image));
+    rotate_90_degrees_clock_wise(expected);
+    bool passed = same(rotated, expected) && same_histogram(ipp::histogram(rotated), compute_histogram(expected));
+    free_image(expected);
+
+    return passed &&
+           check_output(image, [](image_t *c) { rotate_90_degrees_clock_wise(c); },
+                        [](ipp::ConstImageView in) { return ipp::rotate_90_degrees_clock_wise(in); },
+                        [](ipp::ConstImageView in, ipp::ImageView out) { ipp::rotate_90_degrees_clock_wise(in, out); });
+}
+
+bool check_zooms(const image_t *image) {
+    bool passed = check_output(image, [](image_t *c) { zoom_in(c); },
+                               [](ipp::ConstImageView in) { return ipp::zoom_in(in); },
+                               [](ipp::ConstImageView in, ipp::ImageView out) { ipp::zoom_in(in, out); });
+    for (const int *zoom : zooms) {
+        int sx = zoom[0], sy = zoom[1];
+        passed = passed &&
+                 check_output(image, [=](image_t *c) { zoom_out(c, sx, sy); },
+                              [=](ipp::ConstImageView in) { return ipp::zoom_out(in, sx, sy); },
+                              [=](ipp::ConstImageView in, ipp::ImageView out) { ipp::zoom_out(in, sx, sy, out); });
+    }
+    return passed;
+}
+
+bool check_convolve(const image_t *image) {
+    bool passed = true;
+    for (int f = 0; f < FILTER_COUNT; ++f) {
+        for (int clamp = 0; clamp <= 1; ++clamp) {
+            float **filter = filters[f];
+            passed = passed &&
+                     check_output(image, [=](image_t *c) { convolve(c, filter, clamp ? TRUE : FALSE); },
+                                  [=](ipp::ConstImageView in) { return ipp::convolve(in, filter, clamp != 0); },
+                                  [=](ipp::ConstImageView in, ipp::ImageView out) {
+                                      ipp::convolve(in, filter, clamp != 0, out);
+                                  });
+        }
+    }
+    return passed;
+}
+
+bool check_match_histogram(const image_t *image) {
+    image_t *target = random_image(13, 11, 3);
+    for (int y = 0; y < target->height; ++y) {
+        for (int i = 0; i < target->width * 3; ++i) target->pixels[y][i] /= 4;
+    }
+    ipp::Image target_image(target);
+    Framed framed_target(target);
+    bool passed = check_output(image, [=](image_t *c) { match_histogram(c, target); },
+                               [&](ipp::ConstImageView in) { return ipp::match_histogram(in, target_image); },
+                               [&](ipp::ConstImageView in, ipp::ImageView out) {
+                                   ipp::match_histogram(in, framed_target.inside, out);
+                               });
+    free_image(target);
+    return passed;
+}
+
+const struct {
+    const char *name;
+    bool (*check)(const image_t *image);
+} checks[] = {
+        {"point ops", check_point_ops},
+        {"mirrors", check_mirrors},
+        {"equalize_histogram", check_equalize},
+        {"histograms", check_histograms},
+        {"luminance", check_luminance},
+        {"rotate_90_degrees_clock_wise", check_rotate},
+        {"zooms", check_zooms},
+        {"convolve", check_convolve},
+        {"match_histogram", check_match_histogram},
+};
+
+#define CHECK_COUNT ((int) (sizeof(checks) / sizeof(checks[0])))
+
+int main(int argc, char *argv[]) {
+    unsigned int seed = DEFAULT_SEED;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int) std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    random_state = seed;
+
+    for (int i = 0; i < FILTER_COUNT; ++i) filters[i] = filter_constructors[i]();
+
+    int cases[CHECK_COUNT] = {0};
+    int failures[CHECK_COUNT] = {0};
+    for (const int *shape : shapes) {
+        for (int channels = 1; channels <= 3; channels += 2) {
+            for (int r = 0; r < RANDOM_IMAGES; ++r) {
+                image_t *image = random_image(shape[0], shape[1], channels);
+                for (int c = 0; c < CHECK_COUNT; ++c) {
+                    ++cases[c];
+                    bool passed;
+                    try {
+                        passed = checks[c].check(image);
+                    } catch (const std::exception &e) {
+                        printf("%s throws on %dx%dx%d: %s\n", checks[c].name, shape[0], shape[1], channels, e.what());
+                        passed = false;
+                    }
+                    if (!passed && failures[c]++ == 0) {
+                        printf("%s differs on %dx%dx%d\n", checks[c].name, shape[0], shape[1], channels);
+                    }
+                }
+                free_image(image);
+            }
+        }
+    }
+
+    printf("\n%-30s %8s %8s  %s\n", "check", "cases", "failed", "result");
+    int failed = 0;
+    for (int c = 0; c < CHECK_COUNT; ++c) {
+        printf("%-30s %8d %8d  %s\n", checks[c].name, cases[c], failures[c], failures[c] ? "FAIL" : "ok");
+        failed = failed || failures[c];
+    }
+    for (int i = 0; i < FILTER_COUNT; ++i) free_filter(filters[i]);
+
+    printf("%s\n", failed ? "C++ interface differs from the C functions" : "C++ interface matches the C functions");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
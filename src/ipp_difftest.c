@@ -0,0 +1,1437 @@
+#include <stdio.h>
+#include <image_manipulation.h>
+#include <image_formats.h>
+#include <reference_ops.h>
+#include <adaptive_equalization.h>
+#include <gradient.h>
+#include <image_roi.h>
+#include <tiled_image.h>
+#include <pipeline.h>
+#include <parallel_jpeg.h>
+#include <image_cache.h>
+#include <codec_context.h>
+#include <dc_histogram.h>
+#include <pixel_kernels.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define DEFAULT_RANDOM_IMAGES 4
+#define DEFAULT_SEED 1
+#define DIFF_TILE_SIZE 8
+#define FILTER_COUNT 7
+
+/**
+ * Ways of computing an op other than the reference. The library is run once per CPU level the processor supports,
+ * the other paths at the best level.
+ */
+enum diff_path {
+    PATH_LIBRARY_GENERIC,
+    PATH_LIBRARY_SSE4_2,
+    PATH_LIBRARY_AVX2,
+    PATH_LIBRARY_AVX512,
+    PATH_ROI,
+    PATH_TILED,
+    PATH_PIPELINE,
+    PATH_COUNT
+};
+
+/**
+ * Parameter an op is run with, varied over the values of its sweep.
+ */
+enum diff_sweep {
+    SWEEP_NONE,
+    SWEEP_BIAS,
+    SWEEP_GAIN,
+    SWEEP_TONES,
+    SWEEP_ZOOM,
+    SWEEP_FILTER,
+    SWEEP_TARGET,
+    SWEEP_TILES,
+    SWEEP_GRADIENT
+};
+
+typedef struct diff_params_struct {
+    double value;               // bias, gain, number of tones or clip limit
+    int sx;                     // zoom factors or tile size
+    int sy;
+    int filter;
+    boolean clamp;
+    image_t *target;            // of match_histogram, copied before use
+    gradient_options_t gradient;
+} diff_params_t;
+
+/**
+ * Output of an op as plain numbers, so that images and histograms are compared alike.
+ */
+typedef struct diff_result_struct {
+    int width;
+    int height;
+    int channels;
+    int *values;
+    int *alternatives;          // another value accepted for each one, NULL if there is none
+} diff_result_t;
+
+/**
+ * Computes an op on an image, which the function owns and may modify or release.
+ * @return Zero if the path does not cover this case, leaving result empty.
+ */
+typedef int (*diff_function_t)(image_t *image, const diff_params_t *params, diff_result_t *result);
+
+typedef struct diff_op_struct {
+    const char *name;
+    enum diff_sweep sweep;
+    int tolerance;              // largest absolute error accepted from any path
+    diff_function_t reference;
+    diff_function_t paths[PATH_COUNT];  // library entries are all the same function
+} diff_op_t;
+
+/**
+ * Errors of one path of one op over every case.
+ */
+typedef struct diff_stats_struct {
+    int cases;
+    int mismatched_shapes;
+    long compared;
+    int max_error;
+    double error_sum;
+    int reported;               // first failing case already printed
+} diff_stats_t;
+
+const char *path_names[PATH_COUNT] = {"library/generic", "library/sse4.2", "library/avx2", "library/avx512", "roi",
+                                      "tiled", "pipeline"};
+
+float **(*filter_constructors[FILTER_COUNT])() = {gaussian_filter, laplacian_filter, high_pass_filter,
+                                                 prewitt_hx_filter, prewitt_hy_filter, sobel_hx_filter,
+                                                 sobel_hy_filter};
+
+const char *filter_names[FILTER_COUNT] = {"gaussian", "laplacian", "high-pass", "prewitt-hx", "prewitt-hy",
+                                          "sobel-hx", "sobel-hy"};
+
+float **filters[FILTER_COUNT];
+
+image_t *blank_image(int width, int height, int channels) {
+    image_t *image = new_image();
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    image->colorspace = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    image->pixels = new_unsigned_char_matrix(height, width * channels);
+    for (int row = 0; row < height; ++row) memset(image->pixels[row], 0, (size_t) width * channels);
+    return image;
+}
+
+/**
+ * Takes the values of an image and releases it.
+ */
+int image_result(image_t *image, diff_result_t *result) {
+    // an op that failed leaves no pixels, which compare as an empty image
+    if (!image->pixels) image->width = image->height = 0;
+    result->width = image->width;
+    result->height = image->height;
+    result->channels = image->channels;
+    result->values = malloc(((size_t) image->width * image->height * image->channels + 1) * sizeof(int));
+    result->alternatives = NULL;
+    int *value = result->values;
+    for (int row = 0; row < image->height; ++row) {
+        for (int i = 0; i < image->width * image->channels; ++i) *value++ = image->pixels[row][i];
+    }
+    free_image(image);
+    return 1;
+}
+
+/**
+ * Takes the values of one channel of an image, as an image of that channel alone, and releases it.
+ */
+int channel_result(image_t *image, int channel, diff_result_t *result) {
+    image_t *single = blank_image(image->width, image->height, 1);
+    for (int row = 0; row < image->height; ++row) {
+        for (int x = 0; x < image->width; ++x) single->pixels[row][x] = image->pixels[row][x * image->channels + channel];
+    }
+    free_image(image);
+    return image_result(single, result);
+}
+
+/**
+ * Takes a histogram, as a 1 pixel high image of HISTOGRAM_SIZE counts, and releases it.
+ */
+int histogram_result(int *histogram, diff_result_t *result) {
+    result->width = HISTOGRAM_SIZE;
+    result->height = 1;
+    result->channels = 1;
+    result->values = malloc(HISTOGRAM_SIZE * sizeof(int));
+    result->alternatives = NULL;
+    memcpy(result->values, histogram, HISTOGRAM_SIZE * sizeof(int));
+    free_histogram(histogram);
+    return 1;
+}
+
+/**
+ * Adaptive equalization options of a SWEEP_TILES case.
+ */
+clahe_options_t tile_options(const diff_params_t *params) {
+    clahe_options_t options = default_clahe_options();
+    options.tile_width = params->sx;
+    options.tile_height = params->sy;
+    options.clip_limit = params->value;
+    return options;
+}
+
+/**
+ * Tone mapping that matches the luminance histogram of an image to the one of a target, from the reference
+ * compute_histogram_matching().
+ */
+int *reference_matching_of(image_t *image, image_t *target) {
+    image_t *target_copy = copy_image(target);
+    int *hist_cum_source = reference_compute_norm_cum_histogram(image);
+    int *hist_cum_target = reference_compute_norm_cum_histogram(target_copy);
+    int *matching = reference_compute_histogram_matching(hist_cum_source, hist_cum_target);
+    free_histogram(hist_cum_source);
+    free_histogram(hist_cum_target);
+    free_image(target_copy);
+    return matching;
+}
+
+/**
+ * The same mapping from histogram_matching_lut().
+ */
+int *library_matching_of(image_t *image, image_t *target) {
+    image_t *target_copy = copy_image(target);
+    int *hist_cum_source = compute_norm_cum_histogram(image);
+    int *hist_cum_target = compute_norm_cum_histogram(target_copy);
+    unsigned char lut[HISTOGRAM_SIZE];
+    histogram_matching_lut(hist_cum_source, hist_cum_target, lut);
+
+    int *matching = new_histogram();
+    for (int tone = 0; tone < HISTOGRAM_SIZE; ++tone) matching[tone] = lut[tone];
+    free_histogram(hist_cum_source);
+    free_histogram(hist_cum_target);
+    free_image(target_copy);
+    return matching;
+}
+
+// Library and reference ops, which work alike on an image_t
+#define IMAGE_OP(function, call) \
+    int function(image_t *image, const diff_params_t *params, diff_result_t *result) { call; return image_result(image, result); }
+
+#define HISTOGRAM_OP(function, call) \
+    int function(image_t *image, const diff_params_t *params, diff_result_t *result) { \
+        int *histogram = call; free_image(image); return histogram_result(histogram, result); }
+
+IMAGE_OP(diff_reference_mirror_h, reference_mirror_horizontally(image))
+IMAGE_OP(diff_reference_mirror_v, reference_mirror_vertically(image))
+IMAGE_OP(diff_reference_luminance, reference_rgb_to_luminance(image))
+IMAGE_OP(diff_reference_rgb, reference_luminance_to_rgb(image))
+IMAGE_OP(diff_reference_bias, reference_add_bias(image, params->value))
+IMAGE_OP(diff_reference_gain, reference_multiply_gain(image, params->value))
+IMAGE_OP(diff_reference_negative_op, reference_negative(image))
+IMAGE_OP(diff_reference_quantize_op, reference_quantize(image, (int) params->value))
+HISTOGRAM_OP(diff_reference_histogram, reference_compute_histogram(image))
+HISTOGRAM_OP(diff_reference_norm_cum_histogram, reference_compute_norm_cum_histogram(image))
+IMAGE_OP(diff_reference_equalize, reference_equalize_histogram(image))
+IMAGE_OP(diff_reference_match, image_t *target = copy_image(params->target); reference_match_histogram(image, target);
+        free_image(target))
+IMAGE_OP(diff_reference_equalize_channels, reference_equalize_histogram_with_mode(image, HISTOGRAM_MODE_CHANNELS))
+IMAGE_OP(diff_reference_equalize_luma, reference_equalize_histogram_with_mode(image, HISTOGRAM_MODE_LUMA))
+IMAGE_OP(diff_reference_match_channels, image_t *target = copy_image(params->target);
+        reference_match_histogram_with_mode(image, target, HISTOGRAM_MODE_CHANNELS); free_image(target))
+IMAGE_OP(diff_reference_match_luma, image_t *target = copy_image(params->target);
+        reference_match_histogram_with_mode(image, target, HISTOGRAM_MODE_LUMA); free_image(target))
+HISTOGRAM_OP(diff_reference_matching, reference_matching_of(image, params->target))
+IMAGE_OP(diff_reference_adaptive, clahe_options_t options = tile_options(params);
+        reference_equalize_histogram_adaptive(image, &options))
+IMAGE_OP(diff_reference_gradient, reference_compute_gradient(image, &params->gradient, NULL, NULL))
+IMAGE_OP(diff_reference_zoom_out_op, reference_zoom_out(image, params->sx, params->sy))
+IMAGE_OP(diff_reference_zoom_in_op, reference_zoom_in(image))
+IMAGE_OP(diff_reference_rotate, reference_rotate_90_degrees_clock_wise(image))
+IMAGE_OP(diff_reference_convolve_op, reference_convolve(image, filters[params->filter], params->clamp))
+
+IMAGE_OP(diff_library_mirror_h, mirror_horizontally(image))
+IMAGE_OP(diff_library_mirror_v, mirror_vertically(image))
+IMAGE_OP(diff_library_luminance, rgb_to_luminance(image))
+IMAGE_OP(diff_library_rgb, luminance_to_rgb(image))
+IMAGE_OP(diff_library_bias, add_bias(image, params->value))
+IMAGE_OP(diff_library_gain, multiply_gain(image, params->value))
+IMAGE_OP(diff_library_negative, negative(image))
+IMAGE_OP(diff_library_quantize, quantize(image, (int) params->value))
+HISTOGRAM_OP(diff_library_histogram, compute_histogram(image))
+HISTOGRAM_OP(diff_library_norm_cum_histogram, compute_norm_cum_histogram(image))
+IMAGE_OP(diff_library_equalize, equalize_histogram(image))
+IMAGE_OP(diff_library_match, image_t *target = copy_image(params->target); match_histogram(image, target);
+        free_image(target))
+IMAGE_OP(diff_library_equalize_channels, equalize_histogram_with_mode(image, HISTOGRAM_MODE_CHANNELS))
+IMAGE_OP(diff_library_equalize_luma, equalize_histogram_with_mode(image, HISTOGRAM_MODE_LUMA))
+IMAGE_OP(diff_library_match_channels, image_t *target = copy_image(params->target);
+        match_histogram_with_mode(image, target, HISTOGRAM_MODE_CHANNELS); free_image(target))
+IMAGE_OP(diff_library_match_luma, image_t *target = copy_image(params->target);
+        match_histogram_with_mode(image, target, HISTOGRAM_MODE_LUMA); free_image(target))
+HISTOGRAM_OP(diff_library_matching, library_matching_of(image, params->target))
+IMAGE_OP(diff_library_adaptive, clahe_options_t options = tile_options(params);
+        equalize_histogram_adaptive(image, &options))
+IMAGE_OP(diff_library_gradient, compute_gradient(image, &params->gradient, NULL))
+IMAGE_OP(diff_library_zoom_out, zoom_out(image, params->sx, params->sy))
+IMAGE_OP(diff_library_zoom_in, zoom_in(image))
+IMAGE_OP(diff_library_rotate, rotate_90_degrees_clock_wise(image))
+IMAGE_OP(diff_library_convolve, convolve(image, filters[params->filter], params->clamp))
+
+/**
+ * Orientation bins of the reference gradient, with the bins across a boundary the library may give near one.
+ */
+int diff_reference_orientation(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_t *orientation = new_image(), *alternative = new_image();
+    reference_compute_gradient(image, &params->gradient, orientation, alternative);
+    free_image(image);
+    image_result(alternative, result);
+    int *alternatives = result->values;
+    image_result(orientation, result);
+    result->alternatives = alternatives;
+    return 1;
+}
+
+int diff_library_orientation(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_t *orientation = new_image();
+    compute_gradient(image, &params->gradient, orientation);
+    free_image(image);
+    return image_result(orientation, result);
+}
+
+// Regions of interest covering the whole image, whose results are brought to the shape of the library ones
+#define ROI_OP(function, call) \
+    int function(image_t *image, const diff_params_t *params, diff_result_t *result) { \
+        image_roi_t roi = image_roi(image, NULL); call; return image_result(image, result); }
+
+ROI_OP(diff_roi_mirror_h, roi_mirror_horizontally(&roi))
+ROI_OP(diff_roi_mirror_v, roi_mirror_vertically(&roi))
+ROI_OP(diff_roi_bias, roi_add_bias(&roi, params->value))
+ROI_OP(diff_roi_gain, roi_multiply_gain(&roi, params->value))
+ROI_OP(diff_roi_negative_op, roi_negative(&roi))
+ROI_OP(diff_roi_quantize_op, roi_quantize(&roi, (int) params->value))
+ROI_OP(diff_roi_equalize, roi_equalize_histogram(&roi))
+
+int diff_roi_luminance(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_roi_t roi = image_roi(image, NULL);
+    roi_rgb_to_luminance(&roi);
+    return channel_result(image, 0, result);
+}
+
+int diff_roi_histogram(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_roi_t roi = image_roi(image, NULL);
+    int *histogram = new_histogram();
+    roi_compute_histogram(&roi, histogram);
+    free_image(image);
+    return histogram_result(histogram, result);
+}
+
+int diff_roi_norm_cum_histogram(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_roi_t roi = image_roi(image, NULL);
+    int *hist_cum = new_histogram();
+    roi_compute_norm_cum_histogram(&roi, hist_cum);
+    free_image(image);
+    return histogram_result(hist_cum, result);
+}
+
+int diff_roi_match(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_roi_t source = image_roi(image, NULL);
+    image_roi_t target = image_roi(params->target, NULL);
+    roi_match_histogram(&source, &target);
+    return channel_result(image, 0, result);
+}
+
+int diff_roi_zoom_out_op(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_t *zoomed = blank_image((image->width + params->sx - 1) / params->sx,
+                                  (image->height + params->sy - 1) / params->sy, image->channels);
+    image_roi_t source = image_roi(image, NULL);
+    image_roi_t destination = image_roi(zoomed, NULL);
+    roi_zoom_out(&source, &destination, params->sx, params->sy);
+    free_image(image);
+    return image_result(zoomed, result);
+}
+
+int diff_roi_zoom_in_op(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_t *zoomed = blank_image(2 * image->width - 1, 2 * image->height - 1, image->channels);
+    image_roi_t source = image_roi(image, NULL);
+    image_roi_t destination = image_roi(zoomed, NULL);
+    roi_zoom_in(&source, &destination);
+    free_image(image);
+    return image_result(zoomed, result);
+}
+
+int diff_roi_rotate(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    image_t *rotated = blank_image(image->height, image->width, image->channels);
+    image_roi_t source = image_roi(image, NULL);
+    image_roi_t destination = image_roi(rotated, NULL);
+    roi_rotate_90_degrees_clock_wise(&source, &destination);
+    free_image(image);
+    return image_result(rotated, result);
+}
+
+int diff_roi_convolve_op(image_t *image, const diff_params_t *params, diff_result_t *result) {
+    // convolve() computes the pixels at least FILTER_SIZE / 2 away from the edges of an output one pixel smaller
+    // than its input and zeroes the others, which is what the region keeps of its convolution in place
+    int half = FILTER_SIZE / 2;
+    int new_width = image->width - half;
+    int new_height = image->height - half;
+    if (new_width < 0 || new_height < 0) {
+        free_image(image);
+        return 0;
+    }
+
+    image_roi_t roi = image_roi(image, NULL);
+    roi_convolve(&roi, filters[params->filter], params->clamp);
+
+    image_t *convolved = blank_image(new_width, new_height, 1);
+    for (int y = half; y < new_height - half; ++y) {
+        for (int x = half; x < new_width - half; ++x) convolved->pixels[y][x] = image->pixels[y][x * image->channels];
+    }
+    free_image(image);
+    return image_result(convolved, result);
+}
+
+// Tiled images with tiles much smaller than the image, so that ops cross tile edges and evict tiles to the disk
+#define TILED_OP(function, call) \
+    int function(image_t *image, const diff_params_t *params, diff_result_t *result) { \
+        tiled_image_t *tiled = tiled_from_image(image, DIFF_TILE_SIZE, 0, NULL); free_image(image); call; \
+        image_t *output = tiled_to_image(tiled); free_tiled_image(tiled); return image_result(output, result); }
+
+#define TILED_NEW_OP(function, call) \
+    TILED_OP(function, tiled_image_t *input = tiled; tiled = call; free_tiled_image(input))
+
+TILED_OP(diff_tiled_bias, tiled_add_bias(tiled, params->value))
+TILED_OP(diff_tiled_gain, tiled_multiply_gain(tiled, params->value))
+TILED_OP(diff_tiled_negative_op, tiled_negative(tiled))
+TILED_OP(diff_tiled_quantize_op, tiled_quantize(tiled, (int) params->value))
+TILED_NEW_OP(diff_tiled_luminance, tiled_rgb_to_luminance(input))
+TILED_NEW_OP(diff_tiled_rotate, tiled_rotate_90_degrees_clock_wise(input))
+TILED_NEW_OP(diff_tiled_mirror_h, tiled_mirror_horizontally(input))
+TILED_NEW_OP(diff_tiled_convolve_op, tiled_convolve(input, filters[params->filter], params->clamp))
+
+// Pipelines of the op alone, run on the image as their source
+#define PIPELINE_OP(function, add) \
+    int function(image_t *image, const diff_params_t *params, diff_result_t *result) { \
+        pipeline_t *pipeline = new_pipeline(); int node = add; pipeline_run(pipeline, image); free_image(image); \
+        image_t *output = pipeline_image(pipeline, node); int *histogram = pipeline_histogram(pipeline, node); \
+        free_pipeline(pipeline); \
+        return output ? image_result(output, result) : histogram ? histogram_result(histogram, result) : 0; }
+
+PIPELINE_OP(diff_pipeline_mirror_h, pipeline_add_mirror_horizontally(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_mirror_v, pipeline_add_mirror_vertically(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_luminance, pipeline_add_luminance(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_rgb, pipeline_add_luminance_to_rgb(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_bias, pipeline_add_bias(pipeline, PIPELINE_SOURCE, params->value))
+PIPELINE_OP(diff_pipeline_gain, pipeline_add_gain(pipeline, PIPELINE_SOURCE, params->value))
+PIPELINE_OP(diff_pipeline_negative, pipeline_add_negative(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_quantize, pipeline_add_quantize(pipeline, PIPELINE_SOURCE, (int) params->value))
+PIPELINE_OP(diff_pipeline_histogram_op, pipeline_add_histogram(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_equalize, pipeline_add_equalize_histogram(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_zoom_out_op, pipeline_add_zoom_out(pipeline, PIPELINE_SOURCE, params->sx, params->sy))
+PIPELINE_OP(diff_pipeline_zoom_in_op, pipeline_add_zoom_in(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_rotate, pipeline_add_rotate_90_degrees_clock_wise(pipeline, PIPELINE_SOURCE))
+PIPELINE_OP(diff_pipeline_convolve_op,
+            pipeline_add_convolve(pipeline, PIPELINE_SOURCE, filters[params->filter], params->clamp))
+
+#define LIBRARY(function) function, function, function, function
+
+const diff_op_t diff_ops[] = {
+        {"mirror_horizontally", SWEEP_NONE, 0, diff_reference_mirror_h,
+                {LIBRARY(diff_library_mirror_h), diff_roi_mirror_h, diff_tiled_mirror_h, diff_pipeline_mirror_h}},
+        {"mirror_vertically", SWEEP_NONE, 0, diff_reference_mirror_v,
+                {LIBRARY(diff_library_mirror_v), diff_roi_mirror_v, NULL, diff_pipeline_mirror_v}},
+        {"rgb_to_luminance", SWEEP_NONE, 0, diff_reference_luminance,
+                {LIBRARY(diff_library_luminance), diff_roi_luminance, diff_tiled_luminance, diff_pipeline_luminance}},
+        {"luminance_to_rgb", SWEEP_NONE, 0, diff_reference_rgb,
+                {LIBRARY(diff_library_rgb), NULL, NULL, diff_pipeline_rgb}},
+        {"add_bias", SWEEP_BIAS, 0, diff_reference_bias,
+                {LIBRARY(diff_library_bias), diff_roi_bias, diff_tiled_bias, diff_pipeline_bias}},
+        {"multiply_gain", SWEEP_GAIN, 0, diff_reference_gain,
+                {LIBRARY(diff_library_gain), diff_roi_gain, diff_tiled_gain, diff_pipeline_gain}},
+        {"negative", SWEEP_NONE, 0, diff_reference_negative_op,
+                {LIBRARY(diff_library_negative), diff_roi_negative_op, diff_tiled_negative_op, diff_pipeline_negative}},
+        {"quantize", SWEEP_TONES, 0, diff_reference_quantize_op,
+                {LIBRARY(diff_library_quantize), diff_roi_quantize_op, diff_tiled_quantize_op, diff_pipeline_quantize}},
+        {"compute_histogram", SWEEP_NONE, 0, diff_reference_histogram,
+                {LIBRARY(diff_library_histogram), diff_roi_histogram, NULL, diff_pipeline_histogram_op}},
+        {"compute_norm_cum_histogram", SWEEP_NONE, 0, diff_reference_norm_cum_histogram,
+                {LIBRARY(diff_library_norm_cum_histogram), diff_roi_norm_cum_histogram, NULL, NULL}},
+        {"equalize_histogram", SWEEP_NONE, 0, diff_reference_equalize,
+                {LIBRARY(diff_library_equalize), diff_roi_equalize, NULL, diff_pipeline_equalize}},
+        {"match_histogram", SWEEP_TARGET, 0, diff_reference_match,
+                {LIBRARY(diff_library_match), diff_roi_match, NULL, NULL}},
+        {"histogram_matching_lut", SWEEP_TARGET, 0, diff_reference_matching,
+                {LIBRARY(diff_library_matching), NULL, NULL, NULL}},
+        {"equalize_histogram channels", SWEEP_NONE, 0, diff_reference_equalize_channels,
+                {LIBRARY(diff_library_equalize_channels), NULL, NULL, NULL}},
+        {"equalize_histogram luma", SWEEP_NONE, 0, diff_reference_equalize_luma,
+                {LIBRARY(diff_library_equalize_luma), NULL, NULL, NULL}},
+        {"match_histogram channels", SWEEP_TARGET, 0, diff_reference_match_channels,
+                {LIBRARY(diff_library_match_channels), NULL, NULL, NULL}},
+        {"match_histogram luma", SWEEP_TARGET, 0, diff_reference_match_luma,
+                {LIBRARY(diff_library_match_luma), NULL, NULL, NULL}},
+        {"equalize_histogram_adaptive", SWEEP_TILES, 1, diff_reference_adaptive,
+                {LIBRARY(diff_library_adaptive), NULL, NULL, NULL}},
+        {"compute_gradient", SWEEP_GRADIENT, 0, diff_reference_gradient,
+                {LIBRARY(diff_library_gradient), NULL, NULL, NULL}},
+        {"compute_gradient orientation", SWEEP_GRADIENT, 0, diff_reference_orientation,
+                {LIBRARY(diff_library_orientation), NULL, NULL, NULL}},
+        {"zoom_out", SWEEP_ZOOM, 0, diff_reference_zoom_out_op,
+                {LIBRARY(diff_library_zoom_out), diff_roi_zoom_out_op, NULL, diff_pipeline_zoom_out_op}},
+        {"zoom_in", SWEEP_NONE, 0, diff_reference_zoom_in_op,
+                {LIBRARY(diff_library_zoom_in), diff_roi_zoom_in_op, NULL, diff_pipeline_zoom_in_op}},
+        {"rotate_90_degrees_clock_wise", SWEEP_NONE, 0, diff_reference_rotate,
+                {LIBRARY(diff_library_rotate), diff_roi_rotate, diff_tiled_rotate, diff_pipeline_rotate}},
+        {"convolve", SWEEP_FILTER, 0, diff_reference_convolve_op,
+                {LIBRARY(diff_library_convolve), diff_roi_convolve_op, diff_tiled_convolve_op, diff_pipeline_convolve_op}},
+};
+
+#define DIFF_OP_COUNT ((int) (sizeof(diff_ops) / sizeof(diff_ops[0])))
+
+/**
+ * Property of a part of the library without a reference to be compared with, such as the codecs, checked on an
+ * image.
+ * @param failure receives what went wrong
+ * @return Zero if the property does not hold.
+ */
+typedef int (*check_function_t)(image_t *image, char *failure, size_t size);
+
+typedef struct check_struct {
+    const char *name;
+    check_function_t check;
+} check_t;
+
+// Encodes at the largest quality, where nothing is quantized away, in every layout of the output
+const encode_options_t bound_options[] = {
+        {100, JDCT_ISLOW, FALSE, FALSE, 2, 2, 0},
+        {100, JDCT_ISLOW, FALSE, FALSE, 1, 1, 0},
+        {100, JDCT_ISLOW, TRUE, FALSE, 2, 1, 0},
+        {100, JDCT_ISLOW, FALSE, TRUE, 2, 2, 0},
+        {100, JDCT_ISLOW, FALSE, TRUE, 1, 1, 0},
+        {100, JDCT_ISLOW, FALSE, FALSE, 2, 2, 1},
+        {100, JDCT_ISLOW, FALSE, TRUE, 1, 1, 1},
+};
+
+/**
+ * Every encode fits in jpeg_compress_bound(), and jpeg_compress_into() succeeds with a buffer of that size.
+ */
+int check_compress_bound(image_t *image, char *failure, size_t size) {
+    image_t *copy = copy_image(image);
+    int passed = 1;
+    for (int o = 0; passed && o < (int) (sizeof(bound_options) / sizeof(bound_options[0])); ++o) {
+        const encode_options_t *options = &bound_options[o];
+        unsigned long bound = jpeg_compress_bound(copy, options);
+        unsigned char *buffer = NULL;
+        unsigned long written = jpeg_compress_buffer(copy, options, &buffer);
+        free(buffer);
+
+        buffer = malloc(bound);
+        unsigned long written_into = jpeg_compress_into(copy, options, buffer, bound);
+        free(buffer);
+
+        if (written == 0 || written > bound || written_into != written) {
+            snprintf(failure, size, "%s%s%s, %lu bytes for a bound of %lu", options->progressive ? "progressive" :
+                     "baseline", options->h_sampling == 1 ? " 4:4:4" : "", options->restart_in_rows ? " restart" : "",
+                     written, bound);
+            passed = 0;
+        }
+    }
+    free_image(copy);
+    return passed;
+}
+
+// Regions of the region decode check, in eighths of the width and height: inside, on each edge, sticking out
+const int region_eighths[][4] = {{3, 2, 2, 3}, {0, 0, 3, 3}, {5, 5, 3, 3}, {1, 0, 6, 8}, {0, 7, 8, 1}, {6, -1, 4, 10}};
+
+/**
+ * A region decoded alone has the pixels it has in a decode of the whole image, in the default and the progressive
+ * layouts.
+ */
+int check_region_decode(image_t *image, char *failure, size_t size) {
+    encode_options_t options[2] = {default_encode_options(), default_encode_options()};
+    options[1].progressive = TRUE;
+    options[1].h_sampling = options[1].v_sampling = 1;
+
+    int passed = 1;
+    for (int o = 0; passed && o < 2; ++o) {
+        unsigned char *jpeg = NULL;
+        unsigned long jpeg_size = jpeg_compress_buffer(image, &options[o], &jpeg);
+        image_t *full = jpeg_decompress_buffer(jpeg, jpeg_size, NULL);
+
+        for (int r = 0; passed && r < (int) (sizeof(region_eighths) / sizeof(region_eighths[0])); ++r) {
+            region_t region = {image->width * region_eighths[r][0] / 8, image->height * region_eighths[r][1] / 8,
+                               (image->width * region_eighths[r][2] + 7) / 8,
+                               (image->height * region_eighths[r][3] + 7) / 8};
+            image_t *part = jpeg_decompress_buffer_region(jpeg, jpeg_size, &region, NULL);
+            int first_x = region.x < 0 ? 0 : region.x, first_y = region.y < 0 ? 0 : region.y;
+            int width = min_int(region.x + region.width, full->width) - first_x;
+            int height = min_int(region.y + region.height, full->height) - first_y;
+
+            if (part->last_operation != DECOMPRESSION_SUCCESS || part->width != width || part->height != height) {
+                passed = 0;
+            }
+            for (int y = 0; passed && y < height; ++y) {
+                passed = memcmp(part->pixels[y], full->pixels[first_y + y] + (size_t) first_x * full->channels,
+                                (size_t) width * full->channels) == 0;
+            }
+            if (!passed) {
+                snprintf(failure, size, "%s, region %dx%d at (%d, %d)", o ? "progressive 4:4:4" : "baseline 4:2:0",
+                         region.width, region.height, region.x, region.y);
+            }
+            free_image(part);
+        }
+        free_image(full);
+        free(jpeg);
+    }
+    return passed;
+}
+
+/**
+ * Whether two images have the same size and pixels, taking (and releasing) both.
+ */
+int same_images(image_t *a, image_t *b) {
+    int same = a && b && a->width == b->width && a->height == b->height && a->channels == b->channels;
+    for (int y = 0; same && y < a->height; ++y) {
+        same = memcmp(a->pixels[y], b->pixels[y], (size_t) a->width * a->channels) == 0;
+    }
+    free_image(a);
+    free_image(b);
+    return same;
+}
+
+int same_stats(const pipeline_stats_t *a, const pipeline_stats_t *b) {
+    return a->passes == b->passes && a->streamed == b->streamed && a->fused == b->fused &&
+           a->reused_buffers == b->reused_buffers;
+}
+
+// Threads of the parallel codecs: serial, two strips or runs, an odd number and one per processor
+const int codec_threads[] = {1, 2, 5, 0};
+
+// Layouts of the parallel codecs, chroma subsampled or not, with a restart marker every MCU row or every other one
+const encode_options_t parallel_options[] = {
+        {75, JDCT_ISLOW, FALSE, FALSE, 2, 2, 1},
+        {90, JDCT_ISLOW, FALSE, FALSE, 1, 1, 2},
+        {75, JDCT_IFAST, FALSE, FALSE, 2, 1, 1},
+};
+
+#define PARALLEL_CASES ((int) (sizeof(parallel_options) / sizeof(parallel_options[0])))
+#define THREAD_CASES ((int) (sizeof(codec_threads) / sizeof(codec_threads[0])))
+
+/**
+ * A strip-parallel encode decodes to the pixels of a serial encode with the same options, whatever the number of
+ * threads: strips hold whole MCU rows, so they quantize the same coefficients.
+ */
+int check_compress_parallel(image_t *image, char *failure, size_t size) {
+    int passed = 1;
+    for (int o = 0; passed && o < PARALLEL_CASES; ++o) {
+        encode_options_t options = parallel_options[o];
+        options.restart_in_rows = 0;
+        unsigned char *jpeg = NULL;
+        unsigned long jpeg_size = jpeg_compress_buffer(image, &options, &jpeg);
+        image_t *serial = jpeg_decompress_buffer(jpeg, jpeg_size, NULL);
+        free(jpeg);
+
+        for (int t = 0; passed && t < THREAD_CASES; ++t) {
+            jpeg = NULL;
+            jpeg_size = jpeg_compress_parallel_buffer(image, &options, codec_threads[t], &jpeg);
+            passed = jpeg_size > 0 && same_images(copy_image(serial), jpeg_decompress_buffer(jpeg, jpeg_size, NULL));
+            free(jpeg);
+            if (!passed) {
+                snprintf(failure, size, "%d threads, %dx%d sampling", codec_threads[t], options.h_sampling,
+                         options.v_sampling);
+            }
+        }
+        free_image(serial);
+    }
+    return passed;
+}
+
+/**
+ * A decode of runs of restart intervals in parallel gives the pixels of a serial decode, whatever the number of
+ * threads, for JPEGs with restart markers from the serial and the strip-parallel encoders.
+ */
+int check_decompress_parallel(image_t *image, char *failure, size_t size) {
+    int passed = 1;
+    for (int o = 0; passed && o < 2 * PARALLEL_CASES; ++o) {
+        const encode_options_t *options = &parallel_options[o % PARALLEL_CASES];
+        int strips = o >= PARALLEL_CASES;
+        unsigned char *jpeg = NULL;
+        unsigned long jpeg_size = strips ? jpeg_compress_parallel_buffer(image, options, 3, &jpeg)
+                                         : jpeg_compress_buffer(image, options, &jpeg);
+        image_t *serial = jpeg_decompress_buffer(jpeg, jpeg_size, NULL);
+
+        for (int t = 0; passed && t < THREAD_CASES; ++t) {
+            image_t *parallel = jpeg_decompress_parallel_buffer(jpeg, jpeg_size, NULL, codec_threads[t]);
+            int decoded = parallel->last_operation == DECOMPRESSION_SUCCESS;
+            passed = same_images(copy_image(serial), parallel) && decoded;
+            if (!passed) {
+                snprintf(failure, size, "%d threads, %dx%d sampling, restart every %d rows%s", codec_threads[t],
+                         options->h_sampling, options->v_sampling, options->restart_in_rows,
+                         strips ? " from strips" : "");
+            }
+        }
+        free_image(serial);
+        free(jpeg);
+    }
+    return passed;
+}
+
+/**
+ * Library calls a chain of pipeline_chains stands for, made one after another on an image they own.
+ * @param histogram receives the output of chains ending in a histogram
+ * @return The output image of other chains, NULL for those.
+ */
+typedef image_t *(*chain_sequence_t)(image_t *image, int **histogram);
+
+image_t *sequence_lut_chain(image_t *image, int **histogram) {
+    add_bias(image, 30);
+    multiply_gain(image, 1.5);
+    negative(image);
+    return image;
+}
+
+image_t *sequence_luminance_sobel(image_t *image, int **histogram) {
+    rgb_to_luminance(image);
+    convolve(image, filters[5], FALSE);
+    return image;
+}
+
+image_t *sequence_bias_gaussian(image_t *image, int **histogram) {
+    add_bias(image, -20);
+    rgb_to_luminance(image);
+    convolve(image, filters[0], TRUE);
+    return image;
+}
+
+image_t *sequence_mirror_rotate(image_t *image, int **histogram) {
+    add_bias(image, 30);
+    mirror_horizontally(image);
+    rotate_90_degrees_clock_wise(image);
+    return image;
+}
+
+image_t *sequence_mirror_histogram(image_t *image, int **histogram) {
+    rgb_to_luminance(image);
+    mirror_vertically(image);
+    *histogram = compute_histogram(image);
+    free_image(image);
+    return NULL;
+}
+
+image_t *sequence_rotate_zoom(image_t *image, int **histogram) {
+    multiply_gain(image, 0.8);
+    rotate_90_degrees_clock_wise(image);
+    zoom_out(image, 2, 2);
+    return image;
+}
+
+// Chains of ops and how they are planned: folded lookup tables, luminance folded into a convolution, streamed ops
+// read in reverse row order or through a convolution window, whole-image ops taking over the image of the one before
+const struct {
+    const char *spec;
+    chain_sequence_t sequence;
+    pipeline_stats_t plan;      // passes, streamed, fused and reused buffers of a run
+} pipeline_chains[] = {
+        {"bias:30,gain:1.5,negative", sequence_lut_chain, {1, 0, 2, 0}},
+        {"luminance,convolve:sobel-hx", sequence_luminance_sobel, {1, 0, 1, 0}},
+        {"bias:-20,luminance,convolve:gaussian:clamp", sequence_bias_gaussian, {1, 1, 1, 0}},
+        {"bias:30,mirror-h,rotate", sequence_mirror_rotate, {2, 2, 0, 0}},
+        {"luminance,mirror-v,histogram", sequence_mirror_histogram, {1, 2, 0, 0}},
+        {"gain:0.8,rotate,zoom-out:2x2", sequence_rotate_zoom, {3, 1, 0, 0}},
+};
+
+/**
+ * Every chain of pipeline_chains gives the pixels of the library calls it stands for, planned as expected.
+ */
+int check_pipeline_chains(image_t *image, char *failure, size_t size) {
+    int passed = 1;
+    for (int c = 0; passed && c < (int) (sizeof(pipeline_chains) / sizeof(pipeline_chains[0])); ++c) {
+        pipeline_t *pipeline = parse_pipeline(pipeline_chains[c].spec);
+        pipeline_run(pipeline, image);
+        int output = pipeline_output(pipeline);
+
+        int *expected_histogram = NULL;
+        image_t *expected = pipeline_chains[c].sequence(copy_image(image), &expected_histogram);
+        if (pipeline->last_operation != WRITE_SUCCESS) {
+            passed = 0;
+            free_image(expected);
+        } else if (expected_histogram) {
+            int *histogram = pipeline_histogram(pipeline, output);
+            passed = histogram && memcmp(histogram, expected_histogram, HISTOGRAM_SIZE * sizeof(int)) == 0;
+            free_histogram(histogram);
+        } else {
+            passed = same_images(pipeline_image(pipeline, output), expected);
+        }
+        free_histogram(expected_histogram);
+
+        if (!passed) {
+            snprintf(failure, size, "%s differs from its library calls", pipeline_chains[c].spec);
+        } else if (!same_stats(&pipeline->stats, &pipeline_chains[c].plan)) {
+            snprintf(failure, size, "%s planned as %d passes, %d streamed, %d fused", pipeline_chains[c].spec,
+                     pipeline->stats.passes, pipeline->stats.streamed, pipeline->stats.fused);
+            passed = 0;
+        }
+        free_pipeline(pipeline);
+    }
+    return passed;
+}
+
+/**
+ * A graph whose first node has three readers, rotation, negative and a convolution of its luminance, gives the
+ * pixels of the library calls on copies of that node over two runs. The node is written once per run and released
+ * to the pool after its last reader, and the second run takes it back from there.
+ */
+int check_pipeline_graph(image_t *image, char *failure, size_t size) {
+    pipeline_t *pipeline = new_pipeline();
+    int shared = pipeline_add_gain(pipeline, PIPELINE_SOURCE, 1.5);
+    int rotated = pipeline_add_rotate_90_degrees_clock_wise(pipeline, shared);
+    int negated = pipeline_add_negative(pipeline, shared);
+    int edges = pipeline_add_convolve(pipeline, pipeline_add_luminance(pipeline, shared), filters[6], TRUE);
+
+    image_t *gained = copy_image(image);
+    multiply_gain(gained, 1.5);
+
+    int passed = 1;
+    for (int run = 0; passed && run < 2; ++run) {
+        pipeline_run(pipeline, image);
+        // the shared node, the copy rotation reads and the three outputs; the second run reuses the shared one
+        pipeline_stats_t plan = {5, 0, 1, run};
+
+        image_t *expected_rotated = copy_image(gained), *expected_negated = copy_image(gained);
+        image_t *expected_edges = copy_image(gained);
+        rotate_90_degrees_clock_wise(expected_rotated);
+        negative(expected_negated);
+        rgb_to_luminance(expected_edges);
+        convolve(expected_edges, filters[6], TRUE);
+
+        passed = pipeline->last_operation == WRITE_SUCCESS;
+        passed = same_images(pipeline_image(pipeline, rotated), expected_rotated) && passed;
+        passed = same_images(pipeline_image(pipeline, negated), expected_negated) && passed;
+        passed = same_images(pipeline_image(pipeline, edges), expected_edges) && passed;
+        if (!passed) {
+            snprintf(failure, size, "run %d differs from the library calls", run + 1);
+        } else if (!same_stats(&pipeline->stats, &plan) || pipeline->pool_count > PIPELINE_POOL_SIZE) {
+            snprintf(failure, size, "run %d planned as %d passes, %d fused, %d reused buffers", run + 1,
+                     pipeline->stats.passes, pipeline->stats.fused, pipeline->stats.reused_buffers);
+            passed = 0;
+        }
+    }
+    free_image(gained);
+    free_pipeline(pipeline);
+    return passed;
+}
+
+/**
+ * Runs fail without outputs on a source without pixels, and when a whole-image op is left with an empty image, as
+ * zoom_in() is by the convolution of a single pixel. Only single pixels are checked, as every failure is reported on
+ * stderr.
+ */
+int check_pipeline_failure(image_t *image, char *failure, size_t size) {
+    if (image->width != 1 || image->height != 1) return 1;
+
+    pipeline_t *pipeline = parse_pipeline("convolve:gaussian,zoom-in");
+    int output = pipeline_output(pipeline);
+    pipeline_run(pipeline, image);
+    image_t *zoomed = pipeline_image(pipeline, output);
+    int passed = pipeline->last_operation == WRITE_FAILURE && !zoomed;
+    free_image(zoomed);
+
+    image_t *blank = new_image();
+    pipeline_run(pipeline, blank);
+    passed = passed && pipeline->last_operation == WRITE_FAILURE && !pipeline_image(pipeline, output);
+    free_image(blank);
+    free_pipeline(pipeline);
+
+    if (!passed) snprintf(failure, size, "runs on an empty image or source did not fail");
+    return passed;
+}
+
+/**
+ * Tiled ops stop at a tile they can not acquire and report it: with every resident tile of the source pinned, it can
+ * not be mirrored, copied into memory or encoded, and all of these work again once the tiles are released.
+ */
+int check_tiled_failure(image_t *image, char *failure, size_t size) {
+    // a single shape of 5 by 4 tiles keeps the messages of the failures down
+    if (image->width != 33 || image->height != 31 || image->channels != 3) return 1;
+
+    tiled_image_t *tiled = tiled_from_image(image, DIFF_TILE_SIZE, 0, NULL);
+    tile_t *pinned[MIN_RESIDENT_TILES];
+    int passed = tiled->slot_count == MIN_RESIDENT_TILES;
+    for (int i = 0; i < MIN_RESIDENT_TILES; ++i) {
+        pinned[i] = passed ? acquire_tile(tiled, i, 0) : NULL;
+        passed = passed && pinned[i];
+    }
+
+    char filename[] = "/tmp/ipp-difftest-XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd >= 0) close(fd);
+
+    // the last tile of the first row is the one left out
+    tiled_image_t *mirrored = tiled_mirror_horizontally(tiled);
+    image_t *copy = tiled_to_image(tiled);
+    tiled_jpeg_compress(tiled, filename, NULL);
+    passed = passed && mirrored->last_operation == READ_FAILURE && copy->last_operation == READ_FAILURE &&
+             !copy->pixels && tiled->last_operation == COMPRESSION_FAILURE;
+    free_tiled_image(mirrored);
+    free_image(copy);
+
+    for (int i = 0; i < MIN_RESIDENT_TILES; ++i) release_tile(pinned[i], FALSE);
+    tiled_jpeg_compress(tiled, filename, NULL);
+    passed = passed && fd >= 0 && tiled->last_operation == COMPRESSION_SUCCESS;
+    mirrored = tiled_mirror_horizontally(tiled);
+    copy = tiled_to_image(mirrored);
+    image_t *expected = copy_image(image);
+    mirror_horizontally(expected);
+    if (copy->last_operation == READ_SUCCESS) {
+        passed = same_images(copy, expected) && passed;
+    } else {
+        free_image(copy);
+        free_image(expected);
+        passed = 0;
+    }
+    free_tiled_image(mirrored);
+    free_tiled_image(tiled);
+    if (fd >= 0) unlink(filename);
+
+    if (!passed) snprintf(failure, size, "ops on pinned tiles did not fail, or failed after they were released");
+    return passed;
+}
+
+/**
+ * Replaces the content of a file.
+ * @return zero if it could not be written
+ */
+int write_file(const char *filename, const unsigned char *buffer, unsigned long size) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) return 0;
+    int written = fwrite(buffer, 1, size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+/**
+ * Decodes through the image cache give the pixels of a direct decode: on a hit, for a file rewritten with other
+ * content (which must be decoded again rather than served the old pixels), and for an entry the byte budget evicted.
+ */
+int check_image_cache(image_t *image, char *failure, size_t size) {
+    encode_options_t options = default_encode_options();
+    unsigned char *first = NULL;
+    unsigned char *second = NULL;
+    unsigned long first_size = jpeg_compress_buffer(image, &options, &first);
+    options.quality = 50;
+    unsigned long second_size = jpeg_compress_buffer(image, &options, &second);
+    image_t *expected = jpeg_decompress_buffer(first, first_size, NULL);
+    image_t *changed = jpeg_decompress_buffer(second, second_size, NULL);
+
+    char filename[] = "/tmp/ipp-difftest-XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd >= 0) close(fd);
+    int passed = fd >= 0 && write_file(filename, first, first_size);
+
+    // a budget for both files: the second decode is a hit, the rewritten file a miss
+    image_cache_t *cache = new_image_cache(1 << 20, NULL);
+    passed = same_images(image_cache_decompress(cache, filename, NULL), copy_image(expected)) && passed;
+    passed = same_images(image_cache_decompress(cache, filename, NULL), copy_image(expected)) && passed;
+    image_cache_stats_t stats = image_cache_stats(cache);
+    int hit = stats.hits == 1 && stats.misses == 1;
+
+    passed = passed && write_file(filename, second, second_size);
+    passed = same_images(image_cache_decompress(cache, filename, NULL), copy_image(changed)) && passed;
+    stats = image_cache_stats(cache);
+    int invalidated = stats.hits == 1 && stats.misses == 2;
+    free_image_cache(cache);
+
+    // a budget for one of them: each decode evicts the other, which is then decoded again
+    size_t entry_bytes = (size_t) expected->height * (expected->width * expected->channels + sizeof(unsigned char *));
+    cache = new_image_cache(entry_bytes + entry_bytes / 2, NULL);
+    passed = same_images(image_cache_decompress_buffer(cache, first, first_size, NULL), copy_image(expected)) && passed;
+    passed = same_images(image_cache_decompress_buffer(cache, second, second_size, NULL), copy_image(changed)) &&
+             passed;
+    passed = same_images(image_cache_decompress_buffer(cache, first, first_size, NULL), copy_image(expected)) && passed;
+    stats = image_cache_stats(cache);
+    int evicted = stats.hits == 0 && stats.misses == 3 && stats.evictions == 2 && stats.resident_bytes == entry_bytes;
+    free_image_cache(cache);
+
+    if (fd >= 0) unlink(filename);
+    free_image(expected);
+    free_image(changed);
+    free(first);
+    free(second);
+
+    if (!passed || !hit || !invalidated || !evicted) {
+        snprintf(failure, size, "%s", !passed ? "pixels differ from a direct decode" : !hit ?
+                 "second decode of a file was not a hit" : !invalidated ? "rewritten file was served from the cache" :
+                 "byte budget was not kept");
+    }
+    return passed && hit && invalidated && evicted;
+}
+
+/**
+ * A codec context that failed to decode corrupt data, or to encode an empty image, decodes and encodes the next
+ * images as the per-call functions do, reusing the pixels of the image it failed on.
+ */
+int check_codec_context_errors(image_t *image, char *failure, size_t size) {
+    // a single shape keeps the messages of the failures down
+    if (image->width != 17 || image->height != 9) return 1;
+
+    unsigned char *jpeg = NULL;
+    unsigned long jpeg_size = jpeg_compress_buffer(image, NULL, &jpeg);
+    image_t *expected = jpeg_decompress_buffer(jpeg, jpeg_size, NULL);
+    unsigned char *corrupt = malloc(jpeg_size);
+    memcpy(corrupt, jpeg, jpeg_size);
+    corrupt[1] = 0;
+
+    // decoded, then not a JPEG, then cut inside its header, then decoded again
+    codec_context_t *context = new_codec_context();
+    image_t *decoded = new_image();
+    codec_decompress_into(context, jpeg, jpeg_size, NULL, decoded);
+    int passed = decoded->last_operation == DECOMPRESSION_SUCCESS;
+    codec_decompress_into(context, corrupt, jpeg_size, NULL, decoded);
+    passed = passed && decoded->last_operation == DECOMPRESSION_FAILURE && !decoded->pixels;
+    codec_decompress_into(context, jpeg, 20, NULL, decoded);
+    passed = passed && decoded->last_operation == DECOMPRESSION_FAILURE && !decoded->pixels;
+    codec_decompress_into(context, jpeg, jpeg_size, NULL, decoded);
+    passed = passed && decoded->last_operation == DECOMPRESSION_SUCCESS;
+    passed = same_images(decoded, expected) && passed;
+    int decodes = passed;
+
+    image_t *empty = new_image();
+    empty->channels = image->channels;
+    empty->colorspace = image->colorspace;
+    const unsigned char *buffer;
+    passed = codec_compress_buffer(context, empty, NULL, &buffer) == 0 && empty->last_operation == COMPRESSION_FAILURE
+             && passed;
+    image_t *copy = copy_image(image);
+    unsigned long written = codec_compress_buffer(context, copy, NULL, &buffer);
+    passed = passed && copy->last_operation == COMPRESSION_SUCCESS && written == jpeg_size &&
+             memcmp(buffer, jpeg, jpeg_size) == 0;
+    free_image(copy);
+    free_image(empty);
+
+    free_codec_context(context);
+    free(corrupt);
+    free(jpeg);
+    if (!passed) snprintf(failure, size, "%s after an error", decodes ? "encode differs" : "decode differs");
+    return passed;
+}
+
+/**
+ * PGM, PPM and raw files written from an image load back with its pixels. Files cut inside their raster and raw
+ * files of empty images fail to load, leaving no pixels.
+ */
+int check_uncompressed_formats(image_t *image, char *failure, size_t size) {
+    char filename[] = "/tmp/ipp-difftest-XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0) {
+        snprintf(failure, size, "no temporary file");
+        return 0;
+    }
+    close(fd);
+
+    image_t *copy = copy_image(image);
+    pnm_save(copy, filename);
+    int pnm = copy->last_operation == WRITE_SUCCESS && same_images(pnm_load(filename), copy_image(image));
+    raw_save(copy, filename);
+    int raw = copy->last_operation == WRITE_SUCCESS && same_images(raw_load(filename), copy_image(image));
+    free_image(copy);
+
+    // a single shape keeps the messages of the failures down
+    int rejected = 1;
+    if (image->width == 17 && image->height == 9) {
+        pnm_save(image, filename);
+        rejected = truncate(filename, 20) == 0;
+        image_t *loaded = pnm_load(filename);
+        rejected = rejected && loaded->last_operation == READ_FAILURE && !loaded->pixels;
+        free_image(loaded);
+
+        image_t *empty = new_image();
+        empty->channels = image->channels;
+        empty->colorspace = image->colorspace;
+        raw_save(empty, filename);
+        loaded = raw_load(filename);
+        rejected = rejected && empty->last_operation == WRITE_SUCCESS && loaded->last_operation == READ_FAILURE &&
+                   !loaded->pixels;
+        free_image(loaded);
+        free_image(empty);
+    }
+    unlink(filename);
+
+    if (!pnm || !raw || !rejected) {
+        snprintf(failure, size, "%s", !pnm ? (image->channels == 1 ? "P5 round trip differs" : "P6 round trip differs")
+                 : !raw ? "raw round trip differs" : "truncated or empty file loaded");
+    }
+    return pnm && raw && rejected;
+}
+
+// Levels the first DC scan of a progressive JPEG at quality 75 can take the DC histogram away by: the one bit it
+// leaves out times the DC quantization step of 8, over 8
+#define DC_PROGRESSIVE_LEVELS 1
+
+/**
+ * Mean absolute deviation of the pixels of a grayscale image from the mean of their 8x8 block.
+ */
+double block_deviation(image_t *luma) {
+    double deviation = 0;
+    for (int block_y = 0; block_y < luma->height; block_y += 8) {
+        for (int block_x = 0; block_x < luma->width; block_x += 8) {
+            int last_y = min_int(block_y + 8, luma->height), last_x = min_int(block_x + 8, luma->width);
+            double mean = 0;
+            for (int y = block_y; y < last_y; ++y) {
+                for (int x = block_x; x < last_x; ++x) mean += luma->pixels[y][x];
+            }
+            mean /= (last_y - block_y) * (last_x - block_x);
+            for (int y = block_y; y < last_y; ++y) {
+                for (int x = block_x; x < last_x; ++x) deviation += fabs(luma->pixels[y][x] - mean);
+            }
+        }
+    }
+    return deviation / ((double) luma->width * luma->height);
+}
+
+/**
+ * The DC histogram of baseline 4:4:4, progressive and baseline 4:2:0 encodes is within the bound documented in
+ * dc_histogram.h of the histogram of their luma plane, on images of at least a block in each direction.
+ */
+int check_dc_histogram(image_t *image, char *failure, size_t size) {
+    if (image->width < 8 || image->height < 8) return 1;
+
+    encode_options_t options[3] = {default_encode_options(), default_encode_options(), default_encode_options()};
+    options[0].h_sampling = options[0].v_sampling = 1;
+    options[1].h_sampling = options[1].v_sampling = 1;
+    options[1].progressive = TRUE;
+    const char *names[3] = {"baseline", "progressive", "4:2:0"};
+
+    decode_options_t luminance = luminance_decode_options();
+    int passed = 1;
+    for (int o = 0; passed && o < 3; ++o) {
+        unsigned char *jpeg = NULL;
+        unsigned long jpeg_size = jpeg_compress_buffer(image, &options[o], &jpeg);
+        image_t *luma = jpeg_decompress_buffer(jpeg, jpeg_size, &luminance);
+        int dc[HISTOGRAM_SIZE];
+        int *exact = compute_histogram(luma);
+
+        double bound = block_deviation(luma) + 1 + (options[o].progressive ? DC_PROGRESSIVE_LEVELS : 0);
+        double distance = -1;
+        if (jpeg_dc_histogram_buffer(jpeg, jpeg_size, dc) == DECOMPRESSION_SUCCESS) {
+            distance = histogram_distance(dc, exact);
+        }
+        if (distance < 0 || distance > bound) {
+            snprintf(failure, size, "%s, distance %.3f for a bound of %.3f", names[o], distance, bound);
+            passed = 0;
+        }
+        free_histogram(exact);
+        free_image(luma);
+        free(jpeg);
+    }
+    return passed;
+}
+
+const check_t checks[] = {
+        {"jpeg_compress_bound", check_compress_bound},
+        {"jpeg_decompress_region", check_region_decode},
+        {"jpeg_compress_parallel", check_compress_parallel},
+        {"jpeg_decompress_parallel", check_decompress_parallel},
+        {"pipeline chains", check_pipeline_chains},
+        {"pipeline graph", check_pipeline_graph},
+        {"pipeline failures", check_pipeline_failure},
+        {"tiled failures", check_tiled_failure},
+        {"image cache", check_image_cache},
+        {"codec context errors", check_codec_context_errors},
+        {"dc histogram bound", check_dc_histogram},
+        {"pnm and raw files", check_uncompressed_formats},
+};
+
+#define CHECK_COUNT ((int) (sizeof(checks) / sizeof(checks[0])))
+
+// Parameter values, extremes included
+const double biases[] = {-300, -255, -100.5, -1, 0, 0.5, 1, 99.9, 255, 300};
+const double gains[] = {0, 0.25, 0.5, 0.999, 1, 1.5, 2, 3.7, 255, 1000};
+const double tones[] = {2, 3, 4, 7, 16, 100, 256};
+const int zooms[][2] = {{1, 1}, {2, 2}, {3, 2}, {2, 3}, {7, 5}, {64, 64}};
+
+// Tile sizes and clip limits of adaptive equalization: single pixels, unclipped, unchanged, tiles of odd sizes
+const struct {
+    int width;
+    int height;
+    double clip_limit;
+} tiles[] = {{1, 1, 3}, {4, 4, 0}, {8, 8, 1}, {5, 3, 2}, {16, 7, 3}, {13, 32, 0.5}, {128, 128, 3}};
+
+// Gradient operators and norms, magnitudes from unshifted to all shifted out, orientation bins from 1 to the most
+const gradient_options_t gradients[] = {
+        {GRADIENT_SOBEL, GRADIENT_NORM_L1, 0, 4, 0},
+        {GRADIENT_SOBEL, GRADIENT_NORM_L2, 0, 8, 0},
+        {GRADIENT_PREWITT, GRADIENT_NORM_L1, 1, 1, 0},
+        {GRADIENT_PREWITT, GRADIENT_NORM_L2, 2, 7, 0},
+        {GRADIENT_SOBEL, GRADIENT_NORM_L2, 3, 2, 0},
+        {GRADIENT_SOBEL, GRADIENT_NORM_L1, 15, MAX_ORIENTATION_BINS, 0},
+};
+
+// Image shapes: single pixels, single rows and columns, odd and even sides, larger than a tile or two
+const int shapes[][2] = {{1, 1}, {2, 1}, {1, 2}, {3, 3}, {5, 4}, {7, 7}, {17, 9}, {1, 33}, {33, 1}, {33, 31},
+                         {64, 48}, {97, 61}};
+
+enum pattern {
+    PATTERN_BLACK,
+    PATTERN_WHITE,
+    PATTERN_CHECKER,            // alternating 0 and 255, the largest differences between neighbours
+    PATTERN_GRADIENT,
+    PATTERN_RANDOM              // one per random image
+};
+
+const char *pattern_names[] = {"black", "white", "checker", "gradient", "random"};
+
+unsigned int random_state;
+
+unsigned char next_random() {
+    random_state = random_state * 1103515245u + 12345u;
+    return (unsigned char) (random_state >> 16);
+}
+
+image_t *pattern_image(int width, int height, int channels, enum pattern pattern) {
+    image_t *image = blank_image(width, height, channels);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                unsigned char *component = &image->pixels[y][x * channels + c];
+                switch (pattern) {
+                    case PATTERN_BLACK: *component = 0; break;
+                    case PATTERN_WHITE: *component = 255; break;
+                    case PATTERN_CHECKER: *component = (x + y) % 2 ? 255 : 0; break;
+                    case PATTERN_GRADIENT: *component = (unsigned char) ((x * 255 / width + y * 255 / height) / 2 + c * 40); break;
+                    case PATTERN_RANDOM: *component = next_random(); break;
+                }
+            }
+        }
+    }
+    return image;
+}
+
+/**
+ * Number of parameter values of a sweep, and the params for one of them.
+ */
+int sweep_size(enum diff_sweep sweep) {
+    switch (sweep) {
+        case SWEEP_BIAS: return (int) (sizeof(biases) / sizeof(biases[0]));
+        case SWEEP_GAIN: return (int) (sizeof(gains) / sizeof(gains[0]));
+        case SWEEP_TONES: return (int) (sizeof(tones) / sizeof(tones[0]));
+        case SWEEP_ZOOM: return (int) (sizeof(zooms) / sizeof(zooms[0]));
+        case SWEEP_FILTER: return 2 * FILTER_COUNT;
+        case SWEEP_TARGET: return 3;
+        case SWEEP_TILES: return (int) (sizeof(tiles) / sizeof(tiles[0]));
+        case SWEEP_GRADIENT: return (int) (sizeof(gradients) / sizeof(gradients[0]));
+        default: return 1;
+    }
+}
+
+void sweep_params(enum diff_sweep sweep, int index, image_t **targets, diff_params_t *params, char *description,
+                  size_t size) {
+    memset(params, 0, sizeof(diff_params_t));
+    description[0] = '\0';
+    switch (sweep) {
+        case SWEEP_BIAS:
+            params->value = biases[index];
+            snprintf(description, size, "bias %g", params->value);
+            break;
+        case SWEEP_GAIN:
+            params->value = gains[index];
+            snprintf(description, size, "gain %g", params->value);
+            break;
+        case SWEEP_TONES:
+            params->value = tones[index];
+            snprintf(description, size, "%g tones", params->value);
+            break;
+        case SWEEP_ZOOM:
+            params->sx = zooms[index][0];
+            params->sy = zooms[index][1];
+            snprintf(description, size, "%dx%d", params->sx, params->sy);
+            break;
+        case SWEEP_FILTER:
+            params->filter = index / 2;
+            params->clamp = index % 2 ? TRUE : FALSE;
+            snprintf(description, size, "%s%s", filter_names[params->filter], params->clamp ? " clamp" : "");
+            break;
+        case SWEEP_TARGET:
+            params->target = targets[index];
+            snprintf(description, size, "target %d", index);
+            break;
+        case SWEEP_TILES:
+            params->sx = tiles[index].width;
+            params->sy = tiles[index].height;
+            params->value = tiles[index].clip_limit;
+            snprintf(description, size, "%dx%d tiles, clip %g", params->sx, params->sy, params->value);
+            break;
+        case SWEEP_GRADIENT:
+            params->gradient = gradients[index];
+            snprintf(description, size, "%s %s >> %d, %d bins",
+                     params->gradient.gradient_operator == GRADIENT_SOBEL ? "sobel" : "prewitt",
+                     params->gradient.norm == GRADIENT_NORM_L2 ? "l2" : "l1", params->gradient.shift,
+                     params->gradient.orientation_bins);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Adds the differences of a path result to its stats.
+ * @return Largest absolute error of the result, -1 if it does not have the shape of the reference one.
+ */
+int compare_results(const diff_result_t *reference, const diff_result_t *result, diff_stats_t *stats) {
+    ++stats->cases;
+    if (reference->width != result->width || reference->height != result->height ||
+        reference->channels != result->channels) {
+        ++stats->mismatched_shapes;
+        return -1;
+    }
+
+    long count = (long) reference->width * reference->height * reference->channels;
+    int case_max = 0;
+    for (long i = 0; i < count; ++i) {
+        int error = abs(reference->values[i] - result->values[i]);
+        if (reference->alternatives) error = min_int(error, abs(reference->alternatives[i] - result->values[i]));
+        if (error > case_max) case_max = error;
+        stats->error_sum += error;
+    }
+    stats->compared += count;
+    if (case_max > stats->max_error) stats->max_error = case_max;
+    return case_max;
+}
+
+void print_usage(char *program) {
+    printf("%s [--seed <N>] [--random <N>] [--verbose]\n", program);
+    printf("runs every op through the library at each supported CPU level, regions of interest, tiled images and\n"
+           "pipelines, and compares the results with the reference implementations on patterned images and\n"
+           "--random (default %d) random ones of each shape, in 1 and 3 channels. Prints the largest and mean absolute\n"
+           "error of each op and path and exits with a failure if any exceeds the tolerance of the op. The codecs\n"
+           "and the planner of pipelines are checked on the same images for properties they promise.\n"
+           "--verbose prints the first failing case of each op and path, and of each check\n",
+           DEFAULT_RANDOM_IMAGES);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int seed = DEFAULT_SEED;
+    int random_images = DEFAULT_RANDOM_IMAGES;
+    int verbose = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--random") == 0 && i + 1 < argc) {
+            random_images = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    random_state = seed;
+
+    for (int i = 0; i < FILTER_COUNT; ++i) filters[i] = filter_constructors[i]();
+
+    // targets of match_histogram: a random colour image, a flat one and a very dark one
+    image_t *targets[3] = {pattern_image(23, 17, 3, PATTERN_RANDOM), pattern_image(9, 9, 1, PATTERN_WHITE),
+                           pattern_image(40, 30, 1, PATTERN_RANDOM)};
+    for (int y = 0; y < targets[2]->height; ++y) {
+        for (int x = 0; x < targets[2]->width; ++x) targets[2]->pixels[y][x] /= 16;
+    }
+
+    enum cpu_level best_level = supported_cpu_level();
+    diff_stats_t stats[DIFF_OP_COUNT][PATH_COUNT];
+    memset(stats, 0, sizeof(stats));
+    int check_cases[CHECK_COUNT] = {0};
+    int check_failures[CHECK_COUNT] = {0};
+
+    int shape_count = (int) (sizeof(shapes) / sizeof(shapes[0]));
+    for (int s = 0; s < shape_count; ++s) {
+        for (int channels = 1; channels <= 3; channels += 2) {
+            for (int p = 0; p < PATTERN_RANDOM + random_images; ++p) {
+                enum pattern pattern = p < PATTERN_RANDOM ? (enum pattern) p : PATTERN_RANDOM;
+                image_t *input = pattern_image(shapes[s][0], shapes[s][1], channels, pattern);
+
+                for (int o = 0; o < DIFF_OP_COUNT; ++o) {
+                    const diff_op_t *op = &diff_ops[o];
+                    for (int v = 0; v < sweep_size(op->sweep); ++v) {
+                        diff_params_t params;
+                        char description[64];
+                        sweep_params(op->sweep, v, targets, &params, description, sizeof(description));
+
+                        diff_result_t reference = {0};
+                        op->reference(copy_image(input), &params, &reference);
+
+                        for (int path = 0; path < PATH_COUNT; ++path) {
+                            if (!op->paths[path]) continue;
+                            int is_library = path <= PATH_LIBRARY_AVX512;
+                            enum cpu_level level = is_library ? (enum cpu_level) path : best_level;
+                            if (level > best_level) continue;
+                            set_cpu_level(level);
+
+                            diff_result_t result = {0};
+                            if (!op->paths[path](copy_image(input), &params, &result)) continue;
+
+                            diff_stats_t *path_stats = &stats[o][path];
+                            int error = compare_results(&reference, &result, path_stats);
+                            if ((error < 0 || error > op->tolerance) && verbose && !path_stats->reported) {
+                                printf("%s %s differs on %dx%dx%d %s%s%s: ", op->name, path_names[path],
+                                       input->width, input->height, channels, pattern_names[pattern],
+                                       description[0] ? ", " : "", description);
+                                if (error < 0) {
+                                    printf("%dx%dx%d instead of %dx%dx%d\n", result.width, result.height,
+                                           result.channels, reference.width, reference.height, reference.channels);
+                                } else {
+                                    printf("error up to %d\n", error);
+                                }
+                                path_stats->reported = 1;
+                            }
+                            free(result.values);
+                        }
+                        free(reference.values);
+                        free(reference.alternatives);
+                    }
+                }
+
+                for (int c = 0; c < CHECK_COUNT; ++c) {
+                    char failure[128];
+                    ++check_cases[c];
+                    if (checks[c].check(input, failure, sizeof(failure))) continue;
+                    if (verbose && check_failures[c] == 0) {
+                        printf("%s fails on %dx%dx%d %s: %s\n", checks[c].name, input->width, input->height,
+                               channels, pattern_names[pattern], failure);
+                    }
+                    ++check_failures[c];
+                }
+                free_image(input);
+            }
+        }
+    }
+    set_cpu_level(best_level);
+
+    printf("%-30s %-16s %7s %11s %8s %10s %5s  %s\n", "op", "path", "cases", "components", "max err", "mean err",
+           "tol", "result");
+    int failures = 0;
+    for (int o = 0; o < DIFF_OP_COUNT; ++o) {
+        for (int path = 0; path < PATH_COUNT; ++path) {
+            diff_stats_t *path_stats = &stats[o][path];
+            if (path_stats->cases == 0) continue;
+
+            int failed = path_stats->mismatched_shapes > 0 || path_stats->max_error > diff_ops[o].tolerance;
+            failures += failed;
+            printf("%-30s %-16s %7d %11ld %8d %10.4f %5d  %s", diff_ops[o].name, path_names[path], path_stats->cases,
+                   path_stats->compared, path_stats->max_error,
+                   path_stats->compared ? path_stats->error_sum / path_stats->compared : 0, diff_ops[o].tolerance,
+                   failed ? "FAIL" : "ok");
+            if (path_stats->mismatched_shapes) printf(" (%d with another shape)", path_stats->mismatched_shapes);
+            printf("\n");
+        }
+    }
+
+    printf("\n%-30s %7s %8s  %s\n", "check", "cases", "failed", "result");
+    for (int c = 0; c < CHECK_COUNT; ++c) {
+        failures += check_failures[c] > 0;
+        printf("%-30s %7d %8d  %s\n", checks[c].name, check_cases[c], check_failures[c],
+               check_failures[c] ? "FAIL" : "ok");
+    }
+
+    for (int i = 0; i < 3; ++i) free_image(targets[i]);
+    for (int i = 0; i < FILTER_COUNT; ++i) {
+        free_filter(filters[i]);
+    }
+
+    printf("%s\n", failures ? "differences above tolerance" : "all paths within tolerance");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
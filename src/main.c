@@ -1,21 +1,326 @@
 #include <stdio.h>
 #include <image_manipulation.h>
+#include <parallel_jpeg.h>
+#include <image_formats.h>
+#include <codec_context.h>
+#include <pipeline.h>
+#include <tiled_image.h>
 #include <stdlib.h>
+#include <string.h>
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("%s <input file path> <output file path>\n", argv[0]);
+void print_usage(char *program) {
+    printf("%s <input file path> <output file path> [--ops <list>] [encoder options]\n", program);
+    printf("%s --batch <output directory> <input file path>... [--ops <list>] [encoder options]\n", program);
+    printf("files are JPEG (.jpg, .jpeg), PPM/PGM (.ppm, .pgm, .pnm) or raw (any other extension)\n");
+    printf("--batch converts every input file to a file of the same name in the output directory, reusing one JPEG\n"
+           "codec context and one pipeline for all of them\n");
+    printf("--ops runs a comma separated list of ops instead of mirroring horizontally, e.g. bias:30,luminance,\n"
+           "convolve:sobel-hx:clamp; ops are bias:<v>, gain:<v>, negative, quantize:<tones>, luminance, rgb, mirror-h,\n"
+           "mirror-v, rotate, zoom-out:<sx>x<sy>, zoom-in, equalize, histogram (last, writes its plot) and\n"
+           "convolve:<gaussian|laplacian|high-pass|prewitt-hx|prewitt-hy|sobel-hx|sobel-hy>[:clamp]\n");
+    printf("--out-of-core <MiB> converts JPEG to JPEG through tiles in a temporary file ($TMPDIR or /tmp), keeping\n"
+           "at most MiB of them in memory, for images bigger than memory; its ops are bias, gain, negative, quantize,\n"
+           "luminance, mirror-h, rotate and convolve\n");
+    printf("encoder options:\n"
+           "  --preset default|fast|balanced|small|progressive|quality\n"
+           "  --quality <1-100>\n"
+           "  --dct islow|ifast|float\n"
+           "  --optimize\n"
+           "  --progressive\n"
+           "  --sampling <H>x<V>   (luma sampling factors, e.g. 2x2 for 4:2:0, 1x1 for 4:4:4)\n"
+           "  --restart <MCU rows>\n"
+           "  --threads <N>        (decode restart intervals and encode strips on N threads, 0 for one per processor)\n");
+}
+
+/**
+ * Reads encoder options from command line arguments, in order, so that a preset can be refined by later options.
+ * @param ops receives the op list given with --ops, if any
+ * @param cache_bytes receives the memory budget given with --out-of-core, if any
+ * @return zero if every argument was understood, non-zero otherwise
+ */
+int parse_options(int argc, char *argv[], encode_options_t *options, int *threads, char **ops, size_t *cache_bytes) {
+    for (int i = 0; i < argc; ++i) {
+        int has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--preset") == 0 && has_value) {
+            char *name = argv[++i];
+            int preset;
+            for (preset = 0; preset < ENCODE_PRESET_COUNT; ++preset) {
+                if (strcmp(name, encode_preset_name((enum encode_preset) preset)) == 0) break;
+            }
+            if (preset == ENCODE_PRESET_COUNT) return 1;
+            *options = encode_preset_options((enum encode_preset) preset);
+
+        } else if (strcmp(argv[i], "--quality") == 0 && has_value) {
+            options->quality = atoi(argv[++i]);
+            if (options->quality < 1 || options->quality > 100) return 1;
+
+        } else if (strcmp(argv[i], "--dct") == 0 && has_value) {
+            char *method = argv[++i];
+            if (strcmp(method, "islow") == 0) options->dct_method = JDCT_ISLOW;
+            else if (strcmp(method, "ifast") == 0) options->dct_method = JDCT_IFAST;
+            else if (strcmp(method, "float") == 0) options->dct_method = JDCT_FLOAT;
+            else return 1;
+
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            options->optimize_coding = TRUE;
+
+        } else if (strcmp(argv[i], "--progressive") == 0) {
+            options->progressive = TRUE;
+
+        } else if (strcmp(argv[i], "--sampling") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &options->h_sampling, &options->v_sampling) != 2) return 1;
+            if (options->h_sampling < 1 || options->h_sampling > 2 ||
+                options->v_sampling < 1 || options->v_sampling > 2) return 1;
+
+        } else if (strcmp(argv[i], "--restart") == 0 && has_value) {
+            options->restart_in_rows = atoi(argv[++i]);
+            if (options->restart_in_rows < 0) return 1;
+
+        } else if (strcmp(argv[i], "--ops") == 0 && has_value) {
+            *ops = argv[++i];
+
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            *threads = atoi(argv[++i]);
+            if (*threads < 0) return 1;
+
+        } else if (strcmp(argv[i], "--out-of-core") == 0 && has_value) {
+            long megabytes = atol(argv[++i]);
+            if (megabytes < 1) return 1;
+            *cache_bytes = (size_t) megabytes << 20;
+
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Whether every op of a pipeline has a tiled version, as convert_tiled() requires.
+ */
+int tiled_pipeline(pipeline_t *pipeline) {
+    for (int i = 1; i < pipeline->node_count; ++i) {
+        switch (pipeline->nodes[i].op) {
+            case PIPELINE_OP_LUT:
+            case PIPELINE_OP_LUMINANCE:
+            case PIPELINE_OP_MIRROR_HORIZONTALLY:
+            case PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE:
+            case PIPELINE_OP_CONVOLVE:
+                break;
+            default:
+                return FALSE;
+        }
     }
+    return TRUE;
+}
+
+/**
+ * Runs the chain of a pipeline built by parse_pipeline() on a tiled image, replacing the image by the result of each
+ * op. The chain is planned first, so consecutive point operations are a single pass over the tiles, as is luminance
+ * followed by a convolution.
+ * @return zero if every op succeeded, non-zero otherwise
+ */
+int run_tiled_pipeline(tiled_image_t **image, pipeline_t *pipeline) {
+    // Point operations modify the image itself and only report failures, which would go unnoticed after a success
+    (*image)->last_operation = WRITE_SUCCESS;
+
+    pipeline_luminance_only(pipeline);     // plans the chain, if it was not already
+    for (int i = 1; i < pipeline->node_count; ++i) {
+        pipeline_node_t *node = &pipeline->nodes[i];
+        if (node->fused) continue;
+
+        tiled_image_t *result = NULL;
+        if (node->op == PIPELINE_OP_LUT) {
+            tiled_apply_lut(*image, node->lut);
+        } else if (node->op == PIPELINE_OP_LUMINANCE) {
+            result = tiled_rgb_to_luminance(*image);
+        } else if (node->op == PIPELINE_OP_MIRROR_HORIZONTALLY) {
+            result = tiled_mirror_horizontally(*image);
+        } else if (node->op == PIPELINE_OP_ROTATE_90_DEGREES_CLOCK_WISE) {
+            result = tiled_rotate_90_degrees_clock_wise(*image);
+        } else {
+            // the node holds the filter rotated by 180 degrees, tiled_convolve() takes it as given
+            float **filter = new_filter(FILTER_SIZE);
+            for (int row = 0; row < FILTER_SIZE; ++row) {
+                for (int col = 0; col < FILTER_SIZE; ++col) {
+                    filter[row][col] = node->rot_filter[FILTER_SIZE - row - 1][FILTER_SIZE - col - 1];
+                }
+            }
+            result = tiled_convolve(*image, filter, node->clamp);
+            free_filter(filter);
+        }
 
-    // Decompress source image
-    image_t *image = jpeg_decompress(argv[1]);
+        if (result) {
+            free_tiled_image(*image);
+            *image = result;
+        }
+        if ((*image)->last_operation != WRITE_SUCCESS) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Converts a JPEG file into another through a tiled image, holding at most cache_bytes of its tiles in memory, and
+ * runs the pipeline on it (or mirrors it horizontally without one).
+ * @return zero if the file was converted, non-zero after reporting the failure otherwise
+ */
+int convert_tiled(char *input_filename, char *output_filename, pipeline_t *pipeline, const encode_options_t *options,
+                  size_t cache_bytes) {
+    if (!is_jpeg_filename(input_filename) || !is_jpeg_filename(output_filename)) {
+        fprintf(stderr, "Out-of-core conversion is from JPEG to JPEG, skipping %s\n", input_filename);
+        return 1;
+    }
+
+    decode_options_t luminance = luminance_decode_options();
+    tiled_image_t *image = tiled_jpeg_decompress(input_filename, pipeline && pipeline_luminance_only(pipeline) ?
+                                                                 &luminance : NULL, 0, cache_bytes, NULL);
     if (image->last_operation != DECOMPRESSION_SUCCESS) {
-        fprintf(stderr, "Decompression failed for file %s", argv[1]);
+        fprintf(stderr, "Reading failed for file %s\n", input_filename);
+        free_tiled_image(image);
+        return 1;
+    }
+
+    int failed;
+    if (pipeline) {
+        failed = run_tiled_pipeline(&image, pipeline);
+    } else {
+        tiled_image_t *mirrored = tiled_mirror_horizontally(image);
+        free_tiled_image(image);
+        image = mirrored;
+        failed = image->last_operation != WRITE_SUCCESS;
+    }
+    if (failed) {
+        fprintf(stderr, "Processing failed for file %s\n", input_filename);
+        free_tiled_image(image);
+        return 1;
+    }
+
+    tiled_jpeg_compress(image, output_filename, options);
+    int written = image->last_operation == COMPRESSION_SUCCESS;
+    free_tiled_image(image);
+    if (!written) {
+        fprintf(stderr, "Writing failed for file %s\n", output_filename);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads a file, runs the pipeline on it (or mirrors it horizontally without one) and writes the result. Without
+ * threads, JPEGs are decoded and encoded with the codec context of the thread, which batches reuse.
+ * @param cache_bytes non-zero to convert out of core with convert_tiled(), within that many bytes of tiles
+ * @return zero if the file was converted, non-zero after reporting the failure otherwise
+ */
+int convert_file(char *input_filename, char *output_filename, pipeline_t *pipeline, const encode_options_t *options,
+                 int threads, size_t cache_bytes) {
+    if (cache_bytes) return convert_tiled(input_filename, output_filename, pipeline, options, cache_bytes);
+
+    image_t *image;
+    int parallel = threads != 1;
+    if (pipeline) {
+        // Only the luminance of JPEGs is decoded when that is all the pipeline uses (luminance, histogram, convolve),
+        // on restart intervals in parallel with threads, otherwise by the pipeline itself
+        if (parallel && is_jpeg_filename(input_filename)) {
+            decode_options_t luminance = luminance_decode_options();
+            image_t *source = jpeg_decompress_parallel(input_filename, pipeline_luminance_only(pipeline) ?
+                                                                       &luminance : NULL, threads);
+            if (source->last_operation == DECOMPRESSION_SUCCESS) pipeline_run(pipeline, source);
+            else pipeline->last_operation = READ_FAILURE;
+            free_image(source);
+        } else {
+            pipeline_run_file(pipeline, input_filename);
+        }
+        if (pipeline->last_operation != WRITE_SUCCESS) {
+            fprintf(stderr, "Reading failed for file %s\n", input_filename);
+            return 1;
+        }
+
+        int output = pipeline_output(pipeline);
+        int *histogram = pipeline_histogram(pipeline, output);
+        image = histogram ? histogram_plot(histogram) : pipeline_image(pipeline, output);
+        free_histogram(histogram);
+    } else {
+        // Read source image
+        if (!is_jpeg_filename(input_filename)) image = load_image(input_filename);
+        else if (parallel) image = jpeg_decompress_parallel(input_filename, NULL, threads);
+        else image = codec_decompress_file(thread_codec_context(), input_filename, NULL);
+        if (image->last_operation != DECOMPRESSION_SUCCESS && image->last_operation != READ_SUCCESS) {
+            fprintf(stderr, "Reading failed for file %s\n", input_filename);
+            free_image(image);
+            return 1;
+        }
+
+        mirror_horizontally(image);
+    }
+
+    // Write pixels into output image
+    int written;
+    if (!is_jpeg_filename(output_filename)) {
+        written = save_image(image, output_filename, options);
+    } else {
+        if (parallel) jpeg_compress_parallel(image, output_filename, options, threads);
+        else codec_compress_file(thread_codec_context(), image, output_filename, options);
+        written = image->last_operation == COMPRESSION_SUCCESS;
+    }
+    free_image(image);
+    if (!written) {
+        fprintf(stderr, "Writing failed for file %s\n", output_filename);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Converts every input file to a file of the same name in an output directory.
+ * @return Number of files that could not be converted.
+ */
+int convert_batch(char *output_directory, char **input_filenames, int count, pipeline_t *pipeline,
+                  const encode_options_t *options, int threads, size_t cache_bytes) {
+    int failures = 0;
+    for (int i = 0; i < count; ++i) {
+        char *name = strrchr(input_filenames[i], '/');
+        name = name ? name + 1 : input_filenames[i];
+
+        size_t length = strlen(output_directory) + strlen(name) + 2;
+        char *output_filename = malloc(length);
+        snprintf(output_filename, length, "%s/%s", output_directory, name);
+        failures += convert_file(input_filenames[i], output_filename, pipeline, options, threads, cache_bytes) != 0;
+        free(output_filename);
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    mirror_horizontally(image);
+    // Input files of a batch are the arguments up to the first option
+    int batch = strcmp(argv[1], "--batch") == 0;
+    int first_option = 3;
+    if (batch) {
+        while (first_option < argc && strncmp(argv[first_option], "--", 2) != 0) ++first_option;
+        if (first_option == 3) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    encode_options_t options = default_encode_options();
+    int threads = 1;
+    char *ops = NULL;
+    size_t cache_bytes = 0;
+    pipeline_t *pipeline = NULL;
+    if (parse_options(argc - first_option, argv + first_option, &options, &threads, &ops, &cache_bytes) ||
+        (ops && !(pipeline = parse_pipeline(ops))) || (cache_bytes && pipeline && !tiled_pipeline(pipeline))) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
 
-    // Compress pixels_array into output image
-    jpeg_compress(image, argv[2]);
-}
\ No newline at end of file
+    int failures = batch ? convert_batch(argv[2], argv + 3, first_option - 3, pipeline, &options, threads, cache_bytes)
+                         : convert_file(argv[1], argv[2], pipeline, &options, threads, cache_bytes);
+    if (pipeline) free_pipeline(pipeline);
+    if (failures) exit(EXIT_FAILURE);
+}